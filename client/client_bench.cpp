@@ -0,0 +1,186 @@
+/**
+ * @file client_bench.cpp
+ * @brief Throughput and latency of the command path through rp1::Client
+ * @author Yashas Nagaraj Udupa
+ *
+ * Starts the host build of the firmware on a pseudo-terminal (rp1::Loopback), or opens a serial device, and
+ * sends the same command over and over with a fixed number of commands in flight. For every window it prints
+ * the commands per second and the percentiles of the round trip, first transmission to cp_<seq>.
+ *
+ * usage: client_bench [-n commands] [-w windows] [-c command] [-t timeout_ms] [-u] [-f firmware]
+ *                     [-d device] [-b baud] [-v]
+ *   -w 1,2,4,8    windows to measure, at most the firmware queue depth (8)
+ *   -u            loopback over the USB CDC interface of the firmware instead of its UART
+ *   -d device     real board instead of the loopback
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <unistd.h>
+#include "loopback.h"
+#include "rp1_client.h"
+
+namespace {
+
+constexpr unsigned DEFAULT_COMMANDS = 100;
+constexpr std::chrono::milliseconds BOOT_TIMEOUT{15000};
+
+struct Run {
+    std::mutex lock;
+    std::condition_variable finished;
+    unsigned remaining = 0;     // commands still to be sent
+    unsigned outstanding = 0;   // commands in flight, a completion hands its slot to the next command
+    unsigned failures = 0;
+    std::vector<double> round_trip_ms;
+};
+
+double percentile(const std::vector<double> &sorted, double fraction) {
+    if (sorted.empty()) return 0.0;
+    size_t index = (size_t)(fraction * (double)(sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+// Private function sending the next command of a run, every completion sends the next one. The run may end
+// as soon as the last completion has been counted, it is not touched after that
+void send_next(rp1::Client &client, Run &run, const std::string &command, std::chrono::milliseconds timeout) {
+    client.send(command, [&client, &run, command, timeout](const rp1::Response &response) {
+        bool more;
+        {
+            std::lock_guard<std::mutex> guard(run.lock);
+            if (response.ok()) {
+                run.round_trip_ms.push_back((double)response.round_trip.count() / 1000.0);
+            } else {
+                run.failures++;
+            }
+            more = run.remaining > 0;
+            if (more) {
+                run.remaining--;
+            } else if (--run.outstanding == 0) {
+                run.finished.notify_all();
+            }
+        }
+        if (more) send_next(client, run, command, timeout);
+    }, timeout);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    unsigned commands = DEFAULT_COMMANDS;
+    std::vector<unsigned> windows = {1, 2, 4, 8};
+    std::string command = rp1::cmd::firmware_version();
+    std::chrono::milliseconds timeout(0);
+    rp1::Loopback::Channel channel = rp1::Loopback::Channel::UART;
+    std::string firmware;
+    std::string device;
+    unsigned baud = rp1::DEFAULT_BAUDRATE;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:w:c:t:uf:d:b:v")) != -1) {
+        switch (opt) {
+            case 'n': commands = (unsigned)strtoul(optarg, nullptr, 10); break;
+            case 'w': {
+                windows.clear();
+                for (char *field = strtok(optarg, ","); field != nullptr; field = strtok(nullptr, ",")) {
+                    unsigned window = (unsigned)strtoul(field, nullptr, 10);
+                    if (window > 0) windows.push_back(window);
+                }
+                break;
+            }
+            case 'c': command = optarg; break;
+            case 't': timeout = std::chrono::milliseconds(strtoul(optarg, nullptr, 10)); break;
+            case 'u': channel = rp1::Loopback::Channel::USB; break;
+            case 'f': firmware = optarg; break;
+            case 'd': device = optarg; break;
+            case 'b': baud = (unsigned)strtoul(optarg, nullptr, 10); break;
+            case 'v': verbose = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-n commands] [-w windows] [-c command] [-t timeout_ms] [-u] [-f firmware] "
+                        "[-d device] [-b baud] [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (commands == 0 || windows.empty()) {
+        fprintf(stderr, "client_bench: nothing to measure\n");
+        return 2;
+    }
+
+    // the firmware is built next to the benchmark
+    if (firmware.empty()) {
+        const char *slash = strrchr(argv[0], '/');
+        firmware = std::string(argv[0], slash ? (size_t)(slash - argv[0] + 1) : 0) + "rp1_host";
+    }
+
+    rp1::ClientOptions options;
+    options.window = *std::max_element(windows.begin(), windows.end());
+    std::unique_ptr<rp1::Loopback> loopback;
+    std::unique_ptr<rp1::Client> client;
+    try {
+        if (device.empty()) {
+            loopback.reset(new rp1::Loopback(firmware, channel, !verbose));
+            client.reset(new rp1::Client(loopback->take_fd(), options));
+        } else {
+            client = rp1::Client::open(device, baud, options);
+        }
+    } catch (const std::system_error &error) {
+        fprintf(stderr, "client_bench: %s\n", error.what());
+        return 1;
+    }
+    if (verbose) {
+        client->on_unsolicited([](const std::string &line) { printf("< %s\n", line.c_str()); });
+    }
+
+    // the target answers once it has booted, homing included, and the USB interface only once core 1 runs
+    rp1::Response boot;
+    auto boot_deadline = std::chrono::steady_clock::now() + BOOT_TIMEOUT;
+    do {
+        boot = client->call(rp1::cmd::firmware_version(), BOOT_TIMEOUT);
+    } while (boot.status == rp1::Status::TIMEOUT && std::chrono::steady_clock::now() < boot_deadline);
+    if (!boot.ok()) {
+        fprintf(stderr, "client_bench: no answer from the target\n");
+        return 1;
+    }
+    printf("target %s command=%s commands=%u\n", boot.lines.empty() ? "?" : boot.lines.back().c_str(),
+           command.c_str(), commands);
+
+    unsigned total_failures = 0;
+    for (unsigned window : windows) {
+        Run run;
+        run.outstanding = std::min(window, commands);
+        run.remaining = commands - run.outstanding;
+        rp1::ClientStats before = client->stats();
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < run.outstanding; i++) {
+            send_next(*client, run, command, timeout);
+        }
+        {
+            std::unique_lock<std::mutex> guard(run.lock);
+            run.finished.wait(guard, [&run] { return run.remaining == 0 && run.outstanding == 0; });
+        }
+        double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        rp1::ClientStats after = client->stats();
+
+        std::sort(run.round_trip_ms.begin(), run.round_trip_ms.end());
+        printf("window=%u commands=%u cmd_per_s=%.1f p50_ms=%.2f p90_ms=%.2f p99_ms=%.2f max_ms=%.2f "
+               "retries=%llu failures=%u\n", window, commands, (double)commands / elapsed_s,
+               percentile(run.round_trip_ms, 0.50), percentile(run.round_trip_ms, 0.90),
+               percentile(run.round_trip_ms, 0.99), run.round_trip_ms.empty() ? 0.0 : run.round_trip_ms.back(),
+               (unsigned long long)(after.retries - before.retries), run.failures);
+        fflush(stdout);
+        total_failures += run.failures;
+        if (!client->connected()) break;
+    }
+    return total_failures ? 1 : 0;
+}
+
+/*** end of file ***/
@@ -0,0 +1,110 @@
+/**
+ * @file loopback.cpp
+ * @brief Pseudo-terminal target running the host build of the firmware Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <system_error>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "loopback.h"
+
+namespace rp1 {
+
+namespace {
+
+constexpr int STOP_GRACE_MS = 500;
+
+// Private helper closing the descriptors opened so far and throwing the error of the failed call
+[[noreturn]] void fail(const char *what, int master, int slave) {
+    int error = errno;
+    if (master >= 0) close(master);
+    if (slave >= 0) close(slave);
+    throw std::system_error(error, std::generic_category(), std::string("rp1::Loopback: ") + what);
+}
+
+}  // namespace
+
+Loopback::Loopback(const std::string &firmware, Channel channel, bool quiet) {
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) fail("posix_openpt", master, -1);
+    const char *name = ptsname(master);
+    if (name == nullptr) fail("ptsname", master, -1);
+    slave_path = name;
+
+    // raw from the start, the line discipline would echo and translate the command lines
+    slave = ::open(slave_path.c_str(), O_RDWR | O_NOCTTY);
+    if (slave < 0) fail(slave_path.c_str(), master, -1);
+    struct termios tio;
+    if (tcgetattr(slave, &tio) != 0) fail("tcgetattr", master, slave);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    child = fork();
+    if (child < 0) fail("fork", master, slave);
+    if (child == 0) {
+        int null_fd = ::open("/dev/null", O_RDWR);
+        close(master);
+        if (channel == Channel::UART) {
+            dup2(slave, STDIN_FILENO);
+            dup2(slave, STDOUT_FILENO);
+        } else {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            setenv("HAL_HOST_USB", slave_path.c_str(), 1);
+        }
+        if (quiet) dup2(null_fd, STDERR_FILENO);
+        close(slave);
+        close(null_fd);
+        execl(firmware.c_str(), firmware.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+
+    // the UART child holds the slave itself, the master reads EIO once it exits
+    if (channel == Channel::UART) {
+        close(slave);
+        slave = -1;
+    }
+}
+
+Loopback::~Loopback() {
+    if (child > 0) {
+        kill(child, SIGTERM);
+        int status = 0;
+        for (int waited = 0; waitpid(child, &status, WNOHANG) == 0; waited += 10) {
+            if (waited >= STOP_GRACE_MS) {
+                kill(child, SIGKILL);
+                waitpid(child, &status, 0);
+                break;
+            }
+            usleep(10 * 1000);
+        }
+    }
+    if (master >= 0) close(master);
+    if (slave >= 0) close(slave);
+}
+
+int Loopback::take_fd() {
+    int fd = master;
+    master = -1;
+    return fd;
+}
+
+bool Loopback::running() {
+    if (child <= 0) return false;
+    int status = 0;
+    if (waitpid(child, &status, WNOHANG) == child) {
+        child = -1;
+        return false;
+    }
+    return true;
+}
+
+}  // namespace rp1
+
+/*** end of file ***/
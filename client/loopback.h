@@ -0,0 +1,67 @@
+/** @file loopback.h
+*
+* @brief Host build of the firmware (rp1_host) as a local target of the client. The firmware runs as a child
+*        process on a pseudo-terminal, either as its UART (stdin/stdout) or as its USB CDC interface
+*        (HAL_HOST_USB), and the client opens the master side like a serial port.
+*
+*/
+
+#ifndef _RP1_LOOPBACK_H
+#define _RP1_LOOPBACK_H
+
+#include <string>
+#include <sys/types.h>
+
+namespace rp1 {
+
+class Loopback {
+public:
+    enum class Channel { UART, USB };
+
+    /**
+     * @brief Starts the firmware on a new pseudo-terminal, throws std::system_error if it cannot be started
+     * @param firmware - path of rp1_host
+     * @param channel  - interface of the firmware the pseudo-terminal stands in for
+     * @param quiet    - sends the debug output of the firmware (stderr) to /dev/null
+     */
+    explicit Loopback(const std::string &firmware, Channel channel = Channel::UART, bool quiet = true);
+
+    /**
+     * @brief Stops the firmware
+     *
+     */
+    ~Loopback();
+
+    Loopback(const Loopback &) = delete;
+    Loopback &operator=(const Loopback &) = delete;
+
+    /**
+     * @brief Hands the master side of the pseudo-terminal over, e.g. to rp1::Client
+     * @return the descriptor, -1 if it was already taken
+     */
+    int take_fd();
+
+    /**
+     * @brief Returns the path of the slave side
+     *
+     */
+    const std::string &device() const { return slave_path; }
+
+    /**
+     * @brief Checks whether the firmware is still running
+     *
+     */
+    bool running();
+
+private:
+    int master = -1;
+    int slave = -1;             // kept open for the USB channel, the firmware opens it by path
+    std::string slave_path;
+    pid_t child = -1;
+};
+
+}  // namespace rp1
+
+#endif /* _RP1_LOOPBACK_H */
+
+/*** end of file ***/
@@ -0,0 +1,619 @@
+/**
+ * @file rp1_client.cpp
+ * @brief Host side client of the RP1 command protocol Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <system_error>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "rp1_client.h"
+
+extern "C" {
+#include "frame.h"
+}
+
+namespace rp1 {
+
+namespace {
+
+const char *const command_names[] = {
+    "K", "V1", "V2", "V3", "V4", "V5", "V6", "ST", "SF", "IV", "RS", "WV", "FV", "MO", "TS", "IQ", "TM", "TD",
+    "SS", "SR", "VB", "VC", "VS", "EA", "CT", "ET", "NA", "SN"
+};
+
+constexpr char SEQ_PREFIX = '@';
+constexpr char SEQ_SEPARATOR = ':';
+constexpr char ADDRESS_PREFIX = '!';
+constexpr char KILL_SWITCH = 'K';
+constexpr size_t READ_CHUNK = 256;
+constexpr size_t MAX_LINE = 1024;           // longer text without a line feed is dropped
+
+speed_t baud_to_speed(unsigned baud) {
+    switch (baud) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default: return B115200;
+    }
+}
+
+// Private helper reading "<prefix><seq>" at the start of a response, rest points past the digits
+bool parse_seq(const std::string &line, const char *prefix, uint32_t &seq, const char *&rest) {
+    size_t length = strlen(prefix);
+    if (line.compare(0, length, prefix) != 0 || line.size() <= length || !isdigit((unsigned char)line[length])) {
+        return false;
+    }
+    char *end = nullptr;
+    seq = (uint32_t)strtoul(line.c_str() + length, &end, 10);
+    rest = end;
+    return true;
+}
+
+}  // namespace
+
+const char *command_name(Command command) {
+    size_t index = (size_t)command;
+    return index < sizeof(command_names) / sizeof(command_names[0]) ? command_names[index] : "?";
+}
+
+uint32_t line_crc(const std::string &text) {
+    uint32_t sum = 0;
+    for (unsigned char byte : text) sum += byte;
+    return ~sum;
+}
+
+std::string frame_line(const std::string &text) {
+    char crc[16];
+    std::string line = text + ',';
+    snprintf(crc, sizeof(crc), "%X#", line_crc(line));
+    return line + crc;
+}
+
+namespace cmd {
+
+std::string valve(int port) { return "V" + std::to_string(port); }
+std::string shaker() { return "ST"; }
+std::string incubation_shaker() { return "RS"; }
+std::string washing_shaker() { return "WV"; }
+std::string firmware_version() { return "FV"; }
+std::string motor_off() { return "MO"; }
+std::string irq_stats() { return "IQ"; }
+std::string telemetry(unsigned rate_hz) { return "TM," + std::to_string(rate_hz); }
+std::string trace_dump() { return "TD"; }
+std::string stats() { return "SS"; }
+std::string stats_reset() { return "SR"; }
+std::string blocked_ports(unsigned mask) { return "VB," + std::to_string(mask); }
+std::string calibrate() { return "VC"; }
+std::string calibration_clear() { return "VC,0"; }
+std::string speed_report() { return "VS"; }
+std::string speed_bounds(unsigned min_rpm, unsigned max_rpm) {
+    return "VS," + std::to_string(min_rpm) + "," + std::to_string(max_rpm);
+}
+std::string speed_forget() { return "VS,0"; }
+std::string encoder_report() { return "EA"; }
+std::string encoder_clear() { return "EA,0"; }
+std::string camera_report() { return "CT"; }
+std::string camera_valve(uint32_t delay_us, uint32_t width_us) {
+    return "CT,V," + std::to_string(delay_us) + "," + std::to_string(width_us);
+}
+std::string camera_segment(uint32_t delay_us, uint32_t width_us, unsigned segment) {
+    return "CT,S," + std::to_string(delay_us) + "," + std::to_string(width_us) + "," + std::to_string(segment);
+}
+std::string eta_report() { return "ET"; }
+std::string eta_query(Command command) { return std::string("ET,") + command_name(command); }
+std::string eta_field(bool enable) { return enable ? "ET,1" : "ET,0"; }
+std::string bus_report() { return "NA"; }
+std::string bus_configure(unsigned node, unsigned nodes, unsigned groups, uint32_t slot_us) {
+    return "NA," + std::to_string(node) + "," + std::to_string(nodes) + "," + std::to_string(groups) + "," +
+           std::to_string(slot_us);
+}
+std::string session(uint32_t session) { return "SN," + std::to_string(session); }
+
+}  // namespace cmd
+
+Client::Client(int port_fd, const ClientOptions &client_options) : fd(port_fd), options(client_options) {
+    if (options.window == 0) options.window = 1;
+    if (pipe(wake_pipe) != 0) {
+        throw std::system_error(errno, std::generic_category(), "rp1::Client: pipe");
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(wake_pipe[0], F_SETFL, fcntl(wake_pipe[0], F_GETFL) | O_NONBLOCK);
+
+    // the firmware matches retries by sequence ID and line CRC only, a host that restarts at the same
+    // sequence ID would get the cached responses of the previous one. Random sequence IDs keep them apart,
+    // the session line also starts a new retry epoch in the firmware
+    std::random_device random;
+    uint32_t session_id = random();
+    next_seq = random();
+    if (session_id == 0) session_id = 1;
+    if (next_seq == 0) next_seq = 1;
+    session_seq = send(cmd::session(session_id), nullptr);
+    io_thread = std::thread(&Client::run, this);
+}
+
+std::unique_ptr<Client> Client::open(const std::string &device, unsigned baud, const ClientOptions &options) {
+    int port = ::open(device.c_str(), O_RDWR | O_NOCTTY);
+    if (port < 0) {
+        throw std::system_error(errno, std::generic_category(), "rp1::Client: " + device);
+    }
+    struct termios tio;
+    if (isatty(port) && tcgetattr(port, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, baud_to_speed(baud));
+        tcsetattr(port, TCSANOW, &tio);
+    }
+    return std::unique_ptr<Client>(new Client(port, options));
+}
+
+Client::~Client() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake();
+    io_thread.join();
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    close(fd);
+}
+
+uint32_t Client::send(const std::string &command, Callback callback, std::chrono::milliseconds timeout) {
+    std::unique_ptr<Pending> pending(new Pending());
+    std::string text = command;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pending->seq = next_seq++;
+        if (next_seq == 0) next_seq = 1;
+    }
+
+    // the CRC covers the address prefix and the sequence ID
+    text = std::string(1, SEQ_PREFIX) + std::to_string(pending->seq) + SEQ_SEPARATOR + text;
+    if (options.address >= 0) {
+        text = std::string(1, ADDRESS_PREFIX) + std::to_string(options.address) + ':' + text;
+    }
+    pending->line = frame_line(text) + "\n";
+    pending->callback = std::move(callback);
+    pending->timeout = timeout.count() > 0 ? timeout : options.timeout;
+    pending->response.seq = pending->seq;
+
+    uint32_t seq = pending->seq;
+    Response closed;
+    Callback refused;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (open_port && !stopping) {
+            backlog.push_back(std::move(pending));
+        } else {
+            closed = pending->response;
+            refused = std::move(pending->callback);
+        }
+    }
+    if (refused) {
+        refused(closed);
+    } else {
+        wake();
+    }
+    return seq;
+}
+
+std::future<Response> Client::submit(const std::string &command, std::chrono::milliseconds timeout) {
+    auto promise = std::make_shared<std::promise<Response>>();
+    std::future<Response> future = promise->get_future();
+    send(command, [promise](const Response &response) { promise->set_value(response); }, timeout);
+    return future;
+}
+
+Response Client::call(const std::string &command, std::chrono::milliseconds timeout) {
+    return submit(command, timeout).get();
+}
+
+std::future<std::string> Client::kill() {
+    std::promise<std::string> promise;
+    std::future<std::string> future = promise.get_future();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!open_port) {
+            promise.set_value(std::string());
+            return future;
+        }
+        // after an address prefix only the addressed node stops, a bare kill switch stops the whole bus
+        if (options.address >= 0) {
+            outbox += std::string(1, ADDRESS_PREFIX) + std::to_string(options.address) + ':';
+        }
+        outbox += std::string(1, KILL_SWITCH) + "\n";
+        kill_waiters.push_back(std::move(promise));
+    }
+    wake();
+    return future;
+}
+
+void Client::drain() {
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this] { return backlog.empty() && in_flight.empty(); });
+}
+
+void Client::on_unsolicited(LineHandler handler) {
+    std::lock_guard<std::mutex> guard(lock);
+    unsolicited_handler = std::move(handler);
+}
+
+void Client::on_frame(FrameHandler handler) {
+    std::lock_guard<std::mutex> guard(lock);
+    frame_handler = std::move(handler);
+}
+
+bool Client::connected() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return open_port;
+}
+
+ClientStats Client::stats() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return counters;
+}
+
+void Client::wake() {
+    char byte = 0;
+    ssize_t written = write(wake_pipe[1], &byte, 1);
+    (void)written;
+}
+
+bool Client::write_all(const std::string &data) {
+    const char *ptr = data.data();
+    size_t length = data.size();
+    while (length > 0) {
+        ssize_t n = write(fd, ptr, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd out = {fd, POLLOUT, 0};
+            if (poll(&out, 1, (int)options.ack_timeout.count()) <= 0) return false;
+            continue;
+        }
+        if (n <= 0) return false;
+        ptr += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+// Private function writing the line of a command again, or for the first time, must be called with the lock held
+void Client::transmit(Pending &pending, Clock::time_point now) {
+    if (pending.state == State::QUEUED) {
+        pending.first_sent = now;
+    } else {
+        counters.retries++;
+    }
+    pending.state = State::SENT;
+    pending.deadline = now + options.ack_timeout;
+    pending.response.attempts++;
+    counters.sent++;
+    outbox += pending.line;
+}
+
+// Private function moving queued commands into the window, must be called with the lock held
+void Client::fill_window(Clock::time_point now) {
+    while (!backlog.empty() && in_flight.size() < options.window && (session_open || in_flight.empty())) {
+        std::unique_ptr<Pending> pending = std::move(backlog.front());
+        backlog.pop_front();
+        transmit(*pending, now);
+        uint32_t seq = pending->seq;
+        in_flight[seq] = std::move(pending);
+    }
+}
+
+// Private function completing a command, the callback runs once the lock is released
+void Client::finish(uint32_t seq, Status status, std::vector<Completion> &done) {
+    auto it = in_flight.find(seq);
+    if (it == in_flight.end()) return;
+    Pending &pending = *it->second;
+    pending.response.status = status;
+    pending.response.round_trip =
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - pending.first_sent);
+    switch (status) {
+        case Status::COMPLETED: counters.completed++; break;
+        case Status::REJECTED: counters.rejected++; break;
+        case Status::TIMEOUT: counters.timeouts++; break;
+        case Status::CLOSED: break;
+    }
+    for (auto exec = execution.begin(); exec != execution.end(); ++exec) {
+        if (*exec == seq) {
+            execution.erase(exec);
+            break;
+        }
+    }
+    // without an answer to the session line the commands still go ahead in the firmware's session
+    if (seq == session_seq) session_open = true;
+    done.emplace_back(std::move(pending.callback), std::move(pending.response));
+    in_flight.erase(it);
+}
+
+void Client::close_all(std::vector<Completion> &done) {
+    open_port = false;
+    while (!in_flight.empty()) {
+        finish(in_flight.begin()->first, Status::CLOSED, done);
+    }
+    for (auto &pending : backlog) {
+        done.emplace_back(std::move(pending->callback), std::move(pending->response));
+    }
+    backlog.clear();
+    for (auto &waiter : kill_waiters) {
+        waiter.set_value(std::string());
+    }
+    kill_waiters.clear();
+}
+
+// Private function sorting a complete response line, must be called with the lock held
+void Client::handle_line(std::string line, std::vector<Completion> &done) {
+    uint32_t seq = 0;
+    const char *rest = nullptr;
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty()) return;
+
+    // the homing move of a kill reports right before its k_ line, a vf_ followed by anything else is the
+    // report of the command executing
+    if (!kill_report.empty()) {
+        std::string report;
+        report.swap(kill_report);
+        if (line.compare(0, 2, "k_") == 0 && !kill_waiters.empty()) {
+            counters.unsolicited++;
+            stray_lines.push_back(std::move(report));
+        } else {
+            credit_line(std::move(report));
+        }
+    }
+    if (line.compare(0, 3, "vf_") == 0 && !kill_waiters.empty()) {
+        kill_report = std::move(line);
+        return;
+    }
+
+    if (parse_seq(line, "ac_", seq, rest)) {
+        auto it = in_flight.find(seq);
+        if (it == in_flight.end()) return;
+        Pending &pending = *it->second;
+        if (pending.state == State::SENT || pending.state == State::BACKOFF) {
+            pending.state = State::ACCEPTED;
+            pending.deadline = Clock::now() + pending.timeout;
+        }
+        if (pending.awaiting_replay) {
+            // the firmware replays the cached acknowledgements right behind the ac_ of a completed command
+            pending.awaiting_replay = false;
+            pending.response.lines.clear();
+            pending.response.frames.clear();
+            execution.erase(std::remove(execution.begin(), execution.end(), seq), execution.end());
+            execution.push_front(seq);
+        } else if (!pending.on_target) {
+            // commands execute in the order they were accepted
+            pending.on_target = true;
+            execution.push_back(seq);
+        }
+        return;
+    }
+
+    if (parse_seq(line, "rj_", seq, rest)) {
+        auto it = in_flight.find(seq);
+        if (it == in_flight.end()) return;
+        Pending &pending = *it->second;
+        pending.response.reason = *rest == '_' ? rest + 1 : rest;
+        bool retry = pending.response.reason == "crc" || pending.response.reason == "full";
+        if (!retry || pending.response.attempts > options.retries) {
+            finish(seq, Status::REJECTED, done);
+            return;
+        }
+        // a full queue drains one command at a time, a garbled line is sent again at once
+        pending.state = State::BACKOFF;
+        pending.deadline = Clock::now() + (pending.response.reason == "full" ? options.busy_backoff
+                                                                               : std::chrono::milliseconds(0));
+        return;
+    }
+
+    if (parse_seq(line, "cp_", seq, rest)) {
+        if (in_flight.find(seq) == in_flight.end()) return;
+
+        // commands ahead of it have executed, a missing completion was lost on the way and is asked for again
+        bool on_target = std::find(execution.begin(), execution.end(), seq) != execution.end();
+        while (on_target && execution.front() != seq) {
+            Pending &lost = *in_flight[execution.front()];
+            execution.pop_front();
+            lost.awaiting_replay = true;
+            transmit(lost, Clock::now());
+        }
+        in_flight[seq]->response.code = *rest == '_' ? atoi(rest + 1) : 0;
+        finish(seq, Status::COMPLETED, done);
+        return;
+    }
+
+    if (line.compare(0, 2, "k_") == 0 && !kill_waiters.empty()) {
+        kill_waiters.front().set_value(line);
+        kill_waiters.pop_front();
+        return;
+    }
+
+    credit_line(std::move(line));
+}
+
+// Private function giving a line to the command executing, unless it is an unsolicited report. Must be called
+// with the lock held
+void Client::credit_line(std::string line) {
+    if (line.compare(0, 3, "nf_") != 0 && !execution.empty()) {
+        in_flight[execution.front()]->response.lines.push_back(std::move(line));
+        return;
+    }
+    counters.unsolicited++;
+    stray_lines.push_back(std::move(line));
+}
+
+// Private function delivering a binary frame, trace frames answer TD, telemetry streams on its own
+void Client::handle_frame(uint8_t type, std::vector<uint8_t> payload) {
+    if (type == FRAME_TYPE_TRACE && !execution.empty()) {
+        in_flight[execution.front()]->response.frames.push_back(std::move(payload));
+        return;
+    }
+    stream_frames.emplace_back(type, std::move(payload));
+}
+
+// Private function splitting the received bytes into lines and binary frames, must be called with the lock held
+void Client::receive(const uint8_t *data, size_t length, std::vector<Completion> &done) {
+    rx.append((const char *)data, length);
+    size_t start = 0;
+    while (start < rx.size()) {
+        const uint8_t *head = (const uint8_t *)rx.data() + start;
+        size_t available = rx.size() - start;
+
+        // a frame starts with its sync bytes where a line would start
+        if (head[0] == FRAME_SYNC_0 && (available < 2 || head[1] == FRAME_SYNC_1)) {
+            if (available < FRAME_HEADER_SIZE) break;
+            size_t total = (size_t)head[3] + FRAME_OVERHEAD;
+            if (available < total) break;
+            uint16_t sum = (uint16_t)(head[2] + head[3]);
+            for (size_t i = 0; i < head[3]; i++) sum = (uint16_t)(sum + head[FRAME_HEADER_SIZE + i]);
+            uint16_t checksum = (uint16_t)(head[total - 2] | (head[total - 1] << 8));
+            if ((uint16_t)~sum == checksum) {
+                handle_frame(head[2], std::vector<uint8_t>(head + FRAME_HEADER_SIZE, head + FRAME_HEADER_SIZE + head[3]));
+            } else {
+                counters.bad_frames++;
+            }
+            start += total;
+            continue;
+        }
+
+        size_t end = rx.find('\n', start);
+        if (end == std::string::npos) {
+            if (available > MAX_LINE) start = rx.size();
+            break;
+        }
+        std::string line = rx.substr(start, end - start);
+        start = end + 1;
+        handle_line(std::move(line), done);
+    }
+    rx.erase(0, start);
+}
+
+// Private function sending again or giving up on the commands past their deadline, must be called with the lock held
+void Client::check_deadlines(Clock::time_point now, std::vector<Completion> &done) {
+    std::vector<uint32_t> expired;
+    for (auto &entry : in_flight) {
+        if (entry.second->deadline <= now) expired.push_back(entry.first);
+    }
+    for (uint32_t seq : expired) {
+        Pending &pending = *in_flight[seq];
+        if (pending.state == State::BACKOFF) {
+            transmit(pending, now);
+        } else if (pending.response.attempts > options.retries) {
+            finish(seq, Status::TIMEOUT, done);
+        } else {
+            // a queued command is accepted again. An accepted one may have completed with its cp_ lost, its
+            // acknowledgements are then replayed behind the ac_ and replace the ones received so far
+            if (pending.state == State::ACCEPTED) pending.awaiting_replay = true;
+            transmit(pending, now);
+        }
+    }
+}
+
+Client::Clock::time_point Client::next_deadline() const {
+    Clock::time_point next = Clock::time_point::max();
+    for (auto &entry : in_flight) {
+        if (entry.second->deadline < next) next = entry.second->deadline;
+    }
+    return next;
+}
+
+// Private function running the callbacks and handlers of the last pass without the lock, they may send again
+void Client::deliver(std::unique_lock<std::mutex> &guard, std::vector<Completion> &done) {
+    if (done.empty() && stray_lines.empty() && stream_frames.empty()) return;
+    std::vector<std::string> lines;
+    std::vector<std::pair<uint8_t, std::vector<uint8_t>>> frames;
+    lines.swap(stray_lines);
+    frames.swap(stream_frames);
+    LineHandler line_handler = unsolicited_handler;
+    FrameHandler stream_handler = frame_handler;
+    guard.unlock();
+    for (auto &line : lines) {
+        if (line_handler) line_handler(line);
+    }
+    for (auto &frame : frames) {
+        if (stream_handler) stream_handler(frame.first, frame.second);
+    }
+    for (auto &completion : done) {
+        if (completion.first) completion.first(completion.second);
+    }
+    done.clear();
+    guard.lock();
+}
+
+void Client::run() {
+    uint8_t chunk[READ_CHUNK];
+    std::vector<Completion> done;
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (!stopping) {
+        Clock::time_point now = Clock::now();
+        if (open_port) {
+            check_deadlines(now, done);
+            fill_window(now);
+            if (!outbox.empty()) {
+                std::string data;
+                data.swap(outbox);
+                guard.unlock();
+                bool written = write_all(data);
+                guard.lock();
+                if (!written) close_all(done);
+            }
+        }
+        deliver(guard, done);
+        if (backlog.empty() && in_flight.empty()) idle.notify_all();
+        if (stopping) break;
+
+        // the callbacks may have queued commands, the next pass sends them at once
+        int wait_ms = -1;
+        Clock::time_point next = next_deadline();
+        if (!outbox.empty() || (open_port && !backlog.empty() && in_flight.size() < options.window)) {
+            wait_ms = 0;
+        } else if (next != Clock::time_point::max()) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count() + 1;
+            wait_ms = left > 0 ? (int)left : 0;
+        }
+
+        guard.unlock();
+        struct pollfd fds[2] = {{wake_pipe[0], POLLIN, 0}, {fd, POLLIN, 0}};
+        int ready = poll(fds, open_port ? 2 : 1, wait_ms);
+        guard.lock();
+        if (ready <= 0) continue;
+
+        if (fds[0].revents & POLLIN) {
+            while (read(wake_pipe[0], chunk, sizeof(chunk)) > 0) {}
+        }
+        if (open_port && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            for (;;) {
+                ssize_t n = read(fd, chunk, sizeof(chunk));
+                if (n > 0) {
+                    receive(chunk, (size_t)n, done);
+                    continue;
+                }
+                // a pseudo-terminal reports EIO once the other side closed
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) close_all(done);
+                break;
+            }
+        }
+    }
+
+    close_all(done);
+    idle.notify_all();
+    deliver(guard, done);
+}
+
+}  // namespace rp1
+
+/*** end of file ***/
@@ -0,0 +1,292 @@
+/** @file rp1_client.h
+*
+* @brief Host side client of the RP1 command protocol. Builds and frames the command lines ("<command>,<crc>#"
+*        with the CRC over everything before it), numbers them with sequence IDs and keeps up to a window of
+*        commands in flight on one serial port. A command completes with the "cp_<seq>_<status>" line of the
+*        firmware, together with the acknowledgements its execution sent. Lost lines and rejected retries
+*        ("rj_<seq>_<crc|full>") are sent again with the same sequence ID, the firmware never runs a retried
+*        command twice. Responses are delivered to callbacks on the client's I/O thread, or through futures.
+*        Every client starts a firmware session ("SN,<session>") and numbers its commands from a random
+*        sequence ID, a restarted host never gets the cached responses of the one before it.
+*
+*/
+
+#ifndef _RP1_CLIENT_H
+#define _RP1_CLIENT_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rp1 {
+
+// Commands of the firmware state machine, in the order of enum DesiredFunc
+enum class Command {
+    K, V1, V2, V3, V4, V5, V6, ST, SF, IV, RS, WV, FV, MO, TS, IQ, TM, TD, SS, SR, VB, VC, VS, EA, CT, ET, NA, SN
+};
+
+constexpr unsigned DEFAULT_WINDOW = 8;          // CMD_QUEUE_DEPTH of the firmware
+constexpr unsigned DEFAULT_BAUDRATE = 115200;
+
+/**
+ * @brief Returns the two letter name of a command
+ * @param command
+ */
+const char *command_name(Command command);
+
+/**
+ * @brief Computes the command CRC, the 1's complement of the byte sum
+ * @param text
+ */
+uint32_t line_crc(const std::string &text);
+
+/**
+ * @brief Appends the CRC field and the terminator to a command, "<text>,<crc_hex>#"
+ * @param text - command with its arguments, with the sequence ID and the address prefix if any
+ */
+std::string frame_line(const std::string &text);
+
+// Command lines with their arguments, without sequence ID and CRC
+namespace cmd {
+
+std::string valve(int port);                    // "V<port>", port 1 to 5
+std::string shaker();                           // "ST"
+std::string incubation_shaker();                // "RS"
+std::string washing_shaker();                   // "WV"
+std::string firmware_version();                 // "FV"
+std::string motor_off();                        // "MO"
+std::string irq_stats();                        // "IQ"
+std::string telemetry(unsigned rate_hz);        // "TM,<rate_hz>", 0 stops the stream
+std::string trace_dump();                       // "TD"
+std::string stats();                            // "SS"
+std::string stats_reset();                      // "SR"
+std::string blocked_ports(unsigned mask);       // "VB,<mask>"
+std::string calibrate();                        // "VC"
+std::string calibration_clear();                // "VC,0"
+std::string speed_report();                     // "VS"
+std::string speed_bounds(unsigned min_rpm, unsigned max_rpm);   // "VS,<min>,<max>"
+std::string speed_forget();                     // "VS,0"
+std::string encoder_report();                   // "EA"
+std::string encoder_clear();                    // "EA,0"
+std::string camera_report();                    // "CT"
+std::string camera_valve(uint32_t delay_us, uint32_t width_us);                    // "CT,V,<delay>,<width>"
+std::string camera_segment(uint32_t delay_us, uint32_t width_us, unsigned segment); // "CT,S,<delay>,<width>,<segment>"
+std::string eta_report();                       // "ET"
+std::string eta_query(Command command);         // "ET,<cmd>"
+std::string eta_field(bool enable);             // "ET,1" or "ET,0"
+std::string bus_report();                       // "NA"
+std::string bus_configure(unsigned node, unsigned nodes, unsigned groups, uint32_t slot_us);   // "NA,..."
+std::string session(uint32_t session);          // "SN,<session>", a new session ID starts a new retry epoch
+
+}  // namespace cmd
+
+// Outcome of a command
+enum class Status {
+    COMPLETED,      // cp_ received, code holds the status of the command
+    REJECTED,       // rj_ received and not retried, reason holds the firmware's reason
+    TIMEOUT,        // no completion after every retry
+    CLOSED          // the port closed or the client shut down
+};
+
+struct Response {
+    Status status = Status::CLOSED;
+    uint32_t seq = 0;
+    int code = 0;                               // status field of cp_<seq>_<status>
+    std::string reason;                         // crc, cmd or full for a rejected command
+    std::vector<std::string> lines;             // acknowledgements sent while the command executed
+    std::vector<std::vector<uint8_t>> frames;   // binary frames of the command (TD), payload only
+    unsigned attempts = 0;                      // transmissions of the line
+    std::chrono::microseconds round_trip{0};    // first transmission to completion
+
+    bool ok() const { return status == Status::COMPLETED; }
+};
+
+struct ClientOptions {
+    unsigned window = DEFAULT_WINDOW;                       // commands in flight, at most the firmware queue depth
+    unsigned retries = 3;                                   // transmissions after the first
+    std::chrono::milliseconds ack_timeout{500};             // sent line without ac_ or rj_
+    std::chrono::milliseconds timeout{5000};                // accepted command without cp_, per command default
+    std::chrono::milliseconds busy_backoff{50};             // wait before sending a line rejected as full
+    int address = -1;                                       // multi-drop node ID, -1 for a point to point port
+};
+
+struct ClientStats {
+    uint64_t sent = 0;                  // lines written, retries included
+    uint64_t retries = 0;
+    uint64_t completed = 0;
+    uint64_t rejected = 0;
+    uint64_t timeouts = 0;
+    uint64_t unsolicited = 0;           // lines outside of any command
+    uint64_t bad_frames = 0;            // binary frames with a wrong checksum
+};
+
+class Client {
+public:
+    using Callback = std::function<void(const Response &)>;
+    using LineHandler = std::function<void(const std::string &)>;
+    using FrameHandler = std::function<void(uint8_t type, const std::vector<uint8_t> &payload)>;
+
+    /**
+     * @brief Takes over an open serial port or pseudo-terminal and starts the I/O thread. The session line goes
+     *        out first and alone, the commands follow once it completes or times out
+     * @param fd      - closed by the client
+     * @param options
+     */
+    explicit Client(int fd, const ClientOptions &options = ClientOptions());
+
+    /**
+     * @brief Opens a serial device raw at a baud rate, throws std::system_error if it cannot be opened
+     * @param device
+     * @param baud
+     * @param options
+     */
+    static std::unique_ptr<Client> open(const std::string &device, unsigned baud = DEFAULT_BAUDRATE,
+                                        const ClientOptions &options = ClientOptions());
+
+    /**
+     * @brief Stops the I/O thread, commands still in flight complete with Status::CLOSED
+     *
+     */
+    ~Client();
+
+    Client(const Client &) = delete;
+    Client &operator=(const Client &) = delete;
+
+    /**
+     * @brief Queues a command, it is sent as soon as the window has room. Safe from any thread, the callback
+     *        runs on the I/O thread
+     * @param command  - command line without sequence ID and CRC, see rp1::cmd
+     * @param callback - called once with the outcome
+     * @param timeout  - time from acceptance to completion, 0 for the default of the options
+     * @return the sequence ID of the command, they count up from a random start and wrap from 2^32 - 1 to 1
+     */
+    uint32_t send(const std::string &command, Callback callback,
+                  std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    /**
+     * @brief Queues a command and returns its outcome as a future
+     * @param command
+     * @param timeout
+     */
+    std::future<Response> submit(const std::string &command,
+                                 std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    /**
+     * @brief Sends a command and waits for its outcome
+     * @param command
+     * @param timeout
+     */
+    Response call(const std::string &command, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    /**
+     * @brief Sends the kill switch, it bypasses the command queue of the firmware. The future holds the
+     *        "k_<status>" line once the valve is home, the other lines of the kill are delivered as usual
+     *
+     */
+    std::future<std::string> kill();
+
+    /**
+     * @brief Waits until no command is queued or in flight
+     *
+     */
+    void drain();
+
+    /**
+     * @brief Handles lines that belong to no command (nf_ reports, boot output), set before sending
+     * @param handler
+     */
+    void on_unsolicited(LineHandler handler);
+
+    /**
+     * @brief Handles binary frames that belong to no command (telemetry), set before sending
+     * @param handler
+     */
+    void on_frame(FrameHandler handler);
+
+    /**
+     * @brief Checks whether the port is still open
+     *
+     */
+    bool connected() const;
+
+    /**
+     * @brief Reads the counters
+     *
+     */
+    ClientStats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    enum class State { QUEUED, SENT, ACCEPTED, BACKOFF };
+
+    struct Pending {
+        uint32_t seq = 0;
+        std::string line;
+        Callback callback;
+        std::chrono::milliseconds timeout{0};
+        State state = State::QUEUED;
+        bool on_target = false;             // in the firmware's execution order
+        bool awaiting_replay = false;       // executed, its completion was lost and is asked for again
+        Clock::time_point first_sent;
+        Clock::time_point deadline;
+        Response response;
+    };
+
+    using Completion = std::pair<Callback, Response>;
+
+    void run();
+    void receive(const uint8_t *data, size_t length, std::vector<Completion> &done);
+    void handle_line(std::string line, std::vector<Completion> &done);
+    void credit_line(std::string line);
+    void handle_frame(uint8_t type, std::vector<uint8_t> payload);
+    void check_deadlines(Clock::time_point now, std::vector<Completion> &done);
+    void fill_window(Clock::time_point now);
+    void transmit(Pending &pending, Clock::time_point now);
+    void finish(uint32_t seq, Status status, std::vector<Completion> &done);
+    void close_all(std::vector<Completion> &done);
+    void deliver(std::unique_lock<std::mutex> &guard, std::vector<Completion> &done);
+    Clock::time_point next_deadline() const;
+    void wake();
+    bool write_all(const std::string &data);
+
+    int fd;
+    int wake_pipe[2];
+    ClientOptions options;
+
+    mutable std::mutex lock;
+    std::condition_variable idle;
+    bool stopping = false;
+    bool open_port = true;
+    uint32_t next_seq = 1;
+    uint32_t session_seq = 0;                                // the SN line, alone in the window until it finishes
+    bool session_open = false;
+    std::deque<std::unique_ptr<Pending>> backlog;           // waiting for room in the window
+    std::map<uint32_t, std::unique_ptr<Pending>> in_flight;
+    std::deque<uint32_t> execution;                          // accepted commands, oldest first
+    std::deque<std::promise<std::string>> kill_waiters;
+    std::string kill_report;                                 // vf_ during a kill, the kill's own if k_ follows
+    std::string outbox;                                      // lines to write, filled under the lock
+    std::string rx;
+    std::vector<std::string> stray_lines;                    // for the unsolicited handler
+    std::vector<std::pair<uint8_t, std::vector<uint8_t>>> stream_frames;   // for the frame handler
+    LineHandler unsolicited_handler;
+    FrameHandler frame_handler;
+    ClientStats counters;
+    std::thread io_thread;
+};
+
+}  // namespace rp1
+
+#endif /* _RP1_CLIENT_H */
+
+/*** end of file ***/
@@ -0,0 +1,400 @@
+/**
+ * @file bench.c
+ * @brief Host micro-benchmarks of the command path and motion planning with Cortex-M0+ cycle estimates
+ * @author Yashas Nagaraj Udupa
+ *
+ * Times get_desired_func(), check_crc(), calculate_crc(), concatenate_acknowledgement(),
+ * concatenate_encoder() and motor_plan_steps() (the step count / delay math of rotate_handler())
+ * over command corpora recorded from typical RPi traffic, and prints the results as JSON.
+ *
+ * The M0+ estimate is an operation count model of each routine on the RP2040 at 125 MHz:
+ * single cycle ALU and multiplier, 2 cycle loads/stores and taken branches, the SIO divider
+ * behind __aeabi_uidiv and the 64 bit multiply helper. It tracks relative cost and regressions,
+ * it is not a substitute for measuring on target.
+ *
+ * usage: rp1_bench [-t seconds_per_sample] [-s samples] [-f name_filter] [-o output.json]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "gpio_control.h"
+#include "drv8825.h"
+#include "crc.h"
+
+#define BENCH_DEFAULT_SAMPLES 7
+#define BENCH_DEFAULT_SAMPLE_S 0.05
+#define BENCH_MAX_CORPUS 256
+#define BENCH_FRAME_SIZE 48
+#define BENCH_CRC_DIGITS 8
+#define BENCH_ACK_SIZE 100
+#define BENCH_ENCODER_ACK_SIZE ACK_ENCODER_ENTRY_SIZE
+#define BENCH_ENCODER_RESOLUTION Q16_FROM_RATIO(ENCODER_NO_OF_PULSES + 1, DEGREE_FULL_ANGLE)
+
+// RP2040 Cortex-M0+ cycle model
+#define M0P_CLOCK_HZ 125000000u
+#define M0P_CALL 10             // bl, push, pop {pc}
+#define M0P_LOAD 2
+#define M0P_STORE 2
+#define M0P_ALU 1
+#define M0P_BRANCH 2            // taken branch, the pipeline refills
+#define M0P_UDIV 20             // __aeabi_uidiv through the SIO divider
+#define M0P_LMUL 20             // __aeabi_lmul, 64 bit product of the Q16.16 helpers
+#define M0P_STR_SETUP 12        // strcmp / strncmp / strlen / strrchr entry
+#define M0P_STR_CHAR 9          // per character of a byte wise string loop
+#define M0P_MEM_WORD 5          // memset / memcpy per 32 bit word
+#define M0P_SNPRINTF_BASE 700   // newlib-nano vfprintf entry and exit
+#define M0P_SNPRINTF_LITERAL 10 // per literal character of the format
+#define M0P_SNPRINTF_INT 150    // per %d conversion, plus M0P_UDIV per digit
+#define M0P_SNPRINTF_STR 60     // per %s conversion, plus M0P_STR_CHAR per character
+#define M0P_STRTOUL_BASE 40
+#define M0P_STRTOUL_CHAR 20
+
+typedef struct {
+    const char *name;
+    size_t corpus_size;
+    void (*run_pass)(void);             // runs the routine once per corpus entry
+    uint32_t (*m0plus_cycles)(size_t);  // model estimate of one corpus entry
+} bench_t;
+
+typedef struct {
+    double ns_per_op_median;
+    double ns_per_op_min;
+    double m0plus_cycles;
+} bench_result_t;
+
+// Result sink, keeps the compiler from dropping the timed calls
+static volatile uint32_t bench_sink;
+
+/* ---------------------------------------------------------------- Corpora */
+
+// Command mix of a typical assay run: valve moves dominate, status polls and the odd bad line
+static const char *const bench_commands[] = {
+    "V1", "V2", "V3", "V4", "V5", "V1", "V3", "V2", "V4", "V5", "V2", "V1",
+    "ST", "RS", "WV", "MO", "FV", "IQ", "TM,100", "TM,0", "TD", "SS", "SR", "XX"
+};
+#define BENCH_NUM_COMMANDS (sizeof(bench_commands) / sizeof(bench_commands[0]))
+
+static char bench_frames[BENCH_NUM_COMMANDS * 2][BENCH_FRAME_SIZE];
+static size_t bench_frame_count;
+
+static const struct {
+    char direction;
+    const char *steptype;
+    uint16_t angle;
+    uint16_t rpm;
+} bench_moves[] = {
+    {DIR_CCW, "16", 81, 800}, {DIR_CW, "16", 81, 800}, {DIR_CCW, "16", 46, 800}, {DIR_CW, "16", 118, 800},
+    {DIR_CCW, "16", 191, 800}, {DIR_CW, "32", 1, 800}, {DIR_CCW, "32", 1, 800}, {DIR_CCW, "32", 30, 800},
+    {DIR_CW, "16", 2, 800}, {DIR_CCW, "16", 4, 800}, {DIR_CW, "08", 90, 1600}, {DIR_CW, "01", 45, 3200},
+};
+#define BENCH_NUM_MOVES (sizeof(bench_moves) / sizeof(bench_moves[0]))
+
+static const struct {
+    int status;
+    const char *expected;
+    const char *actual;
+} bench_acks[] = {
+    {ROTATION_COMPLETED, "40.5_CCW", "40.4_CCW"}, {ROTATION_COMPLETED, "23.0_CCW", "22.4_CCW_0.6_CCW"},
+    {ROTATION_COMPLETED, "59.0_CW", "59.1_CW"}, {ROTATION_COMPLETED, "", ""}, {MOTOR_FAULT, "", ""},
+    {HOMING_SUCCESSFUL, "", ""}, {ENCODER_HW_FAIL, "", ""}, {ROTATION_COMPLETED, "95.0_CCW", "94.3_CCW_0.7_CCW"},
+};
+#define BENCH_NUM_ACKS (sizeof(bench_acks) / sizeof(bench_acks[0]))
+
+static const MotorEncoderData bench_encoder_data[] = {
+    {40, 0, 0, 0, 40, 0, BENCH_ENCODER_RESOLUTION, 0, 0, Q16_FROM_RATIO(81, 2), Q16_FROM_RATIO(404, 10)},
+    {22, 0, 0, 0, 23, 0, BENCH_ENCODER_RESOLUTION, 0, 0, Q16_FROM_INT(23), Q16_FROM_RATIO(224, 10)},
+    {1, 0, 0, 0, 1, 0, BENCH_ENCODER_RESOLUTION, 0, 0, Q16_FROM_RATIO(6, 10), Q16_FROM_RATIO(6, 10)},
+    {59, 0, 0, 0, 59, 0, BENCH_ENCODER_RESOLUTION, 0, 0, Q16_FROM_INT(59), Q16_FROM_RATIO(591, 10)},
+    {94, 0, 0, 0, 95, 0, BENCH_ENCODER_RESOLUTION, 0, 0, Q16_FROM_INT(95), Q16_FROM_RATIO(943, 10)},
+    {1, 0, 0, 0, 1, 0, BENCH_ENCODER_RESOLUTION, 0, 0, Q16_FROM_RATIO(7, 10), Q16_FROM_RATIO(7, 10)},
+};
+#define BENCH_NUM_ENCODER (sizeof(bench_encoder_data) / sizeof(bench_encoder_data[0]))
+
+// Private function building "<command>,<crc>#" frames, every eighth one with a corrupted CRC
+static void bench_build_frames(void) {
+    bench_frame_count = 0;
+    for (size_t i = 0; i < BENCH_NUM_COMMANDS * 2; i++) {
+        // the payload leaves room for the CRC digits, '#' and the terminator, the frame can never be cut
+        char payload[BENCH_FRAME_SIZE - BENCH_CRC_DIGITS - 2];
+        int length = snprintf(payload, sizeof(payload), "%s,", bench_commands[i % BENCH_NUM_COMMANDS]);
+        if (length < 0 || (size_t)length >= sizeof(payload)) continue;
+        uint32_t crc = calculate_crc(payload, strlen(payload));
+        if (i % 8 == 7) crc ^= 0x10;
+        snprintf(bench_frames[bench_frame_count++], BENCH_FRAME_SIZE, "%s%08X#", payload, (unsigned)crc);
+    }
+}
+
+/* ---------------------------------------------------------------- Cycle model helpers */
+
+static uint32_t m0p_strlen(size_t length) {
+    return M0P_CALL + M0P_STR_SETUP + (uint32_t)(length + 1) * M0P_STR_CHAR;
+}
+
+static uint32_t m0p_digits(int value) {
+    uint32_t digits = value < 0 ? 2 : 1;
+    for (int v = abs(value); v >= 10; v /= 10) digits++;
+    return digits;
+}
+
+static uint32_t m0p_snprintf_int(int value) {
+    return M0P_SNPRINTF_INT + m0p_digits(value) * M0P_UDIV;
+}
+
+static uint32_t m0p_snprintf_str(const char *str) {
+    return M0P_SNPRINTF_STR + (uint32_t)strlen(str) * M0P_STR_CHAR;
+}
+
+// strncmp/strcmp cost: characters are compared up to the first mismatch, terminator or limit
+static uint32_t m0p_strncmp(const char *a, const char *b, size_t limit) {
+    uint32_t chars = 0;
+    for (size_t i = 0; i < limit; i++) {
+        chars++;
+        if (a[i] != b[i] || a[i] == '\0') break;
+    }
+    return M0P_CALL + M0P_STR_SETUP + chars * M0P_STR_CHAR;
+}
+
+static uint32_t m0p_calculate_crc(size_t length) {
+    // watchdog update, then ldrb + add + index + compare + branch per byte, complement and return
+    return M0P_CALL + (M0P_CALL + M0P_STORE) + (uint32_t)length * (M0P_LOAD + 3 * M0P_ALU + M0P_BRANCH) + 4 * M0P_ALU;
+}
+
+/* ---------------------------------------------------------------- get_desired_func() */
+
+static void bench_get_desired_func(void) {
+    for (size_t i = 0; i < bench_frame_count; i++) {
+        bench_sink += (uint32_t)get_desired_func(bench_frames[i]);
+    }
+}
+
+static uint32_t m0p_get_desired_func(size_t i) {
+    const char *frame = bench_frames[i];
+    int match = (int)get_desired_func(frame);
+    int scanned = match >= 0 ? match + 1 : NUM_OF_UART_FUNCS;
+    uint32_t cycles = M0P_CALL;
+    for (int func = 0; func < scanned; func++) {
+        const char *name = get_desired_func_name((enum DesiredFunc)func);
+        cycles += M0P_LOAD + 2 * M0P_ALU + M0P_BRANCH + m0p_strncmp(frame, name, TWO_BYTES);
+    }
+    return cycles;
+}
+
+/* ---------------------------------------------------------------- calculate_crc() / check_crc() */
+
+static void bench_calculate_crc(void) {
+    for (size_t i = 0; i < bench_frame_count; i++) {
+        const char *frame = bench_frames[i];
+        bench_sink += calculate_crc(frame, strlen(frame) - (BENCH_CRC_DIGITS + 1));
+    }
+}
+
+static uint32_t m0p_calculate_crc_entry(size_t i) {
+    return m0p_calculate_crc(strlen(bench_frames[i]) - (BENCH_CRC_DIGITS + 1));
+}
+
+static void bench_check_crc(void) {
+    for (size_t i = 0; i < bench_frame_count; i++) {
+        bench_sink += check_crc(bench_frames[i]);
+    }
+}
+
+static uint32_t m0p_check_crc(size_t i) {
+    const char *frame = bench_frames[i];
+    size_t length = strlen(frame);
+    size_t crc_start = (size_t)(strrchr(frame, ',') - frame) + 1;
+    uint32_t cycles = M0P_CALL + (M0P_CALL + M0P_STORE);
+    cycles += M0P_CALL + M0P_STR_SETUP + (uint32_t)length * M0P_STR_CHAR;         // strrchr
+    cycles += m0p_strlen(length);
+    cycles += (CRC_TEMP_BUFFER_SIZE / 4) * M0P_MEM_WORD + M0P_CALL;               // tempstring = {}
+    cycles += (uint32_t)(crc_start / 4 + 1) * M0P_MEM_WORD + M0P_CALL;            // memcpy payload
+    cycles += 3 * M0P_MEM_WORD + M0P_CALL;                                        // memcpy crc digits
+    cycles += M0P_CALL + M0P_STRTOUL_BASE + BENCH_CRC_DIGITS * M0P_STRTOUL_CHAR;
+    cycles += m0p_calculate_crc(crc_start) + 12 * M0P_ALU + 2 * M0P_BRANCH;
+    return cycles;
+}
+
+/* ---------------------------------------------------------------- Acknowledgements */
+
+static void bench_concatenate_acknowledgement(void) {
+    char valve_ack[BENCH_ACK_SIZE];
+    for (size_t i = 0; i < BENCH_NUM_ACKS; i++) {
+        concatenate_acknowledgement(bench_acks[i].status, valve_ack, bench_acks[i].expected, bench_acks[i].actual);
+        bench_sink += (uint8_t)valve_ack[4];
+    }
+}
+
+static uint32_t m0p_concatenate_acknowledgement(size_t i) {
+    // "vf_%d_%s_%s\n", 6 literal characters
+    return M0P_CALL + M0P_CALL + M0P_SNPRINTF_BASE + 6 * M0P_SNPRINTF_LITERAL + m0p_snprintf_int(bench_acks[i].status) +
+           m0p_snprintf_str(bench_acks[i].expected) + m0p_snprintf_str(bench_acks[i].actual);
+}
+
+static void bench_concatenate_encoder(void) {
+    char expected[BENCH_ENCODER_ACK_SIZE];
+    char actual[BENCH_ENCODER_ACK_SIZE];
+    for (size_t i = 0; i < BENCH_NUM_ENCODER; i++) {
+        char direction = (i & 1u) ? DIR_CW : DIR_CCW;
+        concatenate_encoder(expected, actual, direction, true, &bench_encoder_data[i]);
+        concatenate_encoder(expected, actual, direction, false, &bench_encoder_data[(i + 2) % BENCH_NUM_ENCODER]);
+        bench_sink += (uint8_t)actual[1];
+    }
+}
+
+static uint32_t m0p_concatenate_encoder(size_t i) {
+    const MotorEncoderData *first = &bench_encoder_data[i];
+    const MotorEncoderData *next = &bench_encoder_data[(i + 2) % BENCH_NUM_ENCODER];
+    const char *direction = (i & 1u) ? "CW" : "CCW";
+
+    // both calls: two Q16.16 to tenths conversions and their / 10, % 10
+    // first call: two "%ld.%ld_%s", follow-up: two strlen and "_%ld.%ld_%s" appended to the actual entry
+    int first_expected = (int)(((int64_t)first->expected_travel * 10 + Q16_ONE / 2) >> Q16_FRACTION_BITS);
+    int first_actual = (int)(((int64_t)first->estimated_travel * 10 + Q16_ONE / 2) >> Q16_FRACTION_BITS);
+    int next_actual = (int)(((int64_t)next->estimated_travel * 10 + Q16_ONE / 2) >> Q16_FRACTION_BITS);
+    uint32_t cycles = 2 * M0P_CALL + 6 * M0P_ALU;
+    cycles += 4 * (M0P_CALL + M0P_LMUL + 3 * M0P_ALU) + 4 * 2 * M0P_UDIV;
+    cycles += 2 * (M0P_CALL + M0P_SNPRINTF_BASE + 2 * M0P_SNPRINTF_LITERAL + m0p_snprintf_str(direction));
+    cycles += m0p_snprintf_int(first_expected / 10) + m0p_snprintf_int(first_expected % 10);
+    cycles += m0p_snprintf_int(first_actual / 10) + m0p_snprintf_int(first_actual % 10);
+    size_t actual_length = (size_t)snprintf(NULL, 0, "%d.%d_%s", first_actual / 10, first_actual % 10, direction);
+    cycles += 2 * m0p_strlen(actual_length);
+    cycles += M0P_CALL + M0P_SNPRINTF_BASE + 3 * M0P_SNPRINTF_LITERAL + m0p_snprintf_int(next_actual / 10) +
+              m0p_snprintf_int(next_actual % 10) + m0p_snprintf_str(direction);
+    return cycles;
+}
+
+/* ---------------------------------------------------------------- rotate_handler() step math */
+
+static void bench_motor_plan_steps(void) {
+    motor_step_plan_t plan;
+    for (size_t i = 0; i < BENCH_NUM_MOVES; i++) {
+        int status = motor_plan_steps(bench_moves[i].direction, bench_moves[i].steptype, bench_moves[i].angle,
+                                      bench_moves[i].rpm, BENCH_ENCODER_RESOLUTION, &plan);
+        bench_sink += (uint32_t)status + plan.steps + plan.step_delay_us;
+    }
+}
+
+static uint32_t m0p_motor_plan_steps(size_t i) {
+    uint32_t cycles = M0P_CALL;
+    int index = 0;
+    while (index < NUM_OF_STEPTYPES) {
+        cycles += M0P_LOAD + 2 * M0P_ALU + M0P_BRANCH + m0p_strncmp(bench_moves[i].steptype, steptype_dict[index].micro_steps, THREE_BYTES);
+        if (strcmp(bench_moves[i].steptype, steptype_dict[index].micro_steps) == 0) break;
+        index++;
+    }
+    cycles += M0P_LMUL + 6 * M0P_ALU + M0P_BRANCH;      // q16_mul_int(encoder_resolution, angle), sat_u16
+    cycles += 2 * M0P_LOAD + 2 * M0P_ALU + M0P_UDIV;    // steps = 200 * factor * angle / 360
+    cycles += M0P_UDIV + 2 * M0P_ALU;                   // step delay
+    cycles += M0P_UDIV + 2 * M0P_ALU;                   // telemetry increment
+    cycles += 6 * M0P_STORE + 8 * M0P_ALU + 4 * M0P_BRANCH;
+    return cycles;
+}
+
+/* ---------------------------------------------------------------- Harness */
+
+static bench_t bench_table[] = {
+    {"get_desired_func", 0, bench_get_desired_func, m0p_get_desired_func},
+    {"calculate_crc", 0, bench_calculate_crc, m0p_calculate_crc_entry},
+    {"check_crc", 0, bench_check_crc, m0p_check_crc},
+    {"concatenate_acknowledgement", BENCH_NUM_ACKS, bench_concatenate_acknowledgement, m0p_concatenate_acknowledgement},
+    {"concatenate_encoder", BENCH_NUM_ENCODER, bench_concatenate_encoder, m0p_concatenate_encoder},
+    {"motor_plan_steps", BENCH_NUM_MOVES, bench_motor_plan_steps, m0p_motor_plan_steps},
+};
+#define BENCH_COUNT (sizeof(bench_table) / sizeof(bench_table[0]))
+
+static double bench_now_s(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static int bench_compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Private function timing one benchmark, each sample runs whole corpus passes for at least sample_s
+static void bench_run(const bench_t *bench, unsigned samples, double sample_s, bench_result_t *result) {
+    double ns_per_op[BENCH_MAX_CORPUS];
+    if (samples > BENCH_MAX_CORPUS) samples = BENCH_MAX_CORPUS;
+
+    // calibrate the pass count of a sample, then warm up
+    uint64_t passes = 1;
+    for (;;) {
+        double start = bench_now_s();
+        for (uint64_t p = 0; p < passes; p++) bench->run_pass();
+        if (bench_now_s() - start >= sample_s / 4) break;
+        passes *= 2;
+    }
+    passes *= 4;
+
+    for (unsigned s = 0; s < samples; s++) {
+        double start = bench_now_s();
+        for (uint64_t p = 0; p < passes; p++) bench->run_pass();
+        double elapsed = bench_now_s() - start;
+        ns_per_op[s] = elapsed * 1e9 / ((double)passes * (double)bench->corpus_size);
+    }
+    qsort(ns_per_op, samples, sizeof(double), bench_compare_double);
+    result->ns_per_op_min = ns_per_op[0];
+    result->ns_per_op_median = ns_per_op[samples / 2];
+
+    uint64_t cycles = 0;
+    for (size_t i = 0; i < bench->corpus_size; i++) cycles += bench->m0plus_cycles(i);
+    result->m0plus_cycles = (double)cycles / (double)bench->corpus_size;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned samples = BENCH_DEFAULT_SAMPLES;
+    double sample_s = BENCH_DEFAULT_SAMPLE_S;
+    const char *filter = NULL;
+    const char *output = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:s:f:o:")) != -1) {
+        switch (opt) {
+            case 't': sample_s = strtod(optarg, NULL); break;
+            case 's': samples = (unsigned)strtoul(optarg, NULL, 0); break;
+            case 'f': filter = optarg; break;
+            case 'o': output = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-t seconds_per_sample] [-s samples] [-f name_filter] [-o output.json]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (samples == 0) samples = 1;
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (out == NULL) {
+        perror(output);
+        return 2;
+    }
+
+    bench_build_frames();
+    for (size_t b = 0; b < BENCH_COUNT; b++) {
+        if (bench_table[b].corpus_size == 0) bench_table[b].corpus_size = bench_frame_count;
+    }
+
+    fprintf(out, "{\n  \"suite\": \"rp1_host_bench\",\n  \"samples\": %u,\n  \"sample_s\": %.3f,\n", samples, sample_s);
+    fprintf(out, "  \"m0plus_clock_hz\": %u,\n  \"benchmarks\": [", M0P_CLOCK_HZ);
+    bool first = true;
+    for (size_t b = 0; b < BENCH_COUNT; b++) {
+        const bench_t *bench = &bench_table[b];
+        if (filter && strstr(bench->name, filter) == NULL) continue;
+
+        bench_result_t result;
+        bench_run(bench, samples, sample_s, &result);
+        fprintf(out, "%s\n    {\"name\": \"%s\", \"corpus\": %zu, \"ns_per_op_median\": %.2f, \"ns_per_op_min\": %.2f, "
+                     "\"m0plus_cycles_est\": %.0f, \"m0plus_us_est\": %.3f}",
+                first ? "" : ",", bench->name, bench->corpus_size, result.ns_per_op_median, result.ns_per_op_min,
+                result.m0plus_cycles, result.m0plus_cycles * 1e6 / M0P_CLOCK_HZ);
+        first = false;
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout) fclose(out);
+    return 0;
+}
+
+/*** end of file ***/
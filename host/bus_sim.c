@@ -0,0 +1,506 @@
+/**
+ * @file bus_sim.c
+ * @brief Multi-drop bus simulation with several host builds of the firmware as nodes
+ * @author Yashas Nagaraj Udupa
+ *
+ * Starts one rp1_host process per node. Their UARTs share a virtual RS-485 bus: every frame of the bus
+ * master reaches every node and the output of every node is merged. Each node is commissioned with its node
+ * ID over its own UART first ("NA,<node>,<nodes>,<groups>,<slot_us>"), like a board on the bench, the even
+ * nodes join group 0. The simulated master keeps the bus rules: after a line to a node it sends nothing for
+ * one slot, the turn of the node, and output the node still holds is collected with bare "!<node>:" polls.
+ * Then every round checks
+ *   unicast:   "!<node>:@<seq>:FV" is answered by that node alone
+ *   broadcast: "!0:@<seq>:FV" is answered by every node in its own slot, lines tagged "!<node>:"
+ *   group:     "!240:@<seq>:FV" is answered by the even nodes only
+ * After the rounds every node runs a few more commands so that its statistics ("!0:@<seq>:SS") outgrow a short
+ * slot: the response must still end in the slot with whole tagged lines and its completion, and every node
+ * reports as many overflows as responses it cut. Then every node gets a valve move back to back, the
+ * moves overlap and end together: their reports and completions must only arrive when the master polls.
+ * Finally every node reports how many foreign lines its receive filter dropped.
+ *
+ * The host UART of a node is not rate limited, a chunk of output is taken to occupy the bus for its length at
+ * the bus baud rate from the moment it arrives. Overlapping transmissions of two nodes count as collisions,
+ * output that is no slot response and starts after the turn of its node as unpolled.
+ *
+ * usage: bus_sim [-n nodes] [-s slot_us] [-r rounds] [-b baud] [-f firmware] [-v]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define BUS_MAX_NODES 64
+#define BUS_DEFAULT_NODES 8
+#define BUS_DEFAULT_SLOT_US 20000
+#define BUS_DEFAULT_BAUD 115200
+#define BUS_LINE_SIZE 256
+#define BUS_MAX_LINES 64
+#define BUS_MAX_CHUNKS 4096
+#define BUS_BOOT_TIMEOUT_US 10000000ull
+#define BUS_REPLY_TIMEOUT_US 1000000ull
+#define BUS_MOVE_TIMEOUT_US 10000000ull
+#define BUS_MOVE_COMMAND "V5"
+#define BUS_GROUP_ADDRESS 240           // group 0, joined by the even nodes
+#define BUS_FIRMWARE_VERSION "Bv2.7.2"
+#define BUS_LONG_COMMANDS { "IQ", "VS", "CT", "ET", "VB" }     // each adds a line to SS
+
+typedef struct {
+    pid_t pid;
+    int to_fd;                  // the node's UART RX
+    int from_fd;                // the node's UART TX
+    char partial[BUS_LINE_SIZE];
+    size_t partial_len;
+    char lines[BUS_MAX_LINES][BUS_LINE_SIZE];   // complete lines since the last bus_clear()
+    uint64_t line_us[BUS_MAX_LINES];
+    int line_count;
+    uint64_t busy_until_us;     // end of its last transmission on the modelled bus
+    uint64_t turn_until_us;     // end of its last turn, the master left it the bus until then
+    uint64_t slot_latency_max_us;
+    unsigned cut_responses;     // slot responses without their last lines
+} bus_node_t;
+
+static bus_node_t nodes[BUS_MAX_NODES];
+static int node_count = BUS_DEFAULT_NODES;
+static uint32_t slot_us = BUS_DEFAULT_SLOT_US;
+static uint32_t baud = BUS_DEFAULT_BAUD;
+static bool verbose = false;
+static uint32_t sequence = 1;
+static unsigned collisions = 0;
+static unsigned unpolled = 0;
+static unsigned failures = 0;
+static uint64_t turn_until_us = 0;      // the master stays off the bus until then
+
+static uint64_t now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+}
+
+// Private helper framing a command like the RPi: "<body>,<crc_hex>#", the CRC is the complement of the byte sum
+static int frame_command(char *frame, size_t size, const char *body) {
+    uint32_t sum = 0;
+    for (const char *c = body; *c; c++) sum += (uint8_t)*c;
+    sum += ',';
+    return snprintf(frame, size, "%s,%X#", body, ~sum);
+}
+
+static void node_write_raw(int node, const char *frame, size_t len) {
+    if (write(nodes[node].to_fd, frame, len) != (ssize_t)len) {
+        fprintf(stderr, "bus_sim: node %d does not take input\n", node + 1);
+    }
+}
+
+static void node_write(int node, const char *body) {
+    char frame[BUS_LINE_SIZE];
+    int len = frame_command(frame, sizeof(frame), body);
+    node_write_raw(node, frame, (size_t)len);
+}
+
+static void bus_poll(uint64_t timeout_us);
+
+// Private function putting a frame of the bus master on the bus once it is idle and the last turn is over,
+// every node receives it. A frame to a single node opens its turn
+static void bus_transmit(const char *frame, size_t len) {
+    for (;;) {
+        uint64_t now = now_us(), busy_until = turn_until_us > now ? turn_until_us : now;
+        for (int i = 0; i < node_count; i++) {
+            if (nodes[i].busy_until_us > busy_until) busy_until = nodes[i].busy_until_us;
+        }
+        if (busy_until <= now) break;
+        bus_poll(busy_until - now);
+    }
+    if (verbose) printf("> %.*s\n", (int)strcspn(frame, "\n"), frame);
+    for (int i = 0; i < node_count; i++) node_write_raw(i, frame, len);
+
+    int address = frame[0] == '!' ? atoi(frame + 1) : 0;
+    if (address >= 1 && address <= node_count) {
+        turn_until_us = now_us() + slot_us;
+        nodes[address - 1].turn_until_us = turn_until_us;
+    }
+}
+
+static void bus_send(const char *body) {
+    char frame[BUS_LINE_SIZE];
+    int len = frame_command(frame, sizeof(frame), body);
+    bus_transmit(frame, (size_t)len);
+}
+
+// Private function asking a node for the output it holds, a bare address prefix
+static void bus_send_poll(int node) {
+    char frame[16];
+    int len = snprintf(frame, sizeof(frame), "!%d:\n", node + 1);
+    bus_transmit(frame, (size_t)len);
+}
+
+static void bus_clear(void) {
+    for (int i = 0; i < node_count; i++) nodes[i].line_count = 0;
+}
+
+// Private function moving node output into lines, a chunk that starts while another node still holds the
+// bus is a collision
+static void bus_poll(uint64_t timeout_us) {
+    struct pollfd fds[BUS_MAX_NODES];
+    for (int i = 0; i < node_count; i++) {
+        fds[i].fd = nodes[i].from_fd;
+        fds[i].events = POLLIN;
+    }
+    if (poll(fds, (nfds_t)node_count, (int)(timeout_us / 1000u)) <= 0) return;
+
+    uint64_t now = now_us();
+    for (int i = 0; i < node_count; i++) {
+        if (!(fds[i].revents & POLLIN)) continue;
+        char chunk[BUS_LINE_SIZE];
+        ssize_t n = read(nodes[i].from_fd, chunk, sizeof(chunk));
+        if (n <= 0) continue;
+
+        for (int other = 0; other < node_count; other++) {
+            if (other != i && nodes[other].busy_until_us > now) {
+                collisions++;
+                if (verbose) printf("! collision node %d with node %d (%llu us left)\n", i + 1, other + 1, (unsigned long long)(nodes[other].busy_until_us - now));
+            }
+        }
+        uint64_t start = nodes[i].busy_until_us > now ? nodes[i].busy_until_us : now;
+        nodes[i].busy_until_us = start + (uint64_t)n * 10u * 1000000u / baud;
+
+        // tagged lines are slot responses, any other output belongs in a turn of the node
+        bus_node_t *node = &nodes[i];
+        char first = node->partial_len ? node->partial[0] : chunk[0];
+        if (first != '!' && now > node->turn_until_us) {
+            unpolled++;
+            if (verbose) printf("! unpolled output of node %d, %llu us after its turn\n", i + 1, (unsigned long long)(now - node->turn_until_us));
+        }
+        for (ssize_t k = 0; k < n; k++) {
+            if (chunk[k] == '\n' || node->partial_len == sizeof(node->partial) - 1) {
+                node->partial[node->partial_len] = '\0';
+                if (verbose) printf("< %d %s\n", i + 1, node->partial);
+                if (node->line_count < BUS_MAX_LINES) {
+                    strcpy(node->lines[node->line_count], node->partial);
+                    node->line_us[node->line_count++] = now;
+                }
+                node->partial_len = 0;
+            } else {
+                node->partial[node->partial_len++] = chunk[k];
+            }
+        }
+    }
+}
+
+// Private helper checking that a node only sent lines tagged with its ID
+static bool tagged_lines(int node) {
+    char tag[16];
+    int len = snprintf(tag, sizeof(tag), "!%d:", node + 1);
+    for (int k = 0; k < nodes[node].line_count; k++) {
+        if (strncmp(nodes[node].lines[k], tag, (size_t)len) != 0 || strchr(nodes[node].lines[k] + 1, '!') != NULL) return false;
+    }
+    return true;
+}
+
+// Private helper looking for a line of a node, returns its index or -1
+static int find_line(int node, const char *line) {
+    for (int k = 0; k < nodes[node].line_count; k++) {
+        if (strcmp(nodes[node].lines[k], line) == 0) return k;
+    }
+    return -1;
+}
+
+// Private helper looking for a line of a node that starts with a prefix, returns its index or -1
+static int find_prefix(int node, const char *prefix) {
+    for (int k = 0; k < nodes[node].line_count; k++) {
+        if (strncmp(nodes[node].lines[k], prefix, strlen(prefix)) == 0) return k;
+    }
+    return -1;
+}
+
+// Private function waiting until every expected node sent a line, returns false on timeout
+static bool wait_for_lines(const bool *expected, const char *const *lines, uint64_t timeout_us) {
+    uint64_t deadline = now_us() + timeout_us;
+    for (;;) {
+        bool done = true;
+        for (int i = 0; i < node_count && done; i++) {
+            if (expected[i] && find_line(i, lines[i]) < 0) done = false;
+        }
+        if (done) return true;
+        uint64_t now = now_us();
+        if (now >= deadline) return false;
+        bus_poll(deadline - now < 10000u ? deadline - now : 10000u);
+    }
+}
+
+// Private function collecting the output of a node over its turns until a line with the prefix arrived, the
+// node is polled after each turn. Returns false on timeout
+static bool poll_for_prefix(int node, const char *prefix, uint64_t timeout_us) {
+    uint64_t deadline = now_us() + timeout_us;
+    for (;;) {
+        for (uint64_t now = now_us(); now < turn_until_us; now = now_us()) bus_poll(turn_until_us - now);
+        if (find_prefix(node, prefix) >= 0) return true;
+        if (now_us() >= deadline) return false;
+        bus_send_poll(node);
+    }
+}
+
+static void fail(const char *what, int node) {
+    failures++;
+    printf("FAIL %s node=%d\n", what, node + 1);
+}
+
+static pid_t spawn_node(const char *firmware, int *to_fd, int *from_fd) {
+    int in_pipe[2], out_pipe[2];
+    if (pipe(in_pipe) != 0 || pipe(out_pipe) != 0) return -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(in_pipe[0], STDIN_FILENO);
+        dup2(out_pipe[1], STDOUT_FILENO);
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) dup2(null_fd, STDERR_FILENO);
+        close(in_pipe[1]);
+        close(out_pipe[0]);
+        execl(firmware, firmware, (char *)NULL);
+        _exit(127);
+    }
+    close(in_pipe[0]);
+    close(out_pipe[1]);
+    *to_fd = in_pipe[1];
+    *from_fd = out_pipe[0];
+    return pid;
+}
+
+// Round trip of an addressed command, only the addressed node may answer
+static void check_unicast(int node) {
+    char body[64], done[32];
+    uint32_t seq = sequence++;
+
+    snprintf(body, sizeof(body), "!%d:@%lu:FV", node + 1, (unsigned long)seq);
+    snprintf(done, sizeof(done), "cp_%lu_1", (unsigned long)seq);
+    bus_clear();
+    bus_send(body);
+    if (!poll_for_prefix(node, done, BUS_REPLY_TIMEOUT_US)) fail("unicast timeout", node);
+    if (find_line(node, BUS_FIRMWARE_VERSION) < 0) fail("unicast response", node);
+    bus_poll(slot_us);
+    for (int i = 0; i < node_count; i++) {
+        if (i != node && nodes[i].line_count) fail("foreign node answered", i);
+    }
+}
+
+// Broadcast or group command, every member answers in its own slot with tagged lines
+static void check_slotted(int address, bool even_only) {
+    char body[64];
+    char versions[BUS_MAX_NODES][32], completions[BUS_MAX_NODES][32];
+    bool expected[BUS_MAX_NODES];
+    const char *lines[BUS_MAX_NODES];
+    uint32_t seq = sequence++;
+    uint64_t frame_us = (uint64_t)node_count * slot_us;
+
+    for (int i = 0; i < node_count; i++) {
+        expected[i] = !even_only || (i + 1) % 2 == 0;
+        snprintf(versions[i], sizeof(versions[i]), "!%d:%s", i + 1, BUS_FIRMWARE_VERSION);
+        snprintf(completions[i], sizeof(completions[i]), "!%d:cp_%lu_1", i + 1, (unsigned long)seq);
+        lines[i] = completions[i];
+    }
+    snprintf(body, sizeof(body), "!%d:@%lu:FV", address, (unsigned long)seq);
+    bus_clear();
+    uint64_t sent_us = now_us();
+    bus_send(body);
+    bool complete = wait_for_lines(expected, lines, BUS_REPLY_TIMEOUT_US + 2 * frame_us);
+    bus_poll(frame_us);
+
+    for (int i = 0; i < node_count; i++) {
+        if (!expected[i]) {
+            if (nodes[i].line_count) fail("non member answered", i);
+            continue;
+        }
+        int version = find_line(i, versions[i]);
+        if (!complete && find_line(i, completions[i]) < 0) fail("slot timeout", i);
+        if (version < 0) {
+            fail("slot response", i);
+            continue;
+        }
+        // the slot starts (node - 1) slots after the frame anchor, a whole number of frames later
+        uint64_t latency = nodes[i].line_us[version] - sent_us;
+        if (latency > nodes[i].slot_latency_max_us) nodes[i].slot_latency_max_us = latency;
+    }
+}
+
+// Broadcast with a response longer than a short slot, the node leaves lines out but never its completion
+static void check_long_response(void) {
+    static const char *const commands[] = BUS_LONG_COMMANDS;
+    char body[64], ends[BUS_MAX_NODES][32], completions[BUS_MAX_NODES][32];
+    uint64_t frame_us = (uint64_t)node_count * slot_us;
+
+    for (int i = 0; i < node_count; i++) {
+        for (size_t c = 0; c < sizeof(commands) / sizeof(commands[0]); c++) {
+            char done[32];
+            uint32_t seq = sequence++;
+            snprintf(body, sizeof(body), "!%d:@%lu:%s", i + 1, (unsigned long)seq, commands[c]);
+            snprintf(done, sizeof(done), "cp_%lu_1", (unsigned long)seq);
+            bus_clear();
+            bus_send(body);
+            if (!poll_for_prefix(i, done, BUS_REPLY_TIMEOUT_US)) fail("long response setup", i);
+        }
+    }
+
+    // SS completes with the number of lines it reported, only the prefix of the completion is known
+    uint32_t seq = sequence++;
+    for (int i = 0; i < node_count; i++) {
+        snprintf(ends[i], sizeof(ends[i]), "!%d:cs_end", i + 1);
+        snprintf(completions[i], sizeof(completions[i]), "!%d:cp_%lu_", i + 1, (unsigned long)seq);
+    }
+    snprintf(body, sizeof(body), "!0:@%lu:SS", (unsigned long)seq);
+    bus_clear();
+    bus_send(body);
+    uint64_t deadline = now_us() + BUS_REPLY_TIMEOUT_US + 2 * frame_us;
+    for (int i = 0; i < node_count; i++) {
+        while (find_prefix(i, completions[i]) < 0 && now_us() < deadline) bus_poll(10000);
+    }
+    bus_poll(frame_us);
+    for (int i = 0; i < node_count; i++) {
+        int completion = find_prefix(i, completions[i]);
+        if (completion < 0) fail("long response completion", i);
+        else if (completion != nodes[i].line_count - 1) fail("long response order", i);
+        if (!tagged_lines(i)) fail("long response lines", i);
+        if (find_line(i, ends[i]) < 0) nodes[i].cut_responses++;
+    }
+}
+
+// Valve moves on every node at once, sent back to back so that they overlap and end together. Each node only
+// acknowledges in the turn of its line, its report and completion wait until the master polls it
+static void check_overlapping_moves(void) {
+    char body[64], completions[BUS_MAX_NODES][32];
+
+    bus_clear();
+    for (int i = 0; i < node_count; i++) {
+        uint32_t seq = sequence++;
+        snprintf(body, sizeof(body), "!%d:@%lu:%s", i + 1, (unsigned long)seq, BUS_MOVE_COMMAND);
+        snprintf(completions[i], sizeof(completions[i]), "cp_%lu_", (unsigned long)seq);
+        bus_send(body);
+    }
+    // while the moves run nothing is polled, the nodes stay quiet
+    uint64_t quiet_until = now_us() + BUS_REPLY_TIMEOUT_US;
+    for (uint64_t now = now_us(); now < quiet_until; now = now_us()) bus_poll(quiet_until - now);
+    for (int i = 0; i < node_count; i++) {
+        if (!poll_for_prefix(i, completions[i], BUS_MOVE_TIMEOUT_US)) fail("move completion", i);
+        else if (find_prefix(i, "vf_") < 0) fail("move report", i);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    unsigned rounds = 3;
+    char default_firmware[1024];
+    const char *firmware = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:r:b:f:v")) != -1) {
+        switch (opt) {
+            case 'n': node_count = atoi(optarg); break;
+            case 's': slot_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'r': rounds = (unsigned)strtoul(optarg, NULL, 0); break;
+            case 'b': baud = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'f': firmware = optarg; break;
+            case 'v': verbose = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-n nodes] [-s slot_us] [-r rounds] [-b baud] [-f firmware] [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (node_count < 1 || node_count > BUS_MAX_NODES || baud == 0) {
+        fprintf(stderr, "bus_sim: 1 to %d nodes\n", BUS_MAX_NODES);
+        return 2;
+    }
+
+    // the firmware is built next to the simulator
+    if (firmware == NULL) {
+        const char *slash = strrchr(argv[0], '/');
+        snprintf(default_firmware, sizeof(default_firmware), "%.*srp1_host", slash ? (int)(slash - argv[0] + 1) : 0, argv[0]);
+        firmware = default_firmware;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    for (int i = 0; i < node_count; i++) {
+        nodes[i].pid = spawn_node(firmware, &nodes[i].to_fd, &nodes[i].from_fd);
+        if (nodes[i].pid < 0) {
+            fprintf(stderr, "bus_sim: cannot start %s\n", firmware);
+            return 2;
+        }
+    }
+
+    // every node homes at boot and reports it, then gets its node ID over its own UART
+    bool expected[BUS_MAX_NODES];
+    const char *lines[BUS_MAX_NODES];
+    for (int i = 0; i < node_count; i++) {
+        expected[i] = true;
+    }
+    uint64_t boot_deadline = now_us() + BUS_BOOT_TIMEOUT_US;
+    for (;;) {
+        bool booted = true;
+        for (int i = 0; i < node_count; i++) booted &= nodes[i].line_count > 0;
+        if (booted || now_us() >= boot_deadline) break;
+        bus_poll(10000);
+    }
+    bus_clear();
+    for (int i = 0; i < node_count; i++) {
+        char body[64];
+        snprintf(body, sizeof(body), "NA,%d,%d,%d,%lu", i + 1, node_count, (i + 1) % 2 == 0 ? 1 : 0, (unsigned long)slot_us);
+        node_write(i, body);
+        lines[i] = "na_1";
+    }
+    if (!wait_for_lines(expected, lines, BUS_REPLY_TIMEOUT_US)) {
+        for (int i = 0; i < node_count; i++) {
+            if (find_line(i, "na_1") < 0) fail("commissioning", i);
+        }
+    }
+    collisions = 0;     // commissioning is point to point
+    unpolled = 0;
+
+    double start_s = (double)now_us() / 1e6;
+    for (unsigned round = 0; round < rounds; round++) {
+        for (int i = 0; i < node_count; i++) check_unicast(i);
+        check_slotted(0, false);
+        check_slotted(BUS_GROUP_ADDRESS, true);
+    }
+    check_long_response();
+    check_overlapping_moves();
+    double elapsed_s = (double)now_us() / 1e6 - start_s;
+
+    // node report: "na_<node>_<nodes>_<groups>_<slot_us>_<foreign>_<slotted>_<slots>_<overflows>"
+    unsigned long foreign_total = 0;
+    for (int i = 0; i < node_count; i++) {
+        char body[32];
+        snprintf(body, sizeof(body), "!%d:NA", i + 1);
+        bus_clear();
+        bus_send(body);
+        unsigned node = 0, node_total = 0, groups = 0;
+        unsigned long slot = 0, foreign = 0, slotted = 0, slots = 0, overflows = 0;
+        int report = poll_for_prefix(i, "na_", BUS_REPLY_TIMEOUT_US) ? find_prefix(i, "na_") : -1;
+        if (report < 0 ||
+            sscanf(nodes[i].lines[report], "na_%u_%u_%u_%lu_%lu_%lu_%lu_%lu", &node, &node_total, &groups, &slot,
+                   &foreign, &slotted, &slots, &overflows) != 8 || node != (unsigned)i + 1) {
+            fail("report", i);
+            continue;
+        }
+        if (overflows != nodes[i].cut_responses) fail("slot overflow", i);
+        foreign_total += foreign;
+        printf("node %-3d groups=%u foreign=%lu slotted=%lu slots=%lu overflows=%lu max_slot_latency_ms=%.1f\n", i + 1,
+               groups, foreign, slotted, slots, overflows, (double)nodes[i].slot_latency_max_us / 1000.0);
+    }
+
+    for (int i = 0; i < node_count; i++) {
+        kill(nodes[i].pid, SIGTERM);
+        waitpid(nodes[i].pid, NULL, 0);
+    }
+    if (collisions || unpolled) failures++;
+    printf("summary nodes=%d rounds=%u slot_us=%lu frames=%lu foreign_dropped=%lu collisions=%u unpolled=%u failures=%u real_s=%.1f\n",
+           node_count, rounds, (unsigned long)slot_us, (unsigned long)(sequence - 1), foreign_total, collisions, unpolled,
+           failures, elapsed_s);
+    return failures ? 1 : 0;
+}
+
+/*** end of file ***/
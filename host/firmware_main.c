@@ -0,0 +1,10 @@
+/**
+ * @file firmware_main.c
+ * @brief Firmware main() renamed to rp1_firmware_main() so host tools can run the unmodified main loop
+ * @author Yashas Nagaraj Udupa
+ */
+
+#define main rp1_firmware_main
+#include "main.c"
+
+/*** end of file ***/
@@ -0,0 +1,227 @@
+/**
+ * @file plant_sim.c
+ * @brief Valve axis plant model Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <math.h>
+#include <string.h>
+#include "plant_sim.h"
+#include "gpio_control.h"
+#include "drv8825.h"
+
+// Encoder geometry, 180 slots per revolution and an index window of +-1 degree
+#define PLANT_ENCODER_SLOTS (ENCODER_NO_OF_PULSES + 1)
+#define PLANT_INDEX_HALF_WIDTH (PLANT_MICROSTEPS_PER_REV / DEGREE_FULL_ANGLE)
+
+// Rotor increment of one full step in 1/32 microsteps
+#define PLANT_FINEST_MICROSTEP (PLANT_MICROSTEPS_PER_REV / STEPS_PER_ROTATION)
+
+// A step arriving after this pause starts from standstill
+#define PLANT_STANDSTILL_US 100000
+
+typedef struct {
+    plant_config_t config;
+    plant_state_t state;
+    uint32_t rng;
+    bool dir_cw;
+    bool enable_n;
+    bool sleep_n;
+    bool reset_n;
+    uint8_t mode;
+    uint64_t last_step_us;
+    bool ports_referenced;
+    int32_t port_reference;
+    bool enc_ch1;
+    bool enc_ch2;
+    bool enc_ch3;
+    hal_repeating_timer_t fault_timer;
+    uint64_t fault_duration_us;
+} plant_t;
+
+static plant_t plant;
+
+// DRV8825 MODE2..0 to microsteps, 1/32 for the two upper codes
+static const uint8_t plant_microsteps[8] = {1, 2, 4, 8, 16, 32, 32, 32};
+
+// Private xorshift32 generator, keeps runs reproducible for a given seed
+static float plant_random_uniform(void) {
+    plant.rng ^= plant.rng << 13;
+    plant.rng ^= plant.rng >> 17;
+    plant.rng ^= plant.rng << 5;
+    return (float)((plant.rng >> 8) + 1) / 16777217.0f;
+}
+
+static float plant_random_gauss(void) {
+    float u1 = plant_random_uniform();
+    float u2 = plant_random_uniform();
+    return sqrtf(-2.0f * logf(u1)) * cosf(2.0f * (float)M_PI * u2);
+}
+
+static int32_t plant_wrap(int32_t position) {
+    return ((position % PLANT_MICROSTEPS_PER_REV) + PLANT_MICROSTEPS_PER_REV) % PLANT_MICROSTEPS_PER_REV;
+}
+
+// Private helper, true while the rotor is inside the seal zone of a valve port
+static bool plant_in_seal_zone(void) {
+    if (!plant.ports_referenced) return false;
+    double angle = plant_port_angle();
+    for (int i = 0; i < NUM_OF_VALVES; i++) {
+        double distance = fmod(fabs(angle - valve_coordinates[i].valve_position), DEGREE_FULL_ANGLE);
+        if (distance > DEGREE_FULL_ANGLE / 2) distance = DEGREE_FULL_ANGLE - distance;
+        if (distance <= plant.config.seal_width_deg) return true;
+    }
+    return false;
+}
+
+// Private function updating the encoder outputs, channels are active low like the optical sensor
+static void plant_update_encoder(void) {
+    int32_t position = plant_wrap(plant.state.rotor_position);
+    uint32_t phase = ((uint32_t)position * PLANT_ENCODER_SLOTS) % PLANT_MICROSTEPS_PER_REV;
+
+    // A is low for the first half of a slot, B lags by a quarter slot, Z is low across the index
+    bool ch1 = phase >= PLANT_MICROSTEPS_PER_REV / 2;
+    bool ch3 = phase >= PLANT_MICROSTEPS_PER_REV / 4 && phase < 3 * PLANT_MICROSTEPS_PER_REV / 4;
+    bool ch2 = position >= PLANT_INDEX_HALF_WIDTH && position < PLANT_MICROSTEPS_PER_REV - PLANT_INDEX_HALF_WIDTH;
+
+    if (ch1 != plant.enc_ch1) {
+        plant.enc_ch1 = ch1;
+        if (!ch1) plant.state.encoder_edges++;
+        hal_host_gpio_drive(ENC_CH1, ch1);
+    }
+    if (ch2 != plant.enc_ch2) {
+        plant.enc_ch2 = ch2;
+        hal_host_gpio_drive(ENC_CH2, ch2);
+    }
+    if (ch3 != plant.enc_ch3) {
+        plant.enc_ch3 = ch3;
+        hal_host_gpio_drive(ENC_CH3, ch3);
+    }
+}
+
+// Private function for a STEP rising edge: pull-out torque falls linearly with the full step rate
+static void plant_step(void) {
+    if (plant.enable_n || !plant.sleep_n || !plant.reset_n || plant.state.fault_active) return;
+
+    uint8_t microsteps = plant_microsteps[plant.mode & 7u];
+    uint64_t now = hal_time_us_64();
+    uint64_t interval = now - plant.last_step_us;
+    plant.last_step_us = now;
+    plant.state.steps_commanded++;
+
+    float full_step_rate = 0.0f;
+    if (interval > 0 && interval < PLANT_STANDSTILL_US) {
+        full_step_rate = 1000000.0f / ((float)interval * microsteps);
+    }
+    float pull_out = 1.0f - full_step_rate / plant.config.max_full_step_rate;
+    float load = plant.config.friction_load + plant.config.load_noise * plant_random_gauss();
+    if (plant_in_seal_zone()) load += plant.config.seal_load;
+
+    // a stalled rotor does not follow the microstep, the driver's indexer still advances
+    if (load >= pull_out) {
+        plant.state.steps_missed++;
+        return;
+    }
+    int32_t increment = PLANT_FINEST_MICROSTEP / microsteps;
+    plant.state.rotor_position += plant.dir_cw ? increment : -increment;
+    plant_update_encoder();
+}
+
+// Private GPIO output hook, decodes the DRV8825 inputs
+static void plant_gpio_output(uint gpio, bool value) {
+    switch (gpio) {
+        case M1_STEP:
+            if (value) plant_step();
+            break;
+        case M1_DIR:
+            plant.dir_cw = value;
+            break;
+        case M1_ENABLE:
+            plant.enable_n = value;
+            break;
+        case MOTOR_SLEEP:
+            plant.sleep_n = value;
+            break;
+        case MOTOR_RESET:
+            plant.reset_n = value;
+            break;
+        case M1_MODE0:
+            plant.mode = (uint8_t)((plant.mode & ~1u) | (value ? 1u : 0u));
+            break;
+        case M1_MODE1:
+            plant.mode = (uint8_t)((plant.mode & ~2u) | (value ? 2u : 0u));
+            break;
+        case M1_MODE2:
+            plant.mode = (uint8_t)((plant.mode & ~4u) | (value ? 4u : 0u));
+            break;
+        default:
+            break;
+    }
+}
+
+void plant_default_config(plant_config_t *config) {
+    config->seed = 1;
+    config->friction_load = 0.2f;
+    config->seal_load = 0.3f;
+    config->seal_width_deg = 3.0f;
+    config->load_noise = 0.05f;
+    config->max_full_step_rate = 1000.0f;
+    config->start_angle_deg = 40.0f;
+}
+
+void plant_init(const plant_config_t *config) {
+    memset(&plant, 0, sizeof(plant));
+    plant.config = *config;
+    plant.rng = config->seed ? config->seed : 1;
+    plant.enable_n = true;
+    plant.state.rotor_position = (int32_t)lroundf(config->start_angle_deg * PLANT_MICROSTEPS_PER_REV / DEGREE_FULL_ANGLE);
+
+    // force every encoder channel to be driven on the first update
+    plant.enc_ch1 = plant.enc_ch2 = plant.enc_ch3 = true;
+    hal_host_gpio_drive(ENC_CH1, true);
+    hal_host_gpio_drive(ENC_CH2, true);
+    hal_host_gpio_drive(ENC_CH3, true);
+    hal_host_gpio_drive(M1_NFAULT, true);
+    plant_update_encoder();
+    plant.state.encoder_edges = 0;
+
+    hal_host_set_gpio_output_hook(plant_gpio_output);
+}
+
+void plant_set_port_reference(int32_t rotor_position) {
+    plant.port_reference = rotor_position;
+    plant.ports_referenced = true;
+}
+
+double plant_port_angle(void) {
+    return (double)(plant.state.rotor_position - plant.port_reference) * DEGREE_FULL_ANGLE / PLANT_MICROSTEPS_PER_REV;
+}
+
+// Private one-shot timer callback, asserts nFAULT and then releases it after the fault duration
+static bool plant_fault_timer_callback(hal_repeating_timer_t *timer) {
+    if (!plant.state.fault_active) {
+        plant.state.fault_active = true;
+        hal_host_gpio_drive(M1_NFAULT, false);
+        timer->period_us = (int64_t)plant.fault_duration_us;
+        timer->next_us = hal_time_us_64() + plant.fault_duration_us;
+        return true;
+    }
+    plant.state.fault_active = false;
+    hal_host_gpio_drive(M1_NFAULT, true);
+    return false;
+}
+
+bool plant_schedule_fault(uint64_t at_us, uint64_t duration_us) {
+    uint64_t now = hal_time_us_64();
+    plant.fault_duration_us = duration_us ? duration_us : 1;
+    if (!hal_add_repeating_timer_us((int64_t)(at_us > now ? at_us - now : 1), plant_fault_timer_callback, NULL, &plant.fault_timer)) {
+        return false;
+    }
+    return true;
+}
+
+void plant_get_state(plant_state_t *state) {
+    *state = plant.state;
+}
+
+/*** end of file ***/
@@ -0,0 +1,79 @@
+/** @file plant_sim.h
+*
+* @brief Host side plant model of the valve axis: DRV8825 inputs, stepper with load dependent missed steps,
+*        valve ports and the 3-channel optical encoder. The model is driven by the firmware's GPIO writes
+*        through the host HAL and runs on the HAL virtual clock.
+*
+*/
+
+#ifndef _PLANT_SIM_H
+#define _PLANT_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+
+// Rotor resolution of the model, 1/32 microsteps of a 200 step motor
+#define PLANT_MICROSTEPS_PER_REV 6400
+
+// Plant parameters, torques are fractions of the holding torque
+typedef struct {
+    uint32_t seed;              // random seed of the load noise
+    float friction_load;        // constant load torque of the valve
+    float seal_load;            // extra load while a port seal is engaged
+    float seal_width_deg;       // half width of the seal zone around each port
+    float load_noise;           // standard deviation of the load torque
+    float max_full_step_rate;   // full steps per second where the pull-out torque reaches zero
+    float start_angle_deg;      // rotor angle at power up, 0 is the centre of the encoder index
+} plant_config_t;
+
+// Plant state and counters
+typedef struct {
+    int32_t rotor_position;         // rotor position in 1/32 microsteps, 0 is the centre of the encoder index
+    uint32_t steps_commanded;       // STEP pulses accepted by the driver
+    uint32_t steps_missed;          // STEP pulses the rotor did not follow
+    uint32_t encoder_edges;         // falling edges produced on ENC_CH1
+    bool fault_active;              // nFAULT is held low
+} plant_state_t;
+
+/**
+ * @brief Fills a configuration with the nominal plant parameters
+ * @param config
+ */
+void plant_default_config(plant_config_t *config);
+
+/**
+ * @brief Resets the plant, installs it as GPIO output hook and drives the encoder and nFAULT inputs
+ * @param config
+ */
+void plant_init(const plant_config_t *config);
+
+/**
+ * @brief Sets the rotor position the valve coordinates are measured from and enables the port seals
+ * @param rotor_position - 1/32 microsteps
+ */
+void plant_set_port_reference(int32_t rotor_position);
+
+/**
+ * @brief Returns the rotor angle relative to the port reference in degrees
+ *
+ */
+double plant_port_angle(void);
+
+/**
+ * @brief Schedules an nFAULT pulse on the virtual clock
+ * @param at_us       - absolute virtual time of the falling edge
+ * @param duration_us - time nFAULT stays low
+ * @return true if the fault is scheduled
+ */
+bool plant_schedule_fault(uint64_t at_us, uint64_t duration_us);
+
+/**
+ * @brief Reads the plant state
+ * @param state
+ */
+void plant_get_state(plant_state_t *state);
+
+#endif /* _PLANT_SIM_H */
+
+/*** end of file ***/
@@ -0,0 +1,170 @@
+/**
+ * @file test_commands.c
+ * @brief Host tests of the command line handling, framed lines as the host sends them
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "hal.h"
+#include "hal_host.h"
+#include "cmd_queue.h"
+#include "crc.h"
+#include "drv8825.h"
+#include "move_eta.h"
+#include "telemetry.h"
+#include "transport.h"
+
+#define CHECK(condition, ...)                                             \
+    do {                                                                  \
+        checks++;                                                         \
+        if (!(condition)) {                                               \
+            failures++;                                                   \
+            if (failures <= MAX_REPORTED_FAILURES) {                      \
+                printf("FAIL %s:%d: ", __FILE__, __LINE__);               \
+                printf(__VA_ARGS__);                                      \
+                printf("\n");                                             \
+            }                                                             \
+        }                                                                 \
+    } while (0)
+
+#define MAX_REPORTED_FAILURES 20
+#define TEST_LINE_SIZE 64
+#define TEST_RESPONSE_SIZE 512
+
+static unsigned checks = 0;
+static unsigned failures = 0;
+static char responses[TEST_RESPONSE_SIZE];
+static int usb_host_fd = -1;        // what the firmware sends on the USB interface
+static unsigned executions = 0;     // commands the main loop ran
+
+// Private helper framing a command like the host, "<body>,<crc>#" with the CRC over everything before it
+static void frame_line(const char *body, char *line, size_t size) {
+    char text[TEST_LINE_SIZE];
+    snprintf(text, sizeof(text), "%s,", body);
+    snprintf(line, size, "%s%lX#", text, (unsigned long)calculate_crc(text, strlen(text)));
+}
+
+// Private helper running a command handler on a framed line, the responses are kept in responses
+static int run_framed(int (*handler)(const char *), const char *body) {
+    char line[TEST_LINE_SIZE];
+    frame_line(body, line, sizeof(line));
+    transport_capture_begin(responses, sizeof(responses) - 1);
+    int status = handler(line);
+    responses[transport_capture_end(NULL)] = '\0';
+    return status;
+}
+
+// A framed ET carries its CRC as the only field, it is the report and not a query of the CRC as a command
+static void test_move_eta(void) {
+    int status = run_framed(move_eta_command, "ET");
+    CHECK(status == SUCCESS_INT && strstr(responses, "et_end\n") != NULL, "framed ET reports, got %d \"%s\"", status, responses);
+    CHECK(strstr(responses, "et_-1") == NULL, "framed ET is not rejected, got \"%s\"", responses);
+
+    status = run_framed(move_eta_command, "ET,V1");
+    CHECK(status == SUCCESS_INT && strncmp(responses, "et_V1_", 6) == 0, "framed ET,V1 queries, got %d \"%s\"", status, responses);
+
+    status = run_framed(move_eta_command, "ET,1");
+    CHECK(status == SUCCESS_INT && strcmp(responses, "et_1\n") == 0, "framed ET,1 enables the field, got \"%s\"", responses);
+    status = run_framed(move_eta_command, "ET,0");
+    CHECK(status == SUCCESS_INT && strcmp(responses, "et_1\n") == 0, "framed ET,0 disables the field, got \"%s\"", responses);
+
+    status = run_framed(move_eta_command, "ET,XX");
+    CHECK(status == MOVE_ETA_INVALID && strcmp(responses, "et_-1\n") == 0, "framed ET,XX is rejected, got %d \"%s\"", status, responses);
+}
+
+// The telemetry stream leaves a quarter of the UART to the responses, USB takes the full rate
+static void test_telemetry_rate(void) {
+    transport_set_response(TRANSPORT_UART);
+    int status = run_framed(telemetry_command, "TM,1000");
+    CHECK(status == TELEMETRY_RATE_INVALID && strcmp(responses, "tm_-1\n") == 0, "UART TM,1000 is rejected, got %d \"%s\"", status, responses);
+    status = run_framed(telemetry_command, "TM,250");
+    CHECK(status == TELEMETRY_STARTED && strcmp(responses, "tm_250\n") == 0, "UART TM,250 starts, got %d \"%s\"", status, responses);
+
+    transport_set_response(TRANSPORT_USB);
+    status = run_framed(telemetry_command, "TM,1000");
+    CHECK(status == TELEMETRY_STARTED && strcmp(responses, "tm_1000\n") == 0, "USB TM,1000 starts, got %d \"%s\"", status, responses);
+    status = run_framed(telemetry_command, "TM,0");
+    CHECK(status == TELEMETRY_STOPPED, "TM,0 stops, got %d", status);
+    transport_set_response(TRANSPORT_UART);
+}
+
+// Private helper running the queued commands like the main loop, every command answers "fv_test"
+static void run_queue(void) {
+    cmd_queue_entry_t *entry;
+    while ((entry = cmd_queue_peek()) != NULL) {
+        transport_set_response(entry->transport);
+        cmd_queue_begin(entry);
+        int status = SUCCESS_INT;
+        if (get_desired_func(entry->command) == SN) {
+            status = cmd_queue_session_command(entry->command);
+        } else {
+            transport_respond((const uint8_t *)"fv_test\n", 8);
+        }
+        executions++;
+        cmd_queue_complete(entry, status);
+    }
+}
+
+// Private helper sending a framed line on the USB interface and returning what the firmware answered
+static const char *exchange(const char *body) {
+    char line[TEST_LINE_SIZE];
+    frame_line(body, line, sizeof(line));
+    cmd_queue_receive(line, TRANSPORT_USB);
+    run_queue();
+    transport_poll();
+    ssize_t length = read(usb_host_fd, responses, sizeof(responses) - 1);
+    responses[length > 0 ? length : 0] = '\0';
+    return responses;
+}
+
+// A host that restarts numbers its commands from the same sequence ID again, after its session line they run
+// instead of getting the cached responses of the previous host
+static void test_session_retry(void) {
+    int usb_pipe[2];
+    if (pipe(usb_pipe) != 0) {
+        CHECK(false, "pipe");
+        return;
+    }
+    fcntl(usb_pipe[0], F_SETFL, O_NONBLOCK);
+    usb_host_fd = usb_pipe[0];
+    hal_host_usb_attach(-1, usb_pipe[1]);
+    transport_init();
+    cmd_queue_init();
+
+    CHECK(strcmp(exchange("@1:SN,1234"), "ac_1\nsn_1234\ncp_1_1\n") == 0, "session 1234, got \"%s\"", responses);
+    unsigned before = executions;
+    CHECK(strcmp(exchange("@2:FV"), "ac_2\nfv_test\ncp_2_1\n") == 0, "first FV, got \"%s\"", responses);
+    CHECK(strcmp(exchange("@2:FV"), "ac_2\nfv_test\ncp_2_1\n") == 0, "retry replayed, got \"%s\"", responses);
+    CHECK(executions == before + 1, "a retry in the same session runs once, %u executions", executions - before);
+
+    // the host restarts, a retry of the session line does not start another one
+    CHECK(strcmp(exchange("@1:SN,987"), "ac_1\nsn_987\ncp_1_1\n") == 0, "session 987, got \"%s\"", responses);
+    CHECK(strcmp(exchange("@1:SN,987"), "ac_1\nsn_987\ncp_1_1\n") == 0, "session retry replayed, got \"%s\"", responses);
+    before = executions;
+    CHECK(strcmp(exchange("@2:FV"), "ac_2\nfv_test\ncp_2_1\n") == 0, "FV after the restart, got \"%s\"", responses);
+    CHECK(executions == before + 1, "the reused sequence ID runs after the restart, %u executions", executions - before);
+    CHECK(strcmp(exchange("SN"), "sn_987\n") == 0, "framed SN reports, got \"%s\"", responses);
+    before = executions;
+    CHECK(strcmp(exchange("@3:K"), "rj_3_cmd\n") == 0, "sequenced K rejected, got \"%s\"", responses);
+    CHECK(executions == before, "a rejected K is not queued, %u executions", executions - before);
+
+    cmd_queue_stats_t stats;
+    cmd_queue_get_stats(&stats);
+    CHECK(stats.replayed == 2, "two replays, got %lu", (unsigned long)stats.replayed);
+    hal_host_usb_attach(-1, -1);
+    close(usb_pipe[0]);
+    close(usb_pipe[1]);
+}
+
+int main(void) {
+    test_move_eta();
+    test_telemetry_rate();
+    test_session_retry();
+    printf("%u checks, %u failures\n", checks, failures);
+    return failures ? 1 : 0;
+}
+
+/*** end of file ***/
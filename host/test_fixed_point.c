@@ -0,0 +1,164 @@
+/**
+ * @file test_fixed_point.c
+ * @brief Host tests of the Q16.16 motion math against the float implementation it replaced
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "fixed_point.h"
+#include "drv8825.h"
+
+#define CHECK(condition, ...)                                             \
+    do {                                                                  \
+        checks++;                                                         \
+        if (!(condition)) {                                               \
+            failures++;                                                   \
+            if (failures <= MAX_REPORTED_FAILURES) {                      \
+                printf("FAIL %s:%d: ", __FILE__, __LINE__);               \
+                printf(__VA_ARGS__);                                      \
+                printf("\n");                                             \
+            }                                                             \
+        }                                                                 \
+    } while (0)
+
+#define MAX_REPORTED_FAILURES 20
+#define RANDOM_CASES 100000
+
+static unsigned checks = 0;
+static unsigned failures = 0;
+
+// Encoder resolutions as pulses / degrees, the first one is the production encoder
+static const struct {
+    int pulses;
+    int degrees;
+} resolutions[] = {
+    {ENCODER_NO_OF_PULSES + 1, DEGREE_FULL_ANGLE}, {1, 4}, {1, 1}, {2, 1}, {200, 360}, {1, 3}, {400, 360},
+};
+#define NUM_RESOLUTIONS (sizeof(resolutions) / sizeof(resolutions[0]))
+
+// A resolution is exact in Q16.16 when pulses * 2^16 is a multiple of degrees
+static bool resolution_is_exact(int pulses, int degrees) {
+    return ((int64_t)pulses * Q16_ONE) % degrees == 0;
+}
+
+// Float reference of motor_plan_steps(), as rotate_handler() computed it before the fixed point change
+static int reference_plan_steps(char direction, const char *steptype, uint16_t angle, uint16_t rpm, float encoder_resolution,
+                                motor_step_plan_t *plan) {
+    uint8_t index = 0;
+    while (index < NUM_OF_STEPTYPES && strcmp(steptype, steptype_dict[index].micro_steps) != 0) index++;
+    if (index == NUM_OF_STEPTYPES) return RESOLUTION_ERROR;
+    plan->steptype_index = index;
+    plan->expected_encoder_value = (uint16_t)(encoder_resolution * angle);
+    if (plan->expected_encoder_value > ENCODER_NO_OF_PULSES) return EXP_IS_INVALID;
+    if (angle > ANGLE_MAX) return ANGLE_IS_INVALID;
+    plan->steps = (STEPS_PER_ROTATION * steptype_dict[index].step_factor[3] * angle) / DEGREE_FULL_ANGLE;
+    if (rpm == 0 || rpm > RPM_MAX) return RPM_IS_INVALID;
+    plan->step_delay_us = PICO_MAX(1, (STEPPER_RESOLUTION / rpm));
+    plan->step_increment = 32 / steptype_dict[index].step_factor[3];
+    if (direction != DIR_CW) plan->step_increment = -plan->step_increment;
+    return SUCCESS_INT;
+}
+
+static void test_saturation(void) {
+    CHECK(sat_i32((int64_t)INT32_MAX + 1) == INT32_MAX, "sat_i32 upper");
+    CHECK(sat_i32((int64_t)INT32_MIN - 1) == INT32_MIN, "sat_i32 lower");
+    CHECK(sat_u16(-5) == 0 && sat_u16(70000) == UINT16_MAX && sat_u16(1234) == 1234, "sat_u16");
+    CHECK(sat_add_i32(INT32_MAX, 1) == INT32_MAX && sat_add_i32(INT32_MIN, -1) == INT32_MIN, "sat_add_i32");
+    CHECK(sat_sub_i32(INT32_MIN, 1) == INT32_MIN && sat_sub_i32(INT32_MAX, -1) == INT32_MAX, "sat_sub_i32");
+    CHECK(sat_mul_i32(65536, 65536) == INT32_MAX && sat_mul_i32(-65536, 65536) == INT32_MIN, "sat_mul_i32");
+    CHECK(q16_from_int(40000) == Q16_MAX && q16_from_int(-40000) == Q16_MIN, "q16_from_int saturates");
+    CHECK(q16_mul(Q16_FROM_INT(300), Q16_FROM_INT(300)) == Q16_MAX, "q16_mul saturates");
+    CHECK(q16_div(Q16_ONE, 0) == Q16_MAX && q16_div(-Q16_ONE, 0) == Q16_MIN, "q16_div by zero");
+    CHECK(q16_div_int(5, 0) == INT32_MAX && q16_div_int(-5, 0) == INT32_MIN, "q16_div_int by zero");
+    CHECK(q16_div_int(100000, Q16_FROM_RATIO(1, 2)) == 200000, "q16_div_int 64 bit path");
+    CHECK(q16_mul_int(-Q16_FROM_RATIO(1, 2), 3) == -1, "q16_mul_int truncates towards zero");
+}
+
+// q16_mul() and q16_div() truncate the exact result, compare with a double reference
+static void test_arithmetic(void) {
+    srand(1);
+    for (int i = 0; i < RANDOM_CASES; i++) {
+        q16_16_t a = (q16_16_t)((rand() % (2 * 1000 * Q16_ONE)) - 1000 * Q16_ONE);
+        q16_16_t b = (q16_16_t)((rand() % (2 * 1000 * Q16_ONE)) - 1000 * Q16_ONE);
+        double product = trunc((double)a * (double)b / Q16_ONE);
+        if (fabs(product) < INT32_MAX) CHECK(q16_mul(a, b) == (q16_16_t)product, "q16_mul %d %d", a, b);
+        if (b != 0) {
+            double quotient = trunc((double)a * Q16_ONE / (double)b);
+            if (fabs(quotient) < INT32_MAX) CHECK(q16_div(a, b) == (q16_16_t)quotient, "q16_div %d %d", a, b);
+        }
+    }
+}
+
+// expected_encoder_value = resolution * angle
+static void test_expected_encoder_value(void) {
+    for (size_t r = 0; r < NUM_RESOLUTIONS; r++) {
+        float resolution_float = (float)resolutions[r].pulses / (float)resolutions[r].degrees;
+        q16_16_t resolution = Q16_FROM_RATIO(resolutions[r].pulses, resolutions[r].degrees);
+        bool exact = resolution_is_exact(resolutions[r].pulses, resolutions[r].degrees);
+        for (int angle = 0; angle <= ANGLE_MAX; angle++) {
+            int expected = (uint16_t)(resolution_float * angle);
+            int actual = sat_u16(q16_mul_int(resolution, angle));
+            if (exact) {
+                CHECK(actual == expected, "%d/%d * %d: float %d, q16 %d", resolutions[r].pulses, resolutions[r].degrees, angle, expected, actual);
+            } else {
+                CHECK(abs(actual - expected) <= 1, "%d/%d * %d: float %d, q16 %d", resolutions[r].pulses, resolutions[r].degrees, angle, expected, actual);
+            }
+        }
+    }
+}
+
+// correction angle = |encoder_diff| / resolution, truncated by the uint16_t angle parameter
+static void test_correction_angle(void) {
+    for (size_t r = 0; r < NUM_RESOLUTIONS; r++) {
+        float resolution_float = (float)resolutions[r].pulses / (float)resolutions[r].degrees;
+        q16_16_t resolution = Q16_FROM_RATIO(resolutions[r].pulses, resolutions[r].degrees);
+        bool exact = resolution_is_exact(resolutions[r].pulses, resolutions[r].degrees);
+        for (int diff = -ENCODER_NO_OF_PULSES; diff <= ENCODER_NO_OF_PULSES; diff++) {
+            int expected = (uint16_t)(abs(diff) / resolution_float);
+            int actual = sat_u16(q16_div_int(abs(diff), resolution));
+            if (exact) {
+                CHECK(actual == expected, "%d / (%d/%d): float %d, q16 %d", diff, resolutions[r].pulses, resolutions[r].degrees, expected, actual);
+            } else {
+                CHECK(abs(actual - expected) <= 1, "%d / (%d/%d): float %d, q16 %d", diff, resolutions[r].pulses, resolutions[r].degrees, expected, actual);
+            }
+        }
+    }
+}
+
+// motor_plan_steps() with the production resolution against the float reference, every field and status
+static void test_plan_steps(void) {
+    static const uint16_t rpms[] = {0, 1, 7, 400, 800, 1600, 3200, 3201, UINT16_MAX};
+    static const char *const steptypes[] = {"01", "02", "04", "08", "16", "32", "36", ""};
+    q16_16_t resolution = Q16_FROM_RATIO(ENCODER_NO_OF_PULSES + 1, DEGREE_FULL_ANGLE);
+    float resolution_float = (float)(ENCODER_NO_OF_PULSES + 1) / DEGREE_FULL_ANGLE;
+
+    for (size_t s = 0; s < sizeof(steptypes) / sizeof(steptypes[0]); s++) {
+        for (uint32_t angle = 0; angle <= ANGLE_MAX + 2; angle++) {
+            for (size_t r = 0; r < sizeof(rpms) / sizeof(rpms[0]); r++) {
+                char direction = (angle & 1u) ? DIR_CW : DIR_CCW;
+                motor_step_plan_t expected, actual;
+                memset(&expected, 0, sizeof(expected));
+                memset(&actual, 0, sizeof(actual));
+                int expected_status = reference_plan_steps(direction, steptypes[s], (uint16_t)angle, rpms[r], resolution_float, &expected);
+                int actual_status = motor_plan_steps(direction, steptypes[s], (uint16_t)angle, rpms[r], resolution, &actual);
+                CHECK(actual_status == expected_status && memcmp(&actual, &expected, sizeof(actual)) == 0,
+                      "plan %s %u deg %u rpm: status %d/%d", steptypes[s], (unsigned)angle, rpms[r], expected_status, actual_status);
+            }
+        }
+    }
+}
+
+int main(void) {
+    test_saturation();
+    test_arithmetic();
+    test_expected_encoder_value();
+    test_correction_angle();
+    test_plan_steps();
+
+    printf("%u checks, %u failures\n", checks, failures);
+    return failures ? 1 : 0;
+}
+
+/*** end of file ***/
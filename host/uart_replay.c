@@ -0,0 +1,273 @@
+/**
+ * @file uart_replay.c
+ * @brief Replays a recorded UART trace into the firmware on the virtual clock and compares the responses
+ * @author Yashas Nagaraj Udupa
+ *
+ * The unmodified firmware main() boots against plant_sim, every recorded RX frame is fed at its recorded
+ * time offset and the responses are captured at the UART. Each RX frame and the TX frames up to the next
+ * RX frame form an exchange; content and latency (last response - RX frame) of every exchange are
+ * compared with the recording.
+ *
+ * usage: uart_replay [-b boot_ms] [-w drain_ms] [-t tolerance_ms] [-p tolerance_percent] [-s seed]
+ *                    [-o replayed.bin] [-v] <trace.bin>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "hal.h"
+#include "plant_sim.h"
+#include "uart_trace.h"
+
+#define REPLAY_DEFAULT_BOOT_MS 15000      // first RX frame after boot and homing
+#define REPLAY_DEFAULT_DRAIN_MS 30000     // responses collected after the last RX frame
+#define REPLAY_DEFAULT_TOLERANCE_MS 20.0
+#define REPLAY_DEFAULT_TOLERANCE_PCT 20.0
+
+typedef struct {
+    uart_trace_record_t *records;
+    size_t count;
+    size_t capacity;
+} replay_trace_t;
+
+typedef struct {
+    size_t rx;              // index of the RX record
+    size_t first_tx;        // TX records of the exchange
+    size_t tx_count;
+    double latency_ms;
+} replay_exchange_t;
+
+int rp1_firmware_main(void);
+
+static replay_trace_t recorded;
+static replay_trace_t replayed;
+static uart_trace_framer_t rx_framer, tx_framer;
+
+static size_t next_rx;
+static uint64_t boot_us, drain_us, first_rx_us;
+static int rx_pipe[2];
+static hal_repeating_timer_t feed_timer;
+
+static double tolerance_ms = REPLAY_DEFAULT_TOLERANCE_MS;
+static double tolerance_pct = REPLAY_DEFAULT_TOLERANCE_PCT;
+static const char *replayed_path = NULL;
+static bool verbose = false;
+
+static void trace_append(replay_trace_t *trace, const uart_trace_record_t *record) {
+    if (record == NULL) return;
+    if (trace->count == trace->capacity) {
+        trace->capacity = trace->capacity ? 2 * trace->capacity : 64;
+        trace->records = realloc(trace->records, trace->capacity * sizeof(uart_trace_record_t));
+        if (trace->records == NULL) {
+            perror("uart_replay");
+            exit(2);
+        }
+    }
+    trace->records[trace->count++] = *record;
+}
+
+// Private function grouping a trace into exchanges, TX frames before the first RX frame are skipped
+static size_t build_exchanges(const replay_trace_t *trace, replay_exchange_t **exchanges) {
+    size_t count = 0;
+    *exchanges = calloc(trace->count + 1, sizeof(replay_exchange_t));
+    for (size_t i = 0; i < trace->count; i++) {
+        const uart_trace_record_t *record = &trace->records[i];
+        if (record->direction == UART_TRACE_RX) {
+            replay_exchange_t *exchange = &(*exchanges)[count++];
+            exchange->rx = i;
+            exchange->first_tx = i + 1;
+        } else if (count > 0) {
+            replay_exchange_t *exchange = &(*exchanges)[count - 1];
+            exchange->tx_count++;
+            exchange->latency_ms = (double)(record->time_us - trace->records[exchange->rx].time_us) / 1000.0;
+        }
+    }
+    return count;
+}
+
+static bool same_responses(const replay_exchange_t *a, const replay_exchange_t *b) {
+    if (a->tx_count != b->tx_count) return false;
+    for (size_t i = 0; i < a->tx_count; i++) {
+        const uart_trace_record_t *ra = &recorded.records[a->first_tx + i];
+        const uart_trace_record_t *rb = &replayed.records[b->first_tx + i];
+        if (ra->length != rb->length || memcmp(ra->data, rb->data, ra->length) != 0) return false;
+    }
+    return true;
+}
+
+static void print_responses(const char *label, const replay_trace_t *trace, const replay_exchange_t *exchange) {
+    printf("    %s:", label);
+    for (size_t i = 0; i < exchange->tx_count; i++) {
+        printf(" \"");
+        uart_trace_print_frame(stdout, &trace->records[exchange->first_tx + i]);
+        printf("\"");
+    }
+    printf("\n");
+}
+
+// Private function comparing the replay with the recording, returns the number of differing exchanges
+static unsigned compare_traces(void) {
+    replay_exchange_t *expected, *actual;
+    size_t expected_count = build_exchanges(&recorded, &expected);
+    size_t actual_count = build_exchanges(&replayed, &actual);
+    unsigned content_diffs = 0, timing_diffs = 0;
+
+    if (actual_count != expected_count) {
+        printf("exchange count differs: recorded=%zu replayed=%zu\n", expected_count, actual_count);
+    }
+    size_t count = expected_count < actual_count ? expected_count : actual_count;
+    for (size_t i = 0; i < count; i++) {
+        bool content_ok = same_responses(&expected[i], &actual[i]);
+        double delta = actual[i].latency_ms - expected[i].latency_ms;
+        double limit = expected[i].latency_ms * tolerance_pct / 100.0;
+        if (limit < tolerance_ms) limit = tolerance_ms;
+        bool timing_ok = delta <= limit && delta >= -limit;
+        content_diffs += !content_ok;
+        timing_diffs += !timing_ok;
+
+        if (!verbose && content_ok && timing_ok) continue;
+        printf("exchange %zu rx=\"", i);
+        uart_trace_print_frame(stdout, &recorded.records[expected[i].rx]);
+        printf("\" recorded_ms=%.1f replayed_ms=%.1f delta_ms=%+.1f content=%s timing=%s\n",
+               expected[i].latency_ms, actual[i].latency_ms, delta, content_ok ? "ok" : "DIFF",
+               timing_ok ? "ok" : (delta > 0 ? "SLOW" : "FAST"));
+        if (!content_ok) {
+            print_responses("recorded", &recorded, &expected[i]);
+            print_responses("replayed", &replayed, &actual[i]);
+        }
+    }
+    printf("summary exchanges=%zu content_diffs=%u timing_diffs=%u\n", count, content_diffs, timing_diffs);
+
+    free(expected);
+    free(actual);
+    return content_diffs + timing_diffs + (actual_count != expected_count);
+}
+
+// Private function ending the replay, runs from the feed timer once the drain time is over
+static void finish_replay(void) {
+    trace_append(&replayed, uart_trace_framer_flush(&rx_framer));
+    trace_append(&replayed, uart_trace_framer_flush(&tx_framer));
+
+    if (replayed_path) {
+        uart_trace_file_t out;
+        if (uart_trace_create(&out, replayed_path) != 0) {
+            perror(replayed_path);
+        } else {
+            for (size_t i = 0; i < replayed.count; i++) uart_trace_write(&out, &replayed.records[i]);
+            uart_trace_close(&out);
+        }
+    }
+    unsigned diffs = compare_traces();
+    fflush(stdout);
+    exit(diffs ? 1 : 0);
+}
+
+// UART observer, frames the replayed traffic on the virtual clock
+static void capture_byte(hal_uart_id_t uart, bool tx, uint8_t byte) {
+    if (uart != HAL_UART0) return;
+    uart_trace_framer_t *framer = tx ? &tx_framer : &rx_framer;
+    trace_append(&replayed, uart_trace_framer_put(framer, byte, hal_time_us_64()));
+}
+
+static uint64_t replay_time(const uart_trace_record_t *record) {
+    return boot_us + (record->time_us - first_rx_us);
+}
+
+// Private timer callback feeding the recorded RX frames, re-arms itself for the next one
+static bool feed_timer_callback(hal_repeating_timer_t *timer) {
+    uint64_t now = hal_time_us_64();
+    while (next_rx < recorded.count) {
+        const uart_trace_record_t *record = &recorded.records[next_rx];
+        if (record->direction != UART_TRACE_RX) {
+            next_rx++;
+            continue;
+        }
+        if (replay_time(record) > now) break;
+        if (write(rx_pipe[1], record->data, record->length) != record->length) perror("uart_replay: feed");
+        next_rx++;
+    }
+    // wake up for the next RX frame, or once the responses of the last one have drained
+    uint64_t next = drain_us;
+    for (size_t i = next_rx; i < recorded.count; i++) {
+        if (recorded.records[i].direction == UART_TRACE_RX) {
+            next = replay_time(&recorded.records[i]);
+            break;
+        }
+    }
+    if (next_rx >= recorded.count && now >= drain_us) finish_replay();
+    timer->next_us = next;
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t boot_ms = REPLAY_DEFAULT_BOOT_MS, drain_ms = REPLAY_DEFAULT_DRAIN_MS;
+    plant_config_t config;
+    plant_default_config(&config);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:w:t:p:s:o:v")) != -1) {
+        switch (opt) {
+            case 'b': boot_ms = strtoull(optarg, NULL, 0); break;
+            case 'w': drain_ms = strtoull(optarg, NULL, 0); break;
+            case 't': tolerance_ms = strtod(optarg, NULL); break;
+            case 'p': tolerance_pct = strtod(optarg, NULL); break;
+            case 's': config.seed = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'o': replayed_path = optarg; break;
+            case 'v': verbose = true; break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-b boot_ms] [-w drain_ms] [-t tolerance_ms] [-p tolerance_percent] [-s seed] "
+                        "[-o replayed.bin] [-v] <trace.bin>\n", argv[0]);
+        return 2;
+    }
+
+    uart_trace_file_t trace;
+    if (uart_trace_open(&trace, argv[optind]) != 0) {
+        fprintf(stderr, "uart_replay: %s is not a UART trace\n", argv[optind]);
+        return 2;
+    }
+    uart_trace_record_t record;
+    int status;
+    while ((status = uart_trace_read(&trace, &record)) == 1) trace_append(&recorded, &record);
+    uart_trace_close(&trace);
+    if (status < 0) fprintf(stderr, "uart_replay: trace truncated after %zu records\n", recorded.count);
+
+    uint64_t last_rx_us = 0;
+    bool have_rx = false;
+    for (size_t i = 0; i < recorded.count; i++) {
+        if (recorded.records[i].direction != UART_TRACE_RX) continue;
+        if (!have_rx) first_rx_us = recorded.records[i].time_us;
+        last_rx_us = recorded.records[i].time_us;
+        have_rx = true;
+    }
+    if (!have_rx) {
+        fprintf(stderr, "uart_replay: no RX frames in %s\n", argv[optind]);
+        return 2;
+    }
+    boot_us = boot_ms * 1000u;
+    drain_us = boot_us + (last_rx_us - first_rx_us) + drain_ms * 1000u;
+
+    // UART0 reads the fed frames from a pipe, the responses are only captured
+    int devnull = open("/dev/null", O_WRONLY);
+    if (pipe(rx_pipe) != 0 || devnull < 0) {
+        perror("uart_replay");
+        return 2;
+    }
+    hal_host_uart_attach(HAL_UART0, rx_pipe[0], devnull);
+    uart_trace_framer_init(&rx_framer, UART_TRACE_RX);
+    uart_trace_framer_init(&tx_framer, UART_TRACE_TX);
+    hal_host_uart_set_capture(capture_byte);
+
+    hal_host_set_virtual_time(true);
+    plant_init(&config);
+    hal_add_repeating_timer_us((int64_t)boot_us, feed_timer_callback, NULL, &feed_timer);
+
+    // never returns, finish_replay() exits
+    return rp1_firmware_main();
+}
+
+/*** end of file ***/
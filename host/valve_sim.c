@@ -0,0 +1,269 @@
+/**
+ * @file valve_sim.c
+ * @brief Virtual time simulation of the valve firmware against the plant model
+ * @author Yashas Nagaraj Udupa
+ *
+ * Runs the unmodified motion code (initialisations, state_rotate_valve, home_stepper_motor,
+ * rotate_stepper_motor and the encoder ISRs) against plant_sim on the HAL virtual clock.
+ *
+ * usage: valve_sim [-s seed] [-l friction] [-S seal_load] [-n noise] [-m max_full_step_rate]
+ *                  [-a start_angle] [-f fault_ms:duration_ms] [-r repeats] [-o dirt] [command ...]
+ *
+ * -o dirt: contaminated optics, the swing of the encoder signals shrinks by the fraction and gaussian
+ *          noise of dirt * SIM_OPTICS_NOISE ADC counts is added. The dirt builds up over SIM_OPTICS_RAMP_US.
+ *          The encoder_adc monitoring runs with -o or an EA command, the plain simulation leaves it off
+ *
+ * commands: V1..V5                          state_rotate_valve()
+ *           HC / HA                         home_stepper_motor() clockwise / anticlockwise
+ *           R<C|A>,<steptype>,<angle>,<rpm> rotate_stepper_motor()
+ *           BM                              test_characterize_valve_motor(), report on stdout
+ *           VC                              valve_cal_run(), compensation table on stdout
+ *           EA                              signal quality of the encoder channels from encoder_adc
+ *           CT[,<V|S>,<delay_us>,<width_us>]  camera_trigger_command(), the report goes to stderr
+ */
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hal.h"
+#include "gpio_control.h"
+#include "gpio_dispatch.h"
+#include "drv8825.h"
+#include "plant_sim.h"
+#include "test.h"
+#include "valve_cal.h"
+#include "encoder_adc.h"
+#include "camera_trigger.h"
+#include "move_eta.h"
+
+// Default command sequence, visits every port and returns home
+#define SIM_DEFAULT_SEQUENCE "V1 V3 V4 V5 V2"
+#define SIM_MAX_COMMANDS 64
+#define SIM_PORT_TOLERANCE_DEG 2.0    // one encoder count
+#define SIM_ACK_BUFFER_SIZE ACK_ENCODER_ENTRY_SIZE
+
+// Encoder signal levels of clean optics in ADC counts, noise of fully dirty ones
+#define SIM_OPTICS_LOW 200
+#define SIM_OPTICS_HIGH 3800
+#define SIM_OPTICS_NOISE 400
+#define SIM_OPTICS_RAMP_US 10000000
+
+static float optics_dirt = 0.0f;
+static uint32_t optics_rng = 1;
+
+static atomic_bool core1_ready = false;
+
+// Core 1 only services its GPIO edges in the simulation
+static void sim_core1_entry(void) {
+    gpio_dispatch_enable_core();
+    atomic_store(&core1_ready, true);
+}
+
+// Private ADC source, the sensor output swing shrinks and its noise grows with the dirt on the optics
+static uint16_t sim_optics_source(uint input, bool level, uint64_t time_us) {
+    optics_rng ^= optics_rng << 13;
+    optics_rng ^= optics_rng >> 17;
+    optics_rng ^= optics_rng << 5;
+    float u1 = (float)((optics_rng >> 8) + 1) / 16777217.0f;
+    optics_rng ^= optics_rng << 13;
+    optics_rng ^= optics_rng >> 17;
+    optics_rng ^= optics_rng << 5;
+    float u2 = (float)(optics_rng >> 8) / 16777216.0f;
+    float gauss = sqrtf(-2.0f * logf(u1)) * cosf(2.0f * (float)M_PI * u2);
+
+    float dirt = time_us < SIM_OPTICS_RAMP_US ? optics_dirt * (float)time_us / SIM_OPTICS_RAMP_US : optics_dirt;
+    float swing = (SIM_OPTICS_HIGH - SIM_OPTICS_LOW) * (1.0f - dirt);
+    float value = SIM_OPTICS_LOW + (level ? swing : 0.0f) + dirt * SIM_OPTICS_NOISE * gauss;
+    return (uint16_t)(value < 0.0f ? 0.0f : value > HAL_ADC_MAX ? HAL_ADC_MAX : value);
+}
+
+// Private function printing the signal quality of the encoder channels
+static void sim_print_signal_quality(void) {
+    static const uint gpios[] = {ENC_CH1, ENC_CH2, ENC_CH3};
+    encoder_adc_stats_t stats;
+    for (size_t i = 0; i < sizeof(gpios) / sizeof(gpios[0]); i++) {
+        if (!encoder_adc_get_stats(gpios[i], &stats)) continue;
+        printf("signal gpio=%u amplitude=%u noise=%u duty=%u edges=%lu %s\n", gpios[i], stats.amplitude, stats.noise,
+               stats.duty_permille, (unsigned long)stats.edges, stats.warning ? "warn" : "ok");
+    }
+}
+
+static double sim_real_time_s(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static int sim_valve_index(const char *command) {
+    for (int i = 0; i < NUM_OF_VALVES; i++) {
+        if (strncmp(command, valve_coordinates[i].valve_type, TWO_BYTES) == 0) return i;
+    }
+    return -1;
+}
+
+// Private function listing the non zero entries of the compensation table
+static void sim_print_calibration(void) {
+    valve_cal_table_t table;
+    valve_cal_get(&table);
+    printf("calibration");
+    for (int from = 0; from < NUM_OF_VALVES; from++) {
+        for (int to = 0; to < NUM_OF_VALVES; to++) {
+            for (int d = 0; d < 2; d++) {
+                if (table.compensation_steps[from][to][d] == 0) continue;
+                printf(" %s%s%s=%d", valve_coordinates[from].valve_type, valve_coordinates[to].valve_type, d ? "CCW" : "CW",
+                       table.compensation_steps[from][to][d]);
+            }
+        }
+    }
+    printf("\n");
+}
+
+// Private function executing one command, returns false if a valve move missed its port
+static bool sim_run_command(const char *command) {
+    plant_state_t before, after;
+    plant_get_state(&before);
+    uint64_t start_us = hal_time_us_64();
+    int status;
+    int valve = sim_valve_index(command);
+
+    // valve moves are predicted like the dispatcher does, the bias learns over the run
+    uint32_t predicted_us = valve >= 0 ? move_eta_predict(get_desired_func(command), command) : 0;
+    if (valve >= 0) {
+        move_eta_begin(get_desired_func(command), command);
+        status = state_rotate_valve(command);
+        move_eta_record(get_desired_func(command), (uint32_t)(hal_time_us_64() - start_us));
+    } else if (command[0] == 'H' && (command[1] == DIR_CW || command[1] == DIR_CCW)) {
+        status = home_stepper_motor(command[1]);
+    } else if (command[0] == 'R' && (command[1] == DIR_CW || command[1] == DIR_CCW)) {
+        char steptype[THREE_BYTES] = "";
+        unsigned angle = 0, rpm = 0;
+        char expected[SIM_ACK_BUFFER_SIZE] = "", actual[SIM_ACK_BUFFER_SIZE] = "";
+        if (sscanf(command + 2, ",%2[0-9],%u,%u", steptype, &angle, &rpm) != 3) {
+            fprintf(stderr, "valve_sim: bad command %s\n", command);
+            return false;
+        }
+        status = rotate_stepper_motor(command[1], steptype, expected, actual, (uint16_t)angle, (uint16_t)rpm);
+    } else if (strcmp(command, "BM") == 0) {
+        status = test_characterize_valve_motor();
+    } else if (strcmp(command, "VC") == 0) {
+        status = valve_cal_run();
+        sim_print_calibration();
+    } else if (strcmp(command, "EA") == 0) {
+        sim_print_signal_quality();
+        return true;
+    } else if (strncmp(command, "CT", TWO_BYTES) == 0) {
+        return camera_trigger_command(command) == SUCCESS_INT;
+    } else {
+        fprintf(stderr, "valve_sim: unknown command %s\n", command);
+        return false;
+    }
+
+    plant_get_state(&after);
+    double angle = plant_port_angle();
+    printf("%-4s status=%d time_ms=%.1f angle=%.2f steps=%u missed=%u enc_edges=%u corrections=%u",
+           command, status, (double)(hal_time_us_64() - start_us) / 1000.0, angle,
+           after.steps_commanded - before.steps_commanded, after.steps_missed - before.steps_missed,
+           after.encoder_edges - before.encoder_edges, motor_correction_count());
+    if (valve < 0) {
+        printf("\n");
+        return true;
+    }
+    // homing may take the long way round, compare modulo one revolution
+    double error = fmod(angle - valve_coordinates[valve].valve_position, DEGREE_FULL_ANGLE);
+    if (error > DEGREE_FULL_ANGLE / 2) error -= DEGREE_FULL_ANGLE;
+    if (error < -DEGREE_FULL_ANGLE / 2) error += DEGREE_FULL_ANGLE;
+    printf(" target=%d error=%.2f eta_ms=%.1f\n", valve_coordinates[valve].valve_position, error, (double)predicted_us / 1000.0);
+    return error >= -SIM_PORT_TOLERANCE_DEG && error <= SIM_PORT_TOLERANCE_DEG;
+}
+
+int main(int argc, char *argv[]) {
+    plant_config_t config;
+    plant_default_config(&config);
+    unsigned fault_ms = 0, fault_duration_ms = 0, repeats = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:l:S:n:m:a:f:r:o:")) != -1) {
+        switch (opt) {
+            case 's': config.seed = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'l': config.friction_load = strtof(optarg, NULL); break;
+            case 'S': config.seal_load = strtof(optarg, NULL); break;
+            case 'n': config.load_noise = strtof(optarg, NULL); break;
+            case 'm': config.max_full_step_rate = strtof(optarg, NULL); break;
+            case 'a': config.start_angle_deg = strtof(optarg, NULL); break;
+            case 'f': sscanf(optarg, "%u:%u", &fault_ms, &fault_duration_ms); break;
+            case 'r': repeats = (unsigned)strtoul(optarg, NULL, 0); break;
+            case 'o': optics_dirt = strtof(optarg, NULL); break;
+            default:
+                fprintf(stderr, "usage: %s [-s seed] [-l friction] [-S seal_load] [-n noise] [-m max_full_step_rate] "
+                                "[-a start_angle] [-f fault_ms:duration_ms] [-r repeats] [-o dirt] [command ...]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    static char default_sequence[] = SIM_DEFAULT_SEQUENCE;
+    char *commands[SIM_MAX_COMMANDS];
+    int command_count = 0;
+    if (optind < argc) {
+        for (int i = optind; i < argc && command_count < SIM_MAX_COMMANDS; i++) commands[command_count++] = argv[i];
+    } else {
+        for (char *token = strtok(default_sequence, " "); token && command_count < SIM_MAX_COMMANDS; token = strtok(NULL, " ")) {
+            commands[command_count++] = token;
+        }
+    }
+
+    // acknowledgements go to stderr, the simulation report to stdout
+    hal_host_uart_attach(HAL_UART0, -1, STDERR_FILENO);
+    hal_host_set_virtual_time(true);
+    plant_init(&config);
+    optics_rng = config.seed * 2654435761u | 1u;
+    if (optics_dirt > 0.0f) hal_host_set_adc_source(sim_optics_source);
+    if (fault_duration_ms) plant_schedule_fault((uint64_t)fault_ms * 1000u, (uint64_t)fault_duration_ms * 1000u);
+
+    uart_config_t uart_config = {
+        .uartInst = MAIN_UART_INSTANCE,
+        .baudRate = MAIN_UART_BAUDRATE,
+        .dataLen = MAIN_UART_DATA_LEN,
+        .parityBit = MAIN_UART_PARITY,
+        .stopBit = MAIN_UART_STOP_BIT,
+        .txPin = MAIN_UART_TX,
+        .rxPin = MAIN_UART_RX,
+        .txIntrEnable = MAIN_UART_TX_INTR_ENABLE,
+        .rxIntrEnable = MAIN_UART_RX_INTR_ENABLE,
+        .handler = on_uart_rx,
+    };
+
+    double real_start = sim_real_time_s();
+
+    // boot exactly like main(), including the homing move
+    initialisations(&uart_config);
+    bool monitor = optics_dirt > 0.0f;
+    for (int i = 0; i < command_count; i++) monitor |= strcmp(commands[i], "EA") == 0;
+    if (monitor) encoder_adc_start();
+    hal_multicore_launch_core1(sim_core1_entry);
+    while (!atomic_load(&core1_ready)) hal_tight_loop_contents();
+
+    plant_state_t state;
+    plant_get_state(&state);
+    plant_set_port_reference(state.rotor_position);
+    printf("boot time_ms=%.1f steps=%u missed=%u\n", (double)hal_time_us_64() / 1000.0, state.steps_commanded, state.steps_missed);
+
+    unsigned failures = 0;
+    for (unsigned r = 0; r < repeats; r++) {
+        for (int i = 0; i < command_count; i++) {
+            if (!sim_run_command(commands[i])) failures++;
+        }
+    }
+
+    double real_s = sim_real_time_s() - real_start;
+    double virtual_s = (double)hal_time_us_64() / 1e6;
+    plant_get_state(&state);
+    printf("summary virtual_s=%.3f real_s=%.4f speedup=%.0f steps=%u missed=%u failures=%u\n",
+           virtual_s, real_s, real_s > 0 ? virtual_s / real_s : 0.0, state.steps_commanded, state.steps_missed, failures);
+    return failures ? 1 : 0;
+}
+
+/*** end of file ***/
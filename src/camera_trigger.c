@@ -0,0 +1,145 @@
+/**
+ * @file camera_trigger.c
+ * @brief Image capture trigger output Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <stdio.h>
+#include <ctype.h>
+#include "camera_trigger.h"
+#include "gpio_control.h"
+#include "drv8825.h"
+#include "transport.h"
+
+static const char camera_trigger_names[] = "VS";     // command letter of each source
+
+static camera_trigger_config_t trigger_config[CAMERA_TRIGGER_NUM_SOURCES];
+static camera_trigger_stats_t trigger_stats[CAMERA_TRIGGER_NUM_SOURCES];
+static uint64_t scheduled_us[CAMERA_TRIGGER_NUM_SOURCES];   // last scheduled rising edge, until taken for the ack
+
+// One pulse at a time: the alarm raises the output, fires again after the width and drops it
+static hal_alarm_t trigger_alarm;
+static volatile bool pulse_pending = false;
+static volatile bool pulse_high = false;
+static int pulse_source = CAMERA_TRIGGER_VALVE;
+
+// Private alarm callback driving the pulse edges
+static uint64_t trigger_alarm_callback(hal_alarm_t *alarm) {
+    if (!pulse_high) {
+        hal_gpio_put(CAMERA_TRIGGER, HIGH);
+        uint64_t latency = get_time() - alarm->target_us;
+        camera_trigger_stats_t *stats = &trigger_stats[pulse_source];
+        stats->pulses++;
+        if (latency > stats->max_latency_us) stats->max_latency_us = (uint32_t)PICO_MIN(latency, UINT32_MAX);
+        pulse_high = true;
+        return trigger_config[pulse_source].width_us;
+    }
+    hal_gpio_put(CAMERA_TRIGGER, LOW);
+    pulse_high = false;
+    pulse_pending = false;
+    return 0;
+}
+
+bool camera_trigger_configure(int source, const camera_trigger_config_t *config) {
+    if (source < 0 || source >= CAMERA_TRIGGER_NUM_SOURCES || config == NULL) return false;
+    if (config->delay_us > CAMERA_TRIGGER_MAX_DELAY_US || config->width_us > CAMERA_TRIGGER_MAX_WIDTH_US) return false;
+    uint32_t irq_status = hal_save_and_disable_interrupts();
+    trigger_config[source] = *config;
+    if (source != CAMERA_TRIGGER_VIBRATION) trigger_config[source].segment = 0;
+    hal_restore_interrupts(irq_status);
+    return true;
+}
+
+uint64_t camera_trigger_event(int source, uint64_t event_us) {
+    if (source < 0 || source >= CAMERA_TRIGGER_NUM_SOURCES || trigger_config[source].width_us == 0) return 0;
+    uint64_t trigger_us = event_us + trigger_config[source].delay_us;
+
+    uint32_t irq_status = hal_save_and_disable_interrupts();
+    bool busy = pulse_pending;
+    if (!busy) {
+        pulse_pending = true;
+        pulse_source = source;
+    }
+    hal_restore_interrupts(irq_status);
+
+    if (busy) {
+        trigger_stats[source].dropped++;
+        return 0;
+    }
+    if (!hal_add_alarm_at(trigger_us, trigger_alarm_callback, NULL, &trigger_alarm)) {
+        pulse_pending = false;
+        trigger_stats[source].dropped++;
+        return 0;
+    }
+    scheduled_us[source] = trigger_us;
+    return trigger_us;
+}
+
+void camera_trigger_vibration_segment(uint8_t segment, bool last) {
+    uint8_t fire_segment = trigger_config[CAMERA_TRIGGER_VIBRATION].segment;
+    if (fire_segment == segment || (fire_segment == 0 && last)) camera_trigger_event(CAMERA_TRIGGER_VIBRATION, get_time());
+}
+
+uint64_t camera_trigger_take(int source) {
+    if (source < 0 || source >= CAMERA_TRIGGER_NUM_SOURCES) return 0;
+    uint64_t trigger_us = scheduled_us[source];
+    scheduled_us[source] = 0;
+    return trigger_us;
+}
+
+void camera_trigger_append(char *ack, size_t size, uint64_t trigger_us) {
+    size_t len = strlen(ack);
+    if (trigger_us == 0 || len == 0 || ack[len - 1] != '\n') return;
+    snprintf(ack + len - 1, size - (len - 1), "_ct%llu\n", (unsigned long long)trigger_us);
+}
+
+// Private helper parsing the next decimal argument after a comma
+static bool parse_argument(const char **cursor, unsigned long *value) {
+    const char *comma = strchr(*cursor, ',');
+    if (comma == NULL || !isdigit((unsigned char)comma[1])) return false;
+    *value = strtoul(comma + 1, NULL, 10);
+    *cursor = comma + 1;
+    return true;
+}
+
+int camera_trigger_command(const char *ptr_data_str) {
+    char line[CAMERA_TRIGGER_LINE_SIZE];
+    const char *args = strchr(ptr_data_str, ',');
+    int status = SUCCESS_INT;
+
+    // a framed "CT" still has its CRC field, the settings have more than one field
+    if (args == NULL || strchr(args + 1, ',') == NULL) {
+        for (int source = 0; source < CAMERA_TRIGGER_NUM_SOURCES; source++) {
+            const camera_trigger_config_t *config = &trigger_config[source];
+            const camera_trigger_stats_t *stats = &trigger_stats[source];
+            snprintf(line, sizeof(line), "ct_%c_%lu_%lu_%u_%lu_%lu_%lu\n", camera_trigger_names[source],
+                     (unsigned long)config->delay_us, (unsigned long)config->width_us, config->segment,
+                     (unsigned long)stats->pulses, (unsigned long)stats->dropped, (unsigned long)stats->max_latency_us);
+            transport_respond((const uint8_t *)line, strlen(line));
+        }
+        snprintf(line, sizeof(line), "ct_end\n");
+    } else {
+        const char *name = strchr(camera_trigger_names, args[1]);
+        int source = (args[1] != '\0' && name != NULL) ? (int)(name - camera_trigger_names) : -1;
+        const char *cursor = args + 1;
+        unsigned long delay_us = 0, width_us = 0, segment = 0;
+        camera_trigger_config_t config = {0};
+
+        bool valid = source >= 0 && parse_argument(&cursor, &delay_us) && parse_argument(&cursor, &width_us);
+        // the segment is optional, a CRC field after the width is not a number
+        if (valid && source == CAMERA_TRIGGER_VIBRATION) parse_argument(&cursor, &segment);
+        if (!valid || delay_us > CAMERA_TRIGGER_MAX_DELAY_US || width_us > CAMERA_TRIGGER_MAX_WIDTH_US || segment > UINT8_MAX) {
+            status = CAMERA_TRIGGER_INVALID;
+        } else {
+            config.delay_us = (uint32_t)delay_us;
+            config.width_us = (uint32_t)width_us;
+            config.segment = (uint8_t)segment;
+            if (!camera_trigger_configure(source, &config)) status = CAMERA_TRIGGER_INVALID;
+        }
+        snprintf(line, sizeof(line), "ct_%d\n", status);
+    }
+    transport_respond((const uint8_t *)line, strlen(line));
+    return status;
+}
+
+/*** end of file ***/
@@ -0,0 +1,92 @@
+/** @file camera_trigger.h
+*
+* @brief Trigger output of the image capture. A pulse on CAMERA_TRIGGER fires a programmable delay after a
+*        valve move settles or after a vibration segment ends. The pulse is timed by a hardware alarm, so its
+*        jitter is the alarm interrupt latency and not the command loop, and its scheduled time is reported in
+*        the acknowledgement of the move.
+*
+*/
+
+#ifndef _CAMERA_TRIGGER_H
+#define _CAMERA_TRIGGER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "hal.h"
+
+// Trigger sources
+#define CAMERA_TRIGGER_VALVE 0          // valve move completed
+#define CAMERA_TRIGGER_VIBRATION 1      // vibration segment ended
+#define CAMERA_TRIGGER_NUM_SOURCES 2
+
+#define CAMERA_TRIGGER_MAX_DELAY_US 10000000u
+#define CAMERA_TRIGGER_MAX_WIDTH_US 1000000u
+
+#define CAMERA_TRIGGER_INVALID -1
+#define CAMERA_TRIGGER_LINE_SIZE 96
+
+// Trigger of one source, a width of 0 disables it
+typedef struct {
+    uint32_t delay_us;          // event to rising edge
+    uint32_t width_us;          // pulse width
+    uint8_t segment;            // vibration only: segment whose end fires, 0 for the end of the sequence
+} camera_trigger_config_t;
+
+// Pulses of one source
+typedef struct {
+    uint32_t pulses;
+    uint32_t dropped;           // events while the previous pulse was still pending
+    uint32_t max_latency_us;    // worst rising edge delay after its scheduled time
+} camera_trigger_stats_t;
+
+/**
+ * @brief Sets the trigger of a source
+ * @param source - CAMERA_TRIGGER_VALVE or CAMERA_TRIGGER_VIBRATION
+ * @param config
+ * @return true if the source and the timings are valid
+ */
+bool camera_trigger_configure(int source, const camera_trigger_config_t *config);
+
+/**
+ * @brief Schedules the pulse of a source, called when its event happens
+ * @param source
+ * @param event_us - time of the event
+ * @return scheduled time of the rising edge, 0 if the source is disabled or a pulse is still pending
+ */
+uint64_t camera_trigger_event(int source, uint64_t event_us);
+
+/**
+ * @brief Reports the end of a vibration segment, fires the vibration trigger on its configured segment
+ * @param segment - 1 based
+ * @param last    - the segment ends the sequence
+ */
+void camera_trigger_vibration_segment(uint8_t segment, bool last);
+
+/**
+ * @brief Fetches the time of the pulse scheduled by the last event of a source and clears it
+ * @param source
+ * @return scheduled time of the rising edge, 0 if none
+ */
+uint64_t camera_trigger_take(int source);
+
+/**
+ * @brief Inserts "_ct<us>" before the line feed ending an acknowledgement, nothing if trigger_us is 0
+ * @param ack        - acknowledgement ending in '\n'
+ * @param size       - size of the ack buffer
+ * @param trigger_us - scheduled time of the rising edge
+ */
+void camera_trigger_append(char *ack, size_t size, uint64_t trigger_us);
+
+/**
+ * @brief CT command: "CT" reports every source as "ct_<V|S>_<delay>_<width>_<segment>_<pulses>_<dropped>_<max_latency>"
+ *        followed by "ct_end", "CT,V,<delay_us>,<width_us>" and "CT,S,<delay_us>,<width_us>,<segment>" set a
+ *        trigger and reply "ct_<status>"
+ * @param ptr_data_str
+ * @return SUCCESS_INT or CAMERA_TRIGGER_INVALID
+ */
+int camera_trigger_command(const char *ptr_data_str);
+
+#endif /* _CAMERA_TRIGGER_H */
+
+/*** end of file ***/
@@ -0,0 +1,254 @@
+/**
+ * @file cmd_queue.c
+ * @brief Command queue with sequence IDs Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cmd_queue.h"
+#include "gpio_control.h"
+#include "crc.h"
+#include "telemetry.h"
+#include "multidrop.h"
+#include "drv8825.h"
+#include "trace.h"
+
+#define CMD_QUEUE_MASK (CMD_QUEUE_DEPTH - 1)
+
+// Ring of command lines, filled by the transports and drained by the main loop. An entry is only
+// released once its command has completed, so the main loop works on it in place. The UART interrupt and
+// the USB poll on core 1 both receive, queue_lock keeps them apart
+static cmd_queue_entry_t queue[CMD_QUEUE_DEPTH];
+static volatile uint32_t queue_head = 0;     // next free entry, written by the receivers
+static volatile uint32_t queue_tail = 0;     // oldest entry, written by the main loop
+static hal_spin_lock_t *queue_lock = NULL;
+static cmd_queue_stats_t queue_stats;
+
+// Host session announced with "SN,<session>", every new session starts an epoch. Retries only match the
+// queued and cached commands of the current epoch, a restarted host reusing sequence IDs runs its commands
+static volatile uint32_t session_id = 0;
+static volatile uint32_t session_epoch = 0;
+
+// Responses of the last completed sequenced commands, a retried command gets its response replayed. The
+// oldest entry is reused, it is invalid while the main loop fills it
+typedef struct {
+    volatile bool valid;
+    uint32_t seq;
+    uint32_t epoch;             // session the command ran in
+    uint32_t line_crc;          // tells a retry from a new command that reuses the sequence ID
+    uint16_t length;
+    char response[CMD_CACHE_RESPONSE_SIZE];
+} cmd_cache_entry_t;
+
+static cmd_cache_entry_t cache[CMD_CACHE_ENTRIES];
+static uint32_t cache_next = 0;
+static cmd_cache_entry_t *cache_filling = NULL;
+
+// Private helper sending "ac_<seq>" or, with a reason, "rj_<seq>_<reason>" from the receiver. Never waits
+// for room in the TX ring. Broadcast and group lines are not answered, every node would reply at once
+static void send_response(transport_id_t transport, bool slotted, uint32_t seq, const char *reason) {
+    char response[CMD_QUEUE_RESPONSE_SIZE];
+    if (slotted) return;
+    int len = reason ? snprintf(response, sizeof(response), "rj_%lu_%s\n", (unsigned long)seq, reason)
+                     : snprintf(response, sizeof(response), "ac_%lu\n", (unsigned long)seq);
+    transport_try_write(transport, (const uint8_t *)response, (size_t)len);
+}
+
+// Private function parsing "@<seq>:", returns the command after it or NULL
+static const char *parse_sequence(const char *line, uint32_t *seq) {
+    char *end = NULL;
+    if (line[0] != CMD_SEQ_PREFIX || line[1] < '0' || line[1] > '9') return NULL;
+    *seq = (uint32_t)strtoul(line + 1, &end, 10);
+    return *end == CMD_SEQ_SEPARATOR ? end + 1 : NULL;
+}
+
+// Private function answering a retry of a sequenced command, returns false if the command is new. A queued
+// command is accepted again and runs once, a completed one gets its cached response replayed
+static bool answer_retry(const char *line, uint32_t seq, transport_id_t transport, bool slotted) {
+    for (uint32_t i = queue_tail; i != queue_head; i++) {
+        const cmd_queue_entry_t *entry = &queue[i & CMD_QUEUE_MASK];
+        if (entry->sequenced && entry->epoch == session_epoch && entry->seq == seq && strcmp(entry->line, line) == 0) {
+            send_response(transport, slotted, seq, NULL);
+            return true;
+        }
+    }
+    uint32_t line_crc = calculate_crc(line, strlen(line));
+    for (int i = 0; i < CMD_CACHE_ENTRIES; i++) {
+        const cmd_cache_entry_t *cached = &cache[i];
+        if (!cached->valid || cached->epoch != session_epoch || cached->seq != seq || cached->line_crc != line_crc) continue;
+        send_response(transport, slotted, seq, NULL);
+        if (!slotted) {
+            transport_try_write(transport, (const uint8_t *)cached->response, cached->length);
+            queue_stats.replayed++;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Private function starting the session of a "SN,<session>" line as it is received, the retries queued behind
+// it are already matched against the new session. The same session ID again is a retry and changes nothing
+static void start_session(const char *line, const char *command, bool crc_checked) {
+    if (get_desired_func(command) != SN) return;
+    // "SN" alone still has its CRC field, it only reports the session
+    const char *args = strchr(command, ',');
+    if (args == NULL || strchr(args + 1, ',') == NULL) return;
+#if CRC_ENABLE
+    if (!crc_checked && check_crc(line) == CRC_FAIL) return;
+#endif
+    uint32_t session = (uint32_t)strtoul(args + 1, NULL, 10);
+    if (session == session_id) return;
+    session_id = session;
+    session_epoch++;
+}
+
+void cmd_queue_init(void) {
+    if (queue_lock == NULL) {
+        queue_lock = hal_spin_lock_claim();
+    }
+}
+
+// Private function doing the work of cmd_queue_receive(), called with queue_lock held
+static bool receive_locked(const char *line, transport_id_t transport) {
+    bool full = queue_head - queue_tail >= CMD_QUEUE_DEPTH;
+    uint32_t seq = 0;
+    int route = MULTIDROP_UNICAST;
+    const char *command = multidrop_parse(line, &route);
+
+    // the UART dropped foreign lines as they came in, the USB interface is point to point
+    if (command == NULL) command = line;
+    if (route == MULTIDROP_FOREIGN && transport == TRANSPORT_UART) return false;
+    bool slotted = route == MULTIDROP_SLOTTED && transport == TRANSPORT_UART;
+
+    // on a bus a line to the node opens its turn, a bare "!<node>:" only polls the held output. Broadcast and
+    // group lines are answered in the slots
+    if (transport == TRANSPORT_UART && multidrop_enabled()) {
+        if (slotted) {
+            multidrop_turn_end();
+        } else {
+            multidrop_turn_begin();
+        }
+        if (line[0] == MULTIDROP_PREFIX && command[0] == '\0') return false;
+    }
+    bool sequenced = command[0] == CMD_SEQ_PREFIX;
+
+    // the line becomes the command at queue_head if it is accepted, the trace keys its window on that ID
+    TRACE_POINT(TRACE_RX_FRAME_COMPLETE, queue_head);
+
+    if (sequenced) {
+        // the CRC covers the address and the sequence ID, a command is only accepted if it can be dispatched
+        const char *reason = NULL;
+        command = parse_sequence(command, &seq);
+        enum DesiredFunc func = command ? get_desired_func(command) : INVALID_DESIRED_FUNC;
+        // the kill switch is the bare byte, it is handled by the receiver and never dispatched from the queue
+        if (func == INVALID_DESIRED_FUNC || func == K) reason = "cmd";
+#if CRC_ENABLE
+        else {
+            bool crc = check_crc(line);
+            TRACE_POINT(TRACE_CRC_DONE, crc);
+            if (crc == CRC_FAIL) reason = "crc";
+        }
+#endif
+        if (reason == NULL) {
+            start_session(line, command, true);
+            if (answer_retry(line, seq, transport, slotted)) return false;
+            if (full) reason = "full";
+        }
+        if (reason != NULL) {
+            queue_stats.rejected++;
+            send_response(transport, slotted, seq, reason);
+            return false;
+        }
+    } else if (full) {
+        queue_stats.dropped++;
+        return false;
+    } else {
+        start_session(line, command, false);
+    }
+
+    cmd_queue_entry_t *entry = &queue[queue_head & CMD_QUEUE_MASK];
+    strncpy(entry->line, line, sizeof(entry->line) - 1);
+    entry->line[sizeof(entry->line) - 1] = '\0';
+    entry->command = entry->line + (command - line);
+    entry->seq = seq;
+    entry->epoch = session_epoch;
+    entry->sequenced = sequenced;
+    entry->transport = transport;
+    entry->slotted = slotted;
+    entry->received_us = hal_time_us_64();
+    queue_head++;
+    telemetry_state.rx_queue_depth = (uint8_t)(queue_head - queue_tail);
+    hal_send_event();   // wakes the main loop
+
+    if (sequenced) {
+        queue_stats.accepted++;
+        send_response(transport, slotted, seq, NULL);
+    }
+    return true;
+}
+
+bool __time_critical_func(cmd_queue_receive)(const char *line, transport_id_t transport) {
+    uint32_t irq_status = hal_spin_lock_blocking(queue_lock);
+    bool queued = receive_locked(line, transport);
+    hal_spin_unlock(queue_lock, irq_status);
+    return queued;
+}
+
+cmd_queue_entry_t *cmd_queue_peek(void) {
+    return queue_tail != queue_head ? &queue[queue_tail & CMD_QUEUE_MASK] : NULL;
+}
+
+void cmd_queue_begin(cmd_queue_entry_t *entry) {
+    if (entry == NULL || !entry->sequenced) return;
+    cache_filling = &cache[cache_next];
+    cache_next = (cache_next + 1) % CMD_CACHE_ENTRIES;
+    cache_filling->valid = false;
+    cache_filling->seq = entry->seq;
+    cache_filling->epoch = entry->epoch;
+    cache_filling->line_crc = calculate_crc(entry->line, strlen(entry->line));
+    transport_capture_begin(cache_filling->response, CMD_CACHE_RESPONSE_SIZE - CMD_QUEUE_RESPONSE_SIZE);
+}
+
+void cmd_queue_complete(cmd_queue_entry_t *entry, int status) {
+    if (entry == NULL || entry != cmd_queue_peek()) return;
+    char response[CMD_QUEUE_RESPONSE_SIZE];
+    int len = 0;
+    if (entry->sequenced) {
+        bool overflow = false;
+        size_t captured = cache_filling != NULL ? transport_capture_end(&overflow) : 0;
+        len = snprintf(response, sizeof(response), "cp_%lu_%d\n", (unsigned long)entry->seq, status);
+
+        // the completion is always cached, acknowledgements too long for the entry are left out
+        if (cache_filling != NULL) {
+            if (overflow) captured = 0;
+            memcpy(cache_filling->response + captured, response, (size_t)len);
+            cache_filling->length = (uint16_t)(captured + (size_t)len);
+            cache_filling->valid = true;
+            cache_filling = NULL;
+        }
+    }
+    TRACE_POINT(TRACE_COMMAND_DONE, queue_tail);
+    queue_tail++;
+    telemetry_state.rx_queue_depth = (uint8_t)(queue_head - queue_tail);
+
+    // the entry is free before the host sees the completion, the command it sends next finds room
+    if (len > 0) transport_respond((const uint8_t *)response, (size_t)len);
+}
+
+uint32_t cmd_queue_depth(void) {
+    return queue_head - queue_tail;
+}
+
+void cmd_queue_get_stats(cmd_queue_stats_t *stats) {
+    *stats = queue_stats;
+}
+
+int cmd_queue_session_command(const char *ptr_data_str) {
+    char line[CMD_QUEUE_RESPONSE_SIZE];
+    int len = snprintf(line, sizeof(line), "sn_%lu\n", (unsigned long)session_id);
+    transport_respond((const uint8_t *)line, (size_t)len);
+    return SUCCESS_INT;
+}
+
+/*** end of file ***/
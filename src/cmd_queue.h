@@ -0,0 +1,112 @@
+/** @file cmd_queue.h
+*
+* @brief Queue of the received command lines between the transports and the main loop. A line
+*        "@<seq>:<command>,<crc>#" carries a sequence ID: it is checked on receipt and answered at once with
+*        "ac_<seq>" or "rj_<seq>_<crc|cmd|full>", and "cp_<seq>_<status>" follows the acknowledgements of the
+*        command once it has executed. Up to CMD_QUEUE_DEPTH commands are in flight. A retry of a sequenced
+*        command is never executed twice: while it is queued it is only accepted again, once completed its
+*        cached acknowledgements and completion are replayed. Lines without a sequence ID are queued the
+*        same way and answered as before. Every response goes back on the transport the line arrived on.
+*        A host announces itself with "SN,<session>" when it connects. A new session ID starts a new epoch
+*        as soon as the line is received: queued and cached commands of earlier sessions no longer match
+*        retries, so a restarted host that numbers its commands from the same sequence ID again gets them
+*        executed instead of replayed.
+*        A line may start with a multi-drop address prefix, see multidrop.h. Broadcast and group lines get no
+*        ACCEPTED or REJECTED response, their responses are held for the slot of the node.
+*
+*/
+
+#ifndef _CMD_QUEUE_H
+#define _CMD_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "transport.h"
+
+#define CMD_QUEUE_DEPTH 8                   // power of two
+#define CMD_SEQ_PREFIX '@'
+#define CMD_SEQ_SEPARATOR ':'
+#define CMD_QUEUE_RESPONSE_SIZE 32
+
+// Recent responses replayed to retries
+#define CMD_CACHE_ENTRIES 8
+#define CMD_CACHE_RESPONSE_SIZE 160
+
+// Queued command line
+typedef struct {
+    char line[UART_RX_BUFFER_SIZE];
+    const char *command;        // the command within line, past the sequence ID
+    uint32_t seq;
+    uint32_t epoch;             // host session the line arrived in
+    bool sequenced;             // accepted with a sequence ID, CRC already checked
+    transport_id_t transport;   // where the line came from and the responses go
+    bool slotted;               // broadcast or group line, answered in the response slot
+    uint64_t received_us;       // anchor of the response slots
+} cmd_queue_entry_t;
+
+// Receive counters
+typedef struct {
+    uint32_t accepted;
+    uint32_t rejected;
+    uint32_t dropped;           // lines without a sequence ID lost to a full queue
+    uint32_t replayed;          // retries answered from the response cache
+} cmd_queue_stats_t;
+
+/**
+ * @brief Initialises the queue, called before any transport receives
+ *
+ */
+void cmd_queue_init(void);
+
+/**
+ * @brief Queues a complete command line, called by the line assembly of a transport from interrupt or core 1
+ *        context. A sequenced line is checked and answered with its ACCEPTED or REJECTED response before this
+ *        returns
+ * @param line      - command line without the line feed
+ * @param transport - transport the line arrived on
+ * @return true if the line is queued
+ */
+bool cmd_queue_receive(const char *line, transport_id_t transport);
+
+/**
+ * @brief Returns the oldest queued command, it stays queued until cmd_queue_complete()
+ * @return the entry, NULL if the queue is empty
+ */
+cmd_queue_entry_t *cmd_queue_peek(void);
+
+/**
+ * @brief Starts keeping the acknowledgements of a sequenced command for retries, called before it executes
+ * @param entry - entry returned by cmd_queue_peek()
+ */
+void cmd_queue_begin(cmd_queue_entry_t *entry);
+
+/**
+ * @brief Sends the COMPLETED response of a sequenced command and frees its entry
+ * @param entry  - entry returned by cmd_queue_peek()
+ * @param status - result of the command
+ */
+void cmd_queue_complete(cmd_queue_entry_t *entry, int status);
+
+/**
+ * @brief Returns the number of queued commands
+ *
+ */
+uint32_t cmd_queue_depth(void);
+
+/**
+ * @brief Reads the receive counters
+ * @param stats - filled with a copy of the counters
+ */
+void cmd_queue_get_stats(cmd_queue_stats_t *stats);
+
+/**
+ * @brief SN command: "SN,<session>" announces a host session, the session started when the line was received.
+ *        "SN" and "SN,<session>" reply "sn_<session>" with the current session, 0 before any host announced one
+ * @param ptr_data_str
+ * @return SUCCESS_INT
+ */
+int cmd_queue_session_command(const char *ptr_data_str);
+
+#endif /* _CMD_QUEUE_H */
+
+/*** end of file ***/
@@ -0,0 +1,92 @@
+/**
+ * @file cmd_stats.c
+ * @brief Per command latency histograms Implementation
+ * @author Yashas Nagaraj Udupa 
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cmd_stats.h"
+#include "transport.h"
+
+#define CMD_STATS_LINE_SIZE 400
+
+static cmd_histogram_t cmd_histograms[NUM_OF_UART_FUNCS];
+
+// Private helper returning the log2 bucket of a value, count leading zeros is a ROM routine on the M0+
+static inline uint32_t log2_bucket(uint32_t value, uint32_t num_buckets) {
+    uint32_t bucket = value ? 32u - (uint32_t)__builtin_clz(value) : 0u;
+    return bucket < num_buckets ? bucket : num_buckets - 1;
+}
+
+void cmd_stats_record(enum DesiredFunc func, uint32_t duration_us, uint32_t corrections) {
+    if ((unsigned)func >= NUM_OF_UART_FUNCS) return;
+    cmd_histogram_t *histogram = &cmd_histograms[func];
+
+    if (histogram->count == 0 || duration_us < histogram->time_min_us) histogram->time_min_us = duration_us;
+    if (duration_us > histogram->time_max_us) histogram->time_max_us = duration_us;
+    if (corrections > histogram->corrections_max) histogram->corrections_max = corrections;
+    histogram->count++;
+    histogram->time_sum_us += duration_us;
+    histogram->corrections_sum += corrections;
+    histogram->time_buckets[log2_bucket(duration_us, CMD_STATS_TIME_BUCKETS)]++;
+    histogram->correction_buckets[log2_bucket(corrections, CMD_STATS_CORRECTION_BUCKETS)]++;
+}
+
+bool cmd_stats_get(enum DesiredFunc func, cmd_histogram_t *histogram) {
+    if ((unsigned)func >= NUM_OF_UART_FUNCS || histogram == NULL) return false;
+    *histogram = cmd_histograms[func];
+    return true;
+}
+
+void cmd_stats_reset(void) {
+    memset(cmd_histograms, 0, sizeof(cmd_histograms));
+}
+
+// Private helper to append the non empty prefix of a bucket array
+static size_t format_buckets(char *buffer, size_t size, const uint32_t *buckets, uint32_t num_buckets) {
+    uint32_t used = num_buckets;
+    while (used > 1 && buckets[used - 1] == 0) used--;
+
+    size_t len = 0;
+    for (uint32_t i = 0; i < used && len < size; i++) {
+        len += (size_t)snprintf(buffer + len, size - len, i ? ",%lu" : "%lu", (unsigned long)buckets[i]);
+    }
+    return len;
+}
+
+int cmd_stats_command(const char *ptr_data_str) {
+    char line[CMD_STATS_LINE_SIZE];
+    int reported = 0;
+
+    for (int func = 0; func < NUM_OF_UART_FUNCS; func++) {
+        const cmd_histogram_t *histogram = &cmd_histograms[func];
+        if (histogram->count == 0) continue;
+
+        const char *name = get_desired_func_name((enum DesiredFunc)func);
+        size_t len = (size_t)snprintf(line, sizeof(line), "cs_%.*s_%lu_%lu_%lu_%lu_%lu_%lu_t:", (int)strcspn(name, "\n"), name,
+                                      (unsigned long)histogram->count, (unsigned long)histogram->time_min_us,
+                                      (unsigned long)(histogram->time_sum_us / histogram->count), (unsigned long)histogram->time_max_us,
+                                      (unsigned long)(histogram->corrections_sum / histogram->count), (unsigned long)histogram->corrections_max);
+        if (len < sizeof(line)) len += format_buckets(line + len, sizeof(line) - len, histogram->time_buckets, CMD_STATS_TIME_BUCKETS);
+        if (len < sizeof(line)) len += (size_t)snprintf(line + len, sizeof(line) - len, "_c:");
+        if (len < sizeof(line)) len += format_buckets(line + len, sizeof(line) - len, histogram->correction_buckets, CMD_STATS_CORRECTION_BUCKETS);
+        if (len < sizeof(line)) len += (size_t)snprintf(line + len, sizeof(line) - len, "\n");
+        if (len >= sizeof(line)) len = sizeof(line) - 1;
+
+        transport_respond((const uint8_t *)line, len);
+        reported++;
+    }
+    const char *end = "cs_end\n";
+    transport_respond((const uint8_t *)end, strlen(end));
+    return reported;
+}
+
+int cmd_stats_reset_command(const char *ptr_data_str) {
+    const char *ack = "sr_1\n";
+    cmd_stats_reset();
+    transport_respond((const uint8_t *)ack, strlen(ack));
+    return 1;
+}
+
+/*** end of file ***/
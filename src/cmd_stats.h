@@ -0,0 +1,68 @@
+/** @file cmd_stats.h
+*
+* @brief This module keeps per command execution time and encoder correction histograms.
+*
+*/
+
+#ifndef _CMD_STATS_H
+#define _CMD_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "gpio_control.h"
+
+// log2 buckets, bucket n counts values in [2^(n-1), 2^n), bucket 0 counts zero
+#define CMD_STATS_TIME_BUCKETS 24          // up to 2^23 us, about 8.4 s, last bucket is open ended
+#define CMD_STATS_CORRECTION_BUCKETS 8
+
+// Histogram of one command, mean is derived from sum when reported
+typedef struct {
+    uint32_t count;
+    uint32_t time_min_us;
+    uint32_t time_max_us;
+    uint64_t time_sum_us;
+    uint32_t corrections_max;
+    uint32_t corrections_sum;
+    uint32_t time_buckets[CMD_STATS_TIME_BUCKETS];
+    uint32_t correction_buckets[CMD_STATS_CORRECTION_BUCKETS];
+} cmd_histogram_t;
+
+/**
+ * @brief Records one executed command, O(1) and free of division
+ * @param func        - executed command
+ * @param duration_us - total execution time
+ * @param corrections - encoder correction passes of the command
+ */
+void cmd_stats_record(enum DesiredFunc func, uint32_t duration_us, uint32_t corrections);
+
+/**
+ * @brief Reads the histogram of a command
+ * @param func      - command
+ * @param histogram - filled with a copy of the histogram
+ * @return true if func is valid
+ */
+bool cmd_stats_get(enum DesiredFunc func, cmd_histogram_t *histogram);
+
+/**
+ * @brief Clears all histograms
+ *
+ */
+void cmd_stats_reset(void);
+
+/**
+ * @brief Stats command handler, "SS" replies one line per executed command
+ *        "cs_<cmd>_<count>_<min_us>_<mean_us>_<max_us>_<mean_corr>_<max_corr>_t:<buckets>_c:<buckets>"
+ *        followed by "cs_end", trailing empty buckets are omitted
+ * @param ptr_data_str
+ */
+int cmd_stats_command(const char *ptr_data_str);
+
+/**
+ * @brief Stats reset command handler, "SR" clears the histograms and replies "sr_1"
+ * @param ptr_data_str
+ */
+int cmd_stats_reset_command(const char *ptr_data_str);
+
+#endif /* _CMD_STATS_H */
+
+/*** end of file ***/
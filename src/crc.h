@@ -9,17 +9,9 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdlib.h>
-
-// Define or undefine this macro to enable or disable debug prints
-#define DEBUG_PRINT_ENABLED 0
-
-// Debug print macro
-#if DEBUG_PRINT_ENABLED
-    #define DEBUG_PRINT(fmt, ...) printf(fmt, ##__VA_ARGS__)
-#else
-    #define DEBUG_PRINT(fmt, ...) do {} while(0)
-#endif
+#include "debug_print.h"
 
 // Macro for CRC Enable/Disable
 #define CRC_ENABLE              1  // 1=Enable, 0=Disable
@@ -42,7 +34,7 @@
  * @param length - length of string
  * @return uint32_t - calculated CRC
  */
-uint32_t calculate_crc(char *string, uint64_t length);
+uint32_t calculate_crc(const char *string, uint64_t length);
 
 /**
  * @brief This function calculates crc from the string and compares it with crc recieved from string
@@ -57,6 +49,6 @@ uint32_t calculate_crc(char *string, uint64_t length);
  * @return CRC_FAIL failure
  * @return CRC_OK success
  */
-bool check_crc(char *string);
+bool check_crc(const char *string);
 
 #endif // CRC_H
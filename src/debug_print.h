@@ -0,0 +1,24 @@
+/**
+ * @file debug_print.h
+ * @brief This file contains the debug print macro shared by all modules
+ * 
+ */
+
+#ifndef DEBUG_PRINT_H
+#define DEBUG_PRINT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// Define or undefine this macro to enable or disable debug prints
+#define DEBUG_PRINT_ENABLED 0  // Use 0 or 1 for easier toggling
+
+// Debug print macro, stdio is the USB CDC interface and it stays quiet while a host sends commands on it
+#if DEBUG_PRINT_ENABLED
+    bool transport_usb_commands(void);
+    #define DEBUG_PRINT(fmt, ...) do { if (!transport_usb_commands()) printf(fmt, ##__VA_ARGS__); } while (0)
+#else
+    #define DEBUG_PRINT(fmt, ...) do {} while(0)  // More efficient than ((void)0)
+#endif
+
+#endif // DEBUG_PRINT_H
@@ -4,29 +4,40 @@
  * @author Yashas Nagaraj Udupa
  */
 
-#include "DRV8825.h"
+#include <stdio.h>
+#include "drv8825.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "valve_route.h"
+#include "valve_cal.h"
+#include "speed_tune.h"
+#include "encoder_interp.h"
+#include "encoder_adc.h"
+#include "camera_trigger.h"
+#include "move_eta.h"
+#include "transport.h"
 
 // Constants
 #define BASE_10 10
 #define TWO_BYTES 2
 #define THREE_BYTES 3
 #define FOUR_BYTES 4
-#define FIFTEEN_BYTES 15
 #define HUNDRED_BYTES 100
 #define SIX_BYTES 6
 #define FIVE_BYTES 5
 #define THIRTY_DEGREES 30
+#define ONE_SECOND_US 1000000
 
 // Data structures
-VALVE_DICT valve_coordinates[5] = {
-    {"V1", {-81}}, // Buffer reservoir
-    {"V2", {0}},   // Mixing/Home
-    {"V3", {-46}}, // Drain
-    {"V4", {72}},  // Metering
-    {"V5", {-119}} // Dab
+VALVE_DICT valve_coordinates[NUM_OF_VALVES] = {
+    {"V1", -81}, // Buffer reservoir
+    {"V2", 0},   // Mixing/Home
+    {"V3", -46}, // Drain
+    {"V4", 72},  // Metering
+    {"V5", -119} // Dab
 };
 
-STEPTYPE_DICT steptype_dict[6] = {
+STEPTYPE_DICT steptype_dict[NUM_OF_STEPTYPES] = {
     {"01", {0, 0, 0, 1}}, // 1 Microstepping, Transition table
     {"02", {1, 0, 0, 2}}, // 1/2 Microstepping, Transition table
     {"04", {0, 1, 0, 4}}, // 1/4 Microstepping, Transition table
@@ -35,120 +46,377 @@ STEPTYPE_DICT steptype_dict[6] = {
     {"32", {1, 0, 1, 32}}  // 1/32 Microstepping, Transition table
 };
 
-// Struct to encapsulate motor and encoder data
-typedef struct {
-    uint16_t actual_encoder_value;
-    uint16_t previous_encoder_value;
-    int current_valve_position;
-    int previous_valve_position;
-    uint16_t expected_encoder_value;
-    uint8_t no_of_pulse;
-    float encoder_resolution;
-} MotorEncoderData;
-
 // Static for module scope
-static MotorEncoderData motor_data = {0, 0, 0, 0, 0, 0, 0.5};
+static MotorEncoderData motor_data = {
+    .encoder_resolution = Q16_FROM_RATIO(ENCODER_NO_OF_PULSES + 1, DEGREE_FULL_ANGLE),
+    .compensation_steps = 0,
+    .reference_steps = 0,
+};
+
+// Driver fault state, written by the nFAULT ISR
+static atomic_bool motor_fault_flag = false;
+static volatile motor_fault_event_t motor_fault_event = {0, 0, false};
+
+// Recursive correction passes of the current valve move
+static uint32_t correction_count = 0;
+
+// Work run in the low half of the steps of one core, see motor_set_step_idle()
+static void (*volatile step_idle)(void) = NULL;
+static uint step_idle_core = 0;
+static uint32_t step_idle_period_us = 0;
+static uint64_t step_idle_last_us = 0;
+
+// First encoder entry of the acknowledgement, reset at the start of every valve move
+static bool ack_first_call = true;
+
+// Direction of the last valve rotation, the route planner charges a reversal against it
+static char last_move_direction = 0;
+
+// Encoder error of the first pass of the last valve move, actual - expected pulses
+static int16_t first_pass_error = 0;
 
-static int rotate_handler(char direction, char *steptype, uint16_t angle, uint16_t rpm, MotorEncoderData *data) {
+// DRV8825 indexer position in 1/32 microsteps since the driver reset, 0 is the home state (45 degrees electrical)
+static int32_t indexer_phase = 0;
+
+// Absolute rotor position in 1/32 microsteps, V2 is 0 and CW positive, kept within half a revolution.
+// Counted from the STEP pulses and re-referenced whenever the encoder index passes
+static volatile int32_t rotor_position = 0;
+static int32_t index_centre = 0;                // index centre relative to V2, measured by homing
+static atomic_bool position_referenced = false;
+static uint32_t index_references = 0;
+static volatile char motion_direction = 0;
+
+// ENC_CH2 edges flagged by motor_index_isr(), the stepping loop gives them the position of the last step
+static atomic_uint index_edges = 0;
+static int32_t index_enter_position = 0;
+static char index_enter_direction = 0;
+static int32_t homing_centre = 0;
+static bool homing_centre_valid = false;
+static uint32_t homing_duration_us = 0;         // last homing, stands for the next one in predictions
+
+// Private method to set step resolution
+static int resolution(const char *steptype);
+
+int motor_plan_steps(char direction, const char *steptype, uint16_t angle, uint16_t rpm, q16_16_t encoder_resolution, motor_step_plan_t *plan) {
     uint8_t index = 0;
-    while (index < SIX_BYTES && strcmp(steptype, steptype_dict[index].micro_steps) != 0) {
+    while (index < NUM_OF_STEPTYPES && strcmp(steptype, steptype_dict[index].micro_steps) != 0) {
         index++;
     }
-    if (index == SIX_BYTES) return RESOLUTION_ERROR;
+    if (index == NUM_OF_STEPTYPES) return RESOLUTION_ERROR;
+    plan->steptype_index = index;
 
-    data->expected_encoder_value = (uint16_t)(data->encoder_resolution * angle);
-    if (data->expected_encoder_value > ENCODER_NO_OF_PULSES) return EXP_IS_INVALID;
+    plan->expected_encoder_value = sat_u16(q16_mul_int(encoder_resolution, angle));
+    if (plan->expected_encoder_value > ENCODER_NO_OF_PULSES) return EXP_IS_INVALID;
     if (angle > ANGLE_MAX) return ANGLE_IS_INVALID;
 
-    uint32_t steps = (STEPS_PER_ROTATION * steptype_dict[index].step_factor[3] * angle) / DEGREE_FULL_ANGLE;
-    resolution(steptype);
-    gpio_put(M1_DIR, direction == DIR_CW ? HIGH : LOW);
-
+    plan->steps = (STEPS_PER_ROTATION * steptype_dict[index].step_factor[3] * angle) / DEGREE_FULL_ANGLE;
     if (rpm == 0 || rpm > RPM_MAX) return RPM_IS_INVALID;
-    uint32_t stepdelay = PICO_MAX(1, (STEPPER_RESOLUTION / rpm));
-    
-    gpio_put(M1_ENABLE, LOW);
+    plan->step_delay_us = PICO_MAX(1, (STEPPER_RESOLUTION / rpm));
+
+    // telemetry position is kept in 1/32 microsteps so it stays valid across step modes
+    plan->step_increment = FINEST_MICROSTEP / steptype_dict[index].step_factor[3];
+    if (direction != DIR_CW) plan->step_increment = -plan->step_increment;
+    return SUCCESS_INT;
+}
+
+// Private function returning the steptype_dict entry of a step type
+static int steptype_index_of(const char *steptype) {
+    for (int i = 0; i < NUM_OF_STEPTYPES; i++) {
+        if (strcmp(steptype, steptype_dict[i].micro_steps) == 0) return i;
+    }
+    return RESOLUTION_ERROR;
+}
+
+// Private helper wrapping a rotor position into (-MICROSTEPS_PER_REV / 2, MICROSTEPS_PER_REV / 2]
+static int32_t wrap_rotor_position(int32_t position) {
+    position %= MICROSTEPS_PER_REV;
+    if (position > MICROSTEPS_PER_REV / 2) position -= MICROSTEPS_PER_REV;
+    if (position <= -MICROSTEPS_PER_REV / 2) position += MICROSTEPS_PER_REV;
+    return position;
+}
+
+static int32_t steps_to_pulses(int32_t steps) {
+    return encoder_interp_steps_to_pulses(steps, motor_data.encoder_resolution) / Q16_ONE;
+}
+
+// Private helper, the inverse of encoder_interp_steps_to_pulses() rounded to 1/32 microsteps
+static int32_t pulses_to_steps(q16_16_t pulses) {
+    int64_t denominator = (int64_t)DEGREE_FULL_ANGLE * motor_data.encoder_resolution;
+    return sat_i32(((int64_t)pulses * MICROSTEPS_PER_REV + denominator / 2) / denominator);
+}
+
+static int32_t pulses_rounded(q16_16_t pulses) {
+    return (pulses + (pulses < 0 ? -Q16_ONE / 2 : Q16_ONE / 2)) / Q16_ONE;
+}
+
+// Private helper, Q16.16 encoder pulses in tenths for the acknowledgement
+static int32_t pulse_tenths(q16_16_t pulses) {
+    return (int32_t)(((int64_t)pulses * 10 + Q16_ONE / 2) >> Q16_FRACTION_BITS);
+}
+
+// Private function turning the flagged index edges into an index pass. A pass entered and left in one
+// direction gives the index centre: during homing it is kept as the reference, afterwards the drift of
+// the step count against it is removed from the rotor position. An implausible drift drops the reference
+static void apply_index_edges(void) {
+    unsigned edges = atomic_exchange(&index_edges, 0);
+    if (edges & INDEX_EDGE_ENTER) {
+        index_enter_position = rotor_position;
+        index_enter_direction = motion_direction;
+    }
+    if (!(edges & INDEX_EDGE_EXIT)) return;
+    bool valid = index_enter_direction != 0 && index_enter_direction == motion_direction;
+    index_enter_direction = 0;
+    if (!valid) return;
+
+    int32_t centre = wrap_rotor_position(index_enter_position + wrap_rotor_position(rotor_position - index_enter_position) / 2);
+    if (!atomic_load(&position_referenced)) {
+        homing_centre = centre;
+        homing_centre_valid = true;
+        return;
+    }
+    int32_t drift = wrap_rotor_position(centre - index_centre);
+    if (abs(drift) > INDEX_MAX_DRIFT_STEPS) {
+        atomic_store(&position_referenced, false);
+    } else if (abs(drift) > INDEX_DEADBAND_STEPS) {
+        rotor_position = wrap_rotor_position(rotor_position - drift);
+        index_references++;
+    }
+}
+
+// Private helper running the step idle work when it is due on this core, returns the microseconds it took
+// out of the low half of the step, at most all of it
+static uint32_t run_step_idle(uint32_t stepdelay) {
+    void (*idle)(void) = step_idle;
+    if (idle == NULL || hal_get_core_num() != step_idle_core) return 0;
+    uint64_t start_us = hal_time_us_64();
+    if (start_us - step_idle_last_us < step_idle_period_us) return 0;
+    idle();
+    step_idle_last_us = hal_time_us_64();
+    return (uint32_t)PICO_MIN(step_idle_last_us - start_us, stepdelay);
+}
+
+// Private function stepping one segment of a move in one microstep mode, the half period keeps the angular speed.
+// lead_in_us delays the first STEP so a coarser step does not follow the last finer one early
+static int step_segment(int steptype_index, uint32_t steps, uint32_t stepdelay, uint32_t lead_in_us, char direction) {
+    if (steps == 0) return ROTATION_COMPLETED;
+    resolution(steptype_dict[steptype_index].micro_steps);
+    if (lead_in_us) hal_sleep_us(lead_in_us);
+    apply_index_edges();
+    int32_t step_increment = FINEST_MICROSTEP / steptype_dict[steptype_index].step_factor[3];
+    if (direction != DIR_CW) step_increment = -step_increment;
+    telemetry_state.velocity = step_increment * (int32_t)(ONE_SECOND_US / (2 * stepdelay));
+
     for (uint32_t i = 0; i < steps; i++) {
-        gpio_put(M1_STEP, HIGH);
-        sleep_us(stepdelay); 
-        gpio_put(M1_STEP, LOW);
-        sleep_us(stepdelay); 
+        if (atomic_load(&motor_fault_flag)) return MOTOR_FAULT;
+        encoder_interp_step((uint32_t)abs(step_increment), 2 * stepdelay);
+        hal_gpio_put(M1_STEP, HIGH);
+        hal_sleep_us(stepdelay);
+        hal_gpio_put(M1_STEP, LOW);
+        telemetry_state.step_position += step_increment;
+        indexer_phase += step_increment;
+        rotor_position = wrap_rotor_position(rotor_position + step_increment);
+        hal_sleep_us(stepdelay - run_step_idle(stepdelay));
+        apply_index_edges();
     }
-    gpio_put(M1_ENABLE, HIGH);
     return ROTATION_COMPLETED;
 }
 
-static void concatenate_encoder(char *ptr_e, char *ptr_a, char direction, int first_call, MotorEncoderData *data) {
-    char encoder_temp[HUNDRED_BYTES];
+// Moves with microstep switching run as up to four segments: finest steps to the phase grid of the
+// coarsest mode used, CRUISE_STEPTYPE cruise, the requested mode for the last APPROACH_DEGREES and
+// finest steps for a remainder of the compensation
+static void plan_segments(const motor_step_plan_t *plan, char direction, uint32_t travel, bool switching, int32_t phase_position,
+                          move_segment_t segments[MOVE_SEGMENTS]) {
+    int fine = plan->steptype_index;
+    int finest = NUM_OF_STEPTYPES - 1;
+    uint32_t unit = FINEST_MICROSTEP / steptype_dict[fine].step_factor[3];
+
+    int coarse = fine;
+    int cruise = steptype_index_of(CRUISE_STEPTYPE);
+    uint32_t approach = APPROACH_DEGREES * STEPS_PER_ROTATION * FINEST_MICROSTEP / DEGREE_FULL_ANGLE;
+    uint32_t cruise_grid = FINEST_MICROSTEP / steptype_dict[cruise].step_factor[3];
+    if (switching && unit < cruise_grid && travel >= approach + (CRUISE_MIN_STEPS + 1) * cruise_grid) coarse = cruise;
+
+    // the DRV8825 indexer rounds to the grid of a coarser mode, switch modes only on grid positions
+    uint32_t grid = FINEST_MICROSTEP / steptype_dict[coarse].step_factor[3];
+    uint32_t phase = (uint32_t)(((phase_position % (int32_t)grid) + (int32_t)grid) % (int32_t)grid);
+    uint32_t align = direction == DIR_CW ? (grid - phase) % grid : phase;
+    if (align > travel) align = travel;
+    uint32_t coarse_steps = coarse != fine ? (travel - align - approach) / grid : 0;
+    uint32_t rest = travel - align - coarse_steps * grid;
+
+    segments[0] = (move_segment_t){finest, align, 0, 0};
+    segments[1] = (move_segment_t){coarse, coarse_steps, 0, 0};
+    segments[2] = (move_segment_t){fine, rest / unit, 0, 0};
+    segments[3] = (move_segment_t){finest, rest % unit, 0, 0};
+
+    // the step rate follows the mode, a slower segment settles for the difference before its first step
+    uint32_t previous_delay = 0;
+    for (int i = 0; i < MOVE_SEGMENTS; i++) {
+        if (segments[i].steps == 0) continue;
+        uint32_t mode_unit = FINEST_MICROSTEP / steptype_dict[segments[i].index].step_factor[3];
+        segments[i].stepdelay = PICO_MAX(1, plan->step_delay_us * mode_unit / unit);
+        segments[i].lead_in_us = previous_delay && segments[i].stepdelay > previous_delay ? 2 * (segments[i].stepdelay - previous_delay) : 0;
+        previous_delay = segments[i].stepdelay;
+    }
+}
+
+// Private helper returning the stepping time of planned segments
+static uint64_t segments_duration_us(const move_segment_t segments[MOVE_SEGMENTS]) {
+    uint64_t duration = 0;
+    for (int i = 0; i < MOVE_SEGMENTS; i++) duration += segments[i].lead_in_us + (uint64_t)segments[i].steps * 2 * segments[i].stepdelay;
+    return duration;
+}
+
+// Moves run the segments of plan_segments(). An index pass during the move that shows the rotor short of
+// the planned end adds the missing travel at the end. The encoder feedback of the move is the interpolated
+// estimate of encoder_interp
+static int rotate_handler(char direction, const char *steptype, uint16_t angle, uint16_t rpm, bool switching, MotorEncoderData *data) {
+    motor_step_plan_t plan;
+    int status = motor_plan_steps(direction, steptype, angle, rpm, data->encoder_resolution, &plan);
+    if (status == RESOLUTION_ERROR) return status;
+    data->expected_encoder_value = plan.expected_encoder_value;
+    if (status != SUCCESS_INT) return status;
+
+    hal_gpio_put(M1_DIR, direction == DIR_CW ? HIGH : LOW);
+    motion_direction = direction;
+    if (motor_fault_active() && !motor_fault_clear()) {
+        data->compensation_steps = data->reference_steps = 0;
+        return MOTOR_FAULT;
+    }
+
+    // travel in 1/32 microsteps: the calibrated compensation applies to one move only and the encoder target
+    // stays nominal, the reference correction is real travel the encoder sees
+    int fine = plan.steptype_index;
+    int finest = NUM_OF_STEPTYPES - 1;
+    uint32_t unit = FINEST_MICROSTEP / steptype_dict[fine].step_factor[3];
+    uint32_t travel = (uint32_t)PICO_MAX(0, (int32_t)(plan.steps * unit) + data->compensation_steps + data->reference_steps);
+    data->expected_encoder_value = sat_u16((int32_t)data->expected_encoder_value + steps_to_pulses(data->reference_steps));
+    data->expected_travel = encoder_interp_steps_to_pulses(PICO_MAX(0, (int32_t)(plan.steps * unit) + data->reference_steps), data->encoder_resolution);
+    data->compensation_steps = data->reference_steps = 0;
+    int32_t sign = direction == DIR_CW ? 1 : -1;
+    int32_t planned_end = wrap_rotor_position(rotor_position + sign * (int32_t)travel);
+
+    move_segment_t segments[MOVE_SEGMENTS];
+    plan_segments(&plan, direction, travel, switching, indexer_phase, segments);
+
+    hal_gpio_put(M1_ENABLE, LOW);
+    encoder_interp_start(data->encoder_resolution);
+    status = ROTATION_COMPLETED;
+    for (int i = 0; i < MOVE_SEGMENTS && status == ROTATION_COMPLETED; i++) {
+        status = step_segment(segments[i].index, segments[i].steps, segments[i].stepdelay, segments[i].lead_in_us, direction);
+    }
+
+    int32_t shortfall = sign * wrap_rotor_position(planned_end - rotor_position);
+    if (status == ROTATION_COMPLETED && switching && atomic_load(&position_referenced) && shortfall > 0) {
+        status = step_segment(finest, (uint32_t)shortfall, PICO_MAX(1, plan.step_delay_us / unit), 0, direction);
+        data->expected_encoder_value = sat_u16((int32_t)data->expected_encoder_value + steps_to_pulses(shortfall));
+        data->expected_travel = sat_add_i32(data->expected_travel, encoder_interp_steps_to_pulses(shortfall, data->encoder_resolution));
+    }
+    encoder_adc_poll();
+    data->estimated_travel = encoder_interp_travel();
+
+    // steps the encoder has seen the rotor miss take the rotor position back to the interpolated one
+    int32_t missed = (int32_t)encoder_interp_commanded() - pulses_to_steps(data->estimated_travel);
+    if (data->actual_encoder_value != 0 && abs(missed) > pulses_to_steps(ENCODER_INTERP_TOLERANCE)) {
+        rotor_position = wrap_rotor_position(rotor_position - sign * missed);
+    }
+    hal_gpio_put(M1_ENABLE, HIGH);
+    telemetry_state.velocity = 0;
+    return status;
+}
 
+void concatenate_encoder(char *ptr_e, char *ptr_a, char direction, bool first_call, const MotorEncoderData *data) {
     if (!ptr_e || !ptr_a || !data) return; // NULL check
 
+    int32_t expected = pulse_tenths(data->expected_travel);
+    int32_t actual = pulse_tenths(data->estimated_travel);
     if (first_call) {
-        snprintf(ptr_e, FIFTEEN_BYTES, "%d_%s", data->expected_encoder_value, direction == DIR_CCW ? "CCW" : "CW");
-        snprintf(ptr_a, FIFTEEN_BYTES, "%d_%s", data->actual_encoder_value, direction == DIR_CCW ? "CCW" : "CW");
+        snprintf(ptr_e, ACK_ENCODER_ENTRY_SIZE, "%ld.%ld_%s", (long)(expected / 10), (long)(expected % 10), direction == DIR_CCW ? "CCW" : "CW");
+        snprintf(ptr_a, ACK_ENCODER_ENTRY_SIZE, "%ld.%ld_%s", (long)(actual / 10), (long)(actual % 10), direction == DIR_CCW ? "CCW" : "CW");
     } else {
-        snprintf(ptr_a + strlen(ptr_a), FIFTEEN_BYTES - strlen(ptr_a), "_%d_%s", data->actual_encoder_value, direction == DIR_CCW ? "CCW" : "CW");
+        snprintf(ptr_a + strlen(ptr_a), ACK_ENCODER_ENTRY_SIZE - strlen(ptr_a), "_%ld.%ld_%s", (long)(actual / 10), (long)(actual % 10),
+                 direction == DIR_CCW ? "CCW" : "CW");
     }
 }
 
-int rotate_stepper_motor(char direction, char *steptype, char *ptr_e, char *ptr_a, uint16_t angle, uint16_t rpm) {
-    int status = rotate_handler(direction, steptype, angle, rpm, &motor_data);
+int rotate_stepper_motor(char direction, const char *steptype, char *ptr_e, char *ptr_a, uint16_t angle, uint16_t rpm) {
+    int status = rotate_handler(direction, steptype, angle, rpm, true, &motor_data);
     if (status != ROTATION_COMPLETED) return status;
 
-    static bool first_call = true;
-    concatenate_encoder(ptr_e, ptr_a, direction, first_call, &motor_data);
-    first_call = false; // Reset for next call
+    // the correction runs on the interpolated travel, a shortfall continues the move and an overshoot reverses it
+    q16_16_t travel_error = sat_sub_i32(motor_data.expected_travel, motor_data.estimated_travel);
+    if (ack_first_call) first_pass_error = (int16_t)pulses_rounded(-travel_error);
+    concatenate_encoder(ptr_e, ptr_a, direction, ack_first_call, &motor_data);
+    ack_first_call = false;
 
-    int16_t encoder_diff = (int16_t)motor_data.expected_encoder_value - (int16_t)motor_data.actual_encoder_value;
-    if (encoder_diff != 0 && motor_data.actual_encoder_value != 0) {
-        direction = (encoder_diff > 0 == (direction == DIR_CCW)) ? direction : (direction == DIR_CCW ? DIR_CW : DIR_CCW);
+    if (abs(travel_error) > ENCODER_INTERP_TOLERANCE && motor_data.actual_encoder_value != 0) {
+        if (travel_error < 0) direction = direction == DIR_CCW ? DIR_CW : DIR_CCW;
         motor_data.actual_encoder_value = 0;
-        return rotate_stepper_motor(direction, steptype, ptr_e, ptr_a, abs(encoder_diff) / motor_data.encoder_resolution, rpm);
+        motor_data.reference_steps = (int16_t)PICO_MIN(pulses_to_steps(abs(travel_error)), INT16_MAX);
+        correction_count++;
+        return rotate_stepper_motor(direction, steptype, ptr_e, ptr_a, 0, rpm);
     }
 
-    watchdog_update();
+    hal_watchdog_update();
     return ROTATION_COMPLETED;
 }
 
+int motor_rotate_open_loop(char direction, const char *steptype, uint16_t angle, uint16_t rpm, uint16_t *encoder_pulses) {
+    motor_data.actual_encoder_value = 0;
+    int status = rotate_handler(direction, steptype, angle, rpm, false, &motor_data);
+    if (encoder_pulses) *encoder_pulses = motor_data.actual_encoder_value;
+    motor_data.actual_encoder_value = 0;
+    return status;
+}
+
 // Method to home the stepper motor
 int home_stepper_motor(const char motor_direction) {
     uint32_t step_counter = 0;
-    if (gpio_get(ENC_CH2) == LOW) {
-        gpio_put(M1_ENABLE, HIGH);
+    atomic_store(&position_referenced, false);
+    homing_centre_valid = false;
+    if (hal_gpio_get(ENC_CH2) == LOW) {
+        hal_gpio_put(M1_ENABLE, HIGH);
         return ENCODER_HW_FAIL;
     }
 
     while (step_counter < MAX_COUNT) {
-        if (gpio_get(ENC_CH2) == LOW && gpio_get(ENC_CH1) == LOW && gpio_get(ENC_CH3) == LOW) {
+        if (hal_gpio_get(ENC_CH2) == LOW && hal_gpio_get(ENC_CH1) == LOW && hal_gpio_get(ENC_CH3) == LOW) {
             uint64_t start_time = get_time();
-            while (gpio_get(ENC_CH2) == LOW) {
-                rotate_handler(motor_direction, HOME_STEPTYPE, HOME_NO_OF_STEPS, HOME_RPM_INT, &motor_data);
+            while (hal_gpio_get(ENC_CH2) == LOW) {
+                if (rotate_handler(motor_direction, HOME_STEPTYPE, HOME_NO_OF_STEPS, HOME_RPM_INT, false, &motor_data) == MOTOR_FAULT) return MOTOR_FAULT;
             }
             uint64_t end_time = get_time() + (get_time() - start_time) / 2;
             while (get_time() < end_time) {
-                rotate_handler(motor_direction == DIR_CW ? DIR_CCW : DIR_CW, HOME_STEPTYPE, HOME_NO_OF_STEPS, HOME_RPM_INT, &motor_data);
+                if (rotate_handler(motor_direction == DIR_CW ? DIR_CCW : DIR_CW, HOME_STEPTYPE, HOME_NO_OF_STEPS, HOME_RPM_INT, false, &motor_data) == MOTOR_FAULT) return MOTOR_FAULT;
             }
             uint16_t expected_homing = (motor_data.actual_encoder_value + 6) % (ENCODER_NO_OF_PULSES + 1);
             while (expected_homing > motor_data.actual_encoder_value) {
-                rotate_handler(motor_direction, HOME_STEPTYPE, HOME_NO_OF_STEPS, HOME_RPM_INT, &motor_data);
+                if (rotate_handler(motor_direction, HOME_STEPTYPE, HOME_NO_OF_STEPS, HOME_RPM_INT, false, &motor_data) == MOTOR_FAULT) return MOTOR_FAULT;
             }
-            gpio_put(M1_ENABLE, HIGH);
+            hal_gpio_put(M1_ENABLE, HIGH);
             motor_data.previous_encoder_value = motor_data.actual_encoder_value;
+
+            // the homed position is V2, the index centre of the pass is kept relative to it
+            if (homing_centre_valid) {
+                index_centre = wrap_rotor_position(homing_centre - rotor_position);
+                rotor_position = 0;
+                atomic_store(&position_referenced, true);
+            }
             return HOMING_SUCCESSFUL;
         }
-        rotate_handler(motor_direction, HOME_STEPTYPE, HOME_NO_OF_STEPS, HOME_RPM_INT, &motor_data);
+        if (rotate_handler(motor_direction, HOME_STEPTYPE, HOME_NO_OF_STEPS, HOME_RPM_INT, false, &motor_data) == MOTOR_FAULT) return MOTOR_FAULT;
         step_counter++;
     }
     return MOTOR_HW_FAIL;
 }
 
 // Private method to set step resolution
-static int resolution(char *steptype) {
-    int mode_pins[] = {M1_MODE0, M1_MODE1, M1_MODE2};
-    for (int i = 0; i < SIX_BYTES; i++) {
+static int resolution(const char *steptype) {
+    const uint mode_pins[] = {M1_MODE0, M1_MODE1, M1_MODE2};
+    for (int i = 0; i < NUM_OF_STEPTYPES; i++) {
         if (strcmp(steptype, steptype_dict[i].micro_steps) == 0) {
             for (int j = 0; j < THREE_BYTES; j++) {
-                gpio_put(mode_pins[j], steptype_dict[i].step_factor[j]);
+                hal_gpio_put(mode_pins[j], steptype_dict[i].step_factor[j]);
             }
             return steptype_dict[i].step_factor[THREE_BYTES];  // microsteps per full step
         }
@@ -156,72 +424,281 @@ static int resolution(char *steptype) {
     return RESOLUTION_ERROR;
 }
 
-static void concatenate_acknowledgement(char *ack_buffer, int status, char *valve_ack, const char *ptr_e, const char *ptr_a) {
+void concatenate_acknowledgement(int status, char *valve_ack, const char *ptr_e, const char *ptr_a) {
     snprintf(valve_ack, HUNDRED_BYTES, "vf_%d_%s_%s\n", status, ptr_e, ptr_a);
 }
 
-// State machine to rotate the valve motor
-int state_rotate_valve(const char *data_str) {
-    watchdog_update();
-    int status;
-    char direction, steptype[THREE_BYTES], rpm[FOUR_BYTES];
-    char valve_ack[HUNDRED_BYTES] = "vf";
-    const char *valve_rotation_2 = "V2";
-
-    for (int i = 0; i < SIX_BYTES; i++) {
-        if (strncmp(data_str, valve_coordinates[i].valve_type, TWO_BYTES) == 0) {
-            motor_data.current_valve_position = valve_coordinates[i].valve_position - motor_data.current_valve_position;
-            break;
-        }
+// Private function finding the valve_coordinates entry of a valve angle, the home valve if there is none
+static int valve_index_of(int position) {
+    for (int i = 0; i < NUM_OF_VALVES; i++) {
+        if (valve_coordinates[i].valve_position == position) return i;
     }
-    direction = motor_data.current_valve_position < 0 ? DIR_CCW : DIR_CW;
-    strcpy(steptype, STEPTYPE);
-    strcpy(rpm, RPM);
+    return VALVE_HOME_INDEX;
+}
 
-    int rpm_int = atoi(rpm);
-    int angle_int = abs(motor_data.current_valve_position);
+// Private function planning the legs of a move from an angle, direction 0 lets the route planner choose
+static int plan_route(int16_t from_position, int16_t target_position, char forced_direction, valve_route_t *route) {
+    if (forced_direction == 0) return valve_route_plan(from_position, target_position, last_move_direction, route);
 
-    if (motor_data.previous_valve_position == valve_coordinates[0].valve_position && strncmp(data_str, "V3", TWO_BYTES) == 0) {
-        angle_int += (VALVE_RESISITANCE * DEGREE_FULL_ANGLE) / (STEPS_PER_ROTATION * steptype_dict[4].step_factor[3]);
+    int delta = target_position - from_position;
+    if (forced_direction == DIR_CCW) delta = -delta;
+    route->leg_count = 1;
+    route->legs[0].direction = forced_direction;
+    route->legs[0].angle = (uint16_t)(((delta % DEGREE_FULL_ANGLE) + DEGREE_FULL_ANGLE) % DEGREE_FULL_ANGLE);
+    return SUCCESS_INT;
+}
+
+// Private function homing on the encoder index, the approach ends clockwise like the boot homing
+static int home_valve(char direction, int from_index) {
+    TRACE_POINT(TRACE_MOTION_START, THIRTY_DEGREES);
+    uint64_t start_us = get_time();
+    int status = home_stepper_motor(direction);
+    if (direction == DIR_CCW || from_index == VALVE_HOME_INDEX) {
+        status = rotate_handler(DIR_CCW, HOME_STEPTYPE, THIRTY_DEGREES, HOME_RPM_INT, true, &motor_data);
+        status = home_stepper_motor(DIR_CW);
     }
+    last_move_direction = DIR_CW;
+    motor_data.previous_valve_position = motor_data.current_valve_position = valve_coordinates[VALVE_HOME_INDEX].valve_position;
+    motor_data.actual_encoder_value = 0;
+    if (status == HOMING_SUCCESSFUL) homing_duration_us = (uint32_t)PICO_MIN(get_time() - start_us, UINT32_MAX);
+    TRACE_POINT(TRACE_MOTION_END, status);
+    return status;
+}
 
-    if (gpio_get(ENC_CH1) == HIGH) {
+// Private function returning the 1/32 microsteps the last leg of a route needs on top of its nominal steps
+// so the rotor lands on the target in the index referenced model: the part of a degree the rotor is off
+// its nominal angle, step count truncation and any drift the index has revealed
+static int16_t reference_correction(const valve_route_t *route, int16_t target_position, uint16_t rpm) {
+    int32_t end = rotor_position;
+    for (uint8_t leg = 0; leg < route->leg_count; leg++) {
+        motor_step_plan_t plan;
+        if (motor_plan_steps(route->legs[leg].direction, STEPTYPE, route->legs[leg].angle, rpm, motor_data.encoder_resolution, &plan) != SUCCESS_INT) return 0;
+        end += plan.steps * (FINEST_MICROSTEP / steptype_dict[plan.steptype_index].step_factor[3]) * (route->legs[leg].direction == DIR_CW ? 1 : -1);
+    }
+    int32_t target = ((int32_t)target_position * MICROSTEPS_PER_REV + (target_position < 0 ? -1 : 1) * DEGREE_FULL_ANGLE / 2) / DEGREE_FULL_ANGLE;
+    int32_t correction = wrap_rotor_position(target - end);
+    if (route->legs[route->leg_count - 1].direction != DIR_CW) correction = -correction;
+    return abs(correction) > INDEX_MAX_DRIFT_STEPS ? 0 : (int16_t)correction;
+}
+
+// Private function moving the valve to a port, direction 0 lets the route planner choose. Adaptive moves
+// run at the tuned speed of the transition and report back to the tuner. Moves start from the index
+// referenced rotor position, the valve is homed only while the reference is lost
+static int move_to_valve(int target_index, char forced_direction, bool adaptive, char *ptr_e, char *ptr_a) {
+    int status = ROTATION_COMPLETED;
+    int from_index = valve_index_of(motor_data.previous_valve_position);
+    int16_t target_position = valve_coordinates[target_index].valve_position;
+    valve_route_t route;
+
+    correction_count = 0;
+    ack_first_call = true;
+    first_pass_error = 0;
+
+    if (hal_gpio_get(ENC_CH1) == HIGH) {
         motor_data.no_of_pulse += 1;
     }
 
-    char expected_valve_char[FIFTEEN_BYTES] = "";
-    char actual_valve_char[FIFTEEN_BYTES] = "";
+    if (!atomic_load(&position_referenced)) {
+        status = plan_route(motor_data.previous_valve_position, valve_coordinates[VALVE_HOME_INDEX].valve_position, target_index == VALVE_HOME_INDEX ? forced_direction : 0, &route);
+        if (status != SUCCESS_INT) return status;
+        status = home_valve(route.legs[0].direction, from_index);
+        if (target_index == VALVE_HOME_INDEX || status != HOMING_SUCCESSFUL) return status;
+        from_index = VALVE_HOME_INDEX;
+    }
 
-    if (strncmp(data_str, valve_rotation_2, TWO_BYTES) == 0) {
-        status = home_stepper_motor(direction);
-        angle_int = THIRTY_DEGREES;
-        if (direction == DIR_CCW || motor_data.previous_valve_position == valve_coordinates[1].valve_position) {
-            status = rotate_handler(DIR_CCW, HOME_STEPTYPE, angle_int, HOME_RPM_INT, &motor_data);
-            status = home_stepper_motor(DIR_CW);
+    bool tuned = adaptive;
+    int rpm_int = tuned ? speed_tune_rpm(from_index, target_index) : atoi(RPM);
+    int16_t from_position = (int16_t)((rotor_position * DEGREE_FULL_ANGLE + (rotor_position < 0 ? -1 : 1) * MICROSTEPS_PER_REV / 2) / MICROSTEPS_PER_REV);
+    status = plan_route(from_position, target_position, forced_direction, &route);
+    if (status != SUCCESS_INT) return status;
+
+    status = ROTATION_COMPLETED;
+    for (uint8_t leg = 0; leg < route.leg_count; leg++) {
+        uint16_t angle = route.legs[leg].angle;
+        // the calibrated lost motion of this transition and the referenced position are taken up by the last leg
+        if (leg == route.leg_count - 1) {
+            motor_data.reference_steps = reference_correction(&route, target_position, (uint16_t)rpm_int);
+            if (angle != 0) motor_data.compensation_steps = valve_cal_compensation(from_index, target_index, route.legs[leg].direction);
         }
-    } else {
-        status = rotate_stepper_motor(direction, steptype, expected_valve_char, actual_valve_char, angle_int, rpm_int);
+        TRACE_POINT(TRACE_MOTION_START, angle);
+        status = rotate_stepper_motor(route.legs[leg].direction, STEPTYPE, ptr_e, ptr_a, angle, rpm_int);
+        TRACE_POINT(TRACE_MOTION_END, status);
+        if (angle != 0) last_move_direction = route.legs[leg].direction;
+        if (status != ROTATION_COMPLETED) break;
     }
 
-    for (int i = 0; i < FIVE_BYTES; i++) {
-        if (strncmp(data_str, valve_coordinates[i].valve_type, TWO_BYTES) == 0) {
-            motor_data.previous_valve_position = motor_data.current_valve_position = valve_coordinates[i].valve_position;
+    if (tuned) speed_tune_record(from_index, target_index, status, correction_count, first_pass_error);
+    if (status != ROTATION_COMPLETED) atomic_store(&position_referenced, false);
+
+    motor_data.previous_valve_position = motor_data.current_valve_position = target_position;
+    motor_data.actual_encoder_value = 0;
+    return status;
+}
+
+// Private function returning the valve_coordinates entry of a valve command, -1 if it is none
+static int valve_command_index(const char *data_str) {
+    for (int i = 0; i < NUM_OF_VALVES; i++) {
+        if (strncmp(data_str, valve_coordinates[i].valve_type, TWO_BYTES) == 0) return i;
+    }
+    return -1;
+}
+
+// The prediction replays the planning of move_to_valve() and rotate_handler() on copies of the rotor and
+// indexer positions, the homing time is the one measured last
+uint32_t motor_predict_move_us(const char *data_str) {
+    int target_index = valve_command_index(data_str);
+    if (target_index < 0) return 0;
+
+    int from_index = valve_index_of(motor_data.previous_valve_position);
+    int16_t target_position = valve_coordinates[target_index].valve_position;
+    int32_t position = rotor_position;
+    uint64_t duration = 0;
+    if (!atomic_load(&position_referenced)) {
+        duration += homing_duration_us;
+        if (target_index == VALVE_HOME_INDEX) return (uint32_t)duration;
+        from_index = VALVE_HOME_INDEX;
+        position = 0;
+    }
+
+    uint16_t rpm = speed_tune_rpm(from_index, target_index);
+    int16_t from_position = (int16_t)((position * DEGREE_FULL_ANGLE + (position < 0 ? -1 : 1) * MICROSTEPS_PER_REV / 2) / MICROSTEPS_PER_REV);
+    valve_route_t route;
+    if (plan_route(from_position, target_position, 0, &route) != SUCCESS_INT) return 0;
+    int16_t reference = position == rotor_position ? reference_correction(&route, target_position, rpm) : 0;
+
+    int32_t phase = indexer_phase;
+    for (uint8_t leg = 0; leg < route.leg_count; leg++) {
+        char direction = route.legs[leg].direction;
+        motor_step_plan_t plan;
+        if (motor_plan_steps(direction, STEPTYPE, route.legs[leg].angle, rpm, motor_data.encoder_resolution, &plan) != SUCCESS_INT) return 0;
+        uint32_t unit = FINEST_MICROSTEP / steptype_dict[plan.steptype_index].step_factor[3];
+        int32_t extra = 0;
+        if (leg == route.leg_count - 1) {
+            extra = reference;
+            if (route.legs[leg].angle != 0) extra += valve_cal_compensation(from_index, target_index, direction);
         }
+        uint32_t travel = (uint32_t)PICO_MAX(0, (int32_t)(plan.steps * unit) + extra);
+
+        move_segment_t segments[MOVE_SEGMENTS];
+        plan_segments(&plan, direction, travel, true, phase, segments);
+        duration += segments_duration_us(segments);
+        phase += (direction == DIR_CW ? 1 : -1) * (int32_t)travel;
     }
+    return (uint32_t)PICO_MIN(duration, UINT32_MAX);
+}
 
-    char ack_buffer[FOUR_BYTES];
-    concatenate_acknowledgement(ack_buffer, status, valve_ack, expected_valve_char, actual_valve_char);
+int motor_move_to_valve(int valve_index, char direction) {
+    char expected_valve_char[ACK_ENCODER_ENTRY_SIZE] = "";
+    char actual_valve_char[ACK_ENCODER_ENTRY_SIZE] = "";
+    if (valve_index < 0 || valve_index >= NUM_OF_VALVES) return ANGLE_IS_INVALID;
+    hal_watchdog_update();
+    return move_to_valve(valve_index, direction, false, expected_valve_char, actual_valve_char);
+}
 
-    motor_data.actual_encoder_value = 0;    
-    uart_send_bytes(valve_ack, strlen(valve_ack), RP1_UART_NUMBER);
+int motor_home_valve(void) {
+    atomic_store(&position_referenced, false);
+    hal_watchdog_update();
+    return home_valve(DIR_CW, valve_index_of(motor_data.previous_valve_position));
+}
+
+int16_t motor_first_pass_error(void) {
+    return first_pass_error;
+}
+
+bool motor_position_referenced(void) {
+    return atomic_load(&position_referenced);
+}
+
+uint32_t motor_index_reference_count(void) {
+    return index_references;
+}
+
+// State machine to rotate the valve motor
+int state_rotate_valve(const char *data_str) {
+    hal_watchdog_update();
+    char valve_ack[HUNDRED_BYTES] = "vf";
+    char expected_valve_char[ACK_ENCODER_ENTRY_SIZE] = "";
+    char actual_valve_char[ACK_ENCODER_ENTRY_SIZE] = "";
+
+    // an unknown valve is a zero move with the encoder check
+    int target_index = valve_command_index(data_str);
+    if (target_index < 0) target_index = valve_index_of(motor_data.previous_valve_position);
+
+    int status = move_to_valve(target_index, 0, true, expected_valve_char, actual_valve_char);
+    concatenate_acknowledgement(status, valve_ack, expected_valve_char, actual_valve_char);
+
+    // the camera sees the port only once the valve has settled on it
+    if (status == ROTATION_COMPLETED) {
+        camera_trigger_append(valve_ack, sizeof(valve_ack), camera_trigger_event(CAMERA_TRIGGER_VALVE, get_time()));
+    }
+    move_eta_append(valve_ack, sizeof(valve_ack));
+    transport_respond((const uint8_t *)valve_ack, strlen(valve_ack));
     return status;
 }
 
-// Simplified get_time function for 64-bit time from the timer
-static uint64_t get_time(void) {
-    uint32_t lo = timer_hw->timelr;
-    uint32_t hi = timer_hw->timehr;
-    return ((uint64_t) hi << 32u) | lo;
+// Interrupt service routine for the nFAULT falling edge: stop the driver first, bookkeeping after
+#pragma irq_entry
+void __time_critical_func(motor_fault_isr)(uint gpio, uint32_t events) {
+    hal_gpio_put(M1_ENABLE, HIGH);
+    atomic_store(&motor_fault_flag, true);
+    atomic_store(&position_referenced, false);
+    motor_fault_event.timestamp = get_time();
+    motor_fault_event.fault_count++;
+    motor_fault_event.report_pending = true;
+}
+
+// Interrupt service routine for both edges of the encoder index, ENC_CH2 is low while the index passes.
+// Only flags the edge, the stepping loop knows the rotor position it belongs to
+#pragma irq_entry
+void __time_critical_func(motor_index_isr)(uint gpio, uint32_t events) {
+    if (events & HAL_GPIO_IRQ_EDGE_FALL) atomic_fetch_or(&index_edges, INDEX_EDGE_ENTER);
+    if (events & HAL_GPIO_IRQ_EDGE_RISE) atomic_fetch_or(&index_edges, INDEX_EDGE_EXIT);
+}
+
+uint32_t motor_correction_count(void) {
+    return correction_count;
+}
+
+void motor_set_step_idle(void (*idle)(void), uint32_t period_us) {
+    step_idle = NULL;
+    step_idle_core = hal_get_core_num();
+    step_idle_period_us = period_us;
+    step_idle_last_us = 0;
+    step_idle = idle;
+}
+
+// Called from the encoder ISR on every falling edge of channel A
+void __time_critical_func(motor_encoder_pulse)(uint64_t edge_time_us) {
+    motor_data.actual_encoder_value = (motor_data.actual_encoder_value + 1) % (ENCODER_NO_OF_PULSES + 1);
+    encoder_interp_edge(edge_time_us);
+}
+
+uint16_t motor_encoder_value(void) {
+    return motor_data.actual_encoder_value;
+}
+
+bool motor_fault_active(void) {
+    return atomic_load(&motor_fault_flag);
+}
+
+// Overtemperature faults release nFAULT by themselves, so a move may retry once the line is high again
+bool motor_fault_clear(void) {
+    if (hal_gpio_get(M1_NFAULT) == LOW) return false;
+    atomic_store(&motor_fault_flag, false);
+    return true;
+}
+
+bool motor_fault_take_report(motor_fault_event_t *event) {
+    uint32_t irq_status = hal_save_and_disable_interrupts();
+    bool pending = motor_fault_event.report_pending;
+    if (pending) {
+        event->timestamp = motor_fault_event.timestamp;
+        event->fault_count = motor_fault_event.fault_count;
+        event->report_pending = false;
+        motor_fault_event.report_pending = false;
+    }
+    hal_restore_interrupts(irq_status);
+    return pending;
 }
 
 /*** end of file ***/
@@ -9,31 +9,22 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include "hardware/watchdog.h"
-#include "hardware/irq.h"
-#include "hardware/adc.h"
-#include "hardware/gpio.h"
-#include "hardware/uart.h"
-#include "hardware/timer.h"
-#include "hardware/i2c.h"
-#include "pico/binary_info.h"
-#include "pico/multicore.h"
+#include <stdatomic.h>
+#include "hal.h"
 #include "uart_driver.h"
-#include "hardware/rtc.h"
-#include "pico/util/datetime.h"
+#include "gpio_control.h"
+#include "fixed_point.h"
 
 // Define constants for better maintainability
 #define DEGREE_FULL_ANGLE 360
 #define TOLERANCE_ENCODER_VALUE 2
+#define ENCODER_INTERP_TOLERANCE Q16_FROM_RATIO(1, 2)  // interpolated encoder error left uncorrected, pulses
+#define ACK_ENCODER_ENTRY_SIZE 32                       // expected / actual entries of the valve acknowledgement
 #define KILL_SWITCH 'K'
 
-// Encoder Channels
-#define ENC_CH1 28   // Signal A
-#define ENC_CH2 27   // Signal Z
-#define ENC_CH3 26   // Signal B
-
 // Utility Macros
 #define PICO_MAX(a, b) ((a) > (b) ? (a) : (b))
+#define PICO_MIN(a, b) ((a) < (b) ? (a) : (b))
 
 // Error and Success Codes
 #define RESOLUTION_ERROR -1
@@ -48,8 +39,8 @@
 #define ANGLE_IS_INVALID -5
 #define HOMING_SUCCESSFUL 2
 #define ENCODER_HW_FAIL -2
-#define ENCODER_NO_OF_PULSES 179
 #define HOMING_TIMEOUT -3
+#define MOTOR_FAULT -6
 
 // Motor and Encoder Parameters
 #define NO_OF_STEPS 3200
@@ -59,6 +50,8 @@
 #define DIR_CW 'C'
 #define DIR_CCW 'A'
 #define STEPS_PER_ROTATION 200
+#define FINEST_MICROSTEP 32
+#define MICROSTEPS_PER_REV (STEPS_PER_ROTATION * FINEST_MICROSTEP)
 #define PROPORTIONAL_CONSTANT 10
 #define STEPPER_RESOLUTION 500000
 #define ANGLE_MAX 720
@@ -72,69 +65,254 @@
 #define HOME_RPM_INT 800
 #define HOME_NO_OF_STEPS 1
 
-// GPIO Pin Definitions
-#define M1_STEP 4    // MOTOR1_STEP
-#define M1_DIR 6     // MOTOR1_DIRECTION
-#define M1_NFAULT 7  //
+// Microstep switching of valve moves: half stepping at cruise, STEPTYPE for the final approach
+#define CRUISE_STEPTYPE "02"
+#define APPROACH_DEGREES 4
+#define CRUISE_MIN_STEPS 8          // shorter cruises are not worth the mode switches
+
+// Encoder index re-referencing: flags of the ENC_CH2 edges, drift below the deadband is measurement
+// quantization of a cruise step, drift above the limit means the reference is lost
+#define INDEX_EDGE_ENTER 0x1u
+#define INDEX_EDGE_EXIT 0x2u
+#define INDEX_DEADBAND_STEPS (FINEST_MICROSTEP / 2)
+#define INDEX_MAX_DRIFT_STEPS (10 * MICROSTEPS_PER_REV / DEGREE_FULL_ANGLE)
+
+// Homing step budget, two revolutions of HOME_NO_OF_STEPS degree moves
+#define MAX_COUNT (2 * DEGREE_FULL_ANGLE)
+
+// Number of valve positions and microstepping modes
+#define NUM_OF_VALVES 5
+#define VALVE_HOME_INDEX 1      // V2, found by homing on the encoder index
+#define NUM_OF_STEPTYPES 6
+
+// Valve position table entry
+typedef struct {
+    const char *valve_type;
+    int16_t valve_position;     // degrees from home (V2), CW positive
+} VALVE_DICT;
+
+// Microstepping table entry, step_factor = {MODE0, MODE1, MODE2, microsteps per full step}
+typedef struct {
+    const char *micro_steps;
+    uint8_t step_factor[4];
+} STEPTYPE_DICT;
+
+// Struct to encapsulate motor and encoder data
+typedef struct {
+    uint16_t actual_encoder_value;
+    uint16_t previous_encoder_value;
+    int current_valve_position;
+    int previous_valve_position;
+    uint16_t expected_encoder_value;
+    uint8_t no_of_pulse;
+    q16_16_t encoder_resolution;    // encoder pulses per degree
+    int16_t compensation_steps;     // extra 1/32 microsteps of the next move, consumed by it
+    int16_t reference_steps;        // 1/32 microsteps the next move adds to land on the referenced position, consumed by it
+    q16_16_t expected_travel;       // encoder pulses expected for the last move, sub-pulse
+    q16_16_t estimated_travel;      // interpolated encoder pulses of the last move
+} MotorEncoderData;
+
+// Step plan of one rotate_handler() move
+typedef struct {
+    uint8_t steptype_index;             // entry of steptype_dict
+    uint16_t expected_encoder_value;    // encoder pulses expected for the angle
+    uint32_t steps;                     // STEP pulses for the angle
+    uint32_t step_delay_us;             // half period of the STEP signal
+    int32_t step_increment;             // telemetry position change per step in 1/32 microsteps, CW positive
+} motor_step_plan_t;
+
+// Step segment of a move, moves with microstep switching run up to MOVE_SEGMENTS of them
+#define MOVE_SEGMENTS 4
+typedef struct {
+    int index;                          // entry of steptype_dict
+    uint32_t steps;
+    uint32_t stepdelay;                 // half period of the STEP signal
+    uint32_t lead_in_us;                // settling before the first step when the step rate drops
+} move_segment_t;
+
+extern VALVE_DICT valve_coordinates[NUM_OF_VALVES];
+extern STEPTYPE_DICT steptype_dict[NUM_OF_STEPTYPES];
+
+// Fault event recorded by the nFAULT interrupt
+typedef struct {
+    uint64_t timestamp;      // time of the last nFAULT falling edge in us
+    uint32_t fault_count;    // number of nFAULT events since boot
+    bool report_pending;     // async fault frame not yet sent to the host
+} motor_fault_event_t;
 
 /**
- * @brief Private method to set step resolution
- * @param steptype - argument to set the steptype of the stepper motor
- * 
+ * @brief Interrupt service routine for the falling edge of nFAULT.
+ *        Disables the driver, latches the fault and timestamps the event
+ * @param gpio
+ * @param events
  */
-static int resolution(char *steptype);
+void motor_fault_isr(uint gpio, uint32_t events);
 
 /**
- * @brief State machine to rotate the valve motor
- * @param ptr_data_str - argument to rotate the stepper motor
+ * @brief Interrupt service routine for both edges of the encoder index ENC_CH2.
+ *        Flags the edge for the stepping loop, which re-references the rotor position on a full pass
+ * @param gpio
+ * @param events
+ */
+void motor_index_isr(uint gpio, uint32_t events);
+
+/**
+ * @brief Returns the number of encoder correction passes of the last valve move
  *
  */
-int state_rotate_valve(const char *ptr_data_str);
+uint32_t motor_correction_count(void);
+
+/**
+ * @brief Runs a function in the low half of the steps the calling core makes, at most once per period. Its
+ *        run time comes out of the half step, so a long move keeps a channel serviced at the same speed
+ * @param idle      - NULL stops it
+ * @param period_us
+ */
+void motor_set_step_idle(void (*idle)(void), uint32_t period_us);
 
 /**
- * @brief Helper function to concatenate acknowledgements
- * @param ack_buffer
+ * @brief Returns the current optical encoder count
+ *
+ */
+uint16_t motor_encoder_value(void);
+
+/**
+ * @brief Checks whether a driver fault is latched and stepping must stop
+ * @return true if a fault is latched
+ */
+bool motor_fault_active(void);
+
+/**
+ * @brief Clears a latched fault once the driver has released nFAULT
+ * @return true if the fault is cleared, false if nFAULT is still asserted
+ */
+bool motor_fault_clear(void);
+
+/**
+ * @brief Fetches the last fault event if it has not been reported yet
+ * @param event - filled with the fault event
+ * @return true if a report was pending
+ */
+bool motor_fault_take_report(motor_fault_event_t *event);
+
+/**
+ * @brief Computes the step count, step delay and expected encoder pulses of a move without moving the motor
+ * @param direction
+ * @param steptype           - microstepping mode, "01" to "32"
+ * @param angle              - degrees
+ * @param rpm
+ * @param encoder_resolution - encoder pulses per degree, Q16.16
+ * @param plan               - filled with the step plan
+ * @return SUCCESS_INT, RESOLUTION_ERROR, EXP_IS_INVALID, ANGLE_IS_INVALID or RPM_IS_INVALID
+ */
+int motor_plan_steps(char direction, const char *steptype, uint16_t angle, uint16_t rpm, q16_16_t encoder_resolution, motor_step_plan_t *plan);
+
+/**
+ * @brief Helper function to concatenate acknowledgements "vf_<status>_<expected>_<actual>\n"
  * @param status
- * @param valve_ack
+ * @param valve_ack - destination, 100 bytes
  * @param ptr_e
  * @param ptr_a
  *
  */
-static void concatenate_acknowledgement(char *ack_buffer, int status, char *valve_ack, const char *ptr_e, const char *ptr_a);
+void concatenate_acknowledgement(int status, char *valve_ack, const char *ptr_e, const char *ptr_a);
 
 /**
- * @brief Helper function to concatenate valve adjustments based on encoder's feedback
- * @param ptr_e
- * @param ptr_a
+ * @brief Helper function to concatenate valve adjustments based on encoder's feedback. Entries are the
+ *        expected and interpolated travel in encoder pulses with one decimal, "<pulses>.<tenth>_<CW|CCW>"
+ * @param ptr_e      - expected encoder entry, ACK_ENCODER_ENTRY_SIZE bytes
+ * @param ptr_a      - actual encoder entries, ACK_ENCODER_ENTRY_SIZE bytes
  * @param direction
- * @param first_call
+ * @param first_call - starts a new entry list
  * @param data
  */
-static void concatenate_encoder(char *ptr_e, char *ptr_a, char direction, bool first_call, MotorEncoderData *data);
+void concatenate_encoder(char *ptr_e, char *ptr_a, char direction, bool first_call, const MotorEncoderData *data);
 
 /**
- * @brief This is the function that rotates the valve motor using high precision recursive control system 
+ * @brief Rotates the motor without encoder correction and reports the encoder pulses counted during the move
  * @param direction
  * @param steptype
- * @param ptr_e
- * @param ptr_a
  * @param angle
  * @param rpm
+ * @param encoder_pulses - falling edges of ENC_CH1 seen during the move, may be NULL
+ * @return ROTATION_COMPLETED or the rotate_handler() error
+ */
+int motor_rotate_open_loop(char direction, const char *steptype, uint16_t angle, uint16_t rpm, uint16_t *encoder_pulses);
+
+/**
+ * @brief Moves the valve to a port without an acknowledgement, applying the calibrated compensation.
+ *        Runs at the production RPM and is not fed to the speed tuner
+ * @param valve_index - entry of valve_coordinates
+ * @param direction   - DIR_CW or DIR_CCW forces a single rotation in that direction, 0 plans the route
+ * @return ROTATION_COMPLETED / HOMING_SUCCESSFUL or the error status of the move
+ */
+int motor_move_to_valve(int valve_index, char direction);
+
+/**
+ * @brief Homes the valve on the encoder index and takes a new position reference, whatever the state of
+ *        the current one. Ends at V2
+ * @return HOMING_SUCCESSFUL or the homing error
+ */
+int motor_home_valve(void);
+
+/**
+ * @brief Checks whether the rotor position is referenced to the encoder index. The reference is taken
+ *        by homing and lost on a driver fault, a failed move or an implausible index drift
+ * @return true if valve moves run from the referenced position without homing
+ */
+bool motor_position_referenced(void);
+
+/**
+ * @brief Returns the number of index passes that corrected the rotor position since boot
+ *
+ */
+uint32_t motor_index_reference_count(void);
+
+/**
+ * @brief Predicts the duration of a state_rotate_valve() move from the current rotor position without moving.
+ *        Planned like the move itself: homing while the reference is lost, the route, the tuned speed of the
+ *        transition, the compensation and the step segments of every leg. Correction passes are not predicted
+ * @param ptr_data_str - valve command, "V1" to "V5"
+ * @return predicted stepping time in us, 0 if the command is not a valve or the move is invalid
  */
-int rotate_stepper_motor(char direction, char *steptype, char *ptr_e, char *ptr_a, uint16_t angle, uint16_t rpm);
+uint32_t motor_predict_move_us(const char *ptr_data_str);
 
 /**
- * @brief Helper function to rotate the valve motor
+ * @brief Returns the encoder error of the first pass of the last valve move, before any correction
+ * @return actual - expected encoder pulses, positive is an overshoot
+ */
+int16_t motor_first_pass_error(void);
+
+/**
+ * @brief State machine to rotate the valve motor
+ * @param ptr_data_str - argument to rotate the stepper motor
+ *
+ */
+int state_rotate_valve(const char *ptr_data_str);
+
+/**
+ * @brief This is the function that rotates the valve motor using high precision recursive control system 
  * @param direction
  * @param steptype
+ * @param ptr_e
+ * @param ptr_a
  * @param angle
  * @param rpm
- * @param data
  */
-static int rotate_handler(char direction, char *steptype, uint16_t angle, uint16_t rpm, MotorEncoderData *data)
+int rotate_stepper_motor(char direction, const char *steptype, char *ptr_e, char *ptr_a, uint16_t angle, uint16_t rpm);
 
 /**
  * @brief This is a function to home the stepper motor
  * @param motor_direction
  */
-int home_stepper_motor(const char motor_direction)
\ No newline at end of file
+int home_stepper_motor(const char motor_direction);
+
+/**
+ * @brief Counts one optical encoder pulse, called from the encoder ISR
+ * @param edge_time_us - timestamp of the edge, places it on the step stream
+ */
+void motor_encoder_pulse(uint64_t edge_time_us);
+
+#endif // _DRV8825_H
+
+/*** end of file ***/
@@ -5,6 +5,9 @@
  */
 
 #include "drv8827.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "camera_trigger.h"
 
 // Time delays in milliseconds
 #define MS(x) ((x) * 1000)
@@ -21,41 +24,54 @@
 #define FIFTY_MS 50
 #define TEN_MS 10
 
+// Segment durations of the vibration profiles
+static const uint32_t standard_delays[] = {TWO_FIFTY_MS, THREE_SECONDS, TWO_FIFTY_MS};
+static const uint32_t washing_delays[] = {TWO_FIFTY_MS, THREE_SECONDS};
+
+// Private prototypes
+static void change_pwm_signal_pattern(const uint slice_num, const uint16_t duty_cycle, uint32_t delay);
+static int8_t execute_vibration_sequence(uint slice_num, uint16_t wrap_value, const uint16_t *duty_cycles, const uint32_t *delays, size_t sequence_length);
+
 // Sets the duty cycle and starts the PWM signal
 static void change_pwm_signal_pattern(const uint slice_num, const uint16_t duty_cycle, uint32_t delay) {  
-    pwm_set_chan_level(slice_num, PWM_CHAN_A, duty_cycle);
-    pwm_set_enabled(slice_num, true);
-    sleep_ms(delay);
-    pwm_set_enabled(slice_num, false);
+    hal_pwm_set_chan_level(slice_num, HAL_PWM_CHAN_A, duty_cycle);
+    hal_pwm_set_enabled(slice_num, true);
+    hal_sleep_ms(delay);
+    hal_pwm_set_enabled(slice_num, false);
 }
 
 // Executes the sequences of PWM signal for standard vibration
 static int8_t execute_vibration_sequence(uint slice_num, uint16_t wrap_value, const uint16_t *duty_cycles, const uint32_t *delays, size_t sequence_length) {
+    TRACE_POINT(TRACE_MOTION_START, sequence_length);
     for (size_t i = 0; i < sequence_length; ++i) {
+        telemetry_state.vibration_segment = (uint8_t)(i + 1);
         change_pwm_signal_pattern(slice_num, duty_cycles[i], delays[i]);
+        camera_trigger_vibration_segment((uint8_t)(i + 1), i + 1 == sequence_length);
     }
+    telemetry_state.vibration_segment = 0;
+    TRACE_POINT(TRACE_MOTION_END, VIBRATION_SUCCESSFUL);
     return VIBRATION_SUCCESSFUL;
 }
 
 // Executes vibration sequences
 int8_t process_vibration_sequences() {
-    gpio_put(M3_SLEEP, HIGH);
-    gpio_set_function(M3_IN2, GPIO_FUNC_PWM);
+    hal_gpio_put(M3_SLEEP, HIGH);
+    hal_gpio_set_function(M3_IN2, HAL_GPIO_FUNC_PWM);
 
     const uint16_t wrap_value = 936;
     const uint16_t duty_cycles[] = {205, 160, 179}; // 21.9%, 17.09%, 19%
-    const uint32_t delays[] = {TWO_FIFTY_MS, THREE_SECONDS, TWO_FIFTY_MS};
+    const uint32_t *delays = standard_delays;
     
-    uint slice_num = pwm_gpio_to_slice_num(M3_IN2);
-    pwm_set_clkdiv(slice_num, 256.0f);
-    pwm_set_wrap(slice_num, wrap_value);
+    uint slice_num = hal_pwm_gpio_to_slice_num(M3_IN2);
+    hal_pwm_set_clkdiv_int_frac(slice_num, VIBRATION_PWM_CLKDIV_INT, VIBRATION_PWM_CLKDIV_FRAC);
+    hal_pwm_set_wrap(slice_num, wrap_value);
 
     int8_t status = execute_vibration_sequence(slice_num, wrap_value, duty_cycles, delays, sizeof(duty_cycles) / sizeof(duty_cycles[0]));
 
-    gpio_put(M3_SLEEP, LOW);
-    gpio_init(M3_IN2);
-    gpio_set_dir(M3_IN2, GPIO_OUT);
-    gpio_put(M3_IN2, LOW);
+    hal_gpio_put(M3_SLEEP, LOW);
+    hal_gpio_init(M3_IN2);
+    hal_gpio_set_dir(M3_IN2, HAL_GPIO_OUT);
+    hal_gpio_put(M3_IN2, LOW);
 
     DEBUG_PRINT("Vibration ended \n");
     return status;
@@ -63,23 +79,23 @@ int8_t process_vibration_sequences() {
 
 // Executes washing vibration sequence
 int8_t process_washing_vibration() {
-    gpio_put(M3_SLEEP, HIGH);
-    gpio_set_function(M3_IN2, GPIO_FUNC_PWM);
+    hal_gpio_put(M3_SLEEP, HIGH);
+    hal_gpio_set_function(M3_IN2, HAL_GPIO_FUNC_PWM);
 
     const uint16_t wrap_value = 936;
     const uint16_t duty_cycles[] = {205, 150}; // 21.9%, 16.02%
-    const uint32_t delays[] = {TWO_FIFTY_MS, THREE_SECONDS};
+    const uint32_t *delays = washing_delays;
     
-    uint slice_num = pwm_gpio_to_slice_num(M3_IN2);
-    pwm_set_clkdiv(slice_num, 256.0f);
-    pwm_set_wrap(slice_num, wrap_value);
+    uint slice_num = hal_pwm_gpio_to_slice_num(M3_IN2);
+    hal_pwm_set_clkdiv_int_frac(slice_num, VIBRATION_PWM_CLKDIV_INT, VIBRATION_PWM_CLKDIV_FRAC);
+    hal_pwm_set_wrap(slice_num, wrap_value);
 
     int8_t status = execute_vibration_sequence(slice_num, wrap_value, duty_cycles, delays, sizeof(duty_cycles) / sizeof(duty_cycles[0]));
 
-    gpio_put(M3_SLEEP, LOW);
-    gpio_init(M3_IN2);
-    gpio_set_dir(M3_IN2, GPIO_OUT);
-    gpio_put(M3_IN2, LOW);
+    hal_gpio_put(M3_SLEEP, LOW);
+    hal_gpio_init(M3_IN2);
+    hal_gpio_set_dir(M3_IN2, HAL_GPIO_OUT);
+    hal_gpio_put(M3_IN2, LOW);
 
     DEBUG_PRINT("Vibration during washing ended \n");
     return status;
@@ -87,26 +103,36 @@ int8_t process_washing_vibration() {
 
 // Executes washing vibration with frequency input
 int8_t process_washing_vibration_input(uint16_t freq) {
-    gpio_put(M3_SLEEP, HIGH);
-    gpio_set_function(M3_IN2, GPIO_FUNC_PWM);
+    hal_gpio_put(M3_SLEEP, HIGH);
+    hal_gpio_set_function(M3_IN2, HAL_GPIO_FUNC_PWM);
 
     const uint16_t wrap_value = 936;
     const uint16_t duty_cycles[] = {205, freq, 197}; // 21.9%, variable, 21.7%
-    const uint32_t delays[] = {TWO_FIFTY_MS, THREE_SECONDS, TWO_FIFTY_MS};
+    const uint32_t *delays = standard_delays;
     
-    uint slice_num = pwm_gpio_to_slice_num(M3_IN2);
-    pwm_set_clkdiv(slice_num, 256.0f);
-    pwm_set_wrap(slice_num, wrap_value);
+    uint slice_num = hal_pwm_gpio_to_slice_num(M3_IN2);
+    hal_pwm_set_clkdiv_int_frac(slice_num, VIBRATION_PWM_CLKDIV_INT, VIBRATION_PWM_CLKDIV_FRAC);
+    hal_pwm_set_wrap(slice_num, wrap_value);
 
     int8_t status = execute_vibration_sequence(slice_num, wrap_value, duty_cycles, delays, sizeof(duty_cycles) / sizeof(duty_cycles[0]));
 
-    gpio_put(M3_SLEEP, LOW);
-    gpio_init(M3_IN2);
-    gpio_set_dir(M3_IN2, GPIO_OUT);
-    gpio_put(M3_IN2, LOW);
+    hal_gpio_put(M3_SLEEP, LOW);
+    hal_gpio_init(M3_IN2);
+    hal_gpio_set_dir(M3_IN2, HAL_GPIO_OUT);
+    hal_gpio_put(M3_IN2, LOW);
 
     DEBUG_PRINT("Vibration with input ended \n");
     return status;
 }
 
+// Sums the segment durations of a profile
+uint32_t vibration_duration_ms(int profile) {
+    const uint32_t *delays = profile == VIBRATION_WASHING ? washing_delays : standard_delays;
+    size_t length = profile == VIBRATION_WASHING ? sizeof(washing_delays) / sizeof(washing_delays[0])
+                                                 : sizeof(standard_delays) / sizeof(standard_delays[0]);
+    uint32_t duration = 0;
+    for (size_t i = 0; i < length; i++) duration += delays[i];
+    return duration;
+}
+
 /*** end of file ***/
\ No newline at end of file
@@ -7,28 +7,16 @@
 #ifndef DRV8827_H
 #define DRV8827_H
 
-#include "pico/stdlib.h"
-#include "hardware/pwm.h"
+#include "hal.h"
 #include "gpio_control.h"
 
-// Define or undefine this macro to enable or disable debug prints
-#define DEBUG_PRINT_ENABLED 0
+// Vibration PWM clock divider, integer 0 selects the maximum divider of 256
+#define VIBRATION_PWM_CLKDIV_INT 0
+#define VIBRATION_PWM_CLKDIV_FRAC 0
 
-// Debug print macro
-#if DEBUG_PRINT_ENABLED
-    #define DEBUG_PRINT(fmt, ...) printf(fmt, ##__VA_ARGS__)
-#else
-    #define DEBUG_PRINT(fmt, ...) do {} while(0)
-#endif
-
-/**
- * @brief This function is used to set the PWM signal at the required duty cycle and frequency
- * @param slice_num
- * @param duty_cycle
- * @param delay
- * 
- */
-static void change_pwm_signal_pattern(const uint slice_num, const uint16_t duty_cycle, uint32_t delay);
+// Vibration profiles
+#define VIBRATION_STANDARD 0    // process_vibration_sequences() and process_washing_vibration_input()
+#define VIBRATION_WASHING 1     // process_washing_vibration()
 
 /**
  * @brief This function is used to trigger the vibration sequence
@@ -50,14 +38,11 @@ int8_t process_vibration_sequences();
 int8_t process_washing_vibration_input(uint16_t freq);
 
 /**
- * @brief Private helper function for vibration module
- * @param slice_num
- * @param wrap_value
- * @param duty_cycles
- * @param delays
- * @param sequence_length
+ * @brief Returns the total segment time of a vibration profile
+ * @param profile - VIBRATION_STANDARD or VIBRATION_WASHING
+ * @return milliseconds
  */
-static int8_t execute_vibration_sequence(uint slice_num, uint16_t wrap_value, const uint16_t *duty_cycles, const uint32_t *delays, size_t sequence_length)
+uint32_t vibration_duration_ms(int profile);
 
 #endif /* DRV8827_H */
 
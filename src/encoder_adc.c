@@ -0,0 +1,261 @@
+/**
+ * @file encoder_adc.c
+ * @brief Analog optical sensor capture Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <stdio.h>
+#include "encoder_adc.h"
+#include "gpio_control.h"
+#include "drv8825.h"
+#include "transport.h"
+
+#define ENCODER_ADC_INPUT_MASK ((1u << ENCODER_ADC_NUM_CHANNELS) - 1)
+#define ENCODER_ADC_DUTY_LIMIT (1u << 30)
+
+// Schmitt trigger and statistics of one ADC input, the level and noise sums are scaled by ENCODER_ADC_LEVEL_SHIFT
+typedef struct {
+    bool primed;                // first sample seen, sets the state without an edge
+    bool high;
+    int32_t low_sum;
+    int32_t high_sum;
+    int32_t noise_sum;
+    uint16_t fall_threshold;
+    uint16_t rise_threshold;
+    uint8_t beyond;             // consecutive conversions past the threshold of the other state
+    uint64_t crossing_us;       // time of the first of them
+    uint32_t run_samples;       // conversions of this input since its last edge
+    uint32_t low_run;           // length of the last low run, 0 until a rising edge is seen
+    uint32_t high_total;        // high and low conversions of the completed periods
+    uint32_t low_total;
+    uint32_t edges;
+} adc_channel_t;
+
+// DMA ring, the hardware wraps the write address on its size so it must be aligned to it
+static uint16_t adc_ring[ENCODER_ADC_RING_SAMPLES] __attribute__((aligned(ENCODER_ADC_RING_SAMPLES * sizeof(uint16_t))));
+static hal_adc_capture_t adc_capture;
+static hal_spin_lock_t *adc_lock = NULL;
+static hal_repeating_timer_t adc_timer;
+static bool adc_running = false;
+static bool adc_deliver_edges = false;
+static bool adc_draining = false;       // a poll runs conversions through the triggers outside of the lock
+static bool adc_clear_pending = false;  // EA,0 arrived while a poll was draining
+
+static adc_channel_t adc_channels[ENCODER_ADC_NUM_CHANNELS];
+static uint64_t processed = 0;          // conversions run through the triggers
+static uint32_t next_input = 0;         // input of conversion number processed
+static uint32_t overruns = 0;
+
+// Private helper placing the thresholds on the learned levels
+static void update_thresholds(adc_channel_t *channel) {
+    int32_t low = channel->low_sum >> ENCODER_ADC_LEVEL_SHIFT;
+    int32_t swing = PICO_MAX((channel->high_sum >> ENCODER_ADC_LEVEL_SHIFT) - low, ENCODER_ADC_MIN_SWING);
+    channel->fall_threshold = (uint16_t)PICO_MIN(low + swing * ENCODER_ADC_FALL_EIGHTHS / 8, (int32_t)HAL_ADC_MAX);
+    channel->rise_threshold = (uint16_t)PICO_MIN(low + swing * ENCODER_ADC_RISE_EIGHTHS / 8, (int32_t)HAL_ADC_MAX);
+}
+
+// Private helper averaging a sample into the settled level of the trigger state and the noise around it.
+// The levels follow a swing that shrinks as the optics get dirty, the thresholds move with them
+static void settle(adc_channel_t *channel, int32_t *level_sum, uint16_t sample) {
+    *level_sum += sample - (*level_sum >> ENCODER_ADC_LEVEL_SHIFT);
+    channel->noise_sum += abs(sample - (*level_sum >> ENCODER_ADC_LEVEL_SHIFT)) - (channel->noise_sum >> ENCODER_ADC_LEVEL_SHIFT);
+}
+
+// Private helper handing a Schmitt edge to the motion code in place of the GPIO interrupt
+static void deliver_edge(uint gpio, bool rising, uint64_t time_us) {
+    if (!adc_deliver_edges) return;
+    if (gpio == ENC_CH1 && !rising) motor_encoder_pulse(time_us);
+    if (gpio == ENC_CH2) motor_index_isr(ENC_CH2, rising ? HAL_GPIO_IRQ_EDGE_RISE : HAL_GPIO_IRQ_EDGE_FALL);
+}
+
+// Private function running one conversion through the trigger of its input
+static void process_sample(uint input, uint16_t sample, uint64_t time_us) {
+    adc_channel_t *channel = &adc_channels[input];
+    if (!channel->primed) {
+        channel->primed = true;
+        channel->high = sample >= (channel->fall_threshold + channel->rise_threshold) / 2;
+        return;
+    }
+    channel->run_samples++;
+
+    bool crossed = channel->high ? sample < channel->fall_threshold : sample > channel->rise_threshold;
+    if (!crossed) {
+        channel->beyond = 0;
+        settle(channel, channel->high ? &channel->high_sum : &channel->low_sum, sample);
+        return;
+    }
+    // a crossing only counts once it is confirmed, the edge keeps the time of its first conversion
+    if (channel->beyond++ == 0) channel->crossing_us = time_us;
+    if (channel->beyond < ENCODER_ADC_CONFIRM_SAMPLES) return;
+
+    if (channel->high) {
+        // a low run followed by this high run completes a period
+        if (channel->low_run) {
+            channel->high_total += channel->run_samples;
+            channel->low_total += channel->low_run;
+            if (channel->high_total + channel->low_total > ENCODER_ADC_DUTY_LIMIT) {
+                channel->high_total /= 2;
+                channel->low_total /= 2;
+            }
+        }
+    } else {
+        channel->low_run = channel->run_samples;
+    }
+    channel->high = !channel->high;
+    channel->run_samples = channel->beyond = 0;
+    channel->edges++;
+    update_thresholds(channel);
+    deliver_edge(HAL_ADC_FIRST_GPIO + input, channel->high, channel->crossing_us);
+}
+
+// Private helper clearing the edge, duty and overrun counts, called with adc_lock held while no poll drains
+static void clear_counts(void) {
+    for (uint input = 0; input < ENCODER_ADC_NUM_CHANNELS; input++) {
+        adc_channels[input].edges = adc_channels[input].high_total = adc_channels[input].low_total = 0;
+        adc_channels[input].low_run = 0;
+    }
+    overruns = 0;
+}
+
+void encoder_adc_poll(void) {
+    if (!adc_running) return;
+    // only the ring positions are claimed with the interrupts masked, the triggers run outside of the lock.
+    // A poll that finds another one draining leaves the conversions to it
+    uint32_t lock_status = hal_spin_lock_blocking(adc_lock);
+    if (adc_draining) {
+        hal_spin_unlock(adc_lock, lock_status);
+        return;
+    }
+    uint32_t pending = hal_adc_capture_count(&adc_capture) - (uint32_t)processed;
+
+    // conversions about to be overwritten are dropped, the round robin position moves with them
+    if (pending > ENCODER_ADC_RING_SAMPLES / 2) {
+        uint32_t dropped = pending - ENCODER_ADC_RING_SAMPLES / 2;
+        processed += dropped;
+        next_input = (next_input + dropped) % ENCODER_ADC_NUM_CHANNELS;
+        pending -= dropped;
+        overruns++;
+    }
+    uint64_t sample = processed;
+    uint32_t input = next_input;
+    processed += pending;
+    next_input = (next_input + pending) % ENCODER_ADC_NUM_CHANNELS;
+    adc_draining = true;
+    hal_spin_unlock(adc_lock, lock_status);
+
+    for (; pending; pending--, sample++) {
+        uint64_t time_us = adc_capture.start_us + sample * adc_capture.sample_us;
+        process_sample(input, adc_ring[sample & (ENCODER_ADC_RING_SAMPLES - 1)], time_us);
+        if (++input == ENCODER_ADC_NUM_CHANNELS) input = 0;
+    }
+    for (input = 0; input < ENCODER_ADC_NUM_CHANNELS; input++) update_thresholds(&adc_channels[input]);
+
+    lock_status = hal_spin_lock_blocking(adc_lock);
+    if (adc_clear_pending) clear_counts();
+    adc_clear_pending = adc_draining = false;
+    hal_spin_unlock(adc_lock, lock_status);
+}
+
+// Private timer callback draining the ring
+static bool adc_timer_callback(hal_repeating_timer_t *rt) {
+    encoder_adc_poll();
+    return true;
+}
+
+bool encoder_adc_start(void) {
+    if (adc_running) return true;
+    if (adc_lock == NULL) return false;
+    for (uint input = 0; input < ENCODER_ADC_NUM_CHANNELS; input++) {
+        adc_channel_t *channel = &adc_channels[input];
+        memset(channel, 0, sizeof(*channel));
+        channel->low_sum = ENCODER_ADC_DEFAULT_LOW << ENCODER_ADC_LEVEL_SHIFT;
+        channel->high_sum = ENCODER_ADC_DEFAULT_HIGH << ENCODER_ADC_LEVEL_SHIFT;
+        update_thresholds(channel);
+    }
+    processed = 0;
+    next_input = 0;
+    overruns = 0;
+
+    if (!hal_adc_capture_start(ENCODER_ADC_INPUT_MASK, ENCODER_ADC_SAMPLE_US, adc_ring, ENCODER_ADC_RING_SAMPLES, &adc_capture)) return false;
+    adc_running = true;
+    if (!hal_add_repeating_timer_us(-(int64_t)ENCODER_ADC_POLL_US, adc_timer_callback, NULL, &adc_timer)) {
+        adc_running = false;
+        hal_adc_capture_stop(&adc_capture);
+    }
+    return adc_running;
+}
+
+bool encoder_adc_stop(void) {
+    if (adc_deliver_edges) return false;
+    if (!adc_running) return true;
+    uint32_t lock_status = hal_spin_lock_blocking(adc_lock);
+    adc_running = false;
+    hal_spin_unlock(adc_lock, lock_status);
+    hal_cancel_repeating_timer(&adc_timer);
+    hal_adc_capture_stop(&adc_capture);
+    return true;
+}
+
+bool encoder_adc_init(bool deliver_edges) {
+    if (adc_lock == NULL) adc_lock = hal_spin_lock_claim();
+    adc_deliver_edges = deliver_edges;
+    return deliver_edges ? encoder_adc_start() : true;
+}
+
+bool encoder_adc_get_stats(uint gpio, encoder_adc_stats_t *stats) {
+    if (!adc_running || gpio < HAL_ADC_FIRST_GPIO || gpio >= HAL_ADC_FIRST_GPIO + ENCODER_ADC_NUM_CHANNELS || stats == NULL) return false;
+    // a poll draining at the same time may leave the figures one conversion behind
+    uint32_t lock_status = hal_spin_lock_blocking(adc_lock);
+    const adc_channel_t *channel = &adc_channels[gpio - HAL_ADC_FIRST_GPIO];
+    int32_t amplitude = PICO_MAX((channel->high_sum - channel->low_sum) >> ENCODER_ADC_LEVEL_SHIFT, 0);
+    uint32_t period = channel->high_total + channel->low_total;
+    stats->amplitude = (uint16_t)amplitude;
+    stats->noise = (uint16_t)(channel->noise_sum >> ENCODER_ADC_LEVEL_SHIFT);
+    stats->duty_permille = period ? (uint16_t)((uint64_t)channel->high_total * 1000u / period) : 0;
+    stats->edges = channel->edges;
+    stats->warning = amplitude < ENCODER_ADC_WARN_AMPLITUDE || stats->noise * ENCODER_ADC_WARN_NOISE_DIV > amplitude;
+    hal_spin_unlock(adc_lock, lock_status);
+    return true;
+}
+
+uint32_t encoder_adc_overruns(void) {
+    return overruns;
+}
+
+int encoder_adc_command(const char *ptr_data_str) {
+    static const uint channel_gpios[ENCODER_ADC_NUM_CHANNELS] = {ENC_CH1, ENC_CH2, ENC_CH3};
+    char line[ENCODER_ADC_LINE_SIZE];
+    const char *args = strchr(ptr_data_str, ',');
+    int status = SUCCESS_INT;
+
+    if (args != NULL && args[1] == '1') {
+        if (!encoder_adc_start()) status = ENCODER_ADC_UNAVAILABLE;
+        snprintf(line, sizeof(line), "ea_%d\n", status);
+    } else if (args != NULL && args[1] == '0') {
+        // with the Schmitt edges feeding the encoder the capture keeps running, only the counts are cleared
+        encoder_adc_stop();
+        if (adc_lock != NULL) {
+            uint32_t lock_status = hal_spin_lock_blocking(adc_lock);
+            if (adc_draining) {
+                adc_clear_pending = true;
+            } else {
+                clear_counts();
+            }
+            hal_spin_unlock(adc_lock, lock_status);
+        }
+        snprintf(line, sizeof(line), "ea_%d\n", status);
+    } else {
+        encoder_adc_stats_t stats;
+        for (uint i = 0; i < ENCODER_ADC_NUM_CHANNELS; i++) {
+            if (!encoder_adc_get_stats(channel_gpios[i], &stats)) continue;
+            snprintf(line, sizeof(line), "ea_%u_%u_%u_%u_%lu_%s\n", channel_gpios[i], stats.amplitude, stats.noise,
+                     stats.duty_permille, (unsigned long)stats.edges, stats.warning ? "warn" : "ok");
+            transport_respond((const uint8_t *)line, strlen(line));
+        }
+        snprintf(line, sizeof(line), "ea_end_%lu\n", (unsigned long)overruns);
+    }
+    transport_respond((const uint8_t *)line, strlen(line));
+    return status;
+}
+
+/*** end of file ***/
@@ -0,0 +1,112 @@
+/** @file encoder_adc.h
+*
+* @brief Analog capture of the optical sensor channels. ENC_CH1..3 are the ADC inputs 0 to 2, converted
+*        round robin into a DMA ring and run through software Schmitt triggers whose thresholds follow
+*        the learned high and low levels. Reports the signal quality of every channel (amplitude, noise,
+*        duty) as an early warning of dirty optics, and with ENCODER_ADC_EDGES the Schmitt edges replace
+*        the GPIO interrupts of the encoder. Without ENCODER_ADC_EDGES the capture only runs while the
+*        monitoring is switched on ("EA,1"), the motion code pays nothing for it otherwise.
+*
+*/
+
+#ifndef _ENCODER_ADC_H
+#define _ENCODER_ADC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+
+// Edge source of the encoder, 0 keeps the GPIO interrupts and only monitors the signals
+#ifndef ENCODER_ADC_EDGES
+#define ENCODER_ADC_EDGES 0
+#endif
+
+#define ENCODER_ADC_NUM_CHANNELS 3
+#define ENCODER_ADC_SAMPLE_US 4             // 250 ksps, every channel converted each 12 us
+#define ENCODER_ADC_RING_SAMPLES 2048       // 8 ms of conversions
+#define ENCODER_ADC_POLL_US 100             // ring drained by a repeating timer
+
+// Schmitt thresholds at 3/8 and 5/8 of the swing between the learned low and high levels, every sample
+// updates the level of the trigger state and the noise by 1/16
+#define ENCODER_ADC_FALL_EIGHTHS 3
+#define ENCODER_ADC_RISE_EIGHTHS 5
+#define ENCODER_ADC_LEVEL_SHIFT 4
+#define ENCODER_ADC_DEFAULT_LOW 400
+#define ENCODER_ADC_DEFAULT_HIGH 3600
+#define ENCODER_ADC_MIN_SWING 800           // thresholds never come closer than this swing allows
+#define ENCODER_ADC_CONFIRM_SAMPLES 2       // conversions past a threshold that make an edge, rejects spikes
+
+// Dirty optics warning: swing below the limit or noise above 1/8 of the swing
+#define ENCODER_ADC_WARN_AMPLITUDE 2000
+#define ENCODER_ADC_WARN_NOISE_DIV 8
+
+#define ENCODER_ADC_LINE_SIZE 48
+
+// Error Codes
+#define ENCODER_ADC_UNAVAILABLE -1          // the capture or its timer could not be started
+
+// Signal quality of one channel
+typedef struct {
+    uint16_t amplitude;         // high - low level, ADC counts
+    uint16_t noise;             // mean absolute deviation from the settled level, ADC counts
+    uint16_t duty_permille;     // high share of the completed periods
+    uint32_t edges;             // Schmitt transitions since the last reset
+    bool warning;               // amplitude or noise out of limits
+} encoder_adc_stats_t;
+
+/**
+ * @brief Prepares the capture, it only starts right away when it delivers the encoder edges
+ * @param deliver_edges - feeds the ENC_CH1 falling edges to motor_encoder_pulse() and the ENC_CH2 edges
+ *                        to motor_index_isr(), the GPIO interrupts of these channels must not be registered
+ * @return true if the capture is ready, running with deliver_edges
+ */
+bool encoder_adc_init(bool deliver_edges);
+
+/**
+ * @brief Starts the capture and the timer draining it, the triggers learn the levels again
+ *
+ * @return true if the capture is running
+ */
+bool encoder_adc_start(void);
+
+/**
+ * @brief Stops the capture and its timer, refused while the capture delivers the encoder edges
+ *
+ * @return true if the capture is stopped
+ */
+bool encoder_adc_stop(void);
+
+/**
+ * @brief Runs the conversions captured so far through the Schmitt triggers. Called by the timer and by the
+ *        stepping code before it reads the encoder, safe on both cores. The interrupts are only masked while
+ *        the conversions are claimed, a poll that finds another one running returns at once
+ *
+ */
+void encoder_adc_poll(void);
+
+/**
+ * @brief Reads the signal quality of a channel
+ * @param gpio  - ENC_CH1, ENC_CH2 or ENC_CH3
+ * @param stats - filled with the channel statistics
+ * @return true if the channel is captured
+ */
+bool encoder_adc_get_stats(uint gpio, encoder_adc_stats_t *stats);
+
+/**
+ * @brief Returns the number of times the ring was drained too late and conversions were lost
+ *
+ */
+uint32_t encoder_adc_overruns(void);
+
+/**
+ * @brief EA command: "EA" reports every captured channel as "ea_<gpio>_<amplitude>_<noise>_<duty>_<edges>_<ok|warn>"
+ *        followed by "ea_end_<overruns>", "EA,1" starts the monitoring, "EA,0" stops it and clears the edge,
+ *        duty and overrun counts. With ENCODER_ADC_EDGES the capture always runs and "EA,0" only clears
+ * @param ptr_data_str
+ * @return SUCCESS_INT or ENCODER_ADC_UNAVAILABLE
+ */
+int encoder_adc_command(const char *ptr_data_str);
+
+#endif /* _ENCODER_ADC_H */
+
+/*** end of file ***/
@@ -0,0 +1,94 @@
+/**
+ * @file encoder_interp.c
+ * @brief Sub-pulse encoder interpolation Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include "encoder_interp.h"
+
+// Commanded travel of the move in 1/32 microsteps and the latest steps, written by the stepping loop with
+// interrupts off so an edge handler always reads consistent steps
+typedef struct {
+    uint32_t step_start;        // travel before the step
+    uint32_t step_increment;
+    uint32_t step_period_us;
+    uint64_t step_time_us;      // STEP rising edge
+} interp_step_t;
+
+static volatile interp_step_t steps[ENCODER_INTERP_HISTORY];
+static volatile uint32_t newest_step = 0;
+static q16_16_t interp_resolution = 0;
+
+// Edges of the move, placed on the commanded travel
+static volatile uint32_t edge_count = 0;
+static volatile uint32_t first_edge_travel = 0;
+static volatile uint32_t last_edge_travel = 0;
+
+q16_16_t encoder_interp_steps_to_pulses(int32_t steps, q16_16_t encoder_resolution) {
+    return sat_i32((int64_t)steps * DEGREE_FULL_ANGLE * encoder_resolution / MICROSTEPS_PER_REV);
+}
+
+// Private helper, commanded travel at a time: the rotor is taken to cover a step evenly over its period.
+// An edge reported late is placed on the step it arrived in, older than the history on its oldest step
+static uint32_t travel_at(uint64_t time_us) {
+    const volatile interp_step_t *step = &steps[newest_step % ENCODER_INTERP_HISTORY];
+    for (uint32_t age = 1; age < ENCODER_INTERP_HISTORY && age <= newest_step && time_us < step->step_time_us; age++) {
+        step = &steps[(newest_step - age) % ENCODER_INTERP_HISTORY];
+    }
+    uint64_t elapsed = time_us > step->step_time_us ? time_us - step->step_time_us : 0;
+    if (step->step_period_us == 0 || elapsed >= step->step_period_us) return step->step_start + step->step_increment;
+    return step->step_start + (uint32_t)(step->step_increment * elapsed / step->step_period_us);
+}
+
+void encoder_interp_start(q16_16_t encoder_resolution) {
+    uint32_t irq_status = hal_save_and_disable_interrupts();
+    interp_resolution = encoder_resolution;
+    newest_step = 0;
+    steps[0].step_start = steps[0].step_increment = steps[0].step_period_us = 0;
+    steps[0].step_time_us = get_time();
+    edge_count = first_edge_travel = last_edge_travel = 0;
+    hal_restore_interrupts(irq_status);
+}
+
+void encoder_interp_step(uint32_t increment, uint32_t period_us) {
+    uint64_t now = get_time();
+    uint32_t irq_status = hal_save_and_disable_interrupts();
+    const volatile interp_step_t *previous = &steps[newest_step % ENCODER_INTERP_HISTORY];
+    volatile interp_step_t *step = &steps[(newest_step + 1) % ENCODER_INTERP_HISTORY];
+    step->step_start = previous->step_start + previous->step_increment;
+    step->step_increment = increment;
+    step->step_period_us = period_us;
+    step->step_time_us = now;
+    newest_step++;
+    hal_restore_interrupts(irq_status);
+}
+
+void __time_critical_func(encoder_interp_edge)(uint64_t edge_time_us) {
+    uint32_t travel = travel_at(edge_time_us);
+    if (edge_count == 0) first_edge_travel = travel;
+    last_edge_travel = travel;
+    edge_count++;
+}
+
+uint32_t encoder_interp_commanded(void) {
+    const volatile interp_step_t *step = &steps[newest_step % ENCODER_INTERP_HISTORY];
+    return step->step_start + step->step_increment;
+}
+
+// Travel between the start and the first edge and after the last edge is less than one encoder pulse,
+// whatever the step stream says: a larger value is a rotor lagging or stalled there
+q16_16_t encoder_interp_travel(void) {
+    uint32_t irq_status = hal_save_and_disable_interrupts();
+    uint32_t commanded = travel_at(get_time());
+    uint32_t edges = edge_count, first = first_edge_travel, last = last_edge_travel;
+    hal_restore_interrupts(irq_status);
+
+    q16_16_t below_one_pulse = Q16_ONE - 1;
+    if (edges == 0) return PICO_MIN(encoder_interp_steps_to_pulses((int32_t)commanded, interp_resolution), below_one_pulse);
+
+    q16_16_t lead = PICO_MIN(encoder_interp_steps_to_pulses((int32_t)first, interp_resolution), Q16_ONE);
+    q16_16_t tail = PICO_MIN(encoder_interp_steps_to_pulses(commanded > last ? (int32_t)(commanded - last) : 0, interp_resolution), below_one_pulse);
+    return sat_add_i32(sat_add_i32(lead, q16_from_int((int32_t)edges - 1)), tail);
+}
+
+/*** end of file ***/
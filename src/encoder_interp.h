@@ -0,0 +1,61 @@
+/** @file encoder_interp.h
+*
+* @brief Sub-pulse position estimate of a valve move. The optical encoder resolves 2 degrees, between
+*        its edges the position is interpolated from the commanded step stream: every edge is placed on
+*        the step it arrived in by its timestamp, the travel before the first and after the last edge
+*        comes from the steps commanded there.
+*
+*/
+
+#ifndef _ENCODER_INTERP_H
+#define _ENCODER_INTERP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "drv8825.h"
+
+// Steps kept to place edges reported after the next step has started
+#define ENCODER_INTERP_HISTORY 4
+
+/**
+ * @brief Starts the estimate of a move, called before its first step
+ * @param encoder_resolution - encoder pulses per degree, Q16.16
+ */
+void encoder_interp_start(q16_16_t encoder_resolution);
+
+/**
+ * @brief Records a step of the move, called right before its STEP rising edge
+ * @param increment - 1/32 microsteps of the step, magnitude
+ * @param period_us - time until the next step
+ */
+void encoder_interp_step(uint32_t increment, uint32_t period_us);
+
+/**
+ * @brief Records an encoder edge, called from the encoder ISR
+ * @param edge_time_us - timestamp of the edge
+ */
+void encoder_interp_edge(uint64_t edge_time_us);
+
+/**
+ * @brief Returns the estimated travel of the move
+ * @return encoder pulses, Q16.16
+ */
+q16_16_t encoder_interp_travel(void);
+
+/**
+ * @brief Returns the travel commanded by the steps of the move
+ * @return 1/32 microsteps
+ */
+uint32_t encoder_interp_commanded(void);
+
+/**
+ * @brief Converts 1/32 microsteps to encoder pulses
+ * @param steps
+ * @param encoder_resolution - encoder pulses per degree, Q16.16
+ * @return encoder pulses, Q16.16
+ */
+q16_16_t encoder_interp_steps_to_pulses(int32_t steps, q16_16_t encoder_resolution);
+
+#endif /* _ENCODER_INTERP_H */
+
+/*** end of file ***/
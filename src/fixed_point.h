@@ -0,0 +1,132 @@
+/** @file fixed_point.h
+*
+* @brief Q16.16 fixed point and saturating integer helpers for the motion, encoder and PWM math.
+*        The Cortex-M0+ has no FPU, every float operation is a soft-float library call.
+*
+*/
+
+#ifndef _FIXED_POINT_H
+#define _FIXED_POINT_H
+
+#include <stdint.h>
+
+// Q16.16: 16 integer bits, 16 fraction bits
+typedef int32_t q16_16_t;
+
+#define Q16_FRACTION_BITS 16
+#define Q16_ONE ((q16_16_t)1 << Q16_FRACTION_BITS)
+#define Q16_MAX INT32_MAX
+#define Q16_MIN INT32_MIN
+
+// Compile time constants, a ratio is exact when the denominator divides num * 2^16
+#define Q16_FROM_INT(value) ((q16_16_t)((value) * Q16_ONE))
+#define Q16_FROM_RATIO(num, den) ((q16_16_t)(((int64_t)(num) * Q16_ONE) / (den)))
+
+/**
+ * @brief Clamps a 64 bit intermediate to the int32_t range
+ * @param value
+ */
+static inline int32_t sat_i32(int64_t value) {
+    if (value > INT32_MAX) return INT32_MAX;
+    if (value < INT32_MIN) return INT32_MIN;
+    return (int32_t)value;
+}
+
+/**
+ * @brief Clamps a value to the uint16_t range
+ * @param value
+ */
+static inline uint16_t sat_u16(int64_t value) {
+    if (value > UINT16_MAX) return UINT16_MAX;
+    if (value < 0) return 0;
+    return (uint16_t)value;
+}
+
+/**
+ * @brief Divides by 2^16 truncating towards zero like a float to int conversion, with shifts instead of
+ *        the 64 bit division helper
+ * @param value
+ */
+static inline int64_t q16_truncate(int64_t value) {
+    return value >= 0 ? value >> Q16_FRACTION_BITS : -((-value) >> Q16_FRACTION_BITS);
+}
+
+/**
+ * @brief Saturating int32_t addition
+ * @param a
+ * @param b
+ */
+static inline int32_t sat_add_i32(int32_t a, int32_t b) {
+    return sat_i32((int64_t)a + b);
+}
+
+/**
+ * @brief Saturating int32_t subtraction
+ * @param a
+ * @param b
+ */
+static inline int32_t sat_sub_i32(int32_t a, int32_t b) {
+    return sat_i32((int64_t)a - b);
+}
+
+/**
+ * @brief Saturating int32_t multiplication
+ * @param a
+ * @param b
+ */
+static inline int32_t sat_mul_i32(int32_t a, int32_t b) {
+    return sat_i32((int64_t)a * b);
+}
+
+/**
+ * @brief Converts an integer to Q16.16, saturating outside +-32767
+ * @param value
+ */
+static inline q16_16_t q16_from_int(int32_t value) {
+    return sat_i32((int64_t)value * Q16_ONE);
+}
+
+/**
+ * @brief Saturating Q16.16 multiplication, the result is truncated towards zero
+ * @param a
+ * @param b
+ */
+static inline q16_16_t q16_mul(q16_16_t a, q16_16_t b) {
+    return sat_i32(q16_truncate((int64_t)a * b));
+}
+
+/**
+ * @brief Saturating Q16.16 division, truncated towards zero. Division by zero saturates to the sign of a
+ * @param a
+ * @param b
+ */
+static inline q16_16_t q16_div(q16_16_t a, q16_16_t b) {
+    if (b == 0) return a < 0 ? Q16_MIN : Q16_MAX;
+    return sat_i32(((int64_t)a * Q16_ONE) / b);
+}
+
+/**
+ * @brief Multiplies a Q16.16 value by an integer and truncates to an integer, same as (int)(a_float * value)
+ * @param a
+ * @param value
+ */
+static inline int32_t q16_mul_int(q16_16_t a, int32_t value) {
+    return sat_i32(q16_truncate((int64_t)a * value));
+}
+
+/**
+ * @brief Divides an integer by a Q16.16 value and truncates to an integer, same as (int)(value / a_float).
+ *        Division by zero saturates to the sign of value
+ * @param value
+ * @param a
+ */
+static inline int32_t q16_div_int(int32_t value, q16_16_t a) {
+    if (a == 0) return value < 0 ? INT32_MIN : INT32_MAX;
+    // encoder and angle values fit the 32 bit divider, the 64 bit path is for completeness
+    if (value > -Q16_ONE / 2 && value < Q16_ONE / 2) return (value * Q16_ONE) / a;
+    return sat_i32(((int64_t)value * Q16_ONE) / a);
+}
+
+#endif /* _FIXED_POINT_H */
+
+/*** end of file ***/
@@ -0,0 +1,57 @@
+/**
+ * @file flash_store.c
+ * @brief Persistent parameter blocks Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <string.h>
+#include "flash_store.h"
+#include "crc.h"
+
+#define FLASH_STORE_MAGIC 0x31505246u  // "FRP1"
+
+// RAM copy of the sector while one slot of it is rewritten
+static uint8_t sector_image[HAL_FLASH_SECTOR_SIZE];
+
+static const flash_store_header_t *slot_header(const uint8_t *sector, uint8_t slot) {
+    return (const flash_store_header_t *)(sector + (size_t)slot * FLASH_STORE_SLOT_SIZE);
+}
+
+// Private helper rewriting the sector with one slot replaced, data NULL erases the slot
+static bool write_slot(uint8_t slot, uint16_t version, const void *data, uint16_t length) {
+    if (slot >= FLASH_STORE_NUM_SLOTS || length > FLASH_STORE_MAX_LENGTH) return false;
+
+    memcpy(sector_image, hal_flash_storage(), sizeof(sector_image));
+    uint8_t *slot_data = sector_image + (size_t)slot * FLASH_STORE_SLOT_SIZE;
+    memset(slot_data, 0xFF, FLASH_STORE_SLOT_SIZE);
+    if (data != NULL) {
+        flash_store_header_t header = {FLASH_STORE_MAGIC, version, length, calculate_crc((const char *)data, length)};
+        memcpy(slot_data, &header, sizeof(header));
+        memcpy(slot_data + sizeof(header), data, length);
+    }
+    return hal_flash_storage_write(sector_image);
+}
+
+bool flash_store_load(uint8_t slot, uint16_t version, void *data, uint16_t length) {
+    if (slot >= FLASH_STORE_NUM_SLOTS || length > FLASH_STORE_MAX_LENGTH) return false;
+
+    flash_store_header_t header;
+    const uint8_t *slot_data = (const uint8_t *)slot_header(hal_flash_storage(), slot);
+    memcpy(&header, slot_data, sizeof(header));
+    if (header.magic != FLASH_STORE_MAGIC || header.version != version || header.length != length) return false;
+    if (calculate_crc((const char *)slot_data + sizeof(header), length) != header.checksum) return false;
+
+    memcpy(data, slot_data + sizeof(header), length);
+    return true;
+}
+
+bool flash_store_save(uint8_t slot, uint16_t version, const void *data, uint16_t length) {
+    if (data == NULL || !write_slot(slot, version, data, length)) return false;
+    return memcmp(hal_flash_storage() + (size_t)slot * FLASH_STORE_SLOT_SIZE + sizeof(flash_store_header_t), data, length) == 0;
+}
+
+bool flash_store_erase(uint8_t slot) {
+    return write_slot(slot, 0, NULL, 0);
+}
+
+/*** end of file ***/
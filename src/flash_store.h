@@ -0,0 +1,63 @@
+/** @file flash_store.h
+*
+* @brief Persistent parameter blocks in the flash storage sector. The sector is split into fixed slots,
+*        every slot holds one versioned block protected by a checksum.
+*
+*/
+
+#ifndef _FLASH_STORE_H
+#define _FLASH_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+
+#define FLASH_STORE_SLOT_SIZE 512u
+#define FLASH_STORE_NUM_SLOTS (HAL_FLASH_SECTOR_SIZE / FLASH_STORE_SLOT_SIZE)
+
+// Slot owners
+#define FLASH_STORE_SLOT_VALVE_CAL 0
+#define FLASH_STORE_SLOT_SPEED_TUNE 1
+#define FLASH_STORE_SLOT_MULTIDROP 2
+
+// Slot header, the block follows it
+typedef struct {
+    uint32_t magic;
+    uint16_t version;       // layout version of the block, a mismatch reads as empty
+    uint16_t length;
+    uint32_t checksum;      // calculate_crc() of the block
+} flash_store_header_t;
+
+#define FLASH_STORE_MAX_LENGTH (FLASH_STORE_SLOT_SIZE - sizeof(flash_store_header_t))
+
+/**
+ * @brief Reads a block from its slot
+ * @param slot
+ * @param version - expected layout version
+ * @param data    - left untouched unless the block is valid
+ * @param length  - expected block size
+ * @return true if the slot holds a valid block of this version and length
+ */
+bool flash_store_load(uint8_t slot, uint16_t version, void *data, uint16_t length);
+
+/**
+ * @brief Writes a block to its slot, the other slots are preserved. Erases the whole sector, call it
+ *        only while the motors are idle
+ * @param slot
+ * @param version
+ * @param data
+ * @param length  - at most FLASH_STORE_MAX_LENGTH
+ * @return true if the block is written and reads back valid
+ */
+bool flash_store_save(uint8_t slot, uint16_t version, const void *data, uint16_t length);
+
+/**
+ * @brief Invalidates a slot, the other slots are preserved
+ * @param slot
+ * @return true if the slot is erased
+ */
+bool flash_store_erase(uint8_t slot);
+
+#endif /* _FLASH_STORE_H */
+
+/*** end of file ***/
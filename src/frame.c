@@ -0,0 +1,27 @@
+/**
+ * @file frame.c
+ * @brief This file contains binary frame function definitions
+ * @author Yashas Nagaraj Udupa 
+ */
+
+#include <string.h>
+#include "frame.h"
+
+size_t frame_encode(uint8_t type, const uint8_t *payload, uint8_t length, uint8_t *out)
+{
+    uint16_t sum = (uint16_t)(type + length);   // variable for sum of type, length and payload
+
+    out[0] = FRAME_SYNC_0;
+    out[1] = FRAME_SYNC_1;
+    out[2] = type;
+    out[3] = length;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        out[FRAME_HEADER_SIZE + i] = payload[i];
+        sum += payload[i];
+    }
+    frame_put_u16(&out[FRAME_HEADER_SIZE + length], (uint16_t)~sum);   // 1's complement of sum
+    return (size_t)length + FRAME_OVERHEAD;
+}
+
+/*** end of file ***/
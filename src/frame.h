@@ -0,0 +1,71 @@
+/**
+ * @file frame.h
+ * @brief This file contains the binary frame format shared by telemetry and trace streams
+ * 
+ * Frame layout : | 0xA5 | 0x5A | type | length | payload[length] | checksum (LE16) |
+ * checksum is the 1's complement of the 16 bit sum of type, length and payload bytes,
+ * the same logic as the ASCII command CRC
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Frame sync bytes, never the first byte of an ASCII acknowledgement
+#define FRAME_SYNC_0            0xA5
+#define FRAME_SYNC_1            0x5A
+
+// Frame sizes
+#define FRAME_HEADER_SIZE       4
+#define FRAME_CHECKSUM_SIZE     2
+#define FRAME_MAX_PAYLOAD       255
+#define FRAME_OVERHEAD          (FRAME_HEADER_SIZE + FRAME_CHECKSUM_SIZE)
+
+// Frame types
+#define FRAME_TYPE_TELEMETRY    0x01
+#define FRAME_TYPE_TRACE        0x02
+
+/**
+ * @brief stores a 16 bit value little endian
+ * 
+ * @param dst - destination buffer
+ * @param value - value to store
+ * @return pointer past the stored value
+ */
+static inline uint8_t *frame_put_u16(uint8_t *dst, uint16_t value)
+{
+    dst[0] = (uint8_t)value;
+    dst[1] = (uint8_t)(value >> 8);
+    return dst + 2;
+}
+
+/**
+ * @brief stores a 32 bit value little endian
+ * 
+ * @param dst - destination buffer
+ * @param value - value to store
+ * @return pointer past the stored value
+ */
+static inline uint8_t *frame_put_u32(uint8_t *dst, uint32_t value)
+{
+    dst[0] = (uint8_t)value;
+    dst[1] = (uint8_t)(value >> 8);
+    dst[2] = (uint8_t)(value >> 16);
+    dst[3] = (uint8_t)(value >> 24);
+    return dst + 4;
+}
+
+/**
+ * @brief builds a binary frame around a payload
+ * 
+ * @param type - frame type
+ * @param payload - pointer to payload
+ * @param length - payload length
+ * @param out - destination buffer, at least length + FRAME_OVERHEAD bytes
+ * @return size of the frame in bytes
+ */
+size_t frame_encode(uint8_t type, const uint8_t *payload, uint8_t length, uint8_t *out);
+
+#endif // FRAME_H
@@ -4,31 +4,60 @@
  * @author Yashas Nagaraj Udupa 
  */
 
+#include <stdio.h>
 #include "gpio_control.h"
-// Constants moved to header file or made local where possible
+#include "drv8825.h"
+#include "drv8827.h"
+#include "gpio_dispatch.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "valve_cal.h"
+#include "speed_tune.h"
+#include "encoder_adc.h"
+#include "camera_trigger.h"
+#include "move_eta.h"
+#include "cmd_queue.h"
+#include "multidrop.h"
+#include "transport.h"
+
+// Acknowledgement buffer size
+#define ACK_BUFFER_SIZE 40
 
 // UART interrupt initializations
-static char mainUartStruct.rxBuffer[MAX_SIZE] = {0};  // Changed to static for module scope
-static atomic_bool uart_ix_flag = false;
-static atomic_bool uart_k_flag = false;
+atomic_bool uart_k_flag = false;
 
 static volatile uint64_t start_time = 0;
 static volatile uint64_t end_time = 0;
-uartRxData_t mainUartStruct = {};
 
 // Array of strings corresponding to positions of valve motor rotations 
 static const char *desiredFuncStrings[] = {
     "K\n", "V1\n", "V2\n", "V3\n", "V4\n", "V5\n", "V6\n", "ST\n", 
-    "SF\n", "IV\n", "RS\n", "WV\n", "FV\n", "MO\n", "TS\n"
+    "SF\n", "IV\n", "RS\n", "WV\n", "FV\n", "MO\n", "TS\n", "IQ\n", "TM\n", "TD\n", "SS\n", "SR\n", "VB\n", "VC\n", "VS\n", "EA\n", "CT\n", "ET\n", "NA\n", "SN\n"
 };
 
+// Private helper sending "<prefix>_<status>\n" to the RPi
+static void send_status_ack(const char *prefix, int status) {
+    char ack[ACK_BUFFER_SIZE];
+    int len = snprintf(ack, sizeof(ack), "%s_%d\n", prefix, status);
+    transport_respond((const uint8_t *)ack, (size_t)len);
+}
+
+// Private helper sending the acknowledgement of a vibration with the camera trigger it scheduled and its prediction
+static void send_vibration_ack(const char *prefix, int status) {
+    char ack[ACK_BUFFER_SIZE];
+    snprintf(ack, sizeof(ack), "%s_%d\n", prefix, status);
+    camera_trigger_append(ack, sizeof(ack), camera_trigger_take(CAMERA_TRIGGER_VIBRATION));
+    move_eta_append(ack, sizeof(ack));
+    transport_respond((const uint8_t *)ack, strlen(ack));
+}
+
 // Method to blink LED when Pico one board is reset
 void on_board_led_blink() {
     for (int i = 0; i < 2; i++) {
-        gpio_put(RP1_OB_LED, 1);
-        sleep_ms(FIVE_HUNDRED_MILLISECONDS);
-        gpio_put(RP1_OB_LED, 0);
-        sleep_ms(FIVE_HUNDRED_MILLISECONDS);
+        hal_gpio_put(RP1_OB_LED, 1);
+        hal_sleep_ms(FIVE_HUNDRED_MILLISECONDS);
+        hal_gpio_put(RP1_OB_LED, 0);
+        hal_sleep_ms(FIVE_HUNDRED_MILLISECONDS);
     }
 }
 
@@ -42,138 +71,155 @@ enum DesiredFunc get_desired_func(const char *ptr_data_str) {
     return INVALID_DESIRED_FUNC;  
 }
 
+// Function to get the command string of a DesiredFunc enum
+const char *get_desired_func_name(enum DesiredFunc func) {
+    return (unsigned)func < NUM_OF_UART_FUNCS ? desiredFuncStrings[func] : "?\n";
+}
+
 // Method to reset the Pico board
-int reset_pico(char *ptr_data_str, const char *kill_switch_ack) {
-    gpio_put(M1_ENABLE, LOW);  // Disable motor first
-    gpio_init(M3_IN2);
-    gpio_set_dir(M3_IN2, GPIO_OUT);
-    gpio_put(M3_IN2, 0);
-    state_rotate_valve(ptr_data_str);
+int reset_pico(const char *ptr_data_str) {
+    hal_gpio_put(M1_ENABLE, LOW);  // Disable motor first
+    hal_gpio_init(M3_IN2);
+    hal_gpio_set_dir(M3_IN2, HAL_GPIO_OUT);
+    hal_gpio_put(M3_IN2, 0);
+    int status = state_rotate_valve(ptr_data_str);
 
     // Send the received acknowledgement to PI
-    uart_send_bytes(uart0, kill_switch_ack, strlen(kill_switch_ack));
+    send_status_ack("k", status);
     return 1;  // Return success without using global variable
 }
 
 // Method to trigger the vibration sequence
-int shaker_on(const char *st_ack) {
+int shaker_on() {
     int status = process_vibration_sequences();  
-    uart_send_bytes(uart0, st_ack, strlen(st_ack));
+    send_vibration_ack("st", status);
     return status;    
 }
 
 // Method to trigger the vibration during incubation
-int incubation_shaker_on(const char *iv_ack) {
+int incubation_shaker_on() {
     int status = process_vibration_sequences();  
-    uart_send_bytes(uart0, iv_ack, strlen(iv_ack));
+    send_vibration_ack("rs", status);
     return status;    
 }
 
 // Washing shaker started
-int vibration_shaker_on(const char *wv_ack) {
+int vibration_shaker_on() {
     int status = process_washing_vibration();  
-    uart_send_bytes(uart0, wv_ack, strlen(wv_ack));
+    send_vibration_ack("wv", status);
     return status;    
 }
 
 // Function to report the firmware version to the RPI4
-bool report_firmware_version(const char *version, int uart_port) {
-    uart_send_bytes(uart0, version, strlen(version));
+bool report_firmware_version(const char *version) {
+    transport_respond((const uint8_t *)version, strlen(version));
     return true;  // Return success without using global variable
 }
 
 // Function to turn off the motor
-bool turn_off_motor(int uart_port, const char *turn_off_ack) {
-    gpio_put(M1_ENABLE, HIGH);
+bool turn_off_motor() {
+    hal_gpio_put(M1_ENABLE, HIGH);
 
     // Send acknowledgement to RPI
-    uart_send_bytes(uart0, turn_off_ack, strlen(turn_off_ack));
+    send_status_ack("mo", 1);
     return true;  // Return success without using global variable
 }
 
 // Method to initialize and configure GPIOs
 void initialisations(uart_config_t *uartconfig) {
-    watchdog_update();
-    stdio_init_all();
+    hal_watchdog_update();
+    hal_stdio_init();
 
     // GPIO initializations and configurations
     static const uint gpio_pins[] = {M1_MODE2, M1_MODE1, M1_MODE0, M1_STEP, M1_ENABLE, M1_DIR, M1_NFAULT, MOTOR_SLEEP, MOTOR_RESET, 
-                                     M3_IN2, M3_IN1, M3_SLEEP, RP1_IO16_UART0_TX, RP1_IO17_UART0_RX, ENC_CH3, ENC_CH2, ENC_CH1, RP1_OB_LED};
+                                     M3_IN2, M3_IN1, M3_SLEEP, RP1_IO16_UART0_TX, RP1_IO17_UART0_RX, ENC_CH3, ENC_CH2, ENC_CH1, RP1_OB_LED, CAMERA_TRIGGER};
 
     for (size_t i = 0; i < sizeof(gpio_pins) / sizeof(gpio_pins[0]); i++) {
-        gpio_init(gpio_pins[i]);
+        hal_gpio_init(gpio_pins[i]);
     }
 
-    gpio_set_dir(M3_IN2, GPIO_OUT);
-    gpio_set_dir(M3_IN1, GPIO_OUT);
-    gpio_set_dir(M3_SLEEP, GPIO_OUT);
-    gpio_set_dir(M1_MODE2, GPIO_OUT);
-    gpio_set_dir(M1_MODE1, GPIO_OUT);
-    gpio_set_dir(M1_MODE0, GPIO_OUT);
-    gpio_set_dir(M1_STEP, GPIO_OUT);
-    gpio_set_dir(M1_ENABLE, GPIO_OUT);
-    gpio_set_dir(M1_DIR, GPIO_OUT);
-    gpio_set_dir(M1_NFAULT, GPIO_IN);
-    gpio_set_dir(MOTOR_RESET, GPIO_OUT);
-    gpio_set_dir(MOTOR_SLEEP, GPIO_OUT);
-    gpio_set_dir(ENC_CH1, GPIO_IN);
-    gpio_set_dir(ENC_CH2, GPIO_IN);
-    gpio_set_dir(ENC_CH3, GPIO_IN);
-    gpio_set_dir(RP1_OB_LED, GPIO_OUT);
-
-    gpio_put(M3_IN1, LOW);
-    gpio_put(MOTOR_SLEEP, HIGH);
-    gpio_put(MOTOR_RESET, HIGH);
-    gpio_put(M1_ENABLE, HIGH);
-
-    // UART Initialization
+    hal_gpio_set_dir(M3_IN2, HAL_GPIO_OUT);
+    hal_gpio_set_dir(M3_IN1, HAL_GPIO_OUT);
+    hal_gpio_set_dir(M3_SLEEP, HAL_GPIO_OUT);
+    hal_gpio_set_dir(M1_MODE2, HAL_GPIO_OUT);
+    hal_gpio_set_dir(M1_MODE1, HAL_GPIO_OUT);
+    hal_gpio_set_dir(M1_MODE0, HAL_GPIO_OUT);
+    hal_gpio_set_dir(M1_STEP, HAL_GPIO_OUT);
+    hal_gpio_set_dir(M1_ENABLE, HAL_GPIO_OUT);
+    hal_gpio_set_dir(M1_DIR, HAL_GPIO_OUT);
+    hal_gpio_set_dir(M1_NFAULT, HAL_GPIO_IN);
+    hal_gpio_set_dir(MOTOR_RESET, HAL_GPIO_OUT);
+    hal_gpio_set_dir(MOTOR_SLEEP, HAL_GPIO_OUT);
+    hal_gpio_set_dir(ENC_CH1, HAL_GPIO_IN);
+    hal_gpio_set_dir(ENC_CH2, HAL_GPIO_IN);
+    hal_gpio_set_dir(ENC_CH3, HAL_GPIO_IN);
+    hal_gpio_set_dir(RP1_OB_LED, HAL_GPIO_OUT);
+    hal_gpio_set_dir(CAMERA_TRIGGER, HAL_GPIO_OUT);
+
+    hal_gpio_put(M3_IN1, LOW);
+    hal_gpio_put(MOTOR_SLEEP, HIGH);
+    hal_gpio_put(MOTOR_RESET, HIGH);
+    hal_gpio_put(M1_ENABLE, HIGH);
+    hal_gpio_put(CAMERA_TRIGGER, LOW);
+
+    // command path, the queue, the transports and the bus address are ready before the first byte arrives
+    cmd_queue_init();
+    transport_init();
+    multidrop_init();
+
+    // UART Initialization, the RS-485 driver enable is only driven on a bus. NA turns it on and off later
+    uartconfig->deEnable = multidrop_enabled();
     initialise_uart(uartconfig);
 
-    gpio_set_irq_enabled_with_callback(ENC_CH1, GPIO_IRQ_EDGE_FALL, true, &encoder_isr);
+    // nFAULT is open drain, keep it high while the driver is healthy
+    hal_gpio_set_pulls(M1_NFAULT, true, false);
+
+    // GPIO interrupt sources and the core servicing each of them, with ENCODER_ADC_EDGES the encoder edges
+    // come from the Schmitt triggers of the ADC capture instead
+    gpio_dispatch_register(M1_NFAULT, HAL_GPIO_IRQ_EDGE_FALL, 0, &motor_fault_isr);
+#if !ENCODER_ADC_EDGES
+    gpio_dispatch_register(ENC_CH1, HAL_GPIO_IRQ_EDGE_FALL, 0, &encoder_isr);
+    gpio_dispatch_register(ENC_CH2, HAL_GPIO_IRQ_EDGE_FALL | HAL_GPIO_IRQ_EDGE_RISE, 0, &motor_index_isr);
+    gpio_dispatch_register(ENC_CH1, HAL_GPIO_IRQ_EDGE_RISE, 1, &detect_rise_in_channel_one_isr);
+#endif
+    gpio_dispatch_enable_core();
+    encoder_adc_init(ENCODER_ADC_EDGES);
 
     on_board_led_blink();
-    watchdog_update();
+    hal_watchdog_update();
+    valve_cal_init();
+    speed_tune_init();
     state_rotate_valve("V2");  // "V2" is a constant string for home position
 }
 
-// Private Interrupt service routine for UART RX
+// Interrupt service routine for UART RX, hands the received bytes to the line assembly of the UART transport
 #pragma irq_entry
-static void on_uart_rx() {
-    watchdog_update();
-    while (uart_is_readable(UART_ID))  {
-        memset(mainUartStruct.rxBuffer, 0, MAX_SIZE);
-        uart_read_byte(UART_ID, mainUartStruct.rxBuffer);          
-        clear_buffer(UART_ID);
-
-        if (*mainUartStruct.rxBuffer == 'K') {
-            uart_k_flag = true;
-        }
-        else {
-            uart_ix_flag = true;
-        }
+void on_uart_rx(void) {
+    hal_watchdog_update();
+    uart_tx_irq_service(MAIN_UART_INSTANCE);
+    while (hal_uart_is_readable(MAIN_UART_INSTANCE)) {
+        transport_receive(TRANSPORT_UART, (char)hal_uart_getc_raw(MAIN_UART_INSTANCE));
     }
 }
 
 // Simplest form of getting 64 bit time from the timer.
-static uint64_t get_time(void) {
-    uint32_t lo = timer_hw->timelr;
-    uint32_t hi = timer_hw->timehr;
-    return ((uint64_t) hi << 32u) | lo;
+uint64_t get_time(void) {
+    return hal_time_us_64();
 }
 
 // Private Interrupt service routine for encoder
 #pragma irq_entry
-void encoder_isr(){
+void __time_critical_func(encoder_isr)(uint gpio, uint32_t events) {
     end_time = get_time();
     if(end_time - start_time > 1000) {
-        actual_encoder_value = (actual_encoder_value + 1)%(ENCODER_NO_OF_PULSES + 1);
+        motor_encoder_pulse(end_time);
     }
 }
 
 // Private Interrupt service routine for encoder channel 1
 #pragma irq_entry
-void detect_rise_in_channel_one_isr() {
+void __time_critical_func(detect_rise_in_channel_one_isr)(uint gpio, uint32_t events) {
     start_time = get_time();
 }
 
-/* end of file */
\ No newline at end of file
+/*** end of file ***/
\ No newline at end of file
@@ -7,29 +7,12 @@
 #ifndef _GPIO_CONTROL_H
 #define _GPIO_CONTROL_H
 
-#include "hardware/watchdog.h"
-#include "hardware/irq.h"
-#include "hardware/adc.h"
-#include "hardware/gpio.h"
-#include "hardware/uart.h"
-#include "hardware/timer.h"
-#include "hardware/i2c.h"
-#include "pico/binary_info.h"
 #include <string.h>
-#include "pico/multicore.h"
-#include "uart_driver.h"
 #include <stdatomic.h>
 #include <stdbool.h>
-
-// Define or undefine this macro to enable or disable debug prints
-#define DEBUG_PRINT_ENABLED 0
-
-// Debug print macro
-#if DEBUG_PRINT_ENABLED
-    #define DEBUG_PRINT(fmt, ...) printf(fmt, ##__VA_ARGS__)
-#else
-    #define DEBUG_PRINT(fmt, ...) do {} while(0)
-#endif
+#include "hal.h"
+#include "uart_driver.h"
+#include "debug_print.h"
 
 // Constants
 #define MAX_SIZE 20
@@ -58,6 +41,9 @@
 // On-board LED
 #define RP1_OB_LED 25  // On board LED
 
+// Image capture trigger output
+#define CAMERA_TRIGGER 12
+
 // Valve Motor Pins
 #define M1_STEP 4    // MOTOR1_STEP
 #define M1_DIR 6     // MOTOR1_DIRECTION
@@ -89,7 +75,7 @@
 #define ELEVEN_BYTES 11
 #define TWENTY_BYTES 20
 
-#define NUM_OF_UART_FUNCS 15
+#define NUM_OF_UART_FUNCS 28
 
 // Status Codes
 #define VIBRATION_SUCCESSFUL 1
@@ -97,9 +83,15 @@
 
 // Enumeration for State Machines
 enum DesiredFunc {
-    K, V1, V2, V3, V4, V5, V6, ST, SF, IV, RS, WV, FV, MO, TS
+    K, V1, V2, V3, V4, V5, V6, ST, SF, IV, RS, WV, FV, MO, TS, IQ, TM, TD, SS, SR, VB, VC, VS, EA, CT, ET, NA, SN
 };
 
+// Returned by get_desired_func() for unknown commands
+#define INVALID_DESIRED_FUNC ((enum DesiredFunc)-1)
+
+// Kill switch raised by the transports, served by core 1
+extern atomic_bool uart_k_flag;
+
 //
 /**
  * @brief This function gets the enum corresponding to state machine
@@ -107,6 +99,12 @@ enum DesiredFunc {
  */
 enum DesiredFunc get_desired_func(const char *ptr_data_str);
 
+/**
+ * @brief This function gets the command string of a state machine, terminated by '\n'
+ * @param func
+ */
+const char *get_desired_func_name(enum DesiredFunc func);
+
 /**
  * @brief This function is used to test the motor
  * @param ptr_data_str
@@ -139,21 +137,23 @@ void initialisations(uart_config_t *uartconfig);
 
 /**
  * @brief Interrupt Service routine to update the counter based on the pulse generated on optical sensor
- *
+ * @param gpio
+ * @param events
  */
-void encoder_isr();
+void encoder_isr(uint gpio, uint32_t events);
 
 /**
  * @brief Interrupt Service routine to update the counter based on the pulse generated on optical sensor
- *
+ * @param gpio
+ * @param events
  */
-void detect_rise_in_channel_one_isr();
+void detect_rise_in_channel_one_isr(uint gpio, uint32_t events);
 
 /**
  * @brief This function is used to reset the pico microcnotroller
  * @param ptr_data_str
  */
-int reset_pico(char *ptr_data_str);
+int reset_pico(const char *ptr_data_str);
 
 /**
  * @brief This function is used to trigger vibration helper function
@@ -186,10 +186,10 @@ int shaker_off();
 void on_board_led_blink();
 
 /**
- * @brief ISR to indicate when there is a message in the uart communication channel.
+ * @brief ISR of the main UART, hands received bytes to the line assembly of the UART transport
  *
  */
-static void on_uart_rx();
+void on_uart_rx(void);
 
 /**
  * @brief This function is used to report the Pico's firmware version to RPi4
@@ -199,16 +199,14 @@ bool report_firmware_version(const char *version);
 
 /**
  * @brief This function is used to turn off the motor
- * @param version
+ *
  */
 bool turn_off_motor();
 
 /**
- * @brief This function is used to determine the current time
+ * @brief This function is used to determine the current time, 64 bit microsecond timer
  */
-static uint64_t get_time(void);
-
-// Removed global variable declarations; these should be managed in the implementation or passed as parameters
+uint64_t get_time(void);
 
 #endif /* GPIO_CONTROL_H */
 
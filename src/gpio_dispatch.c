@@ -0,0 +1,100 @@
+/**
+ * @file gpio_dispatch.c
+ * @brief Per-pin GPIO interrupt dispatcher Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <stdio.h>
+#include "gpio_dispatch.h"
+
+typedef struct {
+    gpio_dispatch_handler_t handler;
+    gpio_dispatch_stats_t stats;
+} gpio_dispatch_entry_t;
+
+static gpio_dispatch_entry_t dispatch_entries[GPIO_DISPATCH_MAX_HANDLERS];
+static uint dispatch_entry_count = 0;
+
+// Direct lookup from (core, pin) to the owning entry, keeps the dispatch path O(1)
+static gpio_dispatch_entry_t *dispatch_table[GPIO_DISPATCH_NUM_CORES][GPIO_DISPATCH_NUM_PINS];
+
+int gpio_dispatch_register(uint gpio, uint32_t events, uint core, gpio_dispatch_handler_t handler) {
+    if (gpio >= GPIO_DISPATCH_NUM_PINS || core >= GPIO_DISPATCH_NUM_CORES || handler == NULL || events == 0) {
+        return GPIO_DISPATCH_INVALID;
+    }
+    if (dispatch_table[core][gpio] != NULL) return GPIO_DISPATCH_SLOT_TAKEN;
+    if (dispatch_entry_count == GPIO_DISPATCH_MAX_HANDLERS) return GPIO_DISPATCH_TABLE_FULL;
+
+    gpio_dispatch_entry_t *entry = &dispatch_entries[dispatch_entry_count++];
+    entry->handler = handler;
+    entry->stats.gpio = (uint8_t)gpio;
+    entry->stats.core = (uint8_t)core;
+    entry->stats.events = events;
+    entry->stats.invocation_count = 0;
+    entry->stats.max_exec_cycles = 0;
+    dispatch_table[core][gpio] = entry;
+    return GPIO_DISPATCH_OK;
+}
+
+// Private GPIO callback shared by both cores, runs from RAM
+static void __time_critical_func(gpio_dispatch_callback)(uint gpio, uint32_t events) {
+    uint32_t start = hal_cycle_count();
+    gpio_dispatch_entry_t *entry = dispatch_table[hal_get_core_num()][gpio];
+    if (entry == NULL) return;
+
+    entry->handler(gpio, events);
+
+    uint32_t elapsed = (hal_cycle_count() - start) & HAL_CYCLE_MASK;
+    entry->stats.invocation_count++;
+    if (elapsed > entry->stats.max_exec_cycles) {
+        entry->stats.max_exec_cycles = elapsed;
+    }
+}
+
+void gpio_dispatch_enable_core(void) {
+    uint core = hal_get_core_num();
+
+    // the cycle counter is banked per core, start it free running for the execution time measurement
+    hal_cycle_counter_start();
+
+    hal_gpio_set_irq_callback(&gpio_dispatch_callback);
+    for (uint i = 0; i < dispatch_entry_count; i++) {
+        if (dispatch_entries[i].stats.core == core) {
+            hal_gpio_set_irq_enabled(dispatch_entries[i].stats.gpio, dispatch_entries[i].stats.events, true);
+        }
+    }
+    hal_gpio_irq_bank_enable();
+}
+
+bool gpio_dispatch_get_stats(uint index, gpio_dispatch_stats_t *stats) {
+    if (index >= dispatch_entry_count || stats == NULL) return false;
+    *stats = dispatch_entries[index].stats;
+    return true;
+}
+
+uint gpio_dispatch_handler_count(void) {
+    return dispatch_entry_count;
+}
+
+size_t gpio_dispatch_format_stats(char *buffer, size_t size) {
+    if (buffer == NULL || size == 0) return 0;
+    size_t len = (size_t)snprintf(buffer, size, "iq");
+    for (uint i = 0; i < dispatch_entry_count && len < size; i++) {
+        const gpio_dispatch_stats_t *stats = &dispatch_entries[i].stats;
+        len += (size_t)snprintf(buffer + len, size - len, "_%u:%u:%lu:%lu", stats->gpio, stats->core,
+                                (unsigned long)stats->invocation_count, (unsigned long)stats->max_exec_cycles);
+    }
+    if (len < size) len += (size_t)snprintf(buffer + len, size - len, "\n");
+    return len < size ? len : size - 1;
+}
+
+void gpio_dispatch_reset_stats(void) {
+    uint32_t irq_status = hal_save_and_disable_interrupts();
+    for (uint i = 0; i < dispatch_entry_count; i++) {
+        dispatch_entries[i].stats.invocation_count = 0;
+        dispatch_entries[i].stats.max_exec_cycles = 0;
+    }
+    hal_restore_interrupts(irq_status);
+}
+
+/*** end of file ***/
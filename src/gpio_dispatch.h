@@ -0,0 +1,87 @@
+/** @file gpio_dispatch.h
+*
+* @brief This module owns the per-core GPIO interrupt callback and dispatches edges to per-pin handlers.
+*
+*/
+
+#ifndef _GPIO_DISPATCH_H
+#define _GPIO_DISPATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "hal.h"
+
+// Dispatcher sizes
+#define GPIO_DISPATCH_NUM_CORES HAL_NUM_CORES
+#define GPIO_DISPATCH_NUM_PINS HAL_NUM_GPIOS
+#define GPIO_DISPATCH_MAX_HANDLERS 8
+
+// Status Codes
+#define GPIO_DISPATCH_OK 0
+#define GPIO_DISPATCH_INVALID -1
+#define GPIO_DISPATCH_SLOT_TAKEN -2
+#define GPIO_DISPATCH_TABLE_FULL -3
+
+// Handler signature, same arguments as the SDK callback
+typedef void (*gpio_dispatch_handler_t)(uint gpio, uint32_t events);
+
+// Per-handler statistics, execution time is measured in core cycles with the HAL cycle counter. It starts in
+// the dispatcher, the interrupt entry latency before it is not included
+typedef struct {
+    uint8_t gpio;
+    uint8_t core;
+    uint32_t events;
+    uint32_t invocation_count;
+    uint32_t max_exec_cycles;      // worst case from dispatcher entry to handler return
+} gpio_dispatch_stats_t;
+
+/**
+ * @brief Registers a handler for one pin and its edge mask on the given core.
+ *        Only one handler may own a pin on a core, edges of the same pin can be split across cores
+ * @param gpio    - GPIO number
+ * @param events  - HAL_GPIO_IRQ_EDGE_FALL / HAL_GPIO_IRQ_EDGE_RISE / levels mask
+ * @param core    - core that services the interrupt
+ * @param handler - interrupt handler, should be declared with __time_critical_func
+ * @return GPIO_DISPATCH_OK on success, negative status code on failure
+ */
+int gpio_dispatch_register(uint gpio, uint32_t events, uint core, gpio_dispatch_handler_t handler);
+
+/**
+ * @brief Installs the dispatcher as the GPIO callback of the calling core and
+ *        enables every edge registered for this core. Must be called on each core
+ *
+ */
+void gpio_dispatch_enable_core(void);
+
+/**
+ * @brief Reads the statistics of a registered handler
+ * @param index - handler index, 0 to gpio_dispatch_handler_count() - 1
+ * @param stats - filled with the handler statistics
+ * @return true if the index is valid
+ */
+bool gpio_dispatch_get_stats(uint index, gpio_dispatch_stats_t *stats);
+
+/**
+ * @brief Returns the number of registered handlers
+ *
+ */
+uint gpio_dispatch_handler_count(void);
+
+/**
+ * @brief Formats the statistics of all handlers as "iq_<gpio>:<core>:<count>:<max_exec_cycles>_...\n"
+ * @param buffer - destination buffer
+ * @param size   - size of the destination buffer
+ * @return number of characters written
+ */
+size_t gpio_dispatch_format_stats(char *buffer, size_t size);
+
+/**
+ * @brief Clears invocation counts and worst case execution times
+ *
+ */
+void gpio_dispatch_reset_stats(void);
+
+#endif /* _GPIO_DISPATCH_H */
+
+/*** end of file ***/
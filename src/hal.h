@@ -0,0 +1,554 @@
+/** @file hal.h
+*
+* @brief Hardware abstraction layer used by every firmware module.
+*        The RP2040 backend (hal_rp2040.h) maps each call 1:1 onto the Pico SDK as static inline functions,
+*        the Linux backend (hal_host.c, built with HAL_HOST) emulates the peripherals for off-target builds.
+*
+*/
+
+#ifndef _HAL_H
+#define _HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(HAL_HOST)
+#define HAL_API extern
+typedef unsigned int uint;
+#define __time_critical_func(func_name) func_name
+#else
+#define HAL_API static inline
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+#endif
+
+// GPIO interrupt events, same encoding as the SDK
+#define HAL_GPIO_IRQ_LEVEL_LOW  0x1u
+#define HAL_GPIO_IRQ_LEVEL_HIGH 0x2u
+#define HAL_GPIO_IRQ_EDGE_FALL  0x4u
+#define HAL_GPIO_IRQ_EDGE_RISE  0x8u
+
+// GPIO directions and functions, same encoding as the SDK
+#define HAL_GPIO_IN             false
+#define HAL_GPIO_OUT            true
+#define HAL_GPIO_FUNC_UART      2
+#define HAL_GPIO_FUNC_PWM       4
+#define HAL_GPIO_FUNC_SIO       5
+
+// UART instances and parity, same encoding as the SDK
+#define HAL_UART0               0
+#define HAL_UART1               1
+#define HAL_UART_PARITY_NONE    0
+#define HAL_UART_PARITY_EVEN    1
+#define HAL_UART_PARITY_ODD     2
+
+// PWM channels
+#define HAL_PWM_CHAN_A          0
+#define HAL_PWM_CHAN_B          1
+
+// Number of cores and GPIOs
+#define HAL_NUM_CORES           2
+#define HAL_NUM_GPIOS           30
+
+// Persistent storage is the last erase sector of the flash, programmed as a whole
+#define HAL_FLASH_SECTOR_SIZE   4096u
+
+// ADC inputs 0 to 3 are GPIO 26 to 29, 12 bit conversions of at least 2 us at the 48 MHz ADC clock
+#define HAL_ADC_FIRST_GPIO      26
+#define HAL_ADC_NUM_INPUTS      4
+#define HAL_ADC_MAX             4095u
+#define HAL_ADC_MIN_SAMPLE_US   2
+
+typedef uint8_t hal_uart_id_t;
+typedef void (*hal_irq_handler_t)(void);
+typedef void (*hal_gpio_irq_callback_t)(uint gpio, uint32_t events);
+
+// Alarm callback, returns the time from its target to the next firing or 0 when done
+typedef struct hal_alarm hal_alarm_t;
+typedef uint64_t (*hal_alarm_callback_t)(hal_alarm_t *alarm);
+
+#if defined(HAL_HOST)
+// cycle counter is a nanosecond counter on the host
+#define HAL_CYCLE_MASK          0xFFFFFFFFu
+
+typedef struct hal_spin_lock hal_spin_lock_t;
+typedef struct hal_repeating_timer hal_repeating_timer_t;
+typedef bool (*hal_repeating_timer_callback_t)(hal_repeating_timer_t *timer);
+struct hal_repeating_timer {
+    int64_t period_us;
+    uint64_t next_us;
+    hal_repeating_timer_callback_t callback;
+    void *user_data;
+    bool active;
+};
+
+struct hal_alarm {
+    uint64_t target_us;
+    hal_alarm_callback_t callback;
+    void *user_data;
+    bool active;
+};
+
+// Free running ADC capture, conversions are emulated when the firmware reads the count or an input changes
+typedef struct {
+    uint16_t *ring;
+    uint32_t ring_samples;
+    uint32_t input_mask;
+    uint32_t sample_us;
+    uint64_t start_us;          // time of conversion 0
+    uint32_t written;           // conversions emulated so far
+} hal_adc_capture_t;
+#else
+// SysTick is a 24 bit counter clocked from the core clock
+#define HAL_CYCLE_MASK          0x00FFFFFFu
+
+typedef spin_lock_t hal_spin_lock_t;
+typedef repeating_timer_t hal_repeating_timer_t;
+typedef repeating_timer_callback_t hal_repeating_timer_callback_t;
+
+struct hal_alarm {
+    alarm_id_t id;
+    uint64_t target_us;
+    hal_alarm_callback_t callback;
+    void *user_data;
+};
+
+// Free running ADC capture, a data DMA channel fills the ring and a control channel re-arms it
+typedef struct {
+    uint16_t *ring;
+    uint32_t ring_samples;      // also the re-arm count read by the control channel
+    uint32_t input_mask;
+    uint32_t sample_us;
+    uint64_t start_us;          // time of conversion 0
+    uint32_t written;           // conversions counted by hal_adc_capture_count()
+    uint32_t ring_position;
+    int data_channel;
+    int control_channel;
+} hal_adc_capture_t;
+#endif
+
+/* ---------------------------------------------------------------- GPIO */
+
+/**
+ * @brief Initialises a GPIO as a SIO input driven low
+ * @param gpio
+ */
+HAL_API void hal_gpio_init(uint gpio);
+
+/**
+ * @brief Sets the direction of a GPIO
+ * @param gpio
+ * @param out - HAL_GPIO_OUT or HAL_GPIO_IN
+ */
+HAL_API void hal_gpio_set_dir(uint gpio, bool out);
+
+/**
+ * @brief Drives an output GPIO
+ * @param gpio
+ * @param value
+ */
+HAL_API void hal_gpio_put(uint gpio, bool value);
+
+/**
+ * @brief Reads the input level of a GPIO
+ * @param gpio
+ */
+HAL_API bool hal_gpio_get(uint gpio);
+
+/**
+ * @brief Configures the pull resistors of a GPIO
+ * @param gpio
+ * @param up
+ * @param down
+ */
+HAL_API void hal_gpio_set_pulls(uint gpio, bool up, bool down);
+
+/**
+ * @brief Selects the peripheral function of a GPIO
+ * @param gpio
+ * @param function - HAL_GPIO_FUNC_*
+ */
+HAL_API void hal_gpio_set_function(uint gpio, uint function);
+
+/**
+ * @brief Installs the GPIO interrupt callback of the calling core
+ * @param callback
+ */
+HAL_API void hal_gpio_set_irq_callback(hal_gpio_irq_callback_t callback);
+
+/**
+ * @brief Enables or disables GPIO interrupt events on the calling core
+ * @param gpio
+ * @param events - HAL_GPIO_IRQ_* mask
+ * @param enabled
+ */
+HAL_API void hal_gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled);
+
+/**
+ * @brief Enables the GPIO bank interrupt on the calling core
+ *
+ */
+HAL_API void hal_gpio_irq_bank_enable(void);
+
+/* ---------------------------------------------------------------- UART */
+
+/**
+ * @brief Initialises a UART at the given baud rate
+ * @param uart
+ * @param baudrate
+ */
+HAL_API void hal_uart_init(hal_uart_id_t uart, uint32_t baudrate);
+
+/**
+ * @brief Sets the UART frame format
+ * @param uart
+ * @param data_bits
+ * @param stop_bits
+ * @param parity - HAL_UART_PARITY_*
+ */
+HAL_API void hal_uart_set_format(hal_uart_id_t uart, uint data_bits, uint stop_bits, uint parity);
+
+/**
+ * @brief Enables or disables hardware flow control
+ * @param uart
+ * @param cts
+ * @param rts
+ */
+HAL_API void hal_uart_set_hw_flow(hal_uart_id_t uart, bool cts, bool rts);
+
+/**
+ * @brief Enables or disables the UART FIFOs
+ * @param uart
+ * @param enabled
+ */
+HAL_API void hal_uart_set_fifo_enabled(hal_uart_id_t uart, bool enabled);
+
+/**
+ * @brief Installs the interrupt handler of a UART and enables its interrupt line
+ * @param uart
+ * @param handler
+ */
+HAL_API void hal_uart_set_irq_handler(hal_uart_id_t uart, hal_irq_handler_t handler);
+
+/**
+ * @brief Enables or disables the RX and TX interrupts of a UART
+ * @param uart
+ * @param rx
+ * @param tx
+ */
+HAL_API void hal_uart_set_irq_enables(hal_uart_id_t uart, bool rx, bool tx);
+
+/**
+ * @brief Enables or disables only the TX interrupt, asserted while the TX holding register is empty
+ * @param uart
+ * @param enabled
+ */
+HAL_API void hal_uart_set_tx_irq_enabled(hal_uart_id_t uart, bool enabled);
+
+/**
+ * @brief Checks whether a received byte is available
+ * @param uart
+ */
+HAL_API bool hal_uart_is_readable(hal_uart_id_t uart);
+
+/**
+ * @brief Checks whether the TX holding register has room
+ * @param uart
+ */
+HAL_API bool hal_uart_is_writable(hal_uart_id_t uart);
+
+/**
+ * @brief Checks whether the UART is still shifting out a character
+ * @param uart
+ */
+HAL_API bool hal_uart_is_busy(hal_uart_id_t uart);
+
+/**
+ * @brief Reads the UART data register without waiting
+ * @param uart
+ */
+HAL_API uint8_t hal_uart_getc_raw(hal_uart_id_t uart);
+
+/**
+ * @brief Writes the UART data register without waiting
+ * @param uart
+ * @param c
+ */
+HAL_API void hal_uart_putc_raw(hal_uart_id_t uart, uint8_t c);
+
+/* ---------------------------------------------------------------- Timer */
+
+/**
+ * @brief Returns the 64 bit microsecond timer
+ *
+ */
+HAL_API uint64_t hal_time_us_64(void);
+
+/**
+ * @brief Sleeps for the given number of microseconds
+ * @param us
+ */
+HAL_API void hal_sleep_us(uint64_t us);
+
+/**
+ * @brief Sleeps for the given number of milliseconds
+ * @param ms
+ */
+HAL_API void hal_sleep_ms(uint32_t ms);
+
+/**
+ * @brief Body of busy wait loops
+ *
+ */
+HAL_API void hal_tight_loop_contents(void);
+
+/**
+ * @brief Starts a repeating timer, a negative period keeps the time between callback starts constant
+ * @param period_us
+ * @param callback  - return false to stop the timer
+ * @param user_data
+ * @param timer     - storage owned by the caller until the timer is cancelled
+ * @return true if the timer is started
+ */
+HAL_API bool hal_add_repeating_timer_us(int64_t period_us, hal_repeating_timer_callback_t callback, void *user_data, hal_repeating_timer_t *timer);
+
+/**
+ * @brief Cancels a repeating timer
+ * @param timer
+ */
+HAL_API bool hal_cancel_repeating_timer(hal_repeating_timer_t *timer);
+
+/**
+ * @brief Fires a callback at an absolute time, from the timer interrupt of the calling core. The callback
+ *        may fire again by returning the time from its target to the next one, so pulse edges keep their spacing
+ * @param time_us   - target on the microsecond timer, a past target fires at once
+ * @param callback
+ * @param user_data
+ * @param alarm     - storage owned by the caller until the alarm is done or cancelled
+ * @return true if the alarm is set
+ */
+HAL_API bool hal_add_alarm_at(uint64_t time_us, hal_alarm_callback_t callback, void *user_data, hal_alarm_t *alarm);
+
+/**
+ * @brief Cancels an alarm that has not fired for the last time
+ * @param alarm
+ */
+HAL_API void hal_cancel_alarm(hal_alarm_t *alarm);
+
+/**
+ * @brief Starts the free running cycle counter of the calling core
+ *
+ */
+HAL_API void hal_cycle_counter_start(void);
+
+/**
+ * @brief Returns the up counting cycle counter of the calling core, wraps at HAL_CYCLE_MASK
+ *
+ */
+HAL_API uint32_t hal_cycle_count(void);
+
+/* ---------------------------------------------------------------- PWM */
+
+/**
+ * @brief Returns the PWM slice of a GPIO
+ * @param gpio
+ */
+HAL_API uint hal_pwm_gpio_to_slice_num(uint gpio);
+
+/**
+ * @brief Sets the integer and 4 bit fractional clock divider of a PWM slice
+ * @param slice_num
+ * @param integer   - 1 to 255, 0 divides by 256
+ * @param fract
+ */
+HAL_API void hal_pwm_set_clkdiv_int_frac(uint slice_num, uint8_t integer, uint8_t fract);
+
+/**
+ * @brief Sets the counter wrap value of a PWM slice
+ * @param slice_num
+ * @param wrap
+ */
+HAL_API void hal_pwm_set_wrap(uint slice_num, uint16_t wrap);
+
+/**
+ * @brief Sets the compare level of a PWM channel
+ * @param slice_num
+ * @param chan - HAL_PWM_CHAN_A or HAL_PWM_CHAN_B
+ * @param level
+ */
+HAL_API void hal_pwm_set_chan_level(uint slice_num, uint chan, uint16_t level);
+
+/**
+ * @brief Starts or stops a PWM slice
+ * @param slice_num
+ * @param enabled
+ */
+HAL_API void hal_pwm_set_enabled(uint slice_num, bool enabled);
+
+/* ---------------------------------------------------------------- ADC */
+
+/**
+ * @brief Starts free running round robin conversions of the ADC inputs, written into a ring buffer by DMA.
+ *        Conversion k is of the k-th input of the mask in turn, lowest first, at start_us + k * sample_us.
+ *        The digital input of the pins stays enabled
+ * @param input_mask   - ADC inputs to convert, bit 0 is input 0
+ * @param sample_us    - time between two conversions, at least HAL_ADC_MIN_SAMPLE_US
+ * @param ring         - ring_samples conversions, aligned to its size in bytes
+ * @param ring_samples - power of two, at most 16384
+ * @param capture      - storage owned by the caller until the capture is stopped
+ * @return true if the capture is running
+ */
+HAL_API bool hal_adc_capture_start(uint32_t input_mask, uint32_t sample_us, uint16_t *ring, uint32_t ring_samples, hal_adc_capture_t *capture);
+
+/**
+ * @brief Returns the number of conversions written since the start, wraps at 32 bits. Must be called at
+ *        least once per ring period, conversion k is at ring[k % ring_samples] until it is overwritten
+ * @param capture
+ */
+HAL_API uint32_t hal_adc_capture_count(hal_adc_capture_t *capture);
+
+/**
+ * @brief Stops the conversions and releases the DMA channels
+ * @param capture
+ */
+HAL_API void hal_adc_capture_stop(hal_adc_capture_t *capture);
+
+/* ---------------------------------------------------------------- Watchdog */
+
+/**
+ * @brief Enables the watchdog
+ * @param delay_ms
+ * @param pause_on_debug
+ */
+HAL_API void hal_watchdog_enable(uint32_t delay_ms, bool pause_on_debug);
+
+/**
+ * @brief Reloads the watchdog
+ *
+ */
+HAL_API void hal_watchdog_update(void);
+
+/* ---------------------------------------------------------------- Multicore and sync */
+
+/**
+ * @brief Starts core 1 at the given entry function
+ * @param entry
+ */
+HAL_API void hal_multicore_launch_core1(void (*entry)(void));
+
+/**
+ * @brief Returns the number of the calling core
+ *
+ */
+HAL_API uint hal_get_core_num(void);
+
+/**
+ * @brief Disables interrupts on the calling core
+ * @return previous interrupt state for hal_restore_interrupts()
+ */
+HAL_API uint32_t hal_save_and_disable_interrupts(void);
+
+/**
+ * @brief Restores the interrupt state saved by hal_save_and_disable_interrupts()
+ * @param status
+ */
+HAL_API void hal_restore_interrupts(uint32_t status);
+
+/**
+ * @brief Waits for an event sent by hal_send_event() on either core, an interrupt or the timeout. An event
+ *        sent before the wait ends it at once, the return can also be early without a cause
+ * @param timeout_us
+ */
+HAL_API void hal_wait_for_event_us(uint64_t timeout_us);
+
+/**
+ * @brief Sends an event, ends the waits of both cores in hal_wait_for_event_us()
+ *
+ */
+HAL_API void hal_send_event(void);
+
+/**
+ * @brief Claims and initialises an unused hardware spin lock
+ *
+ */
+HAL_API hal_spin_lock_t *hal_spin_lock_claim(void);
+
+/**
+ * @brief Disables interrupts and takes a spin lock
+ * @param lock
+ * @return previous interrupt state for hal_spin_unlock()
+ */
+HAL_API uint32_t hal_spin_lock_blocking(hal_spin_lock_t *lock);
+
+/**
+ * @brief Releases a spin lock and restores interrupts
+ * @param lock
+ * @param status
+ */
+HAL_API void hal_spin_unlock(hal_spin_lock_t *lock, uint32_t status);
+
+/* ---------------------------------------------------------------- Flash */
+
+/**
+ * @brief Returns the memory mapped storage sector, HAL_FLASH_SECTOR_SIZE bytes, erased bytes read 0xFF
+ *
+ */
+HAL_API const uint8_t *hal_flash_storage(void);
+
+/**
+ * @brief Erases and programs the storage sector. The other core is paused while the flash is busy and
+ *        must have called hal_flash_lockout_init()
+ * @param data - HAL_FLASH_SECTOR_SIZE bytes in RAM
+ * @return true if the sector is programmed
+ */
+HAL_API bool hal_flash_storage_write(const uint8_t *data);
+
+/**
+ * @brief Lets the calling core be paused by a flash write from the other core
+ *
+ */
+HAL_API void hal_flash_lockout_init(void);
+
+/* ---------------------------------------------------------------- USB CDC */
+
+/**
+ * @brief Reads the bytes received on the USB CDC interface, never waits
+ * @param dst
+ * @param len - size of dst
+ * @return number of bytes read
+ */
+HAL_API size_t hal_usb_cdc_read(uint8_t *dst, size_t len);
+
+/**
+ * @brief Sends bytes on the USB CDC interface, waits a bounded time for the host to take them
+ * @param src
+ * @param len
+ * @return number of bytes sent
+ */
+HAL_API size_t hal_usb_cdc_write(const uint8_t *src, size_t len);
+
+/**
+ * @brief Checks whether a host has the USB CDC interface open
+ *
+ */
+HAL_API bool hal_usb_cdc_connected(void);
+
+/* ---------------------------------------------------------------- Stdio */
+
+/**
+ * @brief Initialises the debug console (USB CDC on the RP2040)
+ *
+ */
+HAL_API void hal_stdio_init(void);
+
+#if defined(HAL_HOST)
+#include "hal_host.h"
+#else
+#include "hal_rp2040.h"
+#endif
+
+#endif /* _HAL_H */
+
+/*** end of file ***/
@@ -0,0 +1,982 @@
+/**
+ * @file hal_host.c
+ * @brief Linux backend of the hardware abstraction layer
+ * @author Yashas Nagaraj Udupa
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "hal.h"
+
+#define HOST_NUM_UARTS 2
+#define HOST_UART_RX_FIFO_SIZE 256
+#define HOST_UART_TX_BUFFER_SIZE 1024
+#define HOST_MAX_TIMERS 8
+#define HOST_MAX_IRQ_ROUNDS 64
+#define HOST_NUM_PWM_SLICES 8
+#define HOST_USB_WRITE_TIMEOUT_MS 100
+
+// Default ADC reading of an emulated input, levels of the optical sensor outputs
+#define HOST_ADC_HIGH 3800u
+#define HOST_ADC_LOG_SIZE 16        // changes of an ADC input kept until the conversions reach them
+#define HOST_ADC_LOW 200u
+
+typedef struct {
+    bool out;
+    bool value;
+    bool pull_up;
+    bool pull_down;
+    bool driven;
+    bool driven_level;
+    uint8_t function;
+} host_gpio_t;
+
+typedef struct {
+    int rx_fd;
+    int tx_fd;
+    bool rx_eof;
+    bool rx_irq;
+    bool tx_irq;
+    hal_irq_handler_t handler;
+    uint8_t rx_fifo[HOST_UART_RX_FIFO_SIZE];
+    uint32_t rx_head;
+    uint32_t rx_tail;
+    uint8_t tx_buffer[HOST_UART_TX_BUFFER_SIZE];
+    size_t tx_len;
+} host_uart_t;
+
+typedef struct {
+    uint16_t wrap;
+    uint16_t level[2];
+    bool enabled;
+} host_pwm_t;
+
+struct hal_spin_lock {
+    int unused;
+};
+
+// One recursive lock stands in for "interrupts disabled" on both cores
+static pthread_mutex_t hal_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static _Thread_local uint current_core = 0;
+static _Thread_local uint32_t irq_disable_depth = 0;
+static _Thread_local bool in_irq = false;
+
+static host_gpio_t host_gpio[HAL_NUM_GPIOS];
+static hal_gpio_irq_callback_t gpio_callback[HAL_NUM_CORES];
+static uint32_t gpio_irq_enabled[HAL_NUM_CORES][HAL_NUM_GPIOS];
+static bool gpio_bank_enabled[HAL_NUM_CORES];
+static uint32_t gpio_irq_pending[HAL_NUM_GPIOS];
+static volatile uint32_t gpio_pending_mask = 0;   // one bit per GPIO with latched events
+static void (*gpio_output_hook)(uint gpio, bool value) = NULL;
+
+static host_uart_t host_uart[HOST_NUM_UARTS] = {
+    {.rx_fd = STDIN_FILENO, .tx_fd = STDOUT_FILENO},
+    {.rx_fd = -1, .tx_fd = -1},
+};
+
+static host_pwm_t host_pwm[HOST_NUM_PWM_SLICES];
+
+// USB CDC interface, attached to file descriptors or to the device named by HAL_HOST_USB
+static int usb_rx_fd = -1;
+static int usb_tx_fd = -1;
+static bool usb_rx_eof = false;
+
+// Virtual clock, sleeps jump straight to their deadline instead of waiting
+static bool virtual_time_enabled = false;
+static volatile uint64_t virtual_now_us = 0;
+static hal_repeating_timer_t *host_timers[HOST_MAX_TIMERS];
+static hal_alarm_t *host_alarms[HOST_MAX_TIMERS];
+static struct hal_spin_lock host_spin_lock;
+
+// Virtual clock scheduler, the clock only advances once every running core sleeps
+static pthread_mutex_t virtual_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t virtual_wakeup = PTHREAD_COND_INITIALIZER;
+static uint virtual_running_cores = 1;
+static uint virtual_sleeping_cores = 0;
+static bool virtual_asleep[HAL_NUM_CORES];
+static uint64_t virtual_deadline[HAL_NUM_CORES];
+static bool virtual_advancing = false;
+static bool virtual_event_wait[HAL_NUM_CORES];
+
+// Event register of hal_send_event(), the pipe wakes a wait in real time
+static atomic_bool host_event = false;
+static int event_pipe[2] = {-1, -1};
+static pthread_once_t event_pipe_once = PTHREAD_ONCE_INIT;
+
+// UART traffic observer
+static void (*uart_capture_hook)(hal_uart_id_t uart, bool tx, uint8_t byte) = NULL;
+
+// ADC capture, at most one running. The conversions are only made when the capture is read, the level
+// changes of the inputs in between are logged with the level they replaced
+typedef struct {
+    uint64_t time_us[HOST_ADC_LOG_SIZE];
+    bool level[HOST_ADC_LOG_SIZE];
+    uint32_t head;
+    uint32_t tail;
+} host_adc_log_t;
+
+static hal_adc_capture_t *adc_capture = NULL;
+static host_adc_log_t adc_log[HAL_ADC_NUM_INPUTS];
+static uint16_t (*adc_source)(uint input, bool level, uint64_t time_us) = NULL;
+static void adc_capture_note(uint gpio, bool old_level);
+
+/* ---------------------------------------------------------------- Interrupt emulation */
+
+static bool gpio_input_level(uint gpio) {
+    const host_gpio_t *pin = &host_gpio[gpio];
+    if (pin->driven) return pin->driven_level;
+    if (pin->out) return pin->value;
+    return pin->pull_up;
+}
+
+// Private helper latching the edge events of a level change
+static void gpio_latch_edge(uint gpio, bool old_level, bool new_level) {
+    if (old_level == new_level) return;
+    gpio_irq_pending[gpio] |= new_level ? HAL_GPIO_IRQ_EDGE_RISE : HAL_GPIO_IRQ_EDGE_FALL;
+    gpio_pending_mask |= 1u << gpio;
+}
+
+// Private helper moving received bytes into the RX FIFO, the descriptor is non blocking once the RX interrupt is on
+static void uart_poll_rx(host_uart_t *uart) {
+    if (uart->rx_fd < 0 || uart->rx_eof || !uart->rx_irq) return;
+    while (uart->rx_head - uart->rx_tail < HOST_UART_RX_FIFO_SIZE) {
+        uint8_t c;
+        ssize_t n = read(uart->rx_fd, &c, 1);
+        if (n == 1) {
+            uart->rx_fifo[uart->rx_head++ % HOST_UART_RX_FIFO_SIZE] = c;
+            if (uart_capture_hook) uart_capture_hook((hal_uart_id_t)(uart - host_uart), false, c);
+        } else {
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) uart->rx_eof = true;
+            break;
+        }
+    }
+}
+
+static void uart_flush_tx(host_uart_t *uart) {
+    size_t sent = 0;
+    while (sent < uart->tx_len) {
+        ssize_t n = write(uart->tx_fd, uart->tx_buffer + sent, uart->tx_len - sent);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        sent += (size_t)n;
+    }
+    uart->tx_len = 0;
+}
+
+static uint64_t next_timer_deadline(void) {
+    uint64_t next = UINT64_MAX;
+    for (int i = 0; i < HOST_MAX_TIMERS; i++) {
+        if (host_timers[i] && host_timers[i]->active && host_timers[i]->next_us < next) next = host_timers[i]->next_us;
+        if (host_alarms[i] && host_alarms[i]->active && host_alarms[i]->target_us < next) next = host_alarms[i]->target_us;
+    }
+    return next;
+}
+
+// Private helper, cheap check whether any interrupt source may need servicing
+static bool irq_work_possible(void) {
+    if (gpio_pending_mask) return true;
+    for (int i = 0; i < HOST_NUM_UARTS; i++) {
+        if (host_uart[i].tx_irq || host_uart[i].tx_len) return true;
+        if (host_uart[i].rx_irq && (host_uart[i].rx_head != host_uart[i].rx_tail || (host_uart[i].rx_fd >= 0 && !host_uart[i].rx_eof))) return true;
+    }
+    return next_timer_deadline() <= hal_time_us_64();
+}
+
+// Private function delivering every pending interrupt, runs like an interrupt handler on the calling thread
+static void service_pending(void) {
+    if (in_irq || irq_disable_depth || !irq_work_possible()) return;
+
+    pthread_mutex_lock(&hal_lock);
+    in_irq = true;
+    uint saved_core = current_core;
+
+    for (int round = 0; round < HOST_MAX_IRQ_ROUNDS; round++) {
+        bool delivered = false;
+
+        uint32_t pending_mask = gpio_pending_mask;
+        gpio_pending_mask = 0;
+        for (uint gpio = 0; pending_mask; gpio++, pending_mask >>= 1) {
+            if (!(pending_mask & 1u) || !gpio_irq_pending[gpio]) continue;
+            for (uint core = 0; core < HAL_NUM_CORES; core++) {
+                uint32_t events = gpio_irq_pending[gpio] & gpio_irq_enabled[core][gpio];
+                if (!events || !gpio_bank_enabled[core] || !gpio_callback[core]) continue;
+                gpio_irq_pending[gpio] &= ~events;
+                current_core = core;
+                gpio_callback[core](gpio, events);
+                delivered = true;
+            }
+            // events no core listens to are not kept, enabling an edge later must not fire stale events
+            gpio_irq_pending[gpio] = 0;
+        }
+
+        for (int i = 0; i < HOST_NUM_UARTS; i++) {
+            host_uart_t *uart = &host_uart[i];
+            uart_poll_rx(uart);
+            bool rx_pending = uart->rx_irq && uart->rx_head != uart->rx_tail;
+            if ((rx_pending || uart->tx_irq) && uart->handler) {
+                uint32_t rx_before = uart->rx_tail;
+                size_t tx_before = uart->tx_len;
+                current_core = 0;
+                uart->handler();
+                delivered |= uart->rx_tail != rx_before || uart->tx_len != tx_before;
+            }
+        }
+
+        uint64_t now = hal_time_us_64();
+        for (int i = 0; i < HOST_MAX_TIMERS; i++) {
+            hal_repeating_timer_t *timer = host_timers[i];
+            if (!timer || !timer->active || now < timer->next_us) continue;
+            current_core = 0;
+            uint64_t period = (uint64_t)(timer->period_us < 0 ? -timer->period_us : timer->period_us);
+            timer->next_us += period;
+            if (timer->next_us <= now) timer->next_us = now + period;
+            if (!timer->callback(timer)) {
+                timer->active = false;
+                host_timers[i] = NULL;
+            }
+            delivered = true;
+        }
+
+        for (int i = 0; i < HOST_MAX_TIMERS; i++) {
+            hal_alarm_t *alarm = host_alarms[i];
+            if (!alarm || !alarm->active || now < alarm->target_us) continue;
+            current_core = 0;
+            uint64_t next_us = alarm->callback(alarm);
+            if (next_us) {
+                alarm->target_us += next_us;
+            } else if (host_alarms[i] == alarm) {
+                alarm->active = false;
+                host_alarms[i] = NULL;
+            }
+            delivered = true;
+        }
+
+        if (!delivered) break;
+    }
+
+    for (int i = 0; i < HOST_NUM_UARTS; i++) {
+        if (host_uart[i].tx_len) uart_flush_tx(&host_uart[i]);
+    }
+
+    current_core = saved_core;
+    in_irq = false;
+    pthread_mutex_unlock(&hal_lock);
+}
+
+static void open_event_pipe(void) {
+    if (pipe(event_pipe) != 0) return;
+    fcntl(event_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(event_pipe[1], F_SETFL, O_NONBLOCK);
+}
+
+// Private function waiting for UART input or the timeout, whichever comes first. With wake_on_event a
+// hal_send_event() ends the wait too
+static void wait_for_event(uint64_t timeout_us, bool wake_on_event) {
+    struct pollfd fds[HOST_NUM_UARTS + 1];
+    nfds_t count = 0;
+    for (int i = 0; i < HOST_NUM_UARTS; i++) {
+        if (host_uart[i].rx_fd >= 0 && !host_uart[i].rx_eof && host_uart[i].rx_irq) {
+            fds[count].fd = host_uart[i].rx_fd;
+            fds[count].events = POLLIN;
+            count++;
+        }
+    }
+    if (wake_on_event && event_pipe[0] >= 0) {
+        fds[count].fd = event_pipe[0];
+        fds[count].events = POLLIN;
+        count++;
+    }
+    struct timespec timeout = {(time_t)(timeout_us / 1000000u), (long)(timeout_us % 1000000u) * 1000};
+    if (count) {
+        ppoll(fds, count, &timeout, NULL);
+    } else {
+        nanosleep(&timeout, NULL);
+    }
+}
+
+/* ---------------------------------------------------------------- GPIO */
+
+void hal_gpio_init(uint gpio) {
+    pthread_mutex_lock(&hal_lock);
+    bool old_level = gpio_input_level(gpio);
+    host_gpio[gpio].out = false;
+    host_gpio[gpio].value = false;
+    host_gpio[gpio].function = HAL_GPIO_FUNC_SIO;
+    gpio_latch_edge(gpio, old_level, gpio_input_level(gpio));
+    pthread_mutex_unlock(&hal_lock);
+}
+
+void hal_gpio_set_dir(uint gpio, bool out) {
+    pthread_mutex_lock(&hal_lock);
+    bool old_level = gpio_input_level(gpio);
+    host_gpio[gpio].out = out;
+    gpio_latch_edge(gpio, old_level, gpio_input_level(gpio));
+    pthread_mutex_unlock(&hal_lock);
+}
+
+void hal_gpio_put(uint gpio, bool value) {
+    pthread_mutex_lock(&hal_lock);
+    bool changed = host_gpio[gpio].value != value;
+    bool old_level = gpio_input_level(gpio);
+    host_gpio[gpio].value = value;
+    gpio_latch_edge(gpio, old_level, gpio_input_level(gpio));
+    if (changed && host_gpio[gpio].out && gpio_output_hook) gpio_output_hook(gpio, value);
+    pthread_mutex_unlock(&hal_lock);
+    service_pending();
+}
+
+bool hal_gpio_get(uint gpio) {
+    return gpio_input_level(gpio);
+}
+
+void hal_gpio_set_pulls(uint gpio, bool up, bool down) {
+    pthread_mutex_lock(&hal_lock);
+    bool old_level = gpio_input_level(gpio);
+    host_gpio[gpio].pull_up = up;
+    host_gpio[gpio].pull_down = down;
+    gpio_latch_edge(gpio, old_level, gpio_input_level(gpio));
+    pthread_mutex_unlock(&hal_lock);
+}
+
+void hal_gpio_set_function(uint gpio, uint function) {
+    host_gpio[gpio].function = (uint8_t)function;
+}
+
+void hal_gpio_set_irq_callback(hal_gpio_irq_callback_t callback) {
+    gpio_callback[current_core] = callback;
+}
+
+void hal_gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled) {
+    pthread_mutex_lock(&hal_lock);
+    if (enabled) {
+        gpio_irq_enabled[current_core][gpio] |= events;
+    } else {
+        gpio_irq_enabled[current_core][gpio] &= ~events;
+    }
+    pthread_mutex_unlock(&hal_lock);
+}
+
+void hal_gpio_irq_bank_enable(void) {
+    gpio_bank_enabled[current_core] = true;
+}
+
+void hal_host_gpio_drive(uint gpio, bool level) {
+    pthread_mutex_lock(&hal_lock);
+    bool old_level = gpio_input_level(gpio);
+    if (gpio >= HAL_ADC_FIRST_GPIO) adc_capture_note(gpio, old_level);
+    host_gpio[gpio].driven = true;
+    host_gpio[gpio].driven_level = level;
+    gpio_latch_edge(gpio, old_level, level);
+    pthread_mutex_unlock(&hal_lock);
+    service_pending();
+}
+
+void hal_host_gpio_release(uint gpio) {
+    pthread_mutex_lock(&hal_lock);
+    bool old_level = gpio_input_level(gpio);
+    if (gpio >= HAL_ADC_FIRST_GPIO) adc_capture_note(gpio, old_level);
+    host_gpio[gpio].driven = false;
+    gpio_latch_edge(gpio, old_level, gpio_input_level(gpio));
+    pthread_mutex_unlock(&hal_lock);
+    service_pending();
+}
+
+void hal_host_set_gpio_output_hook(void (*hook)(uint gpio, bool value)) {
+    gpio_output_hook = hook;
+}
+
+/* ---------------------------------------------------------------- UART */
+
+void hal_uart_init(hal_uart_id_t uart, uint32_t baudrate) {
+}
+
+void hal_uart_set_format(hal_uart_id_t uart, uint data_bits, uint stop_bits, uint parity) {
+}
+
+void hal_uart_set_hw_flow(hal_uart_id_t uart, bool cts, bool rts) {
+}
+
+void hal_uart_set_fifo_enabled(hal_uart_id_t uart, bool enabled) {
+}
+
+void hal_uart_set_irq_handler(hal_uart_id_t uart, hal_irq_handler_t handler) {
+    host_uart[uart].handler = handler;
+}
+
+void hal_uart_set_irq_enables(hal_uart_id_t uart, bool rx, bool tx) {
+    if (rx && host_uart[uart].rx_fd >= 0) {
+        fcntl(host_uart[uart].rx_fd, F_SETFL, fcntl(host_uart[uart].rx_fd, F_GETFL) | O_NONBLOCK);
+    }
+    host_uart[uart].rx_irq = rx;
+    host_uart[uart].tx_irq = tx;
+    service_pending();
+}
+
+void hal_uart_set_tx_irq_enabled(hal_uart_id_t uart, bool enabled) {
+    host_uart[uart].tx_irq = enabled;
+    service_pending();
+}
+
+bool hal_uart_is_readable(hal_uart_id_t uart) {
+    return host_uart[uart].rx_head != host_uart[uart].rx_tail;
+}
+
+bool hal_uart_is_writable(hal_uart_id_t uart) {
+    return host_uart[uart].tx_fd >= 0;
+}
+
+// The host UART hands every character to its descriptor at once
+bool hal_uart_is_busy(hal_uart_id_t uart) {
+    return false;
+}
+
+uint8_t hal_uart_getc_raw(hal_uart_id_t uart) {
+    host_uart_t *port = &host_uart[uart];
+    if (port->rx_head == port->rx_tail) return 0;
+    return port->rx_fifo[port->rx_tail++ % HOST_UART_RX_FIFO_SIZE];
+}
+
+void hal_uart_putc_raw(hal_uart_id_t uart, uint8_t c) {
+    host_uart_t *port = &host_uart[uart];
+    if (port->tx_fd < 0) return;
+    pthread_mutex_lock(&hal_lock);
+    if (port->tx_len == HOST_UART_TX_BUFFER_SIZE) uart_flush_tx(port);
+    port->tx_buffer[port->tx_len++] = c;
+    if (uart_capture_hook) uart_capture_hook(uart, true, c);
+    pthread_mutex_unlock(&hal_lock);
+}
+
+void hal_host_uart_attach(hal_uart_id_t uart, int rx_fd, int tx_fd) {
+    pthread_mutex_lock(&hal_lock);
+    host_uart[uart].rx_fd = rx_fd;
+    host_uart[uart].tx_fd = tx_fd;
+    host_uart[uart].rx_eof = false;
+    pthread_mutex_unlock(&hal_lock);
+}
+
+bool hal_host_uart_rx_eof(hal_uart_id_t uart) {
+    return host_uart[uart].rx_eof && host_uart[uart].rx_head == host_uart[uart].rx_tail;
+}
+
+void hal_host_uart_set_capture(void (*hook)(hal_uart_id_t uart, bool tx, uint8_t byte)) {
+    pthread_mutex_lock(&hal_lock);
+    uart_capture_hook = hook;
+    pthread_mutex_unlock(&hal_lock);
+}
+
+/* ---------------------------------------------------------------- Timer */
+
+static struct timespec host_start_time;
+static pthread_once_t host_start_once = PTHREAD_ONCE_INIT;
+
+static void capture_start_time(void) {
+    clock_gettime(CLOCK_MONOTONIC, &host_start_time);
+}
+
+// Timer starts at 0 like the RP2040 timer after reset
+uint64_t hal_time_us_64(void) {
+    if (virtual_time_enabled) return virtual_now_us;
+    struct timespec now;
+    pthread_once(&host_start_once, capture_start_time);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t elapsed_ns = (int64_t)(now.tv_sec - host_start_time.tv_sec) * 1000000000 + (now.tv_nsec - host_start_time.tv_nsec);
+    return (uint64_t)(elapsed_ns / 1000);
+}
+
+// Private helper, called with virtual_lock held once every running core sleeps: moves the clock to the
+// earliest core or timer deadline and wakes the cores that are due
+static void virtual_advance(void) {
+    uint64_t next = next_timer_deadline();
+    for (uint core = 0; core < HAL_NUM_CORES; core++) {
+        if (virtual_asleep[core] && virtual_deadline[core] < next) next = virtual_deadline[core];
+    }
+    if (next > virtual_now_us) virtual_now_us = next;
+    for (uint core = 0; core < HAL_NUM_CORES; core++) {
+        if (virtual_asleep[core] && virtual_deadline[core] <= virtual_now_us) {
+            virtual_asleep[core] = false;
+            virtual_sleeping_cores--;
+        }
+    }
+    virtual_advancing = true;
+    pthread_mutex_unlock(&virtual_lock);
+    service_pending();
+    pthread_mutex_lock(&virtual_lock);
+    virtual_advancing = false;
+    pthread_cond_broadcast(&virtual_wakeup);
+}
+
+// Private virtual time sleep, the last core to go to sleep steps the clock from deadline to deadline. With
+// wake_on_event a hal_send_event() ends the sleep too
+static void virtual_sleep_us(uint64_t us, bool wake_on_event) {
+    uint core = current_core;
+    service_pending();
+    pthread_mutex_lock(&virtual_lock);
+    if (wake_on_event && atomic_exchange(&host_event, false)) {
+        pthread_mutex_unlock(&virtual_lock);
+        return;
+    }
+    virtual_event_wait[core] = wake_on_event;
+    virtual_deadline[core] = virtual_now_us + us;
+    virtual_asleep[core] = true;
+    virtual_sleeping_cores++;
+    while (virtual_asleep[core]) {
+        if (virtual_sleeping_cores == virtual_running_cores && !virtual_advancing) {
+            virtual_advance();
+        } else {
+            pthread_cond_wait(&virtual_wakeup, &virtual_lock);
+        }
+    }
+    virtual_event_wait[core] = false;
+    pthread_mutex_unlock(&virtual_lock);
+    if (wake_on_event) atomic_store(&host_event, false);
+}
+
+void hal_sleep_us(uint64_t us) {
+    if (virtual_time_enabled) {
+        virtual_sleep_us(us, false);
+        return;
+    }
+    uint64_t deadline = hal_time_us_64() + us;
+    for (;;) {
+        service_pending();
+        uint64_t now = hal_time_us_64();
+        if (now >= deadline) break;
+        uint64_t wake = deadline;
+        uint64_t timer = next_timer_deadline();
+        if (timer < wake) wake = timer;
+        wait_for_event(wake > now ? wake - now : 0, false);
+    }
+}
+
+void hal_sleep_ms(uint32_t ms) {
+    hal_sleep_us((uint64_t)ms * 1000u);
+}
+
+// A busy wait iteration costs one microsecond of virtual time so polling loops terminate
+void hal_tight_loop_contents(void) {
+    if (virtual_time_enabled) {
+        virtual_sleep_us(1, false);
+        return;
+    }
+    service_pending();
+}
+
+bool hal_add_repeating_timer_us(int64_t period_us, hal_repeating_timer_callback_t callback, void *user_data, hal_repeating_timer_t *timer) {
+    if (period_us == 0 || callback == NULL || timer == NULL) return false;
+    pthread_mutex_lock(&hal_lock);
+    for (int i = 0; i < HOST_MAX_TIMERS; i++) {
+        if (host_timers[i] == NULL) {
+            timer->period_us = period_us;
+            timer->next_us = hal_time_us_64() + (uint64_t)(period_us < 0 ? -period_us : period_us);
+            timer->callback = callback;
+            timer->user_data = user_data;
+            timer->active = true;
+            host_timers[i] = timer;
+            pthread_mutex_unlock(&hal_lock);
+            return true;
+        }
+    }
+    pthread_mutex_unlock(&hal_lock);
+    return false;
+}
+
+bool hal_cancel_repeating_timer(hal_repeating_timer_t *timer) {
+    bool found = false;
+    pthread_mutex_lock(&hal_lock);
+    for (int i = 0; i < HOST_MAX_TIMERS; i++) {
+        if (host_timers[i] == timer) {
+            host_timers[i] = NULL;
+            found = true;
+        }
+    }
+    timer->active = false;
+    pthread_mutex_unlock(&hal_lock);
+    return found;
+}
+
+bool hal_add_alarm_at(uint64_t time_us, hal_alarm_callback_t callback, void *user_data, hal_alarm_t *alarm) {
+    if (callback == NULL || alarm == NULL) return false;
+    pthread_mutex_lock(&hal_lock);
+    int slot = -1;
+    for (int i = 0; i < HOST_MAX_TIMERS; i++) {
+        if (host_alarms[i] == alarm) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 && host_alarms[i] == NULL) slot = i;
+    }
+    if (slot < 0) {
+        pthread_mutex_unlock(&hal_lock);
+        return false;
+    }
+    alarm->target_us = time_us;
+    alarm->callback = callback;
+    alarm->user_data = user_data;
+    alarm->active = true;
+    host_alarms[slot] = alarm;
+    pthread_mutex_unlock(&hal_lock);
+    service_pending();
+    return true;
+}
+
+void hal_cancel_alarm(hal_alarm_t *alarm) {
+    pthread_mutex_lock(&hal_lock);
+    for (int i = 0; i < HOST_MAX_TIMERS; i++) {
+        if (host_alarms[i] == alarm) host_alarms[i] = NULL;
+    }
+    alarm->active = false;
+    pthread_mutex_unlock(&hal_lock);
+}
+
+void hal_cycle_counter_start(void) {
+}
+
+uint32_t hal_cycle_count(void) {
+    if (virtual_time_enabled) return (uint32_t)(virtual_now_us * 1000u);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec);
+}
+
+void hal_host_set_virtual_time(bool enabled) {
+    pthread_mutex_lock(&hal_lock);
+    if (enabled && !virtual_time_enabled) {
+        virtual_now_us = hal_time_us_64();
+    }
+    virtual_time_enabled = enabled;
+    pthread_mutex_unlock(&hal_lock);
+}
+
+/* ---------------------------------------------------------------- PWM */
+
+uint hal_pwm_gpio_to_slice_num(uint gpio) {
+    return (gpio >> 1u) & 7u;
+}
+
+void hal_pwm_set_clkdiv_int_frac(uint slice_num, uint8_t integer, uint8_t fract) {
+}
+
+void hal_pwm_set_wrap(uint slice_num, uint16_t wrap) {
+    host_pwm[slice_num].wrap = wrap;
+}
+
+void hal_pwm_set_chan_level(uint slice_num, uint chan, uint16_t level) {
+    host_pwm[slice_num].level[chan & 1u] = level;
+}
+
+void hal_pwm_set_enabled(uint slice_num, bool enabled) {
+    host_pwm[slice_num].enabled = enabled;
+}
+
+void hal_host_pwm_get(uint slice_num, uint16_t *wrap, uint16_t *level_a, bool *enabled) {
+    if (wrap) *wrap = host_pwm[slice_num].wrap;
+    if (level_a) *level_a = host_pwm[slice_num].level[HAL_PWM_CHAN_A];
+    if (enabled) *enabled = host_pwm[slice_num].enabled;
+}
+
+/* ---------------------------------------------------------------- ADC */
+
+// Private helper returning the level of an ADC input at a conversion time, the logged changes up to it are dropped
+static bool adc_input_level(uint input, uint64_t time_us) {
+    host_adc_log_t *log = &adc_log[input];
+    while (log->head != log->tail && log->time_us[log->head % HOST_ADC_LOG_SIZE] <= time_us) log->head++;
+    return log->head != log->tail ? log->level[log->head % HOST_ADC_LOG_SIZE] : gpio_input_level(HAL_ADC_FIRST_GPIO + input);
+}
+
+// Private helper converting up to the given time, called with hal_lock held when the capture is read.
+// Conversions older than the ring are skipped, the round robin order stays tied to the conversion number
+static void adc_capture_fill(uint64_t until_us) {
+    hal_adc_capture_t *capture = adc_capture;
+    if (capture == NULL || until_us <= capture->start_us) return;
+    uint32_t due = (uint32_t)((until_us - capture->start_us + capture->sample_us - 1) / capture->sample_us);
+    if (due - capture->written > capture->ring_samples) capture->written = due - capture->ring_samples;
+
+    uint inputs[HAL_ADC_NUM_INPUTS];
+    uint input_count = 0;
+    for (uint input = 0; input < HAL_ADC_NUM_INPUTS; input++) {
+        if (capture->input_mask & (1u << input)) inputs[input_count++] = input;
+    }
+    for (; capture->written != due; capture->written++) {
+        uint input = inputs[capture->written % input_count];
+        uint64_t time_us = capture->start_us + (uint64_t)capture->written * capture->sample_us;
+        bool level = adc_input_level(input, time_us);
+        uint16_t value = adc_source ? adc_source(input, level, time_us) : (uint16_t)(level ? HOST_ADC_HIGH : HOST_ADC_LOW);
+        capture->ring[capture->written & (capture->ring_samples - 1)] = value > HAL_ADC_MAX ? HAL_ADC_MAX : value;
+    }
+    // changes before the next conversion are behind every input now
+    for (uint input = 0; input < HAL_ADC_NUM_INPUTS; input++) {
+        adc_input_level(input, capture->start_us + (uint64_t)due * capture->sample_us);
+    }
+}
+
+// Private helper logging the level an ADC input had before a change, called with hal_lock held. A full log
+// converts up to now, which empties it unless the capture has only just started
+static void adc_capture_note(uint gpio, bool old_level) {
+    if (adc_capture == NULL || gpio >= HAL_ADC_FIRST_GPIO + HAL_ADC_NUM_INPUTS) return;
+    host_adc_log_t *log = &adc_log[gpio - HAL_ADC_FIRST_GPIO];
+    uint64_t now = hal_time_us_64();
+    if (log->tail - log->head == HOST_ADC_LOG_SIZE) adc_capture_fill(now);
+    if (log->tail - log->head == HOST_ADC_LOG_SIZE) log->head++;
+    log->time_us[log->tail % HOST_ADC_LOG_SIZE] = now;
+    log->level[log->tail % HOST_ADC_LOG_SIZE] = old_level;
+    log->tail++;
+}
+
+bool hal_adc_capture_start(uint32_t input_mask, uint32_t sample_us, uint16_t *ring, uint32_t ring_samples, hal_adc_capture_t *capture) {
+    input_mask &= (1u << HAL_ADC_NUM_INPUTS) - 1;
+    if (input_mask == 0 || sample_us < HAL_ADC_MIN_SAMPLE_US || ring_samples == 0 || (ring_samples & (ring_samples - 1))) return false;
+    pthread_mutex_lock(&hal_lock);
+    if (adc_capture != NULL) {
+        pthread_mutex_unlock(&hal_lock);
+        return false;
+    }
+    capture->ring = ring;
+    capture->ring_samples = ring_samples;
+    capture->input_mask = input_mask;
+    capture->sample_us = sample_us;
+    capture->start_us = hal_time_us_64();
+    capture->written = 0;
+    memset(adc_log, 0, sizeof(adc_log));
+    adc_capture = capture;
+    pthread_mutex_unlock(&hal_lock);
+    return true;
+}
+
+// Conversions still in progress are not counted
+uint32_t hal_adc_capture_count(hal_adc_capture_t *capture) {
+    pthread_mutex_lock(&hal_lock);
+    if (capture == adc_capture) adc_capture_fill(hal_time_us_64());
+    uint32_t written = capture->written;
+    pthread_mutex_unlock(&hal_lock);
+    return written;
+}
+
+void hal_adc_capture_stop(hal_adc_capture_t *capture) {
+    pthread_mutex_lock(&hal_lock);
+    if (capture == adc_capture) adc_capture = NULL;
+    pthread_mutex_unlock(&hal_lock);
+}
+
+void hal_host_set_adc_source(uint16_t (*source)(uint input, bool level, uint64_t time_us)) {
+    pthread_mutex_lock(&hal_lock);
+    adc_source = source;
+    pthread_mutex_unlock(&hal_lock);
+}
+
+/* ---------------------------------------------------------------- Watchdog */
+
+void hal_watchdog_enable(uint32_t delay_ms, bool pause_on_debug) {
+}
+
+void hal_watchdog_update(void) {
+}
+
+/* ---------------------------------------------------------------- Multicore and sync */
+
+static void (*core1_entry_point)(void) = NULL;
+
+static void *core1_thread(void *arg) {
+    current_core = 1;
+    core1_entry_point();
+
+    // a returning core no longer holds the virtual clock back
+    pthread_mutex_lock(&virtual_lock);
+    virtual_running_cores--;
+    pthread_cond_broadcast(&virtual_wakeup);
+    pthread_mutex_unlock(&virtual_lock);
+    return NULL;
+}
+
+void hal_multicore_launch_core1(void (*entry)(void)) {
+    pthread_t thread;
+    core1_entry_point = entry;
+    pthread_mutex_lock(&virtual_lock);
+    virtual_running_cores++;
+    pthread_mutex_unlock(&virtual_lock);
+    if (pthread_create(&thread, NULL, core1_thread, NULL) == 0) {
+        pthread_detach(thread);
+    } else {
+        pthread_mutex_lock(&virtual_lock);
+        virtual_running_cores--;
+        pthread_mutex_unlock(&virtual_lock);
+    }
+}
+
+void hal_wait_for_event_us(uint64_t timeout_us) {
+    if (virtual_time_enabled) {
+        virtual_sleep_us(timeout_us, true);
+        return;
+    }
+    pthread_once(&event_pipe_once, open_event_pipe);
+    uint64_t deadline = hal_time_us_64() + timeout_us;
+    for (;;) {
+        service_pending();
+        if (atomic_exchange(&host_event, false)) break;
+        uint64_t now = hal_time_us_64();
+        if (now >= deadline) break;
+        uint64_t wake = deadline;
+        uint64_t timer = next_timer_deadline();
+        if (timer < wake) wake = timer;
+        wait_for_event(wake > now ? wake - now : 0, true);
+    }
+    uint8_t drain[16];
+    while (event_pipe[0] >= 0 && read(event_pipe[0], drain, sizeof(drain)) > 0) {
+    }
+}
+
+// Like SEV the event is latched until a wait takes it, a core sleeping in virtual time is woken at once
+void hal_send_event(void) {
+    atomic_store(&host_event, true);
+    if (virtual_time_enabled) {
+        pthread_mutex_lock(&virtual_lock);
+        for (uint core = 0; core < HAL_NUM_CORES; core++) {
+            if (virtual_event_wait[core] && virtual_asleep[core]) {
+                virtual_asleep[core] = false;
+                virtual_sleeping_cores--;
+            }
+        }
+        pthread_cond_broadcast(&virtual_wakeup);
+        pthread_mutex_unlock(&virtual_lock);
+        return;
+    }
+    // a full pipe already wakes the waiting core, the byte can be dropped
+    pthread_once(&event_pipe_once, open_event_pipe);
+    if (event_pipe[1] >= 0) {
+        ssize_t n = write(event_pipe[1], "", 1);
+        (void)n;
+    }
+}
+
+uint hal_get_core_num(void) {
+    return current_core;
+}
+
+uint32_t hal_save_and_disable_interrupts(void) {
+    pthread_mutex_lock(&hal_lock);
+    return irq_disable_depth++;
+}
+
+void hal_restore_interrupts(uint32_t status) {
+    irq_disable_depth = status;
+    pthread_mutex_unlock(&hal_lock);
+    if (status == 0) service_pending();
+}
+
+hal_spin_lock_t *hal_spin_lock_claim(void) {
+    return &host_spin_lock;
+}
+
+uint32_t hal_spin_lock_blocking(hal_spin_lock_t *lock) {
+    return hal_save_and_disable_interrupts();
+}
+
+void hal_spin_unlock(hal_spin_lock_t *lock, uint32_t status) {
+    hal_restore_interrupts(status);
+}
+
+/* ---------------------------------------------------------------- Flash */
+
+// RAM image of the storage sector, erased on first use
+static uint8_t host_flash[HAL_FLASH_SECTOR_SIZE];
+static bool host_flash_ready = false;
+
+const uint8_t *hal_flash_storage(void) {
+    pthread_mutex_lock(&hal_lock);
+    if (!host_flash_ready) {
+        memset(host_flash, 0xFF, sizeof(host_flash));
+        host_flash_ready = true;
+    }
+    pthread_mutex_unlock(&hal_lock);
+    return host_flash;
+}
+
+bool hal_flash_storage_write(const uint8_t *data) {
+    pthread_mutex_lock(&hal_lock);
+    memcpy(host_flash, data, sizeof(host_flash));
+    host_flash_ready = true;
+    pthread_mutex_unlock(&hal_lock);
+    return true;
+}
+
+void hal_flash_lockout_init(void) {
+}
+
+/* ---------------------------------------------------------------- USB CDC */
+
+size_t hal_usb_cdc_read(uint8_t *dst, size_t len) {
+    if (usb_rx_fd < 0 || usb_rx_eof) return 0;
+    ssize_t n = read(usb_rx_fd, dst, len);
+    if (n > 0) return (size_t)n;
+    if (n == 0) usb_rx_eof = true;      // the host closed the port
+    return 0;
+}
+
+size_t hal_usb_cdc_write(const uint8_t *src, size_t len) {
+    size_t sent = 0;
+    if (!hal_usb_cdc_connected()) return 0;
+    while (sent < len) {
+        ssize_t n = write(usb_tx_fd, src + sent, len - sent);
+        if (n > 0) {
+            sent += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        // a full descriptor gets the same grace period as a USB host that stopped reading
+        struct pollfd fd = {.fd = usb_tx_fd, .events = POLLOUT};
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || poll(&fd, 1, HOST_USB_WRITE_TIMEOUT_MS) <= 0) break;
+    }
+    return sent;
+}
+
+bool hal_usb_cdc_connected(void) {
+    return usb_tx_fd >= 0 && !usb_rx_eof;
+}
+
+void hal_host_usb_attach(int rx_fd, int tx_fd) {
+    if (rx_fd >= 0) {
+        fcntl(rx_fd, F_SETFL, fcntl(rx_fd, F_GETFL) | O_NONBLOCK);
+    }
+    usb_rx_fd = rx_fd;
+    usb_tx_fd = tx_fd;
+    usb_rx_eof = false;
+}
+
+/* ---------------------------------------------------------------- Stdio */
+
+// UART0 keeps the original stdout, printf output of the firmware goes to stderr. HAL_HOST_USB names a
+// device, usually a pseudo-terminal, that stands in for the USB CDC interface
+void hal_stdio_init(void) {
+    if (host_uart[HAL_UART0].tx_fd == STDOUT_FILENO) {
+        fflush(stdout);
+        host_uart[HAL_UART0].tx_fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+
+    const char *usb_device = getenv("HAL_HOST_USB");
+    if (usb_device != NULL && usb_rx_fd < 0) {
+        int fd = open(usb_device, O_RDWR | O_NOCTTY);
+        if (fd < 0) {
+            fprintf(stderr, "hal_host: cannot open %s: %s\n", usb_device, strerror(errno));
+            return;
+        }
+        if (isatty(fd)) {
+            struct termios tio;
+            tcgetattr(fd, &tio);
+            cfmakeraw(&tio);
+            tcsetattr(fd, TCSANOW, &tio);
+        }
+        hal_host_usb_attach(fd, fd);
+    }
+}
+
+/*** end of file ***/
@@ -0,0 +1,92 @@
+/** @file hal_host.h
+*
+* @brief Linux backend of the hardware abstraction layer, host only control API.
+*        Include hal.h instead of this file.
+*
+*        Interrupts are emulated: pending GPIO edges, UART RX/TX and repeating timers are delivered
+*        whenever interrupts are enabled and the firmware sleeps, spins or leaves a critical section.
+*        ADC conversions follow the level of their GPIO unless a source model is installed.
+*        UART0 is attached to stdin/stdout by default, hal_stdio_init() moves printf output to stderr.
+*        The USB CDC interface is unconnected unless attached or named by the HAL_HOST_USB variable.
+*        Time runs from CLOCK_MONOTONIC, or from a virtual clock for simulations.
+*
+*/
+
+#ifndef _HAL_HOST_H
+#define _HAL_HOST_H
+
+/**
+ * @brief Drives an input GPIO from outside the firmware, edges raise the enabled GPIO interrupts
+ * @param gpio
+ * @param level
+ */
+void hal_host_gpio_drive(uint gpio, bool level);
+
+/**
+ * @brief Stops driving an input GPIO, the level falls back to its pull resistor
+ * @param gpio
+ */
+void hal_host_gpio_release(uint gpio);
+
+/**
+ * @brief Installs a hook called whenever the firmware changes a GPIO output level
+ * @param hook
+ */
+void hal_host_set_gpio_output_hook(void (*hook)(uint gpio, bool value));
+
+/**
+ * @brief Attaches a UART to file descriptors, -1 leaves a direction unconnected
+ * @param uart
+ * @param rx_fd
+ * @param tx_fd
+ */
+void hal_host_uart_attach(hal_uart_id_t uart, int rx_fd, int tx_fd);
+
+/**
+ * @brief Checks whether the receive side of a UART reached end of file
+ * @param uart
+ */
+bool hal_host_uart_rx_eof(hal_uart_id_t uart);
+
+/**
+ * @brief Installs an observer of the UART traffic: received bytes as they enter the RX FIFO, transmitted
+ *        bytes as the firmware writes them. The hook runs with interrupts disabled
+ * @param hook - NULL removes the observer
+ */
+void hal_host_uart_set_capture(void (*hook)(hal_uart_id_t uart, bool tx, uint8_t byte));
+
+/**
+ * @brief Attaches the USB CDC interface to file descriptors, the interface is connected while tx_fd is set and
+ *        rx_fd has not reached end of file
+ * @param rx_fd - made non blocking
+ * @param tx_fd
+ */
+void hal_host_usb_attach(int rx_fd, int tx_fd);
+
+/**
+ * @brief Switches the microsecond timer to a virtual clock that only advances when the firmware sleeps.
+ *        Once core 0 and a launched core 1 both sleep, the clock jumps to the earliest sleep or repeating
+ *        timer deadline without waiting. A busy wait iteration costs 1 us
+ * @param enabled - the virtual clock continues from the current time
+ */
+void hal_host_set_virtual_time(bool enabled);
+
+/**
+ * @brief Reads back the state of a PWM slice
+ * @param slice_num
+ * @param wrap      - counter wrap value
+ * @param level_a   - channel A compare level
+ * @param enabled
+ */
+void hal_host_pwm_get(uint slice_num, uint16_t *wrap, uint16_t *level_a, bool *enabled);
+
+/**
+ * @brief Installs the model of the ADC inputs. Without one an input reads a fixed high or low level
+ *        following its GPIO level
+ * @param source - returns the conversion result of an input at a time, NULL restores the default
+ */
+void hal_host_set_adc_source(uint16_t (*source)(uint input, bool level, uint64_t time_us));
+
+#endif /* _HAL_HOST_H */
+
+/*** end of file ***/
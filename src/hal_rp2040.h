@@ -0,0 +1,243 @@
+/** @file hal_rp2040.h
+*
+* @brief RP2040 backend of the hardware abstraction layer, every call maps directly onto the Pico SDK.
+*        Include hal.h instead of this file.
+*
+*/
+
+#ifndef _HAL_RP2040_H
+#define _HAL_RP2040_H
+
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/uart.h"
+#include "hardware/pwm.h"
+#include "hardware/timer.h"
+#include "hardware/watchdog.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/structs/systick.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "pico/flash.h"
+#include "pico/stdio_usb.h"
+#include "pico/time.h"
+
+// SysTick enable with the core clock as source
+#define HAL_SYSTICK_ENABLE_CORE_CLK 0x5
+
+// Storage sector at the end of the flash, time allowed for the other core to pause
+#define HAL_FLASH_STORAGE_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#define HAL_FLASH_LOCKOUT_TIMEOUT_MS 100
+
+// ADC clock, a conversion takes 96 cycles
+#define HAL_ADC_CLOCK_MHZ 48
+
+static inline uart_inst_t *hal_uart_inst(hal_uart_id_t uart) {
+    return uart == HAL_UART1 ? uart1 : uart0;
+}
+
+/* ---------------------------------------------------------------- GPIO */
+
+static inline void hal_gpio_init(uint gpio) { gpio_init(gpio); }
+static inline void hal_gpio_set_dir(uint gpio, bool out) { gpio_set_dir(gpio, out); }
+static inline void hal_gpio_put(uint gpio, bool value) { gpio_put(gpio, value); }
+static inline bool hal_gpio_get(uint gpio) { return gpio_get(gpio); }
+static inline void hal_gpio_set_pulls(uint gpio, bool up, bool down) { gpio_set_pulls(gpio, up, down); }
+static inline void hal_gpio_set_function(uint gpio, uint function) { gpio_set_function(gpio, (enum gpio_function)function); }
+static inline void hal_gpio_set_irq_callback(hal_gpio_irq_callback_t callback) { gpio_set_irq_callback(callback); }
+static inline void hal_gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled) { gpio_set_irq_enabled(gpio, events, enabled); }
+static inline void hal_gpio_irq_bank_enable(void) { irq_set_enabled(IO_IRQ_BANK0, true); }
+
+/* ---------------------------------------------------------------- UART */
+
+static inline void hal_uart_init(hal_uart_id_t uart, uint32_t baudrate) { uart_init(hal_uart_inst(uart), baudrate); }
+static inline void hal_uart_set_format(hal_uart_id_t uart, uint data_bits, uint stop_bits, uint parity) {
+    uart_set_format(hal_uart_inst(uart), data_bits, stop_bits, (uart_parity_t)parity);
+}
+static inline void hal_uart_set_hw_flow(hal_uart_id_t uart, bool cts, bool rts) { uart_set_hw_flow(hal_uart_inst(uart), cts, rts); }
+static inline void hal_uart_set_fifo_enabled(hal_uart_id_t uart, bool enabled) { uart_set_fifo_enabled(hal_uart_inst(uart), enabled); }
+static inline void hal_uart_set_irq_handler(hal_uart_id_t uart, hal_irq_handler_t handler) {
+    uint irq = uart == HAL_UART1 ? UART1_IRQ : UART0_IRQ;
+    irq_set_exclusive_handler(irq, handler);
+    irq_set_enabled(irq, true);
+}
+static inline void hal_uart_set_irq_enables(hal_uart_id_t uart, bool rx, bool tx) { uart_set_irq_enables(hal_uart_inst(uart), rx, tx); }
+static inline void hal_uart_set_tx_irq_enabled(hal_uart_id_t uart, bool enabled) {
+    if (enabled) {
+        hw_set_bits(&uart_get_hw(hal_uart_inst(uart))->imsc, UART_UARTIMSC_TXIM_BITS);
+    } else {
+        hw_clear_bits(&uart_get_hw(hal_uart_inst(uart))->imsc, UART_UARTIMSC_TXIM_BITS);
+    }
+}
+static inline bool hal_uart_is_readable(hal_uart_id_t uart) { return uart_is_readable(hal_uart_inst(uart)); }
+static inline bool hal_uart_is_writable(hal_uart_id_t uart) { return uart_is_writable(hal_uart_inst(uart)); }
+static inline bool hal_uart_is_busy(hal_uart_id_t uart) { return uart_get_hw(hal_uart_inst(uart))->fr & UART_UARTFR_BUSY_BITS; }
+static inline uint8_t hal_uart_getc_raw(hal_uart_id_t uart) { return (uint8_t)uart_get_hw(hal_uart_inst(uart))->dr; }
+static inline void hal_uart_putc_raw(hal_uart_id_t uart, uint8_t c) { uart_get_hw(hal_uart_inst(uart))->dr = c; }
+
+/* ---------------------------------------------------------------- Timer */
+
+static inline uint64_t hal_time_us_64(void) { return time_us_64(); }
+static inline void hal_sleep_us(uint64_t us) { sleep_us(us); }
+static inline void hal_sleep_ms(uint32_t ms) { sleep_ms(ms); }
+static inline void hal_tight_loop_contents(void) { tight_loop_contents(); }
+static inline bool hal_add_repeating_timer_us(int64_t period_us, hal_repeating_timer_callback_t callback, void *user_data, hal_repeating_timer_t *timer) {
+    return add_repeating_timer_us(period_us, callback, user_data, timer);
+}
+static inline bool hal_cancel_repeating_timer(hal_repeating_timer_t *timer) { return cancel_repeating_timer(timer); }
+
+// SDK alarms reschedule relative to the previous target when the callback returns a negative time
+static inline int64_t hal_alarm_trampoline(alarm_id_t id, void *user_data) {
+    hal_alarm_t *alarm = (hal_alarm_t *)user_data;
+    uint64_t next_us = alarm->callback(alarm);
+    if (next_us == 0) {
+        alarm->id = 0;
+        return 0;
+    }
+    alarm->target_us += next_us;
+    return -(int64_t)next_us;
+}
+static inline bool hal_add_alarm_at(uint64_t time_us, hal_alarm_callback_t callback, void *user_data, hal_alarm_t *alarm) {
+    alarm->target_us = time_us;
+    alarm->callback = callback;
+    alarm->user_data = user_data;
+    alarm->id = add_alarm_at(from_us_since_boot(time_us), hal_alarm_trampoline, alarm, true);
+    return alarm->id >= 0;
+}
+static inline void hal_cancel_alarm(hal_alarm_t *alarm) {
+    if (alarm->id > 0) cancel_alarm(alarm->id);
+    alarm->id = 0;
+}
+
+// SysTick is banked per core and counts down, the HAL exposes it as an up counter
+static inline void hal_cycle_counter_start(void) {
+    systick_hw->rvr = HAL_CYCLE_MASK;
+    systick_hw->cvr = 0;
+    systick_hw->csr = HAL_SYSTICK_ENABLE_CORE_CLK;
+}
+static inline uint32_t hal_cycle_count(void) { return ~systick_hw->cvr & HAL_CYCLE_MASK; }
+
+/* ---------------------------------------------------------------- PWM */
+
+static inline uint hal_pwm_gpio_to_slice_num(uint gpio) { return pwm_gpio_to_slice_num(gpio); }
+// written directly, the SDK helper rejects integer 0 which the hardware treats as 256
+static inline void hal_pwm_set_clkdiv_int_frac(uint slice_num, uint8_t integer, uint8_t fract) {
+    pwm_hw->slice[slice_num].div = ((uint32_t)integer << PWM_CH0_DIV_INT_LSB) | ((uint32_t)fract << PWM_CH0_DIV_FRAC_LSB);
+}
+static inline void hal_pwm_set_wrap(uint slice_num, uint16_t wrap) { pwm_set_wrap(slice_num, wrap); }
+static inline void hal_pwm_set_chan_level(uint slice_num, uint chan, uint16_t level) { pwm_set_chan_level(slice_num, chan, level); }
+static inline void hal_pwm_set_enabled(uint slice_num, bool enabled) { pwm_set_enabled(slice_num, enabled); }
+
+/* ---------------------------------------------------------------- ADC */
+
+// The data channel runs ring_samples transfers into the ring and chains to the control channel, which
+// writes ring_samples to the trigger alias of the transfer count and so restarts it without a gap
+static inline bool hal_adc_capture_start(uint32_t input_mask, uint32_t sample_us, uint16_t *ring, uint32_t ring_samples, hal_adc_capture_t *capture) {
+    if (input_mask == 0 || sample_us < HAL_ADC_MIN_SAMPLE_US) return false;
+    capture->data_channel = dma_claim_unused_channel(false);
+    capture->control_channel = dma_claim_unused_channel(false);
+    if (capture->data_channel < 0 || capture->control_channel < 0) {
+        if (capture->data_channel >= 0) dma_channel_unclaim((uint)capture->data_channel);
+        if (capture->control_channel >= 0) dma_channel_unclaim((uint)capture->control_channel);
+        return false;
+    }
+    capture->ring = ring;
+    capture->ring_samples = ring_samples;
+    capture->input_mask = input_mask;
+    capture->sample_us = sample_us;
+    capture->written = 0;
+    capture->ring_position = 0;
+
+    adc_init();
+    adc_select_input((uint)__builtin_ctz(input_mask));
+    adc_set_round_robin(input_mask);
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_set_clkdiv((float)(sample_us * HAL_ADC_CLOCK_MHZ - 1));
+
+    dma_channel_config data = dma_channel_get_default_config((uint)capture->data_channel);
+    channel_config_set_transfer_data_size(&data, DMA_SIZE_16);
+    channel_config_set_read_increment(&data, false);
+    channel_config_set_write_increment(&data, true);
+    channel_config_set_ring(&data, true, (uint)__builtin_ctz(ring_samples * sizeof(uint16_t)));
+    channel_config_set_dreq(&data, DREQ_ADC);
+    channel_config_set_chain_to(&data, (uint)capture->control_channel);
+    dma_channel_configure((uint)capture->data_channel, &data, ring, &adc_hw->fifo, ring_samples, true);
+
+    dma_channel_config control = dma_channel_get_default_config((uint)capture->control_channel);
+    channel_config_set_transfer_data_size(&control, DMA_SIZE_32);
+    channel_config_set_read_increment(&control, false);
+    channel_config_set_write_increment(&control, false);
+    dma_channel_configure((uint)capture->control_channel, &control, &dma_hw->ch[capture->data_channel].al1_transfer_count_trig,
+                          &capture->ring_samples, 1, false);
+
+    capture->start_us = time_us_64();
+    adc_run(true);
+    return true;
+}
+static inline uint32_t hal_adc_capture_count(hal_adc_capture_t *capture) {
+    uint32_t position = ((uint32_t)dma_hw->ch[capture->data_channel].write_addr - (uint32_t)capture->ring) / sizeof(uint16_t);
+    capture->written += (position - capture->ring_position) & (capture->ring_samples - 1);
+    capture->ring_position = position & (capture->ring_samples - 1);
+    return capture->written;
+}
+static inline void hal_adc_capture_stop(hal_adc_capture_t *capture) {
+    adc_run(false);
+    dma_channel_abort((uint)capture->control_channel);
+    dma_channel_abort((uint)capture->data_channel);
+    dma_channel_unclaim((uint)capture->control_channel);
+    dma_channel_unclaim((uint)capture->data_channel);
+    adc_fifo_drain();
+}
+
+/* ---------------------------------------------------------------- Watchdog */
+
+static inline void hal_watchdog_enable(uint32_t delay_ms, bool pause_on_debug) { watchdog_enable(delay_ms, pause_on_debug); }
+static inline void hal_watchdog_update(void) { watchdog_update(); }
+
+/* ---------------------------------------------------------------- Multicore and sync */
+
+static inline void hal_multicore_launch_core1(void (*entry)(void)) { multicore_launch_core1(entry); }
+static inline uint hal_get_core_num(void) { return get_core_num(); }
+static inline uint32_t hal_save_and_disable_interrupts(void) { return save_and_disable_interrupts(); }
+static inline void hal_restore_interrupts(uint32_t status) { restore_interrupts(status); }
+static inline void hal_wait_for_event_us(uint64_t timeout_us) { best_effort_wfe_or_timeout(make_timeout_time_us(timeout_us)); }
+static inline void hal_send_event(void) { __sev(); }
+static inline hal_spin_lock_t *hal_spin_lock_claim(void) { return spin_lock_init(spin_lock_claim_unused(true)); }
+static inline uint32_t hal_spin_lock_blocking(hal_spin_lock_t *lock) { return spin_lock_blocking(lock); }
+static inline void hal_spin_unlock(hal_spin_lock_t *lock, uint32_t status) { spin_unlock(lock, status); }
+
+/* ---------------------------------------------------------------- Flash */
+
+static inline const uint8_t *hal_flash_storage(void) { return (const uint8_t *)(XIP_BASE + HAL_FLASH_STORAGE_OFFSET); }
+// runs with interrupts off and the other core paused, the SDK flash routines execute from RAM
+static inline void hal_flash_program_sector(void *data) {
+    flash_range_erase(HAL_FLASH_STORAGE_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(HAL_FLASH_STORAGE_OFFSET, (const uint8_t *)data, FLASH_SECTOR_SIZE);
+}
+static inline bool hal_flash_storage_write(const uint8_t *data) {
+    return flash_safe_execute(hal_flash_program_sector, (void *)data, HAL_FLASH_LOCKOUT_TIMEOUT_MS) == PICO_OK;
+}
+static inline void hal_flash_lockout_init(void) { flash_safe_execute_core_init(); }
+
+/* ---------------------------------------------------------------- USB CDC */
+
+// The command channel shares the CDC interface of pico_stdio_usb, its driver serialises the TinyUSB calls
+static inline size_t hal_usb_cdc_read(uint8_t *dst, size_t len) {
+    int n = stdio_usb.in_chars((char *)dst, (int)len);
+    return n > 0 ? (size_t)n : 0;
+}
+static inline size_t hal_usb_cdc_write(const uint8_t *src, size_t len) {
+    if (!stdio_usb_connected()) return 0;
+    stdio_usb.out_chars((const char *)src, (int)len);
+    return len;
+}
+static inline bool hal_usb_cdc_connected(void) { return stdio_usb_connected(); }
+
+/* ---------------------------------------------------------------- Stdio */
+
+static inline void hal_stdio_init(void) { stdio_init_all(); }
+
+#endif /* _HAL_RP2040_H */
+
+/*** end of file ***/
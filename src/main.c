@@ -6,6 +6,11 @@
 
 #include "main.h"
 
+// Private prototypes
+static void core1_entry(void);
+static int process_state_machine(const char *data_str);
+static void report_motor_fault(void);
+
 // main UART config Variable
 uart_config_t _mainUartConfig = {
     .uartInst = MAIN_UART_INSTANCE,
@@ -17,54 +22,76 @@ uart_config_t _mainUartConfig = {
     .rxPin = MAIN_UART_RX,
     .txIntrEnable = MAIN_UART_TX_INTR_ENABLE,
     .rxIntrEnable = MAIN_UART_RX_INTR_ENABLE,
-    .handler = mainUartHandler,
+    .deEnable = false,      // set from the bus settings, a point to point board leaves the pin alone
+    .dePin = MAIN_UART_DE,
+    .handler = on_uart_rx,
 };
 
-// Private function that gets launched at core 1 to trigger kill switch and report status to Master
+// The USB command channel opens once the boot benchmark report is out, they never share the CDC interface
+static atomic_bool usb_commands_open = false;
+
+// Private function that gets launched at core 1 to trigger kill switch and report status to Master, it also
+// serves the USB command channel. The kill move keeps polling it between its steps
 static void core1_entry() {
-    gpio_set_irq_enabled_with_callback(ENC_CH1, GPIO_IRQ_EDGE_RISE, true, &detect_rise_in_channel_one_isr);
+    gpio_dispatch_enable_core();
+    hal_flash_lockout_init();
     while(1) {
         if (atomic_load(&uart_k_flag)){
-            memset(mainUartStruct.rxBuffer, 0, MAX_SIZE);
+            uint64_t start_time = get_time();
+            transport_set_response(transport_kill_source());
+            if (atomic_load(&usb_commands_open)) motor_set_step_idle(transport_poll, TRANSPORT_USB_POLL_US);
             reset_pico(valve_coordinates[1].valve_type);
+            motor_set_step_idle(NULL, 0);
+            cmd_stats_record(K, (uint32_t)(get_time() - start_time), motor_correction_count());
             atomic_store(&uart_k_flag, false);
         }
-        sleep_ms(100);
+        if (atomic_load(&usb_commands_open)) transport_poll();
+        if (transport_usb_connected()) {
+            hal_sleep_us(TRANSPORT_USB_POLL_US);
+        } else {
+            hal_sleep_ms(100);
+        }
     }
 }
 
 
-void rp1_feedback(rp1_feedback_response_t rp1Response, uart_config_t *mainUartConfig){
+void rp1_feedback(rp1_feedback_response_t rp1Response){
     char responseMsg[RP1_RESPONSE_BUFFER_SIZE] = {}; // buffer for sending Response
     // crc failed response
     if(rp1Response == CRC_FAILED)
     {
         sprintf(responseMsg, "ERROR:CRC FAIL\r\n");
-        uart_send_string(mainUartConfig, responseMsg);
+        transport_respond((const uint8_t *)responseMsg, strlen(responseMsg));
     }
     // invalid commnd response
     else if(rp1Response == INVALID_COMMAND)
     {
         sprintf(responseMsg, "ERROR:INVALID COMMAND TYPE\r\n");
-        uart_send_string(mainUartConfig, responseMsg);
+        transport_respond((const uint8_t *)responseMsg, strlen(responseMsg));
     }
     // health check failed response
     else if(rp1Response == RP1_HEALTH_CHECK_FAILED)
     {
         sprintf(responseMsg, "ERROR:RP1 HEALTH CHECK FAILED\r\n");
-        uart_send_string(mainUartConfig, responseMsg);
+        transport_respond((const uint8_t *)responseMsg, strlen(responseMsg));
     }
     // health check success response
     else if(rp1Response == RP1_HEALTH_CHECK_SUCCESS)
     {
         sprintf(responseMsg, "SUCCESS:RP1 HEALTH CHECK SUCCESS\r\n");
-        uart_send_string(mainUartConfig, responseMsg);
+        transport_respond((const uint8_t *)responseMsg, strlen(responseMsg));
     }
+}
 
-    // clearing UART Rx buffers
-    memset(mainUartStruct.rxBuffer,0,UART_RX_BUFFER_SIZE);
-    mainUartStruct.rxBufferCount = 0;
-    mainUartStruct.commandRecieved = false;
+// Private function that sends the asynchronous nFAULT frame once per driver fault, to every host listening
+static void report_motor_fault(void) {
+    motor_fault_event_t fault_event;
+    if (motor_fault_take_report(&fault_event)) {
+        char responseMsg[RP1_RESPONSE_BUFFER_SIZE] = {};
+        snprintf(responseMsg, sizeof(responseMsg), "nf_%lu_%llu\n",
+                 (unsigned long)fault_event.fault_count, (unsigned long long)fault_event.timestamp);
+        transport_notify((const uint8_t *)responseMsg, strlen(responseMsg));
+    }
 }
 
 // Private state machine function to process different states based on received commands
@@ -72,6 +99,11 @@ static int process_state_machine(const char *data_str_ptr) {
     int status = INVALID_REQUEST;
     if(*data_str_ptr) {
         enum DesiredFunc userDesiredFunc = get_desired_func(data_str_ptr);
+        move_eta_begin(userDesiredFunc, data_str_ptr);
+        uint64_t start_time = get_time();
+        telemetry_state.active_command = (uint8_t)userDesiredFunc;
+        telemetry_state.rx_queue_depth = (uint8_t)cmd_queue_depth();
+        TRACE_POINT(TRACE_DISPATCH, userDesiredFunc);
 
         switch(userDesiredFunc) {
             case V1: case V2: case V3: case V4: case V5:
@@ -98,53 +130,134 @@ static int process_state_machine(const char *data_str_ptr) {
                 DEBUG_PRINT("Turn off the valve motor \n");
                 status = turn_off_motor();
                 break;
+            case IQ: {
+                DEBUG_PRINT("Entered report IRQ statistics function\n");
+                char irq_stats[RP1_RESPONSE_BUFFER_SIZE] = {};
+                gpio_dispatch_format_stats(irq_stats, sizeof(irq_stats));
+                status = transport_respond((const uint8_t *)irq_stats, strlen(irq_stats));
+                break;
+            }
+            case TM:
+                DEBUG_PRINT("Entered telemetry rate function\n");
+                status = telemetry_command(data_str_ptr);
+                break;
+            case TD:
+                DEBUG_PRINT("Entered trace dump function\n");
+                status = trace_dump_command(data_str_ptr);
+                break;
+            case SS:
+                DEBUG_PRINT("Entered command statistics function\n");
+                status = cmd_stats_command(data_str_ptr);
+                break;
+            case SR:
+                DEBUG_PRINT("Entered command statistics reset function\n");
+                status = cmd_stats_reset_command(data_str_ptr);
+                break;
+            case VB:
+                DEBUG_PRINT("Entered blocked ports function\n");
+                status = valve_route_command(data_str_ptr);
+                break;
+            case VC:
+                DEBUG_PRINT("Entered valve calibration function\n");
+                status = valve_cal_command(data_str_ptr);
+                break;
+            case VS:
+                DEBUG_PRINT("Entered speed tuning function\n");
+                status = speed_tune_command(data_str_ptr);
+                break;
+            case EA:
+                DEBUG_PRINT("Entered encoder signal quality function\n");
+                status = encoder_adc_command(data_str_ptr);
+                break;
+            case CT:
+                DEBUG_PRINT("Entered camera trigger function\n");
+                status = camera_trigger_command(data_str_ptr);
+                break;
+            case ET:
+                DEBUG_PRINT("Entered execution time prediction function\n");
+                status = move_eta_command(data_str_ptr);
+                break;
+            case NA:
+                DEBUG_PRINT("Entered multi-drop addressing function\n");
+                status = multidrop_command(data_str_ptr);
+                break;
+            case SN:
+                DEBUG_PRINT("Entered host session function\n");
+                status = cmd_queue_session_command(data_str_ptr);
+                break;
             default:
                 DEBUG_PRINT("Invalid UART message \n");
-                const char *ack = "Invalid UART message \n";
-                uart_send_bytes(ack, strlen(ack), RP1_UART_NUMBER);
+                rp1_feedback(INVALID_COMMAND);
                 break;
         }
+        telemetry_state.active_command = TELEMETRY_IDLE_COMMAND;
+
+        // valve moves report their correction passes, every other command has none
+        uint32_t corrections = (userDesiredFunc >= V1 && userDesiredFunc <= V5) ? motor_correction_count() : 0;
+        uint32_t elapsed_us = (uint32_t)(get_time() - start_time);
+        cmd_stats_record(userDesiredFunc, elapsed_us, corrections);
+        move_eta_record(userDesiredFunc, elapsed_us);
     }
     return status;
 }
 
 int main(){
     // enable watchdog for 8388 ms 
-    watchdog_enable(8388, true);
+    hal_watchdog_enable(8388, true);
 
     //Invoke the application handlers    
     initialisations(&_mainUartConfig);
 
     //Launch core 1
-    multicore_launch_core1(core1_entry);
+    hal_multicore_launch_core1(core1_entry);
 
-    #ifdef ENABLE_UNIT_TEST
-        //Launch unit tests
-        test_rotate_stepper_motor();
+    #ifdef ENABLE_BENCHMARK
+        //Characterize the valve motor, the report goes to USB CDC
+        test_characterize_valve_motor();
     #endif
+    atomic_store(&usb_commands_open, true);
     
     while(1){
-        watchdog_update();  // to clear watchdog timer
-
-        // CRC Checking
-        #if CRC_ENABLE
-            ret = CheckCRC(mainUartStruct.rxBuffer);
-            if(ret == CRC_FAIL)
-            {
-                DEBUG_PRINT("CRC failed\n");
-                rp1_feedback(CRC_FAILED, &_mainUartConfig);
-                continue;
+        hal_watchdog_update();  // to clear watchdog timer
+
+        // nFAULT reporting
+        report_motor_fault();
+
+        // queued commands run back to back, the entry is released once the command has completed
+        cmd_queue_entry_t *entry;
+        while ((entry = cmd_queue_peek()) != NULL) {
+            DEBUG_PRINT("Command received \n");
+            transport_set_response(entry->transport);
+
+            // broadcast and group commands answer in the response slot of this node
+            bool slotted = entry->slotted;
+            if (slotted) multidrop_slot_begin(entry->received_us);
+
+            // CRC Checking, sequenced commands were checked when they were accepted
+            #if CRC_ENABLE
+            if (!entry->sequenced) {
+                bool ret = check_crc(entry->line);
+                TRACE_POINT(TRACE_CRC_DONE, ret);
+                if(ret == CRC_FAIL)
+                {
+                    DEBUG_PRINT("CRC failed\n");
+                    rp1_feedback(CRC_FAILED);
+                    cmd_queue_complete(entry, CRC_FAILED);
+                    if (slotted) multidrop_slot_end();
+                    continue;
+                }
+                DEBUG_PRINT("CRC success\n");
             }
-            DEBUG_PRINT("CRC success\n");
-        #endif
+            #endif
 
-        if (atomic_load(&uart_ix_flag)){
-            DEBUG_PRINT("Interrupt enabled \n");
-            atomic_store(&uart_ix_flag, false);
-            process_state_machine(mainUartStruct.rxBuffer);
+            cmd_queue_begin(entry);
+            int status = process_state_machine(entry->command);
+            cmd_queue_complete(entry, status);
+            if (slotted) multidrop_slot_end();
+            hal_watchdog_update();
         }
-        sleep_ms(100);
-        tight_loop_contents();
+        // the transports send an event when they queue a line
+        hal_wait_for_event_us(RP1_IDLE_TIMEOUT_US);
     }
 }
 
@@ -3,54 +3,52 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include "pico/stdlib.h"
-#include "pico/stdio_usb.h"
+#include "hal.h"
+#include "debug_print.h"
 #include "gpio_control.h"
 #include "drv8825.h"
 #include "drv8827.h"
 #include "test.h"
-#include "pico/sync.h"  // For atomic operations
 #include "uart_driver.h"
+#include "crc.h"
+#include "gpio_dispatch.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "cmd_stats.h"
+#include "valve_route.h"
+#include "valve_cal.h"
+#include "speed_tune.h"
+#include "encoder_adc.h"
+#include "camera_trigger.h"
+#include "move_eta.h"
+#include "cmd_queue.h"
+#include "transport.h"
+#include "multidrop.h"
+
+// Size of the general feedback buffer
+#define RP1_RESPONSE_BUFFER_SIZE 128
+
+// Longest main loop wait for a queued command, the nFAULT reporting and the watchdog run at least this often
+#define RP1_IDLE_TIMEOUT_US 100000
+
+// General feedback sent back to the RPi
+typedef enum {
+    CRC_FAILED,
+    INVALID_COMMAND,
+    RP1_HEALTH_CHECK_FAILED,
+    RP1_HEALTH_CHECK_SUCCESS
+} rp1_feedback_response_t;
 
-// Define or undefine this macro to enable or disable debug prints
-#define DEBUG_PRINT_ENABLED 0  // Use 0 or 1 for easier toggling
-
-// Debug print macro
-#if DEBUG_PRINT_ENABLED
-#define DEBUG_PRINT(fmt, ...) printf(fmt, ##__VA_ARGS__)
-#else
-#define DEBUG_PRINT(fmt, ...) do {} while(0)  // More efficient than ((void)0)
-#endif
-
-// Extern declarations for global variables
-// main UART Rx data struct variable
-extern uartRxData_t mainUartStruct = {};
-extern atomic_bool uart_ix_flag;
-extern atomic_bool uart_k_flag;
 // Firmware version string, made const for read-only access
 static const char firmware_version[] = "Bv2.7.2\n";
 
-/**
- * @brief This function executes in core 1
- *
- */
-static void core1_entry(void);
-
-/**
- * @brief This function processes the operational state machines
- * 
- * @param data_str       - state machines
- *
- */
-static int process_state_machine(const char *data_str);
-
 /**
  * @brief This function sends back the general feedback for rp1
  * 
- * @param rp1Response       - rp1 general response to send (rp1_feedback_response_t)
- * @param mainUartConfig    - pointer to main UART configuration
+ * @param rp1Response       - rp1 general response to send (rp1_feedback_response_t), goes back on the
+ *                            transport of the command
  */
-void rp1_feedback(rp1_feedback_response_t rp1Response, uart_config_t *mainUartConfig);
+void rp1_feedback(rp1_feedback_response_t rp1Response);
 
 #endif // _RP1_APPLICATION
 
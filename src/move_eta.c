@@ -0,0 +1,108 @@
+/**
+ * @file move_eta.c
+ * @brief Command execution time prediction Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <stdio.h>
+#include "move_eta.h"
+#include "drv8825.h"
+#include "drv8827.h"
+#include "transport.h"
+
+static int32_t eta_bias_us[NUM_OF_UART_FUNCS];        // learned actual - planned, scaled by MOVE_ETA_BIAS_SHIFT
+static move_eta_stats_t eta_stats[NUM_OF_UART_FUNCS];
+static bool eta_ack_field = false;
+
+// Prediction of the dispatched command
+static enum DesiredFunc active_func = INVALID_DESIRED_FUNC;
+static uint32_t active_planned_us = 0;
+static uint32_t active_predicted_us = 0;
+
+// Private function returning the planned time of a command, 0 if it is not predicted
+static uint32_t planned_us(enum DesiredFunc func, const char *ptr_data_str) {
+    switch (func) {
+        case V1: case V2: case V3: case V4: case V5:
+            return motor_predict_move_us(ptr_data_str);
+        case ST: case RS:
+            return vibration_duration_ms(VIBRATION_STANDARD) * 1000u;
+        case WV:
+            return vibration_duration_ms(VIBRATION_WASHING) * 1000u;
+        default:
+            return 0;
+    }
+}
+
+// Private helper adding the learned bias of a command to its plan
+static uint32_t with_bias(enum DesiredFunc func, uint32_t planned) {
+    if (planned == 0) return 0;
+    int64_t predicted = (int64_t)planned + (eta_bias_us[func] >> MOVE_ETA_BIAS_SHIFT);
+    return (uint32_t)PICO_MIN(PICO_MAX(predicted, 1), UINT32_MAX);
+}
+
+uint32_t move_eta_predict(enum DesiredFunc func, const char *ptr_data_str) {
+    if ((unsigned)func >= NUM_OF_UART_FUNCS) return 0;
+    return with_bias(func, planned_us(func, ptr_data_str));
+}
+
+void move_eta_begin(enum DesiredFunc func, const char *ptr_data_str) {
+    active_func = func;
+    active_planned_us = (unsigned)func < NUM_OF_UART_FUNCS ? planned_us(func, ptr_data_str) : 0;
+    active_predicted_us = active_planned_us ? with_bias(func, active_planned_us) : 0;
+}
+
+void move_eta_record(enum DesiredFunc func, uint32_t actual_us) {
+    if (func != active_func || active_planned_us == 0) return;
+    move_eta_stats_t *stats = &eta_stats[func];
+    stats->count++;
+    stats->last_predicted_us = active_predicted_us;
+    stats->last_actual_us = actual_us;
+    stats->abs_error_sum_us += (uint64_t)llabs((int64_t)actual_us - (int64_t)active_predicted_us);
+
+    // the deviation is limited so the scaled bias cannot overflow
+    int64_t limit = INT32_MAX >> (MOVE_ETA_BIAS_SHIFT + 1);
+    int32_t deviation = (int32_t)PICO_MIN(PICO_MAX((int64_t)actual_us - (int64_t)active_planned_us, -limit), limit);
+    eta_bias_us[func] += deviation - (eta_bias_us[func] >> MOVE_ETA_BIAS_SHIFT);
+    active_func = INVALID_DESIRED_FUNC;
+    active_planned_us = active_predicted_us = 0;
+}
+
+void move_eta_append(char *ack, size_t size) {
+    size_t len = strlen(ack);
+    if (!eta_ack_field || active_predicted_us == 0 || len == 0 || ack[len - 1] != '\n') return;
+    snprintf(ack + len - 1, size - (len - 1), "_et%lu\n", (unsigned long)active_predicted_us);
+}
+
+int move_eta_command(const char *ptr_data_str) {
+    char line[MOVE_ETA_LINE_SIZE];
+    const char *args = strchr(ptr_data_str, ',');
+    int status = SUCCESS_INT;
+
+    // a framed "ET" still has its CRC field, the arguments are always followed by it
+    if (args == NULL || strchr(args + 1, ',') == NULL) {
+        for (int func = 0; func < NUM_OF_UART_FUNCS; func++) {
+            const move_eta_stats_t *stats = &eta_stats[func];
+            if (stats->count == 0) continue;
+            snprintf(line, sizeof(line), "et_%.2s_%lu_%lu_%lu_%lu\n", get_desired_func_name((enum DesiredFunc)func),
+                     (unsigned long)stats->count, (unsigned long)stats->last_predicted_us, (unsigned long)stats->last_actual_us,
+                     (unsigned long)(stats->abs_error_sum_us / stats->count));
+            transport_respond((const uint8_t *)line, strlen(line));
+        }
+        snprintf(line, sizeof(line), "et_end\n");
+    } else if (args[1] == '0' || args[1] == '1') {
+        eta_ack_field = args[1] == '1';
+        snprintf(line, sizeof(line), "et_%d\n", status);
+    } else {
+        enum DesiredFunc func = get_desired_func(args + 1);
+        if (func == INVALID_DESIRED_FUNC) {
+            status = MOVE_ETA_INVALID;
+            snprintf(line, sizeof(line), "et_%d\n", status);
+        } else {
+            snprintf(line, sizeof(line), "et_%.2s_%lu\n", args + 1, (unsigned long)move_eta_predict(func, args + 1));
+        }
+    }
+    transport_respond((const uint8_t *)line, strlen(line));
+    return status;
+}
+
+/*** end of file ***/
@@ -0,0 +1,72 @@
+/** @file move_eta.h
+*
+* @brief Execution time prediction of the valve and vibration commands for host side scheduling. Valve moves
+*        are predicted by the motion planner from the current rotor position, vibrations from their profile.
+*        The actual time of every predicted command is recorded and its mean deviation is learned as a bias
+*        on top of the plan, which covers the command and stepping overheads.
+*
+*/
+
+#ifndef _MOVE_ETA_H
+#define _MOVE_ETA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "gpio_control.h"
+
+#define MOVE_ETA_BIAS_SHIFT 3               // the bias follows actual - planned by 1/8 per command
+#define MOVE_ETA_INVALID -1
+#define MOVE_ETA_LINE_SIZE 80
+
+// Predictions of one command
+typedef struct {
+    uint32_t count;                 // predicted commands that completed
+    uint32_t last_predicted_us;
+    uint32_t last_actual_us;
+    uint64_t abs_error_sum_us;      // sum of |actual - predicted|
+} move_eta_stats_t;
+
+/**
+ * @brief Predicts the execution time of a command in the current state
+ * @param func
+ * @param ptr_data_str - the command line
+ * @return microseconds, 0 if the command is not predicted
+ */
+uint32_t move_eta_predict(enum DesiredFunc func, const char *ptr_data_str);
+
+/**
+ * @brief Takes the prediction of a command about to be dispatched, used by its acknowledgement and compared
+ *        with its actual time by move_eta_record()
+ * @param func
+ * @param ptr_data_str
+ */
+void move_eta_begin(enum DesiredFunc func, const char *ptr_data_str);
+
+/**
+ * @brief Records the actual execution time of the dispatched command and updates its bias
+ * @param func
+ * @param actual_us
+ */
+void move_eta_record(enum DesiredFunc func, uint32_t actual_us);
+
+/**
+ * @brief Inserts "_et<us>" with the prediction of the dispatched command before the line feed ending an
+ *        acknowledgement, nothing if the field is disabled or the command has no prediction
+ * @param ack  - acknowledgement ending in '\n'
+ * @param size - size of the ack buffer
+ */
+void move_eta_append(char *ack, size_t size);
+
+/**
+ * @brief ET command: "ET" reports every predicted command as "et_<cmd>_<count>_<predicted>_<actual>_<mean_error>"
+ *        followed by "et_end", "ET,<cmd>" replies "et_<cmd>_<predicted>" for the current state, "ET,1" and "ET,0"
+ *        enable and disable the field of the acknowledgements and reply "et_<status>"
+ * @param ptr_data_str
+ * @return SUCCESS_INT or MOVE_ETA_INVALID
+ */
+int move_eta_command(const char *ptr_data_str);
+
+#endif /* _MOVE_ETA_H */
+
+/*** end of file ***/
@@ -0,0 +1,300 @@
+/**
+ * @file multidrop.c
+ * @brief Multi-drop bus addressing Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "multidrop.h"
+#include "gpio_control.h"
+#include "drv8825.h"
+#include "flash_store.h"
+#include "uart_driver.h"
+#include "transport.h"
+
+#define MULTIDROP_SLOT_RETRY_US 100
+#define MULTIDROP_SLOT_GUARD_US (MAIN_UART_DE_HOLD_US + MULTIDROP_SLOT_RETRY_US)   // driver release and alarm latency
+
+static multidrop_config_t bus_config = {0, MULTIDROP_DEFAULT_NODES, 0, MULTIDROP_DEFAULT_SLOT_US};
+static multidrop_stats_t bus_stats;
+
+// Responses held for the slot, filled by one core between begin and end and sent by the alarm
+static char slot_buffer[MULTIDROP_SLOT_BUFFER_SIZE];
+static size_t slot_length = 0;
+static size_t slot_limit = 0;           // bytes that leave within the slot
+static size_t slot_kept = 0;            // whole lines ahead of the tail
+static bool slot_line_start = true;
+static bool slot_full = false;          // lines left out, later lines take the tail in turn
+static bool slot_skipping = false;      // rest of a line that does not fit
+static volatile bool slot_open = false;
+static volatile bool slot_pending = false;
+static uint slot_core = 0;
+static uint64_t slot_anchor_us = 0;
+static hal_alarm_t slot_alarm;
+
+// Output of the node held for its turn, filled by any core and the receiver
+static char hold_buffer[MULTIDROP_HOLD_BUFFER_SIZE];
+static size_t hold_length = 0;
+static hal_spin_lock_t *hold_lock = NULL;
+static uint64_t turn_end_us = 0;        // the bus master leaves the bus to the node until then
+
+// Private helper returning the response bytes sent within a slot, the driver is off before the next slot starts
+static size_t slot_capacity(uint32_t slot_us) {
+    if (slot_us <= MULTIDROP_SLOT_GUARD_US) return 0;
+    size_t bytes = (slot_us - MULTIDROP_SLOT_GUARD_US) / MAIN_UART_CHAR_US;
+    return bytes < sizeof(slot_buffer) ? bytes : sizeof(slot_buffer);
+}
+
+// Private helper checking the settings, a node must own a slot of the frame that fits a completion
+static bool valid_config(const multidrop_config_t *config) {
+    if (config->node > MULTIDROP_MAX_NODE || config->nodes == 0 || config->nodes > MULTIDROP_MAX_NODE) return false;
+    if (config->node > config->nodes) return false;
+    return slot_capacity(config->slot_us) >= MULTIDROP_MIN_SLOT_BYTES && config->slot_us <= MULTIDROP_MAX_SLOT_US;
+}
+
+// Private alarm callback sending the held responses at the start of the slot
+static uint64_t slot_alarm_callback(hal_alarm_t *alarm) {
+    // the TX ring only fills up with responses of this node, retry once it has drained
+    if (!uart_try_write(MAIN_UART_INSTANCE, (const uint8_t *)slot_buffer, slot_length)) return MULTIDROP_SLOT_RETRY_US;
+    bus_stats.slots++;
+    slot_pending = false;
+    return 0;
+}
+
+// Private function sending the held lines that leave before the turn ends, must be called with hold_lock held.
+// A line longer than a whole turn is dropped, it would never fit
+static void hold_send_locked(void) {
+    uint64_t now = get_time();
+    size_t sent = 0;
+    while (sent < hold_length) {
+        const char *end = memchr(hold_buffer + sent, '\n', hold_length - sent);
+        if (end == NULL) break;
+        size_t line_len = (size_t)(end - (hold_buffer + sent)) + 1;
+        if (line_len * MAIN_UART_CHAR_US + MULTIDROP_SLOT_GUARD_US > bus_config.slot_us) {
+            bus_stats.overflows++;
+            sent += line_len;
+            continue;
+        }
+        uint64_t done_us = now + (uart_tx_pending() + line_len) * MAIN_UART_CHAR_US + MULTIDROP_SLOT_GUARD_US;
+        if (done_us > turn_end_us) break;
+        if (!uart_try_write(MAIN_UART_INSTANCE, (const uint8_t *)hold_buffer + sent, line_len)) break;
+        sent += line_len;
+    }
+    memmove(hold_buffer, hold_buffer + sent, hold_length - sent);
+    hold_length -= sent;
+}
+
+void multidrop_init(void) {
+    if (hold_lock == NULL) {
+        hold_lock = hal_spin_lock_claim();
+    }
+    multidrop_config_t stored;
+    if (flash_store_load(FLASH_STORE_SLOT_MULTIDROP, MULTIDROP_VERSION, &stored, sizeof(stored)) && valid_config(&stored)) {
+        bus_config = stored;
+    }
+}
+
+bool multidrop_enabled(void) {
+    return bus_config.node != 0;
+}
+
+int __time_critical_func(multidrop_route)(uint32_t address) {
+    if (bus_config.node == 0) return MULTIDROP_UNICAST;
+    if (address == bus_config.node) return MULTIDROP_UNICAST;
+    if (address == MULTIDROP_BROADCAST) return MULTIDROP_SLOTTED;
+    if (address >= MULTIDROP_GROUP_BASE && address < MULTIDROP_GROUP_BASE + MULTIDROP_NUM_GROUPS &&
+        (bus_config.groups & (1u << (address - MULTIDROP_GROUP_BASE)))) {
+        return MULTIDROP_SLOTTED;
+    }
+    return MULTIDROP_FOREIGN;
+}
+
+const char *multidrop_parse(const char *line, int *route) {
+    char *end = NULL;
+    *route = MULTIDROP_UNICAST;
+    if (line[0] != MULTIDROP_PREFIX) return line;
+    if (!isdigit((unsigned char)line[1])) return NULL;
+    uint32_t address = (uint32_t)strtoul(line + 1, &end, 10);
+    if (*end != MULTIDROP_SEPARATOR) return NULL;
+    *route = multidrop_route(address);
+    return end + 1;
+}
+
+void multidrop_count_foreign(void) {
+    bus_stats.foreign++;
+    multidrop_turn_end();
+}
+
+void multidrop_turn_begin(void) {
+    uint32_t irq_status = hal_spin_lock_blocking(hold_lock);
+    turn_end_us = get_time() + bus_config.slot_us;
+    hold_send_locked();
+    hal_spin_unlock(hold_lock, irq_status);
+}
+
+void multidrop_turn_end(void) {
+    uint32_t irq_status = hal_spin_lock_blocking(hold_lock);
+    turn_end_us = 0;
+    hal_spin_unlock(hold_lock, irq_status);
+}
+
+bool multidrop_write(const uint8_t *src, size_t len) {
+    uint32_t irq_status = hal_spin_lock_blocking(hold_lock);
+    bool held = len <= sizeof(hold_buffer) - hold_length;
+    if (held) {
+        memcpy(hold_buffer + hold_length, src, len);
+        hold_length += len;
+        hold_send_locked();
+    } else {
+        bus_stats.overflows++;
+    }
+    hal_spin_unlock(hold_lock, irq_status);
+    return held;
+}
+
+void multidrop_slot_begin(uint64_t anchor_us) {
+    // one slot response at a time, the previous one leaves within a frame
+    while (slot_pending) {
+        hal_watchdog_update();
+        hal_sleep_us(MULTIDROP_SLOT_RETRY_US);
+    }
+    slot_length = 0;
+    slot_limit = slot_capacity(bus_config.slot_us);
+    slot_kept = 0;
+    slot_line_start = true;
+    slot_full = false;
+    slot_skipping = false;
+    slot_anchor_us = anchor_us;
+    slot_core = hal_get_core_num();
+    slot_open = true;
+    bus_stats.slotted++;
+}
+
+bool multidrop_slot_capture(const uint8_t *src, size_t len) {
+    if (!slot_open || hal_get_core_num() != slot_core) return false;
+
+    // every line is tagged with the node, the host tells the slots apart without relying on their timing
+    char prefix[MULTIDROP_PREFIX_MAX + 2];
+    int prefix_len = snprintf(prefix, sizeof(prefix), "%c%u%c", MULTIDROP_PREFIX, bus_config.node, MULTIDROP_SEPARATOR);
+    for (size_t i = 0; i < len; i++) {
+        if (slot_skipping) {
+            slot_skipping = src[i] != '\n';
+            slot_line_start = !slot_skipping;
+            continue;
+        }
+        // once lines were left out each line replaces the one before it in the tail, the completion ends up there
+        if (slot_line_start && slot_full) slot_length = slot_kept;
+        size_t needed = slot_line_start ? (size_t)prefix_len + 1 : 1;
+        if (!slot_full && slot_length + needed > slot_limit) {
+            // the first line that does not fit, the last whole lines give way to a tail that holds a completion
+            size_t line_len = slot_length - slot_kept;
+            size_t kept = slot_kept;
+            while (kept > 0 && slot_limit - kept < MULTIDROP_MIN_SLOT_BYTES) {
+                do kept--; while (kept > 0 && slot_buffer[kept - 1] != '\n');
+            }
+            memmove(slot_buffer + kept, slot_buffer + slot_kept, line_len);
+            slot_kept = kept;
+            slot_length = kept + line_len;
+            slot_full = true;
+            bus_stats.overflows++;
+        }
+        if (slot_length + needed > slot_limit) {
+            // whole lines only, a cut line would run into the next one
+            slot_length = slot_kept;
+            slot_skipping = src[i] != '\n';
+            slot_line_start = !slot_skipping;
+            continue;
+        }
+        if (slot_line_start) {
+            memcpy(slot_buffer + slot_length, prefix, (size_t)prefix_len);
+            slot_length += (size_t)prefix_len;
+        }
+        slot_buffer[slot_length++] = (char)src[i];
+        slot_line_start = src[i] == '\n';
+        if (slot_line_start && !slot_full) slot_kept = slot_length;
+    }
+    return true;
+}
+
+void multidrop_slot_end(void) {
+    if (!slot_open || hal_get_core_num() != slot_core) return;
+    slot_open = false;
+    if (slot_length == 0) return;
+
+    // slots repeat every frame from the receipt of the line, the response takes the first one still ahead.
+    // A line that just turned the addressing off is answered at once
+    uint64_t now = get_time();
+    uint64_t start_us = now;
+    if (bus_config.node != 0) {
+        uint64_t offset_us = (uint64_t)(bus_config.node - 1) * bus_config.slot_us;
+        uint64_t frame_us = (uint64_t)bus_config.nodes * bus_config.slot_us;
+        start_us = slot_anchor_us + offset_us;
+        if (start_us <= now) start_us += ((now - start_us) / frame_us + 1) * frame_us;
+    }
+
+    slot_pending = true;
+    if (!hal_add_alarm_at(start_us, slot_alarm_callback, NULL, &slot_alarm)) {
+        slot_pending = false;
+    }
+}
+
+void multidrop_get_config(multidrop_config_t *config) {
+    *config = bus_config;
+}
+
+bool multidrop_configure(const multidrop_config_t *config) {
+    if (!valid_config(config)) return false;
+    bool joined = bus_config.node == 0 && config->node != 0;
+    bus_config = *config;
+    flash_store_save(FLASH_STORE_SLOT_MULTIDROP, MULTIDROP_VERSION, &bus_config, sizeof(bus_config));
+
+    // a board joining the bus got the line point to point, the bus is its own for the reply. One leaving it
+    // sends at once, nothing stays held for a later bus
+    if (joined) {
+        uart_set_de_enabled(true);
+        multidrop_turn_begin();
+    } else if (config->node == 0) {
+        uint32_t irq_status = hal_spin_lock_blocking(hold_lock);
+        hold_length = 0;
+        hal_spin_unlock(hold_lock, irq_status);
+    }
+    return true;
+}
+
+int multidrop_command(const char *ptr_data_str) {
+    char line[MULTIDROP_LINE_SIZE];
+    const char *cursor = strchr(ptr_data_str, ',');
+    int status = SUCCESS_INT;
+
+    // a CRC field alone is not a setting
+    if (cursor == NULL || !isdigit((unsigned char)cursor[1])) {
+        snprintf(line, sizeof(line), "na_%u_%u_%u_%lu_%lu_%lu_%lu_%lu\n", bus_config.node, bus_config.nodes,
+                 bus_config.groups, (unsigned long)bus_config.slot_us, (unsigned long)bus_stats.foreign,
+                 (unsigned long)bus_stats.slotted, (unsigned long)bus_stats.slots, (unsigned long)bus_stats.overflows);
+    } else {
+        // fields are read while they are numbers, the CRC field ends them
+        unsigned long values[4];
+        int count = 0;
+        while (cursor != NULL && count < 4 && isdigit((unsigned char)cursor[1])) {
+            values[count++] = strtoul(cursor + 1, NULL, 10);
+            cursor = strchr(cursor + 1, ',');
+        }
+        multidrop_config_t config = bus_config;
+        if (count >= 1) config.node = (uint8_t)PICO_MIN(values[0], UINT8_MAX);
+        if (count >= 2) config.nodes = (uint8_t)PICO_MIN(values[1], UINT8_MAX);
+        if (count >= 3) config.groups = (uint16_t)PICO_MIN(values[2], UINT16_MAX);
+        if (count >= 4) config.slot_us = (uint32_t)PICO_MIN(values[3], UINT32_MAX);
+        if (count == 0 || !multidrop_configure(&config)) status = MULTIDROP_INVALID;
+        snprintf(line, sizeof(line), "na_%d\n", status);
+    }
+    transport_respond((const uint8_t *)line, strlen(line));
+
+    // a board leaving the bus releases the driver enable after its reply
+    if (!multidrop_enabled()) uart_set_de_enabled(false);
+    return status;
+}
+
+/*** end of file ***/
@@ -0,0 +1,167 @@
+/** @file multidrop.h
+*
+* @brief Addressed framing for several boards on one RS-485 bus. A line "!<address>:<command>,<crc>#" goes to
+*        one node, to every node (address 0) or to a group of nodes, the CRC covers the address. Once a node
+*        ID is set the UART drops foreign and unaddressed lines while they are received, and the node only
+*        transmits when the bus master left the bus to it. A line to the node opens its turn, one slot long:
+*        the master sends nothing on the bus until it ends. The output of the node (acknowledgements,
+*        replies, completions of long commands, nFAULT reports) goes out while it leaves within the turn and
+*        is held for the next turn otherwise; a bare "!<node>:" line polls it. The responses to broadcast
+*        and group lines are sent as "!<node>:<response>" lines in the node's slot of a TDMA frame anchored
+*        on the receipt of the line, so they never collide. The USB interface stays point to point.
+*
+*/
+
+#ifndef _MULTIDROP_H
+#define _MULTIDROP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MULTIDROP_PREFIX '!'
+#define MULTIDROP_SEPARATOR ':'
+#define MULTIDROP_PREFIX_MAX 5              // "!255:"
+
+// Addresses
+#define MULTIDROP_BROADCAST 0
+#define MULTIDROP_MAX_NODE 239
+#define MULTIDROP_GROUP_BASE 240            // 240 to 255 address group 0 to 15
+#define MULTIDROP_NUM_GROUPS 16
+
+// Routes of a received line
+#define MULTIDROP_FOREIGN 0                 // for another node, dropped
+#define MULTIDROP_UNICAST 1                 // answered at once
+#define MULTIDROP_SLOTTED 2                 // answered in the node's response slot
+
+#define MULTIDROP_MIN_SLOT_BYTES 40         // a tagged completion, "!<node>:cp_<seq>_<status>", about 3.8 ms at 115200 baud
+#define MULTIDROP_MAX_SLOT_US 1000000u
+#define MULTIDROP_DEFAULT_SLOT_US 20000u    // 226 response bytes at 115200 baud
+#define MULTIDROP_DEFAULT_NODES 16
+#define MULTIDROP_SLOT_BUFFER_SIZE 256
+#define MULTIDROP_HOLD_BUFFER_SIZE 512    // output waiting for the turn of the node
+#define MULTIDROP_VERSION 1
+
+#define MULTIDROP_INVALID -1
+#define MULTIDROP_LINE_SIZE 96
+
+// Bus settings, kept in flash
+typedef struct {
+    uint8_t node;               // 1 to MULTIDROP_MAX_NODE, 0 leaves the UART point to point
+    uint8_t nodes;              // slots per frame, at least the highest node ID on the bus
+    uint16_t groups;            // bit g joins group address MULTIDROP_GROUP_BASE + g
+    uint32_t slot_us;
+} multidrop_config_t;
+
+// Bus counters
+typedef struct {
+    uint32_t foreign;           // lines dropped by the receive filter
+    uint32_t slotted;           // broadcast and group lines queued
+    uint32_t slots;             // responses sent in a slot
+    uint32_t overflows;         // slotted responses with lines left out and held lines dropped
+} multidrop_stats_t;
+
+/**
+ * @brief Loads the bus settings, called before the UART interrupt is enabled
+ *
+ */
+void multidrop_init(void);
+
+/**
+ * @brief Checks whether the UART is on a shared bus, a node ID is set
+ *
+ */
+bool multidrop_enabled(void);
+
+/**
+ * @brief Returns the route of a line addressed to an address, every address is answered at once on a point
+ *        to point UART
+ * @param address
+ * @return MULTIDROP_FOREIGN, MULTIDROP_UNICAST or MULTIDROP_SLOTTED
+ */
+int multidrop_route(uint32_t address);
+
+/**
+ * @brief Finds the command after the address prefix of a line
+ * @param line
+ * @param route - route of the line, MULTIDROP_UNICAST without a prefix
+ * @return the line past "!<address>:", the line itself without a prefix, NULL for a malformed prefix
+ */
+const char *multidrop_parse(const char *line, int *route);
+
+/**
+ * @brief Counts a line dropped by the receive filter, the turn of the node ends with it
+ *
+ */
+void multidrop_count_foreign(void);
+
+/**
+ * @brief Opens the turn of the node for one slot from now and sends the held lines that fit, called when
+ *        a line addressed to the node is received
+ *
+ */
+void multidrop_turn_begin(void);
+
+/**
+ * @brief Ends the turn of the node, called when the bus master sends a line to other nodes
+ *
+ */
+void multidrop_turn_end(void);
+
+/**
+ * @brief Sends output of the node on the bus, whole lines that leave before its turn ends go out at once
+ *        and the rest is held for the next turn. Never waits, safe from interrupts
+ * @param src
+ * @param len
+ * @return true if sent or held, false if the hold buffer has no room (counted as an overflow)
+ */
+bool multidrop_write(const uint8_t *src, size_t len);
+
+/**
+ * @brief Starts holding the responses of the calling core for its slot, waits until the previous slot
+ *        response is sent
+ * @param anchor_us - time the broadcast line was received
+ */
+void multidrop_slot_begin(uint64_t anchor_us);
+
+/**
+ * @brief Holds a response while a slot is open on the calling core. Only whole lines that leave within the
+ *        slot at MAIN_UART_BAUDRATE are held. Once a line does not fit, the last MULTIDROP_MIN_SLOT_BYTES are
+ *        freed for the last line of the response, its completion
+ * @param src
+ * @param len
+ * @return true if the response is held, false if it is to be sent at once
+ */
+bool multidrop_slot_capture(const uint8_t *src, size_t len);
+
+/**
+ * @brief Closes the slot and schedules the held responses at the start of the next slot of the node
+ *
+ */
+void multidrop_slot_end(void);
+
+/**
+ * @brief Reads the bus settings
+ * @param config
+ */
+void multidrop_get_config(multidrop_config_t *config);
+
+/**
+ * @brief Validates, applies and saves the bus settings, a slot holds at least MULTIDROP_MIN_SLOT_BYTES
+ * @param config
+ * @return true if the settings are valid
+ */
+bool multidrop_configure(const multidrop_config_t *config);
+
+/**
+ * @brief NA command: "NA" reports "na_<node>_<nodes>_<groups>_<slot_us>_<foreign>_<slotted>_<slots>_<overflows>",
+ *        "NA,<node>[,<nodes>[,<groups>[,<slot_us>]]]" sets the bus settings, omitted fields are kept, and
+ *        replies "na_<status>". Node 0 turns the addressing off
+ * @param ptr_data_str
+ * @return SUCCESS_INT or MULTIDROP_INVALID
+ */
+int multidrop_command(const char *ptr_data_str);
+
+#endif /* _MULTIDROP_H */
+
+/*** end of file ***/
@@ -0,0 +1,152 @@
+/**
+ * @file speed_tune.c
+ * @brief Valve move speed tuning Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include "speed_tune.h"
+#include "transport.h"
+
+#define SPEED_TUNE_LINE_SIZE 48
+
+static speed_tune_store_t tune_store;
+static speed_tune_stats_t tune_stats[NUM_OF_VALVES][NUM_OF_VALVES];
+static bool tune_dirty = false;
+static uint64_t last_save_us = 0;
+
+static bool valid_transition(int from_index, int to_index) {
+    return from_index >= 0 && from_index < NUM_OF_VALVES && to_index >= 0 && to_index < NUM_OF_VALVES;
+}
+
+static uint16_t clamp_rpm(uint32_t rpm) {
+    if (rpm < tune_store.rpm_min) return tune_store.rpm_min;
+    if (rpm > tune_store.rpm_max) return tune_store.rpm_max;
+    return (uint16_t)rpm;
+}
+
+static void reset_speeds(void) {
+    for (int from = 0; from < NUM_OF_VALVES; from++) {
+        for (int to = 0; to < NUM_OF_VALVES; to++) {
+            tune_store.rpm[from][to] = tune_store.rpm_min;
+            tune_store.fail_rpm[from][to] = 0;
+        }
+    }
+}
+
+// Private helper writing the learned speeds, rate limited to spare the flash
+static void save_if_due(void) {
+    uint64_t now = get_time();
+    if (!tune_dirty || (last_save_us != 0 && now - last_save_us < SPEED_TUNE_SAVE_PERIOD_US)) return;
+    if (flash_store_save(FLASH_STORE_SLOT_SPEED_TUNE, SPEED_TUNE_VERSION, &tune_store, sizeof(tune_store))) {
+        tune_dirty = false;
+        last_save_us = now;
+    }
+}
+
+void speed_tune_init(void) {
+    memset(tune_stats, 0, sizeof(tune_stats));
+    if (!flash_store_load(FLASH_STORE_SLOT_SPEED_TUNE, SPEED_TUNE_VERSION, &tune_store, sizeof(tune_store))) {
+        tune_store.rpm_min = SPEED_TUNE_RPM_MIN;
+        tune_store.rpm_max = SPEED_TUNE_RPM_MAX;
+        reset_speeds();
+    }
+}
+
+uint16_t speed_tune_rpm(int from_index, int to_index) {
+    if (!valid_transition(from_index, to_index)) return tune_store.rpm_min;
+    return tune_store.rpm[from_index][to_index];
+}
+
+void speed_tune_record(int from_index, int to_index, int status, uint32_t corrections, int16_t error) {
+    if (!valid_transition(from_index, to_index)) return;
+    speed_tune_stats_t *stats = &tune_stats[from_index][to_index];
+    uint16_t *rpm = &tune_store.rpm[from_index][to_index];
+    uint16_t *fail_rpm = &tune_store.fail_rpm[from_index][to_index];
+    uint16_t previous_rpm = *rpm;
+
+    stats->moves++;
+    stats->corrections += corrections;
+    stats->last_error = error;
+
+    if (status != ROTATION_COMPLETED || error <= -SPEED_TUNE_STALL_PULSES) {
+        // lost steps, the load is beyond the pull-out torque at this speed
+        stats->stalls++;
+        stats->clean_streak = 0;
+        *fail_rpm = *rpm;
+        *rpm = clamp_rpm(*rpm / 2u);
+    } else if (corrections > 0) {
+        stats->clean_streak = 0;
+        if (*fail_rpm == 0 || *rpm < *fail_rpm) *fail_rpm = *rpm;
+        *rpm = clamp_rpm(*rpm - *rpm / SPEED_TUNE_BACKOFF_DIV);
+    } else if (++stats->clean_streak >= SPEED_TUNE_CLEAN_MOVES) {
+        uint32_t next = clamp_rpm(*rpm + PICO_MAX(1u, *rpm / SPEED_TUNE_RAISE_DIV));
+        // stay below the speed that failed until the transition has proven itself for longer
+        if (*fail_rpm != 0 && next >= *fail_rpm) {
+            if (stats->clean_streak < SPEED_TUNE_PROBE_MOVES) return;
+            *fail_rpm = 0;
+        }
+        stats->clean_streak = 0;
+        *rpm = (uint16_t)next;
+    }
+
+    if (*rpm != previous_rpm) tune_dirty = true;
+    save_if_due();
+}
+
+bool speed_tune_set_bounds(uint16_t rpm_min, uint16_t rpm_max) {
+    if (rpm_min == 0 || rpm_min > rpm_max || rpm_max > RPM_MAX) return false;
+    tune_store.rpm_min = rpm_min;
+    tune_store.rpm_max = rpm_max;
+    for (int from = 0; from < NUM_OF_VALVES; from++) {
+        for (int to = 0; to < NUM_OF_VALVES; to++) tune_store.rpm[from][to] = clamp_rpm(tune_store.rpm[from][to]);
+    }
+    tune_dirty = true;
+    last_save_us = 0;
+    save_if_due();
+    return true;
+}
+
+bool speed_tune_get_stats(int from_index, int to_index, speed_tune_stats_t *stats) {
+    if (!valid_transition(from_index, to_index) || stats == NULL) return false;
+    *stats = tune_stats[from_index][to_index];
+    return true;
+}
+
+int speed_tune_command(const char *ptr_data_str) {
+    char line[SPEED_TUNE_LINE_SIZE];
+    const char *args = strchr(ptr_data_str, ',');
+    int status = SUCCESS_INT;
+
+    if (args == NULL || !isdigit((unsigned char)args[1])) {
+        for (int from = 0; from < NUM_OF_VALVES; from++) {
+            for (int to = 0; to < NUM_OF_VALVES; to++) {
+                const speed_tune_stats_t *stats = &tune_stats[from][to];
+                if (stats->moves == 0) continue;
+                snprintf(line, sizeof(line), "vs_%s%s_%u_%u_%lu_%lu_%u\n", valve_coordinates[from].valve_type,
+                         valve_coordinates[to].valve_type, tune_store.rpm[from][to], tune_store.fail_rpm[from][to],
+                         (unsigned long)stats->moves, (unsigned long)stats->corrections, stats->stalls);
+                transport_respond((const uint8_t *)line, strlen(line));
+            }
+        }
+        snprintf(line, sizeof(line), "vs_end\n");
+    } else {
+        unsigned long rpm_min = strtoul(args + 1, NULL, 10);
+        const char *max_str = strchr(args + 1, ',');
+        if (rpm_min == 0 && max_str == NULL) {
+            reset_speeds();
+            memset(tune_stats, 0, sizeof(tune_stats));
+            flash_store_erase(FLASH_STORE_SLOT_SPEED_TUNE);
+            tune_dirty = false;
+        } else {
+            unsigned long rpm_max = max_str ? strtoul(max_str + 1, NULL, 10) : 0;
+            if (rpm_max > UINT16_MAX || !speed_tune_set_bounds((uint16_t)rpm_min, (uint16_t)rpm_max)) status = RPM_IS_INVALID;
+        }
+        snprintf(line, sizeof(line), "vs_%d\n", status);
+    }
+    transport_respond((const uint8_t *)line, strlen(line));
+    return status;
+}
+
+/*** end of file ***/
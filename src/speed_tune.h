@@ -0,0 +1,101 @@
+/** @file speed_tune.h
+*
+* @brief Online speed tuning of the valve moves. Every (from, to) transition keeps its own RPM, raised
+*        step by step while its moves stay clean and cut back on correction passes or stalls, within
+*        configurable bounds. The learned speeds are kept in flash.
+*
+*/
+
+#ifndef _SPEED_TUNE_H
+#define _SPEED_TUNE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "drv8825.h"
+#include "flash_store.h"
+
+#define SPEED_TUNE_VERSION 1
+
+// Default bounds, the lower one is the production RPM
+#define SPEED_TUNE_RPM_MIN 800
+#define SPEED_TUNE_RPM_MAX 2400
+
+// Additive increase after a run of clean moves, multiplicative decrease on errors
+#define SPEED_TUNE_CLEAN_MOVES 8            // clean moves before the next increase
+#define SPEED_TUNE_RAISE_DIV 8              // increase by rpm / 8
+#define SPEED_TUNE_BACKOFF_DIV 4            // a correction pass cuts rpm / 4
+#define SPEED_TUNE_STALL_PULSES 3           // first pass shortfall counted as a stall, cuts rpm / 2
+#define SPEED_TUNE_PROBE_MOVES 64           // clean moves before the RPM that failed is tried again
+
+// Flash wear limit, learned speeds are written at most once per period
+#define SPEED_TUNE_SAVE_PERIOD_US (15ull * 60u * 1000000u)
+
+// Learned state, persisted
+typedef struct {
+    uint16_t rpm_min;
+    uint16_t rpm_max;
+    uint16_t rpm[NUM_OF_VALVES][NUM_OF_VALVES];
+    uint16_t fail_rpm[NUM_OF_VALVES][NUM_OF_VALVES];    // lowest RPM that needed a correction, 0 if none
+} speed_tune_store_t;
+
+// Statistics of one transition since boot
+typedef struct {
+    uint32_t moves;
+    uint32_t corrections;
+    uint16_t stalls;
+    uint16_t clean_streak;
+    int16_t last_error;                 // first pass encoder error of the last move, pulses
+} speed_tune_stats_t;
+
+/**
+ * @brief Loads the learned speeds from flash, every transition starts at the lower bound otherwise
+ *
+ */
+void speed_tune_init(void);
+
+/**
+ * @brief Returns the RPM of a transition
+ * @param from_index - valve_coordinates entry
+ * @param to_index   - valve_coordinates entry
+ */
+uint16_t speed_tune_rpm(int from_index, int to_index);
+
+/**
+ * @brief Feeds the result of a move back into the tuner
+ * @param from_index
+ * @param to_index
+ * @param status      - status of the move
+ * @param corrections - correction passes of the move
+ * @param error       - first pass encoder error, actual - expected pulses
+ */
+void speed_tune_record(int from_index, int to_index, int status, uint32_t corrections, int16_t error);
+
+/**
+ * @brief Sets the RPM bounds and clamps every learned speed into them
+ * @param rpm_min
+ * @param rpm_max
+ * @return false if the bounds are invalid
+ */
+bool speed_tune_set_bounds(uint16_t rpm_min, uint16_t rpm_max);
+
+/**
+ * @brief Reads the statistics of a transition
+ * @param from_index
+ * @param to_index
+ * @param stats
+ * @return false for an invalid transition
+ */
+bool speed_tune_get_stats(int from_index, int to_index, speed_tune_stats_t *stats);
+
+/**
+ * @brief Speed tuning command handler
+ *        "VS" replies "vs_<from><to>_<rpm>_<fail_rpm>_<moves>_<corrections>_<stalls>" per moved transition
+ *        and "vs_end", "VS,0" forgets the learned speeds and replies "vs_1",
+ *        "VS,<min>,<max>" sets the bounds and replies "vs_1" or "vs_-3" for invalid bounds
+ * @param ptr_data_str
+ */
+int speed_tune_command(const char *ptr_data_str);
+
+#endif /* _SPEED_TUNE_H */
+
+/*** end of file ***/
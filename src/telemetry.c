@@ -0,0 +1,99 @@
+/**
+ * @file telemetry.c
+ * @brief Periodic binary telemetry Implementation
+ * @author Yashas Nagaraj Udupa 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "telemetry.h"
+#include "frame.h"
+#include "transport.h"
+#include "gpio_control.h"
+#include "drv8825.h"
+#include "uart_driver.h"
+#include "multidrop.h"
+
+#define ONE_SECOND_US 1000000
+#define TELEMETRY_ACK_SIZE 20
+#define TELEMETRY_FRAME_SIZE (TELEMETRY_PAYLOAD_SIZE + FRAME_OVERHEAD)
+
+// the stream takes at most 3/4 of the UART, responses to commands always find room in the TX ring
+#define TELEMETRY_UART_MAX_RATE_HZ (MAIN_UART_BAUDRATE / 10 * 3 / 4 / TELEMETRY_FRAME_SIZE)
+
+volatile telemetry_state_t telemetry_state = {0, 0, TELEMETRY_IDLE_COMMAND, 0, 0};
+
+static hal_repeating_timer_t telemetry_timer;
+static bool telemetry_running = false;
+static uint16_t telemetry_sequence = 0;
+static uint32_t telemetry_dropped = 0;
+static transport_id_t telemetry_transport = TRANSPORT_UART;   // the stream goes where TM came from
+
+// Private timer callback: snapshot, encode and queue one frame, never waits for the transport
+static bool telemetry_timer_callback(hal_repeating_timer_t *rt) {
+    uint8_t payload[TELEMETRY_PAYLOAD_SIZE];
+    uint8_t frame[TELEMETRY_PAYLOAD_SIZE + FRAME_OVERHEAD];
+    uint8_t *ptr = payload;
+
+    ptr = frame_put_u32(ptr, (uint32_t)hal_time_us_64());
+    ptr = frame_put_u16(ptr, telemetry_sequence++);
+    ptr = frame_put_u16(ptr, motor_encoder_value());
+    ptr = frame_put_u32(ptr, (uint32_t)telemetry_state.step_position);
+    ptr = frame_put_u32(ptr, (uint32_t)telemetry_state.velocity);
+    *ptr++ = (uint8_t)hal_gpio_get(M1_NFAULT);
+    *ptr++ = telemetry_state.active_command;
+    *ptr++ = telemetry_state.vibration_segment;
+    *ptr++ = telemetry_state.rx_queue_depth;
+    ptr = frame_put_u16(ptr, (uint16_t)transport_tx_pending(telemetry_transport));
+    ptr = frame_put_u16(ptr, (uint16_t)telemetry_dropped);
+
+    size_t frame_len = frame_encode(FRAME_TYPE_TELEMETRY, payload, TELEMETRY_PAYLOAD_SIZE, frame);
+    if (!transport_try_write(telemetry_transport, frame, frame_len)) {
+        telemetry_dropped++;
+    }
+    return true;
+}
+
+int telemetry_start(uint32_t rate_hz) {
+    uint32_t max_rate_hz = telemetry_transport == TRANSPORT_UART ? TELEMETRY_UART_MAX_RATE_HZ : TELEMETRY_MAX_RATE_HZ;
+    // a node of a bus only sends when polled, there is no stream
+    if (telemetry_transport == TRANSPORT_UART && multidrop_enabled()) max_rate_hz = 0;
+    if (rate_hz > max_rate_hz) return TELEMETRY_RATE_INVALID;
+
+    telemetry_stop();
+    if (rate_hz == 0) return TELEMETRY_STOPPED;
+
+    // negative period keeps the interval between starts constant
+    telemetry_running = hal_add_repeating_timer_us(-(int64_t)(ONE_SECOND_US / rate_hz), telemetry_timer_callback, NULL, &telemetry_timer);
+    return telemetry_running ? TELEMETRY_STARTED : TELEMETRY_RATE_INVALID;
+}
+
+void telemetry_stop(void) {
+    if (telemetry_running) {
+        hal_cancel_repeating_timer(&telemetry_timer);
+        telemetry_running = false;
+    }
+}
+
+uint32_t telemetry_dropped_frames(void) {
+    return telemetry_dropped;
+}
+
+int telemetry_command(const char *ptr_data_str) {
+    char ack[TELEMETRY_ACK_SIZE];
+    const char *rate_str = strchr(ptr_data_str, ',');
+    uint32_t rate_hz = rate_str ? (uint32_t)strtoul(rate_str + 1, NULL, 10) : 0;
+
+    telemetry_transport = transport_response();
+    int status = telemetry_start(rate_hz);
+    if (status == TELEMETRY_RATE_INVALID) {
+        snprintf(ack, sizeof(ack), "tm_%d\n", status);
+    } else {
+        snprintf(ack, sizeof(ack), "tm_%lu\n", (unsigned long)rate_hz);
+    }
+    transport_respond((const uint8_t *)ack, strlen(ack));
+    return status;
+}
+
+/*** end of file ***/
@@ -0,0 +1,63 @@
+/** @file telemetry.h
+*
+* @brief This module streams periodic binary telemetry frames of the motor, encoder and timing state.
+*
+*/
+
+#ifndef _TELEMETRY_H
+#define _TELEMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+
+// Telemetry limits
+#define TELEMETRY_MAX_RATE_HZ 1000          // on USB, the UART allows 3/4 of its bandwidth (288 Hz at 115200 baud)
+#define TELEMETRY_IDLE_COMMAND 0xFF
+#define TELEMETRY_PAYLOAD_SIZE 24
+
+// Status Codes
+#define TELEMETRY_STARTED 1
+#define TELEMETRY_STOPPED 0
+#define TELEMETRY_RATE_INVALID -1
+
+// Live state sampled by the telemetry timer. Every field has a single writer and is
+// word sized, so the control loop only pays for plain stores
+typedef struct {
+    int32_t step_position;        // commanded position in 1/32 microsteps, CW positive
+    int32_t velocity;             // commanded speed in 1/32 microsteps per second, CW positive
+    uint8_t active_command;       // enum DesiredFunc being executed or TELEMETRY_IDLE_COMMAND
+    uint8_t vibration_segment;    // 1 based index of the running vibration segment, 0 when idle
+    uint8_t rx_queue_depth;       // commands received and not yet processed
+} telemetry_state_t;
+
+extern volatile telemetry_state_t telemetry_state;
+
+/**
+ * @brief Starts or restarts the periodic telemetry stream on the transport of the last TM command
+ * @param rate_hz - frames per second, 1 to TELEMETRY_MAX_RATE_HZ (less on the UART, none on a bus), 0 stops the stream
+ * @return TELEMETRY_STARTED, TELEMETRY_STOPPED or TELEMETRY_RATE_INVALID
+ */
+int telemetry_start(uint32_t rate_hz);
+
+/**
+ * @brief Stops the periodic telemetry stream
+ *
+ */
+void telemetry_stop(void);
+
+/**
+ * @brief Returns the number of frames dropped because the TX ring was full
+ *
+ */
+uint32_t telemetry_dropped_frames(void);
+
+/**
+ * @brief Telemetry command handler, "TM,<rate_hz>" replies "tm_<rate_hz>" or "tm_<error>"
+ * @param ptr_data_str
+ */
+int telemetry_command(const char *ptr_data_str);
+
+#endif /* _TELEMETRY_H */
+
+/*** end of file ***/
@@ -1,36 +1,131 @@
 /**
  * @file test.c
- * @brief Test cases module
- * @author Yashas Nagaraj Udupa 
+ * @brief Valve motor characterization benchmark
+ * @author Yashas Nagaraj Udupa
  */
 
 #include "test.h"
 
-void test_rotate_stepper_motor() {
-    // Test cases for direction
-    static const char directions[] = {-1, 0, 1, 2}; // Including valid and invalid values
-    // Test cases for steptype
-    static const char *steptypes[] = {"01", "02", "04", "08", "16", "32", "36", NULL}; // Various step types
-    // Test cases for angle and RPM
-    static const int angles[] = {INT_MIN, -1000, 0, 1000, INT_MAX}; 
-    static const int rpms[] = {INT_MIN, -500, 0, 500, INT_MAX};
-
-    printf("Starting tests for rotate_stepper_motor...\n");
-
-    char ptr_e[10] = "PTR_E"; // Static buffer for expected values
-    char ptr_a[10] = "PTR_A"; // Static buffer for actual values
-    for (uint16_t test_no = 0; directions[test_no] != '\0'; test_no++) {
-        for (int j = 0; steptypes[j] != NULL; j++) {
-            for (int k = 0; k < sizeof(angles) / sizeof(angles[0]); k++) {
-                for (int l = 0; l < sizeof(rpms) / sizeof(rpms[0]); l++) {
-                    printf("Test Case : %u \t Direction=%d, Steptype=%s, Angle=%d, RPM=%d\n", 
-                           test_no, directions[test_no % sizeof(directions)], steptypes[j], angles[k], rpms[l]);
-                    int result = rotate_stepper_motor(directions[test_no % sizeof(directions)], (char*)steptypes[j], ptr_e, ptr_a, angles[k], rpms[l]);
-                    printf("Test status: %d\n", result);
+// Encoder pulses per degree
+#define BENCH_ENCODER_RESOLUTION Q16_FROM_RATIO(ENCODER_NO_OF_PULSES + 1, DEGREE_FULL_ANGLE)
+
+// Home position of the valve
+#define BENCH_HOME_VALVE "V2"
+
+static unsigned long long bench_elapsed_us(uint64_t start_us) {
+    return (unsigned long long)(get_time() - start_us);
+}
+
+// Private function running one open loop test move, returns the encoder error in pulses or -1 on a failed move
+static int bench_test_move(char direction, const char *steptype, uint16_t rpm, uint16_t expected_pulses, int *status) {
+    uint16_t pulses = 0;
+    hal_watchdog_update();
+    *status = motor_rotate_open_loop(direction, steptype, BENCH_SWEEP_ANGLE, rpm, &pulses);
+    if (*status != ROTATION_COMPLETED) return -1;
+    return abs((int)pulses - (int)expected_pulses);
+}
+
+// Private function raising the RPM of one microstep mode until a test move loses encoder pulses
+static void bench_sweep_mode(const char *steptype) {
+    uint16_t max_rpm = 0, fail_rpm = 0;
+    int fail_status = 0, fail_error = 0;
+    unsigned trials = 0;
+    uint32_t rpm = BENCH_RPM_START;
+
+    while (fail_rpm == 0) {
+        motor_step_plan_t plan;
+        if (motor_plan_steps(DIR_CW, steptype, BENCH_SWEEP_ANGLE, (uint16_t)rpm, BENCH_ENCODER_RESOLUTION, &plan) != SUCCESS_INT) break;
+
+        // round trips keep the valve near its start position while the mode is healthy
+        for (int trial = 0; trial < BENCH_SWEEP_TRIALS && fail_rpm == 0; trial++) {
+            for (int leg = 0; leg < 2 && fail_rpm == 0; leg++) {
+                int status;
+                int error = bench_test_move(leg == 0 ? DIR_CW : DIR_CCW, steptype, (uint16_t)rpm, plan.expected_encoder_value, &status);
+                trials++;
+                if (error < 0 || error >= TOLERANCE_ENCODER_VALUE) {
+                    fail_rpm = (uint16_t)rpm;
+                    fail_status = status;
+                    fail_error = error;
                 }
             }
         }
+        if (fail_rpm != 0) break;
+        max_rpm = (uint16_t)rpm;
+        if (rpm == RPM_MAX) break;
+        rpm = rpm * BENCH_RPM_RAMP_NUM / BENCH_RPM_RAMP_DEN;
+        if (rpm > RPM_MAX) rpm = RPM_MAX;
     }
 
-    printf("Tests completed.\n");
-}
\ No newline at end of file
+    printf("{\"type\":\"mode\",\"steptype\":\"%s\",\"max_rpm\":%u,\"fail_rpm\":%u,\"fail_status\":%d,\"fail_error\":%d,\"trials\":%u}\n",
+           steptype, max_rpm, fail_rpm, fail_status, fail_error, trials);
+    fflush(stdout);
+
+    // a failed move leaves the valve at an unknown angle
+    if (fail_rpm != 0) state_rotate_valve(BENCH_HOME_VALVE);
+}
+
+// Private function timing one valve transition, returns true on success
+static bool bench_transition(int from, int to) {
+    hal_watchdog_update();
+    uint64_t start_us = get_time();
+    int status = state_rotate_valve(valve_coordinates[to].valve_type);
+    unsigned long long time_us = bench_elapsed_us(start_us);
+
+    printf("{\"type\":\"transition\",\"from\":\"%s\",\"to\":\"%s\",\"status\":%d,\"time_us\":%llu,\"corrections\":%lu}\n",
+           valve_coordinates[from].valve_type, valve_coordinates[to].valve_type, status, time_us,
+           (unsigned long)motor_correction_count());
+    fflush(stdout);
+    return status == ROTATION_COMPLETED;
+}
+
+int test_characterize_valve_motor(void) {
+    int failures = 0;
+    uint64_t bench_start_us = get_time();
+
+    printf("{\"type\":\"begin\",\"rpm_start\":%u,\"rpm_max\":%u,\"sweep_angle\":%u,\"trials\":%u}\n",
+           BENCH_RPM_START, RPM_MAX, BENCH_SWEEP_ANGLE, BENCH_SWEEP_TRIALS);
+    fflush(stdout);
+    state_rotate_valve(BENCH_HOME_VALVE);
+
+    // maximum reliable speed of every microstep mode
+    for (int i = 0; i < NUM_OF_STEPTYPES; i++) {
+        bench_sweep_mode(steptype_dict[i].micro_steps);
+    }
+
+    // every ordered valve pair at the production step type and RPM
+    int current = 1;    // index of BENCH_HOME_VALVE
+    for (int from = 0; from < NUM_OF_VALVES; from++) {
+        for (int to = 0; to < NUM_OF_VALVES; to++) {
+            if (to == from) continue;
+            if (current != from) {
+                hal_watchdog_update();
+                if (state_rotate_valve(valve_coordinates[from].valve_type) != ROTATION_COMPLETED) failures++;
+            }
+            if (!bench_transition(from, to)) failures++;
+            current = to;
+        }
+    }
+
+    // homing from offsets on the anticlockwise side of the index
+    if (current != 1) state_rotate_valve(BENCH_HOME_VALVE);
+    for (int run = 0; run < BENCH_HOMING_RUNS; run++) {
+        uint16_t offset_deg = (uint16_t)(DEGREE_FULL_ANGLE * (run + 1) / (BENCH_HOMING_RUNS + 1));
+        hal_watchdog_update();
+        motor_rotate_open_loop(DIR_CCW, STEPTYPE, offset_deg, HOME_RPM_INT, NULL);
+
+        hal_watchdog_update();
+        uint64_t start_us = get_time();
+        int status = home_stepper_motor(DIR_CW);
+        unsigned long long time_us = bench_elapsed_us(start_us);
+        if (status != HOMING_SUCCESSFUL) failures++;
+
+        printf("{\"type\":\"homing\",\"run\":%d,\"offset_deg\":%u,\"status\":%d,\"time_us\":%llu}\n", run, offset_deg, status, time_us);
+        fflush(stdout);
+    }
+
+    printf("{\"type\":\"end\",\"failures\":%d,\"time_us\":%llu}\n", failures, bench_elapsed_us(bench_start_us));
+    fflush(stdout);
+    return failures;
+}
+
+/*** end of file ***/
@@ -1,13 +1,42 @@
+/** @file test.h
+*
+* @brief Valve motor characterization benchmark, built with ENABLE_BENCHMARK. The report is written as
+*        JSON lines to stdio (USB CDC on the target).
+*
+*/
+
+#ifndef _TEST_H
+#define _TEST_H
+
 #include <stdio.h>
 #include <stdlib.h>
-#include <limits.h>
 #include "gpio_control.h"
 #include "drv8825.h"
 #include "drv8827.h"
 
+// RPM sweep of every microstep mode
+#define BENCH_RPM_START 400         // first RPM of a sweep
+#define BENCH_RPM_RAMP_NUM 5        // next RPM = RPM * 5 / 4
+#define BENCH_RPM_RAMP_DEN 4
+#define BENCH_SWEEP_ANGLE 90        // degrees of every test move
+#define BENCH_SWEEP_TRIALS 3        // round trips an RPM must pass
+
+// Homing repetitions, each one from a different offset
+#define BENCH_HOMING_RUNS 3
+
 /**
- * @brief This function subjects the valve motor to all corner cases
+ * @brief Characterizes the valve axis: maximum reliable RPM of every microstep mode, move time of every
+ *        valve transition and homing time. Ends with the valve at the home position.
+ *
+ * Report lines:
+ *   {"type":"mode","steptype":"16","max_rpm":1220,"fail_rpm":1525,"fail_status":2,"fail_error":3,"trials":15}
+ *   {"type":"transition","from":"V1","to":"V3","status":2,"time_us":412300,"corrections":0}
+ *   {"type":"homing","run":0,"offset_deg":90,"status":2,"time_us":1520000}
  *
+ * @return number of failed valve transitions and homing runs
  */
+int test_characterize_valve_motor(void);
+
+#endif /* _TEST_H */
 
-void test_rotate_stepper_motor();
\ No newline at end of file
+/*** end of file ***/
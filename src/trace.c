@@ -0,0 +1,99 @@
+/**
+ * @file trace.c
+ * @brief Hot path trace ring Implementation
+ * @author Yashas Nagaraj Udupa 
+ */
+
+#include <string.h>
+#include "trace.h"
+#include "frame.h"
+#include "transport.h"
+#include "gpio_control.h"
+
+#if TRACE_ENABLED
+
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+typedef struct {
+    uint64_t timestamp;
+    uint8_t stage;
+    uint16_t arg;
+} trace_entry_t;
+
+// One ring per core, so recording needs no lock shared between cores
+static trace_entry_t trace_ring[TRACE_NUM_CORES][TRACE_RING_SIZE];
+static uint32_t trace_head[TRACE_NUM_CORES];
+static volatile bool trace_paused = false;
+
+void __time_critical_func(trace_record)(uint8_t stage, uint16_t arg) {
+    if (trace_paused) return;
+
+    uint core = hal_get_core_num();
+    uint32_t irq_status = hal_save_and_disable_interrupts();
+    trace_entry_t *entry = &trace_ring[core][trace_head[core] & TRACE_RING_MASK];
+    entry->timestamp = get_time();
+    entry->stage = stage;
+    entry->arg = arg;
+    trace_head[core]++;
+    hal_restore_interrupts(irq_status);
+}
+
+// Private helper to send one dump frame
+static void trace_send_frame(uint8_t *payload, uint8_t entry_count) {
+    uint8_t frame[1 + TRACE_ENTRIES_PER_FRAME * TRACE_ENTRY_SIZE + FRAME_OVERHEAD];
+    payload[0] = entry_count;
+    size_t frame_len = frame_encode(FRAME_TYPE_TRACE, payload, (uint8_t)(1 + entry_count * TRACE_ENTRY_SIZE), frame);
+    transport_respond(frame, frame_len);
+}
+
+int trace_dump_command(const char *ptr_data_str) {
+    uint8_t payload[1 + TRACE_ENTRIES_PER_FRAME * TRACE_ENTRY_SIZE];
+    uint8_t entry_count = 0;
+    int total = 0;
+
+    // the dump itself goes through the traced TX path, keep it out of the ring
+    trace_paused = true;
+    for (uint core = 0; core < TRACE_NUM_CORES; core++) {
+        uint32_t head = trace_head[core];
+        uint32_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        for (uint32_t i = first; i < head; i++) {
+            const trace_entry_t *entry = &trace_ring[core][i & TRACE_RING_MASK];
+            uint8_t *ptr = &payload[1 + entry_count * TRACE_ENTRY_SIZE];
+            ptr = frame_put_u32(ptr, (uint32_t)entry->timestamp);
+            ptr = frame_put_u32(ptr, (uint32_t)(entry->timestamp >> 32));
+            *ptr++ = entry->stage;
+            *ptr++ = (uint8_t)core;
+            frame_put_u16(ptr, entry->arg);
+            total++;
+            if (++entry_count == TRACE_ENTRIES_PER_FRAME) {
+                trace_send_frame(payload, entry_count);
+                entry_count = 0;
+            }
+        }
+        trace_head[core] = 0;
+    }
+    if (entry_count > 0) {
+        trace_send_frame(payload, entry_count);
+    }
+    trace_send_frame(payload, 0);
+    trace_paused = false;
+    return total;
+}
+
+#else
+
+void trace_record(uint8_t stage, uint16_t arg) {
+}
+
+// Tracing compiled out, reply with an empty dump so the host decoder still terminates
+int trace_dump_command(const char *ptr_data_str) {
+    uint8_t payload[1] = {0};
+    uint8_t frame[1 + FRAME_OVERHEAD];
+    size_t frame_len = frame_encode(FRAME_TYPE_TRACE, payload, 1, frame);
+    transport_respond(frame, frame_len);
+    return 0;
+}
+
+#endif // TRACE_ENABLED
+
+/*** end of file ***/
@@ -0,0 +1,63 @@
+/** @file trace.h
+*
+* @brief This module records timestamped trace points of the command hot path into a RAM ring.
+*
+*/
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+
+// Define or undefine this macro to enable or disable trace points (overridden by the ENABLE_TRACE build option)
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 0  // Use 0 or 1 for easier toggling
+#endif
+
+// Trace ring size per core, power of two
+#define TRACE_RING_SIZE 128
+#define TRACE_NUM_CORES 2
+
+// Serialized entry size and entries per dump frame
+#define TRACE_ENTRY_SIZE 12
+#define TRACE_ENTRIES_PER_FRAME 20
+
+// Hot path stages, in the order a command passes through them
+enum TraceStage {
+    TRACE_RX_FRAME_COMPLETE = 1,   // command line received, arg = command ID (its queue position)
+    TRACE_CRC_DONE,                // CRC check finished, arg = CRC result
+    TRACE_DISPATCH,                // state machine dispatch, arg = enum DesiredFunc
+    TRACE_MOTION_START,            // valve move or vibration started, arg = angle or segment count
+    TRACE_MOTION_END,              // valve move or vibration finished, arg = status
+    TRACE_ACK_QUEUED,              // acknowledgement queued in the TX ring, arg = length
+    TRACE_TX_DRAINED,              // TX ring emptied by the UART interrupt after sending
+    TRACE_COMMAND_DONE             // final response queued (cp_ or the command's reply), arg = command ID
+};
+
+// Trace point macro, compiles to nothing when tracing is disabled
+#if TRACE_ENABLED
+#define TRACE_POINT(stage, arg) trace_record((stage), (uint16_t)(arg))
+#else
+#define TRACE_POINT(stage, arg) do {} while(0)
+#endif
+
+/**
+ * @brief Records one trace point in the ring of the calling core
+ * @param stage - enum TraceStage
+ * @param arg   - stage specific argument
+ */
+void trace_record(uint8_t stage, uint16_t arg);
+
+/**
+ * @brief Trace dump command handler, "TD" sends the rings as FRAME_TYPE_TRACE frames and clears them.
+ *        Each frame holds a count byte followed by that many 12 byte entries
+ *        (timestamp LE64, stage, core, arg LE16), a frame with a count of 0 ends the dump
+ * @param ptr_data_str
+ */
+int trace_dump_command(const char *ptr_data_str);
+
+#endif /* _TRACE_H */
+
+/*** end of file ***/
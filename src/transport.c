@@ -0,0 +1,295 @@
+/**
+ * @file transport.c
+ * @brief Command transports Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <string.h>
+#include "transport.h"
+#include "gpio_control.h"
+#include "drv8825.h"
+#include "cmd_queue.h"
+#include "multidrop.h"
+
+#define TRANSPORT_USB_TX_RING_MASK (TRANSPORT_USB_TX_RING_SIZE - 1)
+
+// Line being received on each transport, the UART one is written by its interrupt, the USB one by core 1
+typedef struct {
+    uartRxData_t line;
+    uint8_t prefix_length;      // length of the address prefix of this node, 0 until it is complete
+    bool slotted;               // the prefix is a broadcast or group address
+    bool foreign;               // the line is for another node, skipped up to its terminator
+} rx_state_t;
+
+static rx_state_t rx_state[NUM_OF_TRANSPORTS];
+static volatile transport_id_t kill_source = TRANSPORT_UART;
+static volatile bool usb_commands = false;  // a command line arrived on the USB interface of this connection
+
+// Transport each core answers on
+static volatile transport_id_t response_transport[HAL_NUM_CORES];
+
+// USB TX ring, filled by any core and drained by the core 1 poll
+static uint8_t usb_tx_ring[TRANSPORT_USB_TX_RING_SIZE];
+static volatile uint32_t usb_tx_head = 0;   // next free slot, written by producers
+static volatile uint32_t usb_tx_tail = 0;   // next byte to send, written by the poll
+static hal_spin_lock_t *usb_tx_lock = NULL;
+
+// Copy of the responses of one core, used to keep the responses of a command
+static char *capture_buffer = NULL;
+static size_t capture_size = 0;
+static size_t capture_count = 0;
+static bool capture_overflow = false;
+static uint capture_core = 0;
+
+// Private function to queue the whole buffer in the USB ring, must be called with usb_tx_lock held
+static bool usb_tx_enqueue_locked(const uint8_t *src, size_t len) {
+    if (TRANSPORT_USB_TX_RING_SIZE - (usb_tx_head - usb_tx_tail) < len) return false;
+    for (size_t i = 0; i < len; i++) {
+        usb_tx_ring[(usb_tx_head + i) & TRANSPORT_USB_TX_RING_MASK] = src[i];
+    }
+    usb_tx_head += len;
+    return true;
+}
+
+static bool usb_try_write(const uint8_t *src, size_t len) {
+    if (!hal_usb_cdc_connected()) return false;
+    uint32_t irq_status = hal_spin_lock_blocking(usb_tx_lock);
+    bool queued = usb_tx_enqueue_locked(src, len);
+    hal_spin_unlock(usb_tx_lock, irq_status);
+    return queued;
+}
+
+// Private function sending queued bytes to the USB host, only called by the polling core
+static void usb_drain(void) {
+    uint8_t chunk[TRANSPORT_USB_CHUNK];
+
+    // the poll is the only reader of the ring, producers only move the head
+    while (usb_tx_tail != usb_tx_head) {
+        uint32_t tail = usb_tx_tail;
+        size_t len = 0;
+        while (len < sizeof(chunk) && tail + len != usb_tx_head) {
+            chunk[len] = usb_tx_ring[(tail + len) & TRANSPORT_USB_TX_RING_MASK];
+            len++;
+        }
+        size_t sent = hal_usb_cdc_write(chunk, len);
+        usb_tx_tail = tail + (uint32_t)sent;
+        if (sent < len) break;
+    }
+}
+
+// Private function queueing in chunks that fit the ring, waits for the poll to make room. The polling core
+// drains the ring itself
+static bool usb_write(const uint8_t *src, size_t len) {
+    uint64_t old_time = hal_time_us_64();
+    while (len > 0) {
+        if (!hal_usb_cdc_connected()) return false;
+        size_t chunk = len < TRANSPORT_USB_TX_RING_SIZE ? len : TRANSPORT_USB_TX_RING_SIZE;
+        if (usb_try_write(src, chunk)) {
+            src += chunk;
+            len -= chunk;
+            old_time = hal_time_us_64();
+            continue;
+        }
+        if (hal_time_us_64() - old_time > TRANSPORT_USB_TX_TIMEOUT) return false;
+        hal_watchdog_update();
+        if (hal_get_core_num() == TRANSPORT_POLL_CORE) {
+            usb_drain();
+        } else {
+            hal_sleep_us(TRANSPORT_USB_POLL_US);
+        }
+    }
+    return true;
+}
+
+void transport_init(void) {
+    if (usb_tx_lock == NULL) {
+        usb_tx_lock = hal_spin_lock_claim();
+    }
+    for (int core = 0; core < HAL_NUM_CORES; core++) {
+        response_transport[core] = TRANSPORT_UART;
+    }
+}
+
+// Private helper returning the route of a line from its address prefix, once its separator arrived
+static int __time_critical_func(prefix_route)(const uartRxData_t *line) {
+    uint32_t address = 0;
+    if (line->rxBufferCount < 3) return MULTIDROP_FOREIGN;
+    for (uint32_t i = 1; i < line->rxBufferCount - 1; i++) {
+        char digit = line->rxBuffer[i];
+        if (digit < '0' || digit > '9') return MULTIDROP_FOREIGN;
+        address = address * 10 + (uint32_t)(digit - '0');
+    }
+    return multidrop_route(address);
+}
+
+void __time_critical_func(transport_receive)(transport_id_t transport, char byte) {
+    rx_state_t *rx = &rx_state[transport];
+    uartRxData_t *line = &rx->line;
+
+    // lines of other nodes cost a compare per byte
+    if (rx->foreign) {
+        if (byte == '\n' || byte == '#') {
+            rx->foreign = false;
+        }
+        return;
+    }
+
+    // the kill switch is a single byte and must get through while a command is executing. On a bus a bare
+    // kill switch stops every node, after an address prefix only the addressed nodes
+    if (byte == KILL_SWITCH && (line->rxBufferCount == 0 || line->rxBufferCount == rx->prefix_length)) {
+        bool bus_wide = rx->prefix_length ? rx->slotted : transport == TRANSPORT_UART && multidrop_enabled();
+        kill_source = bus_wide ? TRANSPORT_NONE : transport;
+        atomic_store(&uart_k_flag, true);
+        line->rxBufferCount = 0;
+        rx->prefix_length = 0;
+        return;
+    }
+    if (byte == '\r') return;
+    if (byte == '\n' || byte == '#') {
+        if (byte == '#' && line->rxBufferCount < UART_RX_BUFFER_SIZE - 1) {
+            line->rxBuffer[line->rxBufferCount++] = byte;
+        }
+        rx->prefix_length = 0;
+        if (line->rxBufferCount == 0) return;
+        line->rxBuffer[line->rxBufferCount] = '\0';
+
+        // the line is copied to the command queue, the buffer collects the next one right away
+        if (transport == TRANSPORT_USB) usb_commands = true;
+        cmd_queue_receive(line->rxBuffer, transport);
+        line->rxBufferCount = 0;
+        return;
+    }
+
+    // on a bus the UART only takes lines addressed to this node, the USB interface stays point to point
+    bool filtered = transport == TRANSPORT_UART && multidrop_enabled();
+    if (filtered && line->rxBufferCount == 0 && byte != MULTIDROP_PREFIX) {
+        rx->foreign = true;
+        multidrop_count_foreign();
+        return;
+    }
+    if (line->rxBufferCount < UART_RX_BUFFER_SIZE - 2) {
+        line->rxBuffer[line->rxBufferCount++] = byte;
+    } else {
+        line->rxBufferCount = 0;   // overlong line, drop it
+        rx->prefix_length = 0;
+        return;
+    }
+    if (line->rxBuffer[0] == MULTIDROP_PREFIX && rx->prefix_length == 0) {
+        int route = MULTIDROP_UNICAST;
+        if (byte == MULTIDROP_SEPARATOR) {
+            route = prefix_route(line);
+            if (route != MULTIDROP_FOREIGN) {
+                rx->prefix_length = (uint8_t)line->rxBufferCount;
+                rx->slotted = route == MULTIDROP_SLOTTED;
+            }
+        } else if (line->rxBufferCount > MULTIDROP_PREFIX_MAX) {
+            route = MULTIDROP_FOREIGN;      // malformed prefix
+        }
+        // without a node ID every prefix is taken, the command queue rejects malformed ones
+        if (filtered && route == MULTIDROP_FOREIGN) {
+            rx->foreign = true;
+            rx->prefix_length = 0;
+            line->rxBufferCount = 0;
+            multidrop_count_foreign();
+        }
+    }
+}
+
+void transport_poll(void) {
+    uint8_t chunk[TRANSPORT_USB_CHUNK];
+
+    if (!hal_usb_cdc_connected()) {
+        // nobody reads the ring, stale responses are not sent to the next host
+        usb_tx_tail = usb_tx_head;
+        rx_state[TRANSPORT_USB].line.rxBufferCount = 0;
+        usb_commands = false;
+        return;
+    }
+
+    size_t received;
+    while ((received = hal_usb_cdc_read(chunk, sizeof(chunk))) > 0) {
+        for (size_t i = 0; i < received; i++) {
+            transport_receive(TRANSPORT_USB, (char)chunk[i]);
+        }
+    }
+    usb_drain();
+}
+
+bool transport_usb_connected(void) {
+    return hal_usb_cdc_connected();
+}
+
+bool transport_usb_commands(void) {
+    return usb_commands && hal_usb_cdc_connected();
+}
+
+bool transport_write(transport_id_t transport, const uint8_t *src, size_t len) {
+    if (transport == TRANSPORT_NONE) return true;
+    if (transport == TRANSPORT_USB) return usb_write(src, len);
+    // on a bus the node only transmits in its turn
+    if (multidrop_enabled()) return multidrop_write(src, len);
+    return uart_write(MAIN_UART_INSTANCE, src, len);
+}
+
+bool transport_try_write(transport_id_t transport, const uint8_t *src, size_t len) {
+    if (transport == TRANSPORT_NONE) return true;
+    if (transport == TRANSPORT_USB) return usb_try_write(src, len);
+    if (multidrop_enabled()) return multidrop_write(src, len);
+    return uart_try_write(MAIN_UART_INSTANCE, src, len);
+}
+
+size_t transport_tx_pending(transport_id_t transport) {
+    if (transport == TRANSPORT_NONE) return 0;
+    if (transport == TRANSPORT_USB) return usb_tx_head - usb_tx_tail;
+    return uart_tx_pending();
+}
+
+void transport_set_response(transport_id_t transport) {
+    response_transport[hal_get_core_num()] = transport;
+}
+
+transport_id_t transport_response(void) {
+    return response_transport[hal_get_core_num()];
+}
+
+transport_id_t transport_kill_source(void) {
+    return kill_source;
+}
+
+bool transport_respond(const uint8_t *src, size_t len) {
+    // keeping a copy for the capture, the bytes that do not fit are flagged
+    if (capture_buffer != NULL && hal_get_core_num() == capture_core) {
+        size_t copied = len < capture_size - capture_count ? len : capture_size - capture_count;
+        memcpy(capture_buffer + capture_count, src, copied);
+        capture_count += copied;
+        capture_overflow |= copied < len;
+    }
+    if (multidrop_slot_capture(src, len)) return true;
+    return transport_write(transport_response(), src, len);
+}
+
+void transport_notify(const uint8_t *src, size_t len) {
+    // on a bus the line waits for the next turn of the node
+    transport_write(TRANSPORT_UART, src, len);
+    if (hal_usb_cdc_connected()) {
+        usb_write(src, len);
+    }
+}
+
+void transport_capture_begin(char *buffer, size_t size) {
+    capture_count = 0;
+    capture_overflow = false;
+    capture_size = size;
+    capture_core = hal_get_core_num();
+    capture_buffer = buffer;
+}
+
+size_t transport_capture_end(bool *overflow) {
+    capture_buffer = NULL;
+    if (overflow != NULL) {
+        *overflow = capture_overflow;
+    }
+    return capture_count;
+}
+
+/*** end of file ***/
@@ -0,0 +1,141 @@
+/** @file transport.h
+*
+* @brief Byte streams carrying the command lines: the main UART and the USB CDC interface. Both feed the same
+*        line assembly and command queue, and every response of a command goes back on the transport the
+*        command arrived on. The UART is driven by its interrupt, the USB interface is polled by core 1 through
+*        a TX ring so responses never wait on the USB host.
+*
+*/
+
+#ifndef _TRANSPORT_H
+#define _TRANSPORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "uart_driver.h"
+
+#define TRANSPORT_USB_TX_RING_SIZE 4096     // power of two
+#define TRANSPORT_USB_CHUNK 64              // one full speed bulk packet
+#define TRANSPORT_USB_POLL_US 500           // core 1 poll period while a USB host is connected
+#define TRANSPORT_USB_TX_TIMEOUT (100 * 1000)
+#define TRANSPORT_POLL_CORE 1
+
+typedef enum {
+    TRANSPORT_UART,
+    TRANSPORT_USB,
+    NUM_OF_TRANSPORTS,
+    TRANSPORT_NONE = NUM_OF_TRANSPORTS      // responses are dropped
+} transport_id_t;
+
+/**
+ * @brief Initialises the transports, called before the UART interrupt is enabled
+ *
+ */
+void transport_init(void);
+
+/**
+ * @brief Collects a received byte into the line of its transport and queues complete lines. A kill switch
+ *        byte at the start of a line, or right after an address prefix of this node, raises uart_k_flag at
+ *        once. On a multi-drop bus the UART skips the lines of other nodes up to their terminator
+ * @param transport
+ * @param byte
+ */
+void transport_receive(transport_id_t transport, char byte);
+
+/**
+ * @brief Moves received USB bytes to the line assembly and queued responses to the USB host, called by core 1
+ *
+ */
+void transport_poll(void);
+
+/**
+ * @brief Checks whether a USB host has the command channel open
+ *
+ */
+bool transport_usb_connected(void);
+
+/**
+ * @brief Checks whether the connected USB host sends commands, the CDC interface is then no console
+ *
+ */
+bool transport_usb_commands(void);
+
+/**
+ * @brief Queues bytes on a transport, waits a bounded time for room. On a multi-drop bus the UART bytes wait
+ *        for the turn of the node instead, see multidrop_write()
+ * @param transport
+ * @param src
+ * @param len
+ * @return true if everything is queued
+ */
+bool transport_write(transport_id_t transport, const uint8_t *src, size_t len);
+
+/**
+ * @brief Queues a complete buffer on a transport without waiting, safe from interrupts
+ * @param transport
+ * @param src
+ * @param len
+ * @return true if queued, nothing is queued otherwise
+ */
+bool transport_try_write(transport_id_t transport, const uint8_t *src, size_t len);
+
+/**
+ * @brief Returns the number of bytes waiting to be sent on a transport
+ * @param transport
+ */
+size_t transport_tx_pending(transport_id_t transport);
+
+/**
+ * @brief Selects the transport the calling core answers on, set to the origin of each dispatched command
+ * @param transport
+ */
+void transport_set_response(transport_id_t transport);
+
+/**
+ * @brief Returns the transport the calling core answers on
+ *
+ */
+transport_id_t transport_response(void);
+
+/**
+ * @brief Returns the transport the last kill switch byte arrived on, TRANSPORT_NONE for a kill of the whole
+ *        bus, which every node obeys without answering
+ *
+ */
+transport_id_t transport_kill_source(void);
+
+/**
+ * @brief Sends a response of the running command on the transport it came from
+ * @param src
+ * @param len
+ * @return true if everything is queued
+ */
+bool transport_respond(const uint8_t *src, size_t len);
+
+/**
+ * @brief Sends an unsolicited report on the UART, held for the next turn of the node on a multi-drop bus, and
+ *        on the USB interface if a host is connected
+ * @param src
+ * @param len
+ */
+void transport_notify(const uint8_t *src, size_t len);
+
+/**
+ * @brief Copies everything transport_respond() sends from the calling core into a buffer as well, until
+ *        transport_capture_end(). Responses of the other core are not captured
+ * @param buffer
+ * @param size
+ */
+void transport_capture_begin(char *buffer, size_t size);
+
+/**
+ * @brief Stops the capture
+ * @param overflow - set if the responses did not fit in the buffer, may be NULL
+ * @return number of captured bytes
+ */
+size_t transport_capture_end(bool *overflow);
+
+#endif /* _TRANSPORT_H */
+
+/*** end of file ***/
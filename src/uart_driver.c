@@ -6,82 +6,234 @@
 
 #include <string.h>
 #include "uart_driver.h"
-#include "pico.h"
+#include "trace.h"
+
+#define UART_TX_RING_MASK (UART_TX_RING_SIZE - 1)
+
+// TX ring of the main UART, filled by any core and drained by the UART interrupt
+static uint8_t txRing[UART_TX_RING_SIZE];
+static volatile uint32_t txHead = 0;    // next free slot, written by producers
+static volatile uint32_t txTail = 0;    // next byte to send, written by the interrupt
+static hal_spin_lock_t *txLock = NULL;
+
+// RS-485 driver enable, raised with the first queued byte and dropped by an alarm after the ring drained
+static volatile bool deEnabled = false;
+static bool deDriven = false;           // the pin is an output, stays one until the last transmission ended
+static uint deGpio = 0;
+static hal_uart_id_t deUart = 0;
+static hal_alarm_t deAlarm;
+static volatile bool deReleasePending = false;
+static volatile uint64_t txDrainedUs = 0;
+
+// Private alarm callback releasing the bus once the last character has left the shift register, a UART still
+// busy gets another character time
+static uint64_t uart_de_release_callback(hal_alarm_t *alarm)
+{
+    uint32_t irqStatus = hal_spin_lock_blocking(txLock);
+    uint64_t releaseUs = txDrainedUs + MAIN_UART_DE_HOLD_US;
+    uint64_t next = 0;
+    if (txTail != txHead)
+    {
+        deReleasePending = false;               // sending again, the next drain re-arms the alarm
+    }
+    else if (releaseUs > alarm->target_us)
+    {
+        next = releaseUs - alarm->target_us;    // drained again since the alarm was set
+    }
+    else if (hal_uart_is_busy(deUart))
+    {
+        next = MAIN_UART_CHAR_US;
+    }
+    else
+    {
+        hal_gpio_put(deGpio, false);
+        deReleasePending = false;
+        if (!deEnabled)
+        {
+            hal_gpio_set_dir(deGpio, HAL_GPIO_IN);
+            deDriven = false;
+        }
+    }
+    hal_spin_unlock(txLock, irqStatus);
+    return next;
+}
+
+// Private function to queue the whole buffer, must be called with txLock held
+static bool uart_tx_enqueue_locked(hal_uart_id_t uart, const uint8_t *src, size_t len)
+{
+    if (UART_TX_RING_SIZE - (txHead - txTail) < len)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; ++i)
+    {
+        txRing[(txHead + i) & UART_TX_RING_MASK] = src[i];
+    }
+    txHead += len;
+
+    // the driver is on before the start bit of the first byte
+    if (deEnabled)
+    {
+        hal_gpio_put(deGpio, true);
+    }
+
+    // TX interrupt asserts while the holding register is empty, so enabling it starts the transfer
+    hal_uart_set_tx_irq_enabled(uart, true);
+    return true;
+}
 
 void initialise_uart(uart_config_t *uartconfig)
 {
-    watchdog_update();  // to clear watchdog timer
+    hal_watchdog_update();  // to clear watchdog timer
+
+    // TX ring is shared by both cores
+    if (txLock == NULL)
+    {
+        txLock = hal_spin_lock_claim();
+    }
+
+    // RS-485 driver off until there is something to send
+    deGpio = uartconfig->dePin;
+    deUart = uartconfig->uartInst;
+    uart_set_de_enabled(uartconfig->deEnable);
 
     // set gpio pins for UART functionality
-    gpio_set_function(uartconfig->txPin, GPIO_FUNC_UART);
-    gpio_set_function(uartconfig->rxPin, GPIO_FUNC_UART);
+    hal_gpio_set_function(uartconfig->txPin, HAL_GPIO_FUNC_UART);
+    hal_gpio_set_function(uartconfig->rxPin, HAL_GPIO_FUNC_UART);
 
     // Rx pin pulled up
-    gpio_set_pulls(uartconfig->rxPin, true, false);
+    hal_gpio_set_pulls(uartconfig->rxPin, true, false);
     
     // Set up the UART baud rate.
-    uart_init(uartconfig->uartInst, uartconfig->baudRate);
+    hal_uart_init(uartconfig->uartInst, (uint32_t)uartconfig->baudRate);
 
     // desable UART hardware flow
-    uart_set_hw_flow(uartconfig->uartInst, false, false);
+    hal_uart_set_hw_flow(uartconfig->uartInst, false, false);
 
     // Set Up UART Frame (stop bit, data bits, parity)
-    uart_set_format(uartconfig->uartInst, uartconfig->dataLen, uartconfig->stopBit, uartconfig->parityBit);
+    hal_uart_set_format(uartconfig->uartInst, uartconfig->dataLen, uartconfig->stopBit, uartconfig->parityBit);
 
     // Turning off FIFO's - we want to recieve character by character
-    uart_set_fifo_enabled(uartconfig->uartInst, false);
-
-    // We need to set up the handler first
-    // Select correct interrupt for the UART we are using
-    int UART_IRQ = uartconfig->uartInst == uart0 ? UART0_IRQ : UART1_IRQ;
+    hal_uart_set_fifo_enabled(uartconfig->uartInst, false);
 
-    // setting up UART interrupt handlers
-    irq_set_exclusive_handler(UART_IRQ, uartconfig->handler);
-
-    // enable UART interrupt
-    irq_set_enabled(UART_IRQ, true);
+    // setting up UART interrupt handler and enabling the UART interrupt
+    hal_uart_set_irq_handler(uartconfig->uartInst, uartconfig->handler);
 
     // enable/disable UART RX/TX interrupts
-    uart_set_irq_enables(uartconfig->uartInst, uartconfig->rxIntrEnable, uartconfig->txIntrEnable);
+    hal_uart_set_irq_enables(uartconfig->uartInst, uartconfig->rxIntrEnable, uartconfig->txIntrEnable);
 }
 
-bool uart_write(uart_inst_t *uart, const uint8_t *src, size_t len)
+bool uart_write(hal_uart_id_t uart, const uint8_t *src, size_t len)
 {
-    watchdog_update();  // to clear watchdog timer
+    hal_watchdog_update();  // to clear watchdog timer
 
     // variables for tracking time
     uint64_t oldTime = 0;
-    uint64_t newTime = 0;
     uint64_t elapsedTime = 0;
 
     // updating as current time
-    oldTime = time_us_64();
-    newTime = time_us_64();
+    oldTime = hal_time_us_64();
 
-    // trying to write source buffer to UART
-    for (size_t i = 0; i < len; ++i) 
+    // queueing source buffer in chunks that fit the ring, each chunk is queued as a whole
+    while (len > 0)
     {
-        oldTime = time_us_64();
-        // Checking for UART is writable till UART Tx timeout
-        while (!uart_is_writable(uart))
+        size_t chunk = len < UART_TX_RING_SIZE ? len : UART_TX_RING_SIZE;
+        uint32_t irqStatus = hal_spin_lock_blocking(txLock);
+        bool queued = uart_tx_enqueue_locked(uart, src, chunk);
+        hal_spin_unlock(txLock, irqStatus);
+
+        if (queued)
+        {
+            src += chunk;
+            len -= chunk;
+            oldTime = hal_time_us_64();
+            TRACE_POINT(TRACE_ACK_QUEUED, chunk);
+            continue;
+        }
+        elapsedTime = hal_time_us_64() - oldTime;   // calculating time spent waiting for room in the ring
+        // error on uart tx timeout
+        if(elapsedTime > MAIN_UART_TX_TIMEOUT)
+        {
+            return false;
+        }
+        hal_tight_loop_contents();                  // empty function
+    }
+    return true;
+}
+
+bool uart_try_write(hal_uart_id_t uart, const uint8_t *src, size_t len)
+{
+    uint32_t irqStatus = hal_spin_lock_blocking(txLock);
+    bool queued = uart_tx_enqueue_locked(uart, src, len);
+    hal_spin_unlock(txLock, irqStatus);
+    if (queued)
+    {
+        TRACE_POINT(TRACE_ACK_QUEUED, len);
+    }
+    return queued;
+}
+
+void uart_set_de_enabled(bool enabled)
+{
+    uint32_t irqStatus = hal_spin_lock_blocking(txLock);
+    if (enabled && !deDriven)
+    {
+        hal_gpio_init(deGpio);
+        hal_gpio_set_dir(deGpio, HAL_GPIO_OUT);
+        hal_gpio_put(deGpio, txTail != txHead);
+        deDriven = true;
+    }
+    deEnabled = enabled;
+
+    // a transmission in progress keeps the driver, the release alarm frees the pin after it
+    if (!enabled && deDriven && txTail == txHead && !deReleasePending)
+    {
+        hal_gpio_put(deGpio, false);
+        hal_gpio_set_dir(deGpio, HAL_GPIO_IN);
+        deDriven = false;
+    }
+    hal_spin_unlock(txLock, irqStatus);
+}
+
+size_t uart_tx_pending(void)
+{
+    return txHead - txTail;
+}
+
+void uart_tx_irq_service(hal_uart_id_t uart)
+{
+    uint32_t irqStatus = hal_spin_lock_blocking(txLock);
+    bool sent = false;
+    while (txTail != txHead && hal_uart_is_writable(uart))
+    {
+        hal_uart_putc_raw(uart, txRing[txTail & UART_TX_RING_MASK]);
+        txTail++;
+        sent = true;
+    }
+    // nothing left to send, stop the TX interrupt until the next enqueue
+    if (txTail == txHead)
+    {
+        hal_uart_set_tx_irq_enabled(uart, false);
+        // only a drain that sent something counts, the RX interrupt calls in with the ring already empty
+        if (sent)
+        {
+            TRACE_POINT(TRACE_TX_DRAINED, 0);
+        }
+        if (deDriven && sent)
         {
-            newTime = time_us_64();
-            elapsedTime = newTime - oldTime;    // calculating elapsed time for sending 1 characer out
-            // error on uart tx timeout 
-            if(elapsedTime > MAIN_UART_TX_TIMEOUT)
+            txDrainedUs = hal_time_us_64();
+            if (!deReleasePending)
             {
-                return false;
+                deReleasePending = hal_add_alarm_at(txDrainedUs + MAIN_UART_DE_HOLD_US, uart_de_release_callback, NULL, &deAlarm);
             }
-            tight_loop_contents();              // empty function
         }
-        uart_get_hw(uart)->dr = *src++;         // copying single character to UART data register
     }
-    return true;
+    hal_spin_unlock(txLock, irqStatus);
 }
 
 bool uart_send_byte(uart_config_t *uartconfig, uint8_t byte)
 {
-    watchdog_update();  // to clear watchdog timer
+    hal_watchdog_update();  // to clear watchdog timer
 
     bool timeOut = false;   // variable for error checking
     
@@ -89,9 +241,9 @@ bool uart_send_byte(uart_config_t *uartconfig, uint8_t byte)
     return timeOut;
 }
 
-bool uart_send_bytes(uart_config_t *uartconfig, uint8_t *buffer, size_t size)
+bool uart_send_bytes(uart_config_t *uartconfig, const uint8_t *buffer, size_t size)
 {
-    watchdog_update();  // to clear watchdog timer
+    hal_watchdog_update();  // to clear watchdog timer
 
     bool timeOut = false;   // variable for error checking
 
@@ -100,20 +252,20 @@ bool uart_send_bytes(uart_config_t *uartconfig, uint8_t *buffer, size_t size)
     return timeOut;
 }
 
-bool uart_send_string(uart_config_t *uartconfig, char *str)
+bool uart_send_string(uart_config_t *uartconfig, const char *str)
 {
-    watchdog_update();  // to clear watchdog timer
+    hal_watchdog_update();  // to clear watchdog timer
 
     bool timeOut = false;   // variable for error checking
     
     // writes a string until '\0'
-    timeOut = uart_write(uartconfig->uartInst, str, strlen(str));
+    timeOut = uart_write(uartconfig->uartInst, (const uint8_t *)str, strlen(str));
     return timeOut;
 }
 
-bool uart_read_byte(uart_inst_t *uart, uint8_t *dst)
+bool uart_read_byte(hal_uart_id_t uart, uint8_t *dst)
 {
-    watchdog_update();  // to clear watchdog timer
+    hal_watchdog_update();  // to clear watchdog timer
 
     // variables for tracking time
     uint64_t oldTime = 0;
@@ -122,19 +274,19 @@ bool uart_read_byte(uart_inst_t *uart, uint8_t *dst)
 
     // trying to read source buffer to UART
 
-    oldTime = time_us_64();
-    while (!uart_is_readable(uart))
+    oldTime = hal_time_us_64();
+    while (!hal_uart_is_readable(uart))
     {
-        newTime = time_us_64();
+        newTime = hal_time_us_64();
         elapsedTime = newTime - oldTime;    // calculating time differance
         // error on uart tx timeout
         if(elapsedTime > MAIN_UART_RX_TIMEOUT)
         {
             return false;
         }
-        tight_loop_contents();
+        hal_tight_loop_contents();
     }
-    *dst = (uint8_t) uart_get_hw(uart)->dr; // copying single character from UART data register to destination variable
+    *dst = hal_uart_getc_raw(uart);         // copying single character from UART data register to destination variable
     return true;
 }
 
@@ -7,16 +7,15 @@
 #ifndef UART_DRIVER_H
 #define UART_DRIVER_H
 
-#include "pico/stdlib.h"
 #include <stdio.h>
-#include "hardware/watchdog.h"
+#include "hal.h"
 #include "debug_print.h"
 
 // RP2 main UART CONFIG
-#define MAIN_UART_INSTANCE              uart0
+#define MAIN_UART_INSTANCE              HAL_UART0
 #define MAIN_UART_BAUDRATE              115200
 #define MAIN_UART_DATA_LEN              8
-#define MAIN_UART_PARITY                UART_PARITY_NONE
+#define MAIN_UART_PARITY                HAL_UART_PARITY_NONE
 #define MAIN_UART_STOP_BIT              1
 #define MAIN_UART_TX_INTR_ENABLE        false
 #define MAIN_UART_RX_INTR_ENABLE        true    
@@ -24,9 +23,16 @@
 // RP2 main UART Pins
 #define MAIN_UART_TX                    16
 #define MAIN_UART_RX                    17
+#define MAIN_UART_DE                    18      // RS-485 driver enable, high while transmitting
 
 // RP2 main UART buffer size
 #define UART_RX_BUFFER_SIZE             100
+#define UART_TX_RING_SIZE               512     // interrupt driven TX ring, power of two
+
+// RS-485 driver enable hold after the TX ring drained. Without the FIFO the last character is still in the
+// holding register while the one before it shifts out, the release also waits for the UART BUSY flag
+#define MAIN_UART_CHAR_US               ((10 * 1000000 + MAIN_UART_BAUDRATE - 1) / MAIN_UART_BAUDRATE)
+#define MAIN_UART_DE_HOLD_US            (2 * MAIN_UART_CHAR_US + 10)
 
 // RP2 main UART RX/TX Timeout
 #define MAIN_UART_TX_TIMEOUT            (100 * 1000) // 100 ms UART tx timeout
@@ -35,7 +41,7 @@
 // UART config structure
 typedef struct
 {
-    uart_inst_t *uartInst;
+    hal_uart_id_t uartInst;
     uint64_t baudRate; 
     uint16_t dataLen;
     uint16_t parityBit;
@@ -44,7 +50,9 @@ typedef struct
     uint16_t rxPin;
     bool txIntrEnable;
     bool rxIntrEnable;
-    irq_handler_t handler;
+    bool deEnable;      // drive an RS-485 driver enable on dePin, see uart_set_de_enabled()
+    uint16_t dePin;
+    hal_irq_handler_t handler;
 }uart_config_t;
 
 // UART rx data structure
@@ -64,6 +72,8 @@ void initialise_uart(uart_config_t *uartconfig);
 
 /**
  * @brief writes number of bytes on UART (non blocking with a MAIN_UART_TX_TIMEOUT timeout)
+ *        bytes are queued in the TX ring and sent from the UART interrupt,
+ *        the call only waits while the ring has no room for the whole buffer
  * 
  * @param uart - uart instance
  * @param src - pointer to buffer to write
@@ -71,7 +81,41 @@ void initialise_uart(uart_config_t *uartconfig);
  * @return true - on successfully sent
  * @return false - on timeout
  */
-bool uart_write(uart_inst_t *uart, const uint8_t *src, size_t len);
+bool uart_write(hal_uart_id_t uart, const uint8_t *src, size_t len);
+
+/**
+ * @brief queues a complete buffer in the TX ring without waiting
+ * 
+ * @param uart - uart instance
+ * @param src - pointer to buffer to write
+ * @param len - length of buffer
+ * @return true - on queued
+ * @return false - when the ring has no room, nothing is queued
+ */
+bool uart_try_write(hal_uart_id_t uart, const uint8_t *src, size_t len);
+
+/**
+ * @brief returns the number of bytes waiting in the TX ring
+ * 
+ * @return number of queued bytes
+ */
+size_t uart_tx_pending(void);
+
+/**
+ * @brief turns the RS-485 driver enable on dePin on or off. The pin is an output only while it is enabled,
+ *        a disabled pin is released to an input once the bytes already queued have left
+ * 
+ * @param enabled - raise the driver enable for every transmission
+ */
+void uart_set_de_enabled(bool enabled);
+
+/**
+ * @brief moves bytes from the TX ring to the UART, call from the UART interrupt handler. With a driver
+ *        enable pin the driver is released once the last character has left
+ * 
+ * @param uart - uart instance
+ */
+void uart_tx_irq_service(hal_uart_id_t uart);
 
 /**
  * @brief writes single byte on UART (non blocking with a MAIN_UART_TX_TIMEOUT timeout)
@@ -92,7 +136,7 @@ bool uart_send_byte(uart_config_t *uartconfig, uint8_t byte);
  * @return true - on successfully write
  * @return false - on timeout
  */
-bool uart_send_bytes(uart_config_t *uartconfig, uint8_t *buffer, size_t size);
+bool uart_send_bytes(uart_config_t *uartconfig, const uint8_t *buffer, size_t size);
 
 /**
  * @brief writes string on UART (non blocking with a MAIN_UART_TX_TIMEOUT timeout)
@@ -102,7 +146,7 @@ bool uart_send_bytes(uart_config_t *uartconfig, uint8_t *buffer, size_t size);
  * @return true - on successfully write
  * @return false - on timeout
  */
-bool uart_send_string(uart_config_t *uartconfig, char *str);
+bool uart_send_string(uart_config_t *uartconfig, const char *str);
 
 /**
  * @brief reads single byte on UART (non blocking with a MAIN_UART_RX_TIMEOUT timeout)
@@ -112,6 +156,6 @@ bool uart_send_string(uart_config_t *uartconfig, char *str);
  * @return true - on successfully read
  * @return false - on timeout
  */
-bool uart_read_byte(uart_inst_t *uart, uint8_t *dst);
+bool uart_read_byte(hal_uart_id_t uart, uint8_t *dst);
 
 #endif
@@ -0,0 +1,107 @@
+/**
+ * @file valve_cal.c
+ * @brief Valve lost motion calibration Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <stdio.h>
+#include "valve_cal.h"
+#include "transport.h"
+
+#define VALVE_CAL_ACK_SIZE 24
+#define VALVE_CAL_PULSES_PER_REV (ENCODER_NO_OF_PULSES + 1)
+#define VALVE_CAL_STEPS_PER_REV (STEPS_PER_ROTATION * FINEST_MICROSTEP)
+#define VALVE_CAL_MAX_STEPS (VALVE_CAL_MAX_DEG * VALVE_CAL_STEPS_PER_REV / DEGREE_FULL_ANGLE)
+
+static valve_cal_table_t cal_table;
+static bool calibrating = false;
+
+static int direction_slot(char direction) {
+    return direction == DIR_CCW ? 1 : 0;
+}
+
+// Private helper converting the summed first pass error of the trials to rounded, clamped 1/32 microsteps
+static int16_t error_to_steps(int32_t error_pulses_sum) {
+    int32_t numerator = -error_pulses_sum * VALVE_CAL_STEPS_PER_REV;
+    int32_t denominator = VALVE_CAL_PULSES_PER_REV * VALVE_CAL_TRIALS;
+    int32_t steps = (numerator + (numerator < 0 ? -denominator : denominator) / 2) / denominator;
+    if (steps > VALVE_CAL_MAX_STEPS) steps = VALVE_CAL_MAX_STEPS;
+    if (steps < -VALVE_CAL_MAX_STEPS) steps = -VALVE_CAL_MAX_STEPS;
+    return (int16_t)steps;
+}
+
+void valve_cal_init(void) {
+    if (!flash_store_load(FLASH_STORE_SLOT_VALVE_CAL, VALVE_CAL_VERSION, &cal_table, sizeof(cal_table))) {
+        memset(&cal_table, 0, sizeof(cal_table));
+    }
+}
+
+int16_t valve_cal_compensation(int from_index, int to_index, char direction) {
+    if (calibrating || from_index < 0 || from_index >= NUM_OF_VALVES || to_index < 0 || to_index >= NUM_OF_VALVES) return 0;
+    return cal_table.compensation_steps[from_index][to_index][direction_slot(direction)];
+}
+
+void valve_cal_get(valve_cal_table_t *table) {
+    *table = cal_table;
+}
+
+int valve_cal_run(void) {
+    static valve_cal_table_t measured;
+    static const char directions[2] = {DIR_CW, DIR_CCW};
+    int status = ROTATION_COMPLETED;
+
+    memset(&measured, 0, sizeof(measured));
+    calibrating = true;
+    if (motor_home_valve() != HOMING_SUCCESSFUL) status = HOMING_TIMEOUT;
+
+    for (int from = 0; from < NUM_OF_VALVES && status == ROTATION_COMPLETED; from++) {
+        for (int to = 0; to < NUM_OF_VALVES && status == ROTATION_COMPLETED; to++) {
+            if (to == from) continue;
+            for (int d = 0; d < 2 && status == ROTATION_COMPLETED; d++) {
+                int32_t error_sum = 0;
+                for (int trial = 0; trial < VALVE_CAL_TRIALS; trial++) {
+                    // the approach to the start port is closed loop, the measured move is the first pass
+                    status = motor_move_to_valve(from, 0);
+                    if (status != ROTATION_COMPLETED) break;
+                    status = motor_move_to_valve(to, directions[d]);
+                    if (status != ROTATION_COMPLETED) break;
+                    error_sum += motor_first_pass_error();
+                }
+                measured.compensation_steps[from][to][d] = error_to_steps(error_sum);
+            }
+        }
+    }
+    calibrating = false;
+
+    int home_status = motor_home_valve();
+    if (status != ROTATION_COMPLETED) return status;
+    if (home_status != HOMING_SUCCESSFUL) return HOMING_TIMEOUT;
+
+    cal_table = measured;
+    if (!flash_store_save(FLASH_STORE_SLOT_VALVE_CAL, VALVE_CAL_VERSION, &cal_table, sizeof(cal_table))) return MOTOR_HW_FAIL;
+    return ROTATION_COMPLETED;
+}
+
+int valve_cal_command(const char *ptr_data_str) {
+    char ack[VALVE_CAL_ACK_SIZE];
+    const char *mode_str = strchr(ptr_data_str, ',');
+    int status;
+    int max_steps = 0;
+
+    if (mode_str != NULL && atoi(mode_str + 1) == 0) {
+        memset(&cal_table, 0, sizeof(cal_table));
+        status = flash_store_erase(FLASH_STORE_SLOT_VALVE_CAL) ? SUCCESS_INT : MOTOR_HW_FAIL;
+    } else {
+        status = valve_cal_run();
+        for (int from = 0; from < NUM_OF_VALVES; from++) {
+            for (int to = 0; to < NUM_OF_VALVES; to++) {
+                for (int d = 0; d < 2; d++) max_steps = PICO_MAX(max_steps, abs(cal_table.compensation_steps[from][to][d]));
+            }
+        }
+    }
+    snprintf(ack, sizeof(ack), "vc_%d_%d\n", status, max_steps);
+    transport_respond((const uint8_t *)ack, strlen(ack));
+    return status;
+}
+
+/*** end of file ***/
@@ -0,0 +1,63 @@
+/** @file valve_cal.h
+*
+* @brief Per transition lost motion calibration of the valve. Measures the first pass encoder error of
+*        every (from, to, direction) move and keeps the compensation in flash, so valve moves land on the
+*        port without correction passes.
+*
+*/
+
+#ifndef _VALVE_CAL_H
+#define _VALVE_CAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "drv8825.h"
+#include "flash_store.h"
+
+#define VALVE_CAL_VERSION 1
+#define VALVE_CAL_TRIALS 3          // measured moves averaged per table entry
+#define VALVE_CAL_MAX_DEG 8         // larger errors are mechanical faults, not lost motion
+
+// Compensation table, extra 1/32 microsteps of the last leg of a move, index 0 is DIR_CW and 1 is DIR_CCW
+typedef struct {
+    int16_t compensation_steps[NUM_OF_VALVES][NUM_OF_VALVES][2];
+} valve_cal_table_t;
+
+/**
+ * @brief Loads the compensation table from flash, an empty or invalid slot leaves every entry at zero
+ *
+ */
+void valve_cal_init(void);
+
+/**
+ * @brief Returns the compensation of a move, zero while a calibration is running
+ * @param from_index - valve_coordinates entry the move starts at
+ * @param to_index   - valve_coordinates entry of the target
+ * @param direction  - DIR_CW or DIR_CCW
+ * @return 1/32 microsteps, positive adds steps
+ */
+int16_t valve_cal_compensation(int from_index, int to_index, char direction);
+
+/**
+ * @brief Measures every transition in both directions and stores the table in flash. Starts and
+ *        ends with homing, so the table is measured from a fresh index reference
+ * @return ROTATION_COMPLETED or the status of the first failed move, the previous table is kept then
+ */
+int valve_cal_run(void);
+
+/**
+ * @brief Returns the active table
+ * @param table
+ */
+void valve_cal_get(valve_cal_table_t *table);
+
+/**
+ * @brief Calibration command handler. "VC" calibrates and replies "vc_<status>_<max_abs_steps>",
+ *        "VC,0" clears the table and replies "vc_1_0"
+ * @param ptr_data_str
+ */
+int valve_cal_command(const char *ptr_data_str);
+
+#endif /* _VALVE_CAL_H */
+
+/*** end of file ***/
@@ -0,0 +1,214 @@
+/**
+ * @file valve_route.c
+ * @brief Valve routing planner Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include "valve_route.h"
+#include "transport.h"
+
+// Route graph: the valve ports plus the start and target angles, clockwise (increasing angle) order
+#define ROUTE_MAX_NODES (NUM_OF_VALVES + 2)
+#define ROUTE_NUM_STATES (2 * ROUTE_MAX_NODES)
+#define ROUTE_NO_STATE 0xFF
+#define ROUTE_COST_INFINITE UINT32_MAX
+#define ROUTE_ACK_SIZE 16
+#define ROUTE_MASK_ALL ((1u << NUM_OF_VALVES) - 1)
+
+// Graph state: node and the direction the rotor arrived in, direction 0 is clockwise
+typedef struct {
+    uint32_t cost_us;
+    uint8_t previous;
+    bool done;
+} route_state_t;
+
+static uint8_t blocked_ports = 0;
+static valve_route_zone_t route_zones[ROUTE_MAX_ZONES];
+static uint8_t route_zone_count = 0;
+
+static uint16_t wrap_degrees(int32_t angle) {
+    return (uint16_t)(((angle % DEGREE_FULL_ANGLE) + DEGREE_FULL_ANGLE) % DEGREE_FULL_ANGLE);
+}
+
+// Private helper, true if x lies on the clockwise arc of length degrees starting at start
+static bool arc_contains(uint16_t start, uint16_t length, uint16_t x) {
+    return wrap_degrees((int32_t)x - start) <= length;
+}
+
+static bool arcs_intersect(uint16_t a_start, uint16_t a_length, uint16_t b_start, uint16_t b_length) {
+    return arc_contains(a_start, a_length, b_start) || arc_contains(b_start, b_length, a_start);
+}
+
+uint32_t valve_route_move_time_us(uint16_t angle) {
+    motor_step_plan_t plan;
+    q16_16_t resolution = Q16_FROM_RATIO(ENCODER_NO_OF_PULSES + 1, DEGREE_FULL_ANGLE);
+    if (angle == 0) return 0;
+    if (motor_plan_steps(DIR_CW, STEPTYPE, angle % DEGREE_FULL_ANGLE, (uint16_t)atoi(RPM), resolution, &plan) != SUCCESS_INT) {
+        return ROUTE_COST_INFINITE / 4;
+    }
+    return plan.steps * 2u * plan.step_delay_us;
+}
+
+// Private helper, true if the clockwise arc crosses a forbidden zone or a blocked port other than the end ports
+static bool arc_is_forbidden(uint16_t start, uint16_t length, uint16_t from, uint16_t to) {
+    for (uint8_t i = 0; i < route_zone_count; i++) {
+        uint16_t zone_start = wrap_degrees(route_zones[i].start_deg);
+        uint16_t zone_length = wrap_degrees((int32_t)route_zones[i].end_deg - route_zones[i].start_deg);
+        if (arcs_intersect(start, length, zone_start, zone_length)) return true;
+    }
+    for (int port = 0; port < NUM_OF_VALVES; port++) {
+        if (!(blocked_ports & (1u << port))) continue;
+        uint16_t centre = wrap_degrees(valve_coordinates[port].valve_position);
+        if (arc_contains(wrap_degrees((int32_t)centre - ROUTE_PORT_HALF_WIDTH_DEG), 2 * ROUTE_PORT_HALF_WIDTH_DEG, from) ||
+            arc_contains(wrap_degrees((int32_t)centre - ROUTE_PORT_HALF_WIDTH_DEG), 2 * ROUTE_PORT_HALF_WIDTH_DEG, to)) {
+            continue;
+        }
+        if (arcs_intersect(start, length, wrap_degrees((int32_t)centre - ROUTE_PORT_HALF_WIDTH_DEG), 2 * ROUTE_PORT_HALF_WIDTH_DEG)) return true;
+    }
+    return false;
+}
+
+// Private helper adding an angle to the sorted node list unless it is already there, returns its index
+static uint8_t add_node(uint16_t *nodes, uint8_t *count, uint16_t angle) {
+    uint8_t i = 0;
+    while (i < *count && nodes[i] < angle) i++;
+    if (i < *count && nodes[i] == angle) return i;
+    for (uint8_t j = *count; j > i; j--) nodes[j] = nodes[j - 1];
+    nodes[i] = angle;
+    (*count)++;
+    return i;
+}
+
+static uint8_t find_node(const uint16_t *nodes, uint8_t count, uint16_t angle) {
+    for (uint8_t i = 0; i < count; i++) {
+        if (nodes[i] == angle) return i;
+    }
+    return ROUTE_NO_STATE;
+}
+
+int valve_route_plan(int16_t from_deg, int16_t to_deg, char last_direction, valve_route_t *route) {
+    uint16_t from = wrap_degrees(from_deg), to = wrap_degrees(to_deg);
+    route->leg_count = 0;
+    route->cost_us = 0;
+
+    if (from == to) {
+        route->legs[0].direction = DIR_CW;
+        route->legs[0].angle = 0;
+        route->leg_count = 1;
+        return SUCCESS_INT;
+    }
+
+    uint16_t nodes[ROUTE_MAX_NODES];
+    uint8_t node_count = 0;
+    for (int port = 0; port < NUM_OF_VALVES; port++) add_node(nodes, &node_count, wrap_degrees(valve_coordinates[port].valve_position));
+    add_node(nodes, &node_count, from);
+    add_node(nodes, &node_count, to);
+    uint8_t start = find_node(nodes, node_count, from), target = find_node(nodes, node_count, to);
+
+    // Dijkstra over (node, arrival direction), a reversal costs backlash plus stop/start
+    route_state_t states[ROUTE_NUM_STATES];
+    for (uint8_t s = 0; s < ROUTE_NUM_STATES; s++) {
+        states[s].cost_us = ROUTE_COST_INFINITE;
+        states[s].previous = ROUTE_NO_STATE;
+        states[s].done = false;
+    }
+    uint32_t reversal_us = ROUTE_REVERSAL_US + valve_route_move_time_us(ROUTE_BACKLASH_DEG);
+    uint8_t start_dir = last_direction == DIR_CCW ? 1 : 0;
+    states[2 * start] .cost_us = (last_direction && start_dir != 0) ? reversal_us : 0;
+    states[2 * start + 1].cost_us = (last_direction && start_dir != 1) ? reversal_us : 0;
+    uint8_t reached = ROUTE_NO_STATE;
+
+    for (;;) {
+        uint8_t current = ROUTE_NO_STATE;
+        for (uint8_t s = 0; s < 2 * node_count; s++) {
+            if (!states[s].done && states[s].cost_us != ROUTE_COST_INFINITE &&
+                (current == ROUTE_NO_STATE || states[s].cost_us < states[current].cost_us)) {
+                current = s;
+            }
+        }
+        if (current == ROUTE_NO_STATE) break;
+        states[current].done = true;
+        uint8_t node = current / 2, dir = current % 2;
+        if (node == target) {
+            reached = current;
+            break;
+        }
+        for (uint8_t next_dir = 0; next_dir < 2; next_dir++) {
+            uint8_t next = next_dir == 0 ? (uint8_t)((node + 1) % node_count) : (uint8_t)((node + node_count - 1) % node_count);
+            uint16_t length = next_dir == 0 ? wrap_degrees((int32_t)nodes[next] - nodes[node]) : wrap_degrees((int32_t)nodes[node] - nodes[next]);
+            uint16_t arc_start = next_dir == 0 ? nodes[node] : nodes[next];
+            if (arc_is_forbidden(arc_start, length, from, to)) continue;
+
+            uint32_t cost = states[current].cost_us + valve_route_move_time_us(length) + (next_dir != dir && node != start ? reversal_us : 0);
+            uint8_t next_state = (uint8_t)(2 * next + next_dir);
+            if (!states[next_state].done && cost < states[next_state].cost_us) {
+                states[next_state].cost_us = cost;
+                states[next_state].previous = current;
+            }
+        }
+    }
+    if (reached == ROUTE_NO_STATE) return ROUTE_IS_INVALID;
+
+    // walk back to the start, merging consecutive segments of one direction into a leg
+    valve_route_leg_t reversed[ROUTE_NUM_STATES];
+    uint8_t reversed_count = 0;
+    for (uint8_t s = reached; states[s].previous != ROUTE_NO_STATE; s = states[s].previous) {
+        uint8_t previous = states[s].previous;
+        char direction = (s % 2) == 0 ? DIR_CW : DIR_CCW;
+        uint16_t length = (s % 2) == 0 ? wrap_degrees((int32_t)nodes[s / 2] - nodes[previous / 2]) : wrap_degrees((int32_t)nodes[previous / 2] - nodes[s / 2]);
+        if (reversed_count > 0 && reversed[reversed_count - 1].direction == direction) {
+            reversed[reversed_count - 1].angle += length;
+        } else {
+            reversed[reversed_count].direction = direction;
+            reversed[reversed_count].angle = length;
+            reversed_count++;
+        }
+    }
+    if (reversed_count > ROUTE_MAX_LEGS) return ROUTE_IS_INVALID;
+    for (uint8_t i = 0; i < reversed_count; i++) route->legs[i] = reversed[reversed_count - 1 - i];
+    route->leg_count = reversed_count;
+    route->cost_us = states[reached].cost_us;
+    return SUCCESS_INT;
+}
+
+void valve_route_set_blocked_ports(uint8_t mask) {
+    blocked_ports = mask & ROUTE_MASK_ALL;
+}
+
+uint8_t valve_route_blocked_ports(void) {
+    return blocked_ports;
+}
+
+bool valve_route_set_zones(const valve_route_zone_t *zones, uint8_t count) {
+    if (count > ROUTE_MAX_ZONES || (count && zones == NULL)) return false;
+    for (uint8_t i = 0; i < count; i++) route_zones[i] = zones[i];
+    route_zone_count = count;
+    return true;
+}
+
+int valve_route_command(const char *ptr_data_str) {
+    char ack[ROUTE_ACK_SIZE];
+    const char *mask_str = strchr(ptr_data_str, ',');
+
+    // a CRC field alone is not a mask, "VB" reports the blocked ports
+    int status = SUCCESS_INT;
+    if (mask_str == NULL || !isdigit((unsigned char)mask_str[1])) {
+        snprintf(ack, sizeof(ack), "vb_%u\n", (unsigned)blocked_ports);
+        transport_respond((const uint8_t *)ack, strlen(ack));
+        return status;
+    }
+    unsigned long mask = strtoul(mask_str + 1, NULL, 10);
+    if (mask > ROUTE_MASK_ALL) {
+        status = RESOLUTION_ERROR;
+        snprintf(ack, sizeof(ack), "vb_%d\n", status);
+    } else {
+        valve_route_set_blocked_ports((uint8_t)mask);
+        snprintf(ack, sizeof(ack), "vb_%u\n", (unsigned)mask);
+    }
+    transport_respond((const uint8_t *)ack, strlen(ack));
+    return status;
+}
+
+/*** end of file ***/
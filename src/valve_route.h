@@ -0,0 +1,94 @@
+/** @file valve_route.h
+*
+* @brief Routing planner of the rotary valve. Finds the minimum time legal path between two valve
+*        angles on the full circle: both rotation directions, wrap-around, forbidden zones, ports
+*        that must not be crossed and the cost of a direction reversal.
+*
+*/
+
+#ifndef _VALVE_ROUTE_H
+#define _VALVE_ROUTE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "drv8825.h"
+
+// Status codes, next to the drv8825 ones
+#define ROUTE_IS_INVALID -7                 // no legal path between the two angles
+
+#define ROUTE_MAX_LEGS 4
+#define ROUTE_MAX_ZONES 4
+
+// A blocked port may not be crossed within this distance of its centre
+#define ROUTE_PORT_HALF_WIDTH_DEG 3
+
+// Direction reversal: lost motion of the gear train and the stop/start of the motor
+#define ROUTE_BACKLASH_DEG 2
+#define ROUTE_REVERSAL_US 20000
+
+// One uninterrupted rotation of a route
+typedef struct {
+    char direction;         // DIR_CW or DIR_CCW
+    uint16_t angle;         // degrees
+} valve_route_leg_t;
+
+typedef struct {
+    uint8_t leg_count;
+    valve_route_leg_t legs[ROUTE_MAX_LEGS];
+    uint32_t cost_us;       // estimated rotation time including reversals
+} valve_route_t;
+
+// Forbidden arc, clockwise from start_deg to end_deg
+typedef struct {
+    int16_t start_deg;
+    int16_t end_deg;
+} valve_route_zone_t;
+
+/**
+ * @brief Plans the route between two valve angles. A move to the current angle is a single zero
+ *        angle clockwise leg, so the caller still runs its encoder check
+ * @param from_deg       - current valve angle, valve_coordinates convention
+ * @param to_deg         - target valve angle
+ * @param last_direction - direction of the previous move, 0 if unknown
+ * @param route          - filled with the legs
+ * @return SUCCESS_INT or ROUTE_IS_INVALID
+ */
+int valve_route_plan(int16_t from_deg, int16_t to_deg, char last_direction, valve_route_t *route);
+
+/**
+ * @brief Estimated time of a rotation at the production step type and RPM
+ * @param angle - degrees
+ */
+uint32_t valve_route_move_time_us(uint16_t angle);
+
+/**
+ * @brief Sets the ports that must not be crossed, e.g. while pressurized. Start and target ports of a
+ *        route are always allowed
+ * @param mask - bit n blocks valve_coordinates[n]
+ */
+void valve_route_set_blocked_ports(uint8_t mask);
+
+/**
+ * @brief Returns the mask of blocked ports
+ *
+ */
+uint8_t valve_route_blocked_ports(void);
+
+/**
+ * @brief Replaces the forbidden zones of the valve head
+ * @param zones - copied, may be NULL if count is 0
+ * @param count - at most ROUTE_MAX_ZONES
+ * @return true if the zones are installed
+ */
+bool valve_route_set_zones(const valve_route_zone_t *zones, uint8_t count);
+
+/**
+ * @brief Blocked ports command handler, "VB,<mask>" replies "vb_<mask>" or "vb_-1" for an invalid mask, "VB"
+ *        reports the blocked ports as "vb_<mask>"
+ * @param ptr_data_str
+ */
+int valve_route_command(const char *ptr_data_str);
+
+#endif /* _VALVE_ROUTE_H */
+
+/*** end of file ***/
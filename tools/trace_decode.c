@@ -0,0 +1,244 @@
+/**
+ * @file trace_decode.c
+ * @brief Host side decoder of the TD trace dump, prints per stage latencies
+ * @author Yashas Nagaraj Udupa 
+ *
+ * Usage : trace_decode <capture.bin>   (or the capture on stdin)
+ * The capture is the raw byte stream received after sending "TD", other bytes are skipped.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "../src/frame.h"
+
+#define MAX_ENTRIES 4096
+#define NUM_STAGES 9
+#define ENTRY_SIZE 12
+#define MAX_WINDOWS 16        // commands open at once, CMD_QUEUE_DEPTH plus lines still being answered
+
+// Mirrors enum TraceStage in src/trace.h
+#define TRACE_STAGE_RX 1      // TRACE_RX_FRAME_COMPLETE, arg = command ID
+#define TRACE_STAGE_CRC 2     // TRACE_CRC_DONE
+#define TRACE_STAGE_DISPATCH 3
+#define TRACE_STAGE_ACK 6     // TRACE_ACK_QUEUED
+#define TRACE_STAGE_LAST 7    // TRACE_TX_DRAINED
+#define TRACE_STAGE_DONE 8    // TRACE_COMMAND_DONE, arg = command ID
+
+typedef struct {
+    uint64_t timestamp;
+    uint8_t stage;
+    uint8_t core;
+    uint16_t arg;
+} trace_entry_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+} latency_t;
+
+static const char *stage_names[NUM_STAGES] = {
+    "?", "RX_FRAME_COMPLETE", "CRC_DONE", "DISPATCH", "MOTION_START", "MOTION_END", "ACK_QUEUED", "TX_DRAINED",
+    "COMMAND_DONE"
+};
+
+// A command from its line to the drain of its final response, commands overlap once the host pipelines
+typedef struct {
+    bool open;
+    uint16_t id;
+    bool crc_done;
+    bool dispatched;
+    bool done;
+    const trace_entry_t *first;
+    const trace_entry_t *previous;
+} window_t;
+
+static window_t windows[MAX_WINDOWS];
+static uint32_t window_order = 0;       // RX order of the windows, oldest first
+static uint32_t window_rank[MAX_WINDOWS];
+
+static trace_entry_t entries[MAX_ENTRIES];
+static size_t entry_count = 0;
+
+static uint32_t get_u32(const uint8_t *src) {
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const trace_entry_t *ea = a, *eb = b;
+    return ea->timestamp < eb->timestamp ? -1 : ea->timestamp > eb->timestamp;
+}
+
+// Reads frames until the terminating empty trace frame, returns 0 on success
+static int read_dump(FILE *in) {
+    int c;
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    while ((c = fgetc(in)) != EOF) {
+        if (c != FRAME_SYNC_0) continue;
+        if (fgetc(in) != FRAME_SYNC_1) continue;
+        int type = fgetc(in), length = fgetc(in);
+        if (type == EOF || length == EOF) break;
+        if (fread(payload, 1, (size_t)length, in) != (size_t)length) break;
+        uint8_t checksum[FRAME_CHECKSUM_SIZE];
+        if (fread(checksum, 1, sizeof(checksum), in) != sizeof(checksum)) break;
+
+        uint16_t sum = (uint16_t)(type + length);
+        for (int i = 0; i < length; i++) sum += payload[i];
+        uint16_t expected = (uint16_t)~sum;
+        if (expected != (uint16_t)(checksum[0] | (checksum[1] << 8))) {
+            fprintf(stderr, "checksum mismatch, frame skipped\n");
+            continue;
+        }
+        if (type != FRAME_TYPE_TRACE || length < 1) continue;
+        if (payload[0] == 0) return 0;
+
+        for (int i = 0; i < payload[0] && entry_count < MAX_ENTRIES; i++) {
+            const uint8_t *src = &payload[1 + i * ENTRY_SIZE];
+            trace_entry_t *entry = &entries[entry_count++];
+            entry->timestamp = (uint64_t)get_u32(src) | ((uint64_t)get_u32(src + 4) << 32);
+            entry->stage = src[8];
+            entry->core = src[9];
+            entry->arg = (uint16_t)(src[10] | (src[11] << 8));
+        }
+    }
+    return entry_count ? 0 : -1;
+}
+
+enum { WINDOW_NO_CRC, WINDOW_QUEUED, WINDOW_EXECUTING, WINDOW_DONE };
+
+static window_t *find_window(uint16_t id) {
+    for (int i = 0; i < MAX_WINDOWS; i++) {
+        if (windows[i].open && windows[i].id == id) return &windows[i];
+    }
+    return NULL;
+}
+
+// Private helper returning a closed window, or the oldest open one if a command never finished
+static window_t *free_window(void) {
+    window_t *oldest = &windows[0];
+    for (int i = 0; i < MAX_WINDOWS; i++) {
+        if (!windows[i].open) return &windows[i];
+        if (window_rank[i] < window_rank[oldest - windows]) oldest = &windows[i];
+    }
+    return oldest;
+}
+
+// Private helper returning the oldest open window in a state
+static window_t *oldest_window(int state) {
+    window_t *oldest = NULL;
+    for (int i = 0; i < MAX_WINDOWS; i++) {
+        const window_t *w = &windows[i];
+        bool match = false;
+        if (!w->open) continue;
+        switch (state) {
+            case WINDOW_NO_CRC: match = !w->crc_done && !w->dispatched; break;
+            case WINDOW_QUEUED: match = !w->dispatched; break;
+            case WINDOW_EXECUTING: match = w->dispatched && !w->done; break;
+            case WINDOW_DONE: match = w->done; break;
+        }
+        if (match && (oldest == NULL || window_rank[i] < window_rank[oldest - windows])) oldest = &windows[i];
+    }
+    return oldest;
+}
+
+int main(int argc, char **argv) {
+    FILE *in = argc > 1 ? fopen(argv[1], "rb") : stdin;
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (read_dump(in) != 0) {
+        fprintf(stderr, "no trace dump found\n");
+        return 1;
+    }
+    qsort(entries, entry_count, sizeof(entries[0]), compare_entries);
+
+    // latency of every stage transition within a command. A command starts at RX_FRAME_COMPLETE and ends with
+    // the first TX_DRAINED after its COMMAND_DONE, or at COMMAND_DONE if its response already drained. Commands run in the order they were received: CRC_DONE goes to
+    // the oldest command without one, DISPATCH to the oldest not dispatched, an ACK_QUEUED right behind a line
+    // to that line (its ac_) and the other stages to the command executing
+    static latency_t latency[NUM_STAGES][NUM_STAGES];
+    latency_t total = {0, 0, UINT64_MAX, 0};
+    const trace_entry_t *last = NULL;
+    window_t *last_window = NULL;
+    bool tx_idle = true;                // nothing queued since the last TX_DRAINED
+    for (size_t i = 0; i < entry_count; i++) {
+        const trace_entry_t *entry = &entries[i];
+        if (entry->stage >= NUM_STAGES) continue;
+        window_t *window = NULL;
+        if (entry->stage == TRACE_STAGE_RX) {
+            // a rejected line leaves its ID to the next one, that window starts over
+            window = find_window(entry->arg);
+            if (window == NULL) window = free_window();
+            *window = (window_t){true, entry->arg, false, false, false, entry, entry};
+            window_rank[window - windows] = window_order++;
+            last = entry;
+            last_window = window;
+            continue;
+        }
+        if (entry->stage == TRACE_STAGE_CRC) {
+            window = oldest_window(WINDOW_NO_CRC);
+            if (window) window->crc_done = true;
+        } else if (entry->stage == TRACE_STAGE_DISPATCH) {
+            window = oldest_window(WINDOW_QUEUED);
+            if (window) window->crc_done = window->dispatched = true;
+        } else if (entry->stage == TRACE_STAGE_DONE) {
+            window = find_window(entry->arg);
+            if (window) window->done = true;
+        } else if (entry->stage == TRACE_STAGE_LAST) {
+            window = oldest_window(WINDOW_DONE);
+            if (window == NULL) window = oldest_window(WINDOW_EXECUTING);
+        } else if (entry->stage == TRACE_STAGE_ACK && last != NULL &&
+                   (last->stage == TRACE_STAGE_RX || last->stage == TRACE_STAGE_CRC)) {
+            window = last_window;
+        } else {
+            window = oldest_window(WINDOW_EXECUTING);
+        }
+        last = entry;
+        last_window = window;
+        if (entry->stage == TRACE_STAGE_ACK) tx_idle = false;
+        if (entry->stage == TRACE_STAGE_LAST) tx_idle = true;
+        if (window == NULL || !window->open) continue;
+
+        latency_t *l = &latency[window->previous->stage][entry->stage];
+        uint64_t delta = entry->timestamp - window->previous->timestamp;
+        if (l->count == 0 || delta < l->min) l->min = delta;
+        if (delta > l->max) l->max = delta;
+        l->total += delta;
+        l->count++;
+        window->previous = entry;
+
+        if ((entry->stage == TRACE_STAGE_LAST && window->done) || (entry->stage == TRACE_STAGE_DONE && tx_idle)) {
+            delta = entry->timestamp - window->first->timestamp;
+            if (delta < total.min) total.min = delta;
+            if (delta > total.max) total.max = delta;
+            total.total += delta;
+            total.count++;
+            window->open = false;
+        }
+    }
+
+    printf("%zu trace entries\n", entry_count);
+    printf("%-20s -> %-20s %8s %10s %10s %10s\n", "from", "to", "count", "min_us", "mean_us", "max_us");
+    for (int from = 0; from < NUM_STAGES; from++) {
+        for (int to = 0; to < NUM_STAGES; to++) {
+            const latency_t *l = &latency[from][to];
+            if (l->count == 0) continue;
+            printf("%-20s -> %-20s %8llu %10llu %10llu %10llu\n", stage_names[from], stage_names[to],
+                   (unsigned long long)l->count, (unsigned long long)l->min,
+                   (unsigned long long)(l->total / l->count), (unsigned long long)l->max);
+        }
+    }
+    if (total.count) {
+        printf("%-20s -> %-20s %8llu %10llu %10llu %10llu\n", stage_names[TRACE_STAGE_RX], stage_names[TRACE_STAGE_LAST],
+               (unsigned long long)total.count, (unsigned long long)total.min,
+               (unsigned long long)(total.total / total.count), (unsigned long long)total.max);
+    }
+    return 0;
+}
+
+/*** end of file ***/
@@ -0,0 +1,228 @@
+/**
+ * @file uart_record.c
+ * @brief Records the RPi <-> RP1 UART traffic into a binary trace (tools/uart_trace.h)
+ * @author Yashas Nagaraj Udupa
+ *
+ * Usage : uart_record -o trace.bin [-b baud] <serial_device>
+ *             Creates a pseudo terminal and prints its path. The RPi application opens the pseudo
+ *             terminal instead of the serial device, uart_record forwards and records both directions.
+ *         uart_record -o trace.bin -- <command> [args]
+ *             Runs the command (e.g. the host build rp1_host) with its stdin/stdout as the UART and
+ *             forwards uart_record's own stdin/stdout.
+ * Recording stops at Ctrl-C or when the RP1 side closes.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "uart_trace.h"
+
+#define DEFAULT_BAUDRATE 115200
+#define READ_CHUNK 256
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int signum) {
+    stop_requested = 1;
+}
+
+static uint64_t now_us(void) {
+    static struct timespec start;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (start.tv_sec == 0 && start.tv_nsec == 0) start = now;
+    return (uint64_t)(now.tv_sec - start.tv_sec) * 1000000u + (uint64_t)((now.tv_nsec - start.tv_nsec) / 1000);
+}
+
+static speed_t baud_to_speed(unsigned baud) {
+    switch (baud) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default: return B115200;
+    }
+}
+
+static int make_raw(int fd, unsigned baud) {
+    struct termios tio;
+    if (tcgetattr(fd, &tio) != 0) return -1;
+    cfmakeraw(&tio);
+    cfsetspeed(&tio, baud_to_speed(baud));
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    return tcsetattr(fd, TCSANOW, &tio);
+}
+
+static int write_all(int fd, const uint8_t *data, size_t length) {
+    while (length) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        length -= (size_t)n;
+    }
+    return 0;
+}
+
+// Private helper writing a completed frame, stops the recording on a write error
+static void record_frame(uart_trace_file_t *trace, const uart_trace_record_t *frame, unsigned *frames) {
+    if (frame == NULL) return;
+    if (uart_trace_write(trace, frame) != 0) {
+        perror("uart_record: trace");
+        stop_requested = 1;
+        return;
+    }
+    (*frames)++;
+}
+
+int main(int argc, char *argv[]) {
+    const char *output = NULL;
+    unsigned baud = DEFAULT_BAUDRATE;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "+o:b:")) != -1) {
+        switch (opt) {
+            case 'o': output = optarg; break;
+            case 'b': baud = (unsigned)strtoul(optarg, NULL, 0); break;
+            default: output = NULL; optind = argc + 1; break;
+        }
+    }
+    if (output == NULL || optind >= argc) {
+        fprintf(stderr, "usage: %s -o trace.bin [-b baud] <serial_device>\n"
+                        "       %s -o trace.bin -- <command> [args]\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    // host side: descriptors towards the RPi application, rp1 side: towards the firmware
+    int host_in, host_out, rp1_in, rp1_out;
+    pid_t child = -1;
+    bool command_mode = strcmp(argv[optind - 1], "--") == 0;
+
+    if (command_mode) {
+        int to_child[2], from_child[2];
+        if (pipe(to_child) != 0 || pipe(from_child) != 0) {
+            perror("uart_record: pipe");
+            return 1;
+        }
+        child = fork();
+        if (child < 0) {
+            perror("uart_record: fork");
+            return 1;
+        }
+        if (child == 0) {
+            dup2(to_child[0], STDIN_FILENO);
+            dup2(from_child[1], STDOUT_FILENO);
+            close(to_child[0]);
+            close(to_child[1]);
+            close(from_child[0]);
+            close(from_child[1]);
+            execvp(argv[optind], &argv[optind]);
+            perror("uart_record: exec");
+            _exit(127);
+        }
+        close(to_child[0]);
+        close(from_child[1]);
+        host_in = STDIN_FILENO;
+        host_out = STDOUT_FILENO;
+        rp1_in = from_child[0];
+        rp1_out = to_child[1];
+    } else {
+        int device = open(argv[optind], O_RDWR | O_NOCTTY);
+        if (device < 0 || make_raw(device, baud) != 0) {
+            perror(argv[optind]);
+            return 1;
+        }
+        int master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+            perror("uart_record: pseudo terminal");
+            return 1;
+        }
+        // keep the slave open so the master survives the application reopening it
+        int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+        if (slave < 0 || make_raw(slave, baud) != 0) {
+            perror("uart_record: pseudo terminal");
+            return 1;
+        }
+        fprintf(stderr, "uart_record: open %s instead of %s\n", ptsname(master), argv[optind]);
+        host_in = host_out = master;
+        rp1_in = rp1_out = device;
+    }
+
+    uart_trace_file_t trace;
+    if (uart_trace_create(&trace, output) != 0) {
+        perror(output);
+        return 1;
+    }
+
+    struct sigaction action = {.sa_handler = on_signal};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    uart_trace_framer_t rx_framer, tx_framer;
+    uart_trace_framer_init(&rx_framer, UART_TRACE_RX);
+    uart_trace_framer_init(&tx_framer, UART_TRACE_TX);
+    unsigned frames = 0;
+    bool host_open = true;
+    now_us();
+
+    while (!stop_requested) {
+        struct pollfd fds[2] = {{.fd = rp1_in, .events = POLLIN}, {.fd = host_open ? host_in : -1, .events = POLLIN}};
+        int ready = poll(fds, 2, UART_TRACE_IDLE_US / 1000);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (ready == 0) {
+            record_frame(&trace, uart_trace_framer_flush(&rx_framer), &frames);
+            record_frame(&trace, uart_trace_framer_flush(&tx_framer), &frames);
+            continue;
+        }
+
+        uint8_t buffer[READ_CHUNK];
+        if (fds[1].revents & (POLLIN | POLLHUP)) {
+            ssize_t n = read(host_in, buffer, sizeof(buffer));
+            if (n > 0) {
+                uint64_t time = now_us();
+                for (ssize_t i = 0; i < n; i++) record_frame(&trace, uart_trace_framer_put(&rx_framer, buffer[i], time), &frames);
+                if (write_all(rp1_out, buffer, (size_t)n) != 0) break;
+            } else if (command_mode && (n == 0 || errno != EAGAIN)) {
+                // end of the scripted input, the firmware keeps running until it closes or Ctrl-C
+                host_open = false;
+                close(rp1_out);
+            }
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = read(rp1_in, buffer, sizeof(buffer));
+            if (n <= 0) break;
+            uint64_t time = now_us();
+            for (ssize_t i = 0; i < n; i++) record_frame(&trace, uart_trace_framer_put(&tx_framer, buffer[i], time), &frames);
+            write_all(host_out, buffer, (size_t)n);
+        }
+    }
+
+    record_frame(&trace, uart_trace_framer_flush(&rx_framer), &frames);
+    record_frame(&trace, uart_trace_framer_flush(&tx_framer), &frames);
+    if (uart_trace_close(&trace) != 0) perror(output);
+    if (child > 0) {
+        kill(child, SIGTERM);
+        waitpid(child, NULL, 0);
+    }
+    fprintf(stderr, "uart_record: %u frames written to %s\n", frames, output);
+    return 0;
+}
+
+/*** end of file ***/
@@ -0,0 +1,135 @@
+/**
+ * @file uart_trace.c
+ * @brief Binary UART trace Implementation
+ * @author Yashas Nagaraj Udupa
+ */
+
+#include <string.h>
+#include "uart_trace.h"
+
+#define LEB128_MAX_BYTES 10
+
+static int put_leb128(FILE *file, uint64_t value) {
+    do {
+        uint8_t byte = value & 0x7fu;
+        value >>= 7;
+        if (value) byte |= 0x80u;
+        if (fputc(byte, file) == EOF) return -1;
+    } while (value);
+    return 0;
+}
+
+// Returns 0 on success, -1 on a truncated or overlong value
+static int get_leb128(FILE *file, uint64_t *value) {
+    *value = 0;
+    for (int i = 0; i < LEB128_MAX_BYTES; i++) {
+        int c = fgetc(file);
+        if (c == EOF) return -1;
+        *value |= (uint64_t)(c & 0x7f) << (7 * i);
+        if (!(c & 0x80)) return 0;
+    }
+    return -1;
+}
+
+int uart_trace_create(uart_trace_file_t *trace, const char *path) {
+    static const uint8_t header[UART_TRACE_HEADER_SIZE] = {'R', 'P', '1', 'U', UART_TRACE_VERSION, 0, 0, 0};
+    trace->file = fopen(path, "wb");
+    trace->last_us = 0;
+    if (trace->file == NULL) return -1;
+    if (fwrite(header, 1, sizeof(header), trace->file) != sizeof(header)) {
+        fclose(trace->file);
+        trace->file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int uart_trace_open(uart_trace_file_t *trace, const char *path) {
+    uint8_t header[UART_TRACE_HEADER_SIZE];
+    trace->file = fopen(path, "rb");
+    trace->last_us = 0;
+    if (trace->file == NULL) return -1;
+    if (fread(header, 1, sizeof(header), trace->file) != sizeof(header) ||
+        memcmp(header, UART_TRACE_MAGIC, 4) != 0 || header[4] != UART_TRACE_VERSION) {
+        fclose(trace->file);
+        trace->file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int uart_trace_write(uart_trace_file_t *trace, const uart_trace_record_t *record) {
+    uint64_t delta = record->time_us >= trace->last_us ? record->time_us - trace->last_us : 0;
+    trace->last_us += delta;
+    if (fputc(record->direction, trace->file) == EOF) return -1;
+    if (put_leb128(trace->file, delta) || put_leb128(trace->file, record->length)) return -1;
+    if (fwrite(record->data, 1, record->length, trace->file) != record->length) return -1;
+    return 0;
+}
+
+int uart_trace_read(uart_trace_file_t *trace, uart_trace_record_t *record) {
+    int direction = fgetc(trace->file);
+    if (direction == EOF) return 0;
+    if (direction != UART_TRACE_RX && direction != UART_TRACE_TX) return -1;
+
+    uint64_t delta, length;
+    if (get_leb128(trace->file, &delta) || get_leb128(trace->file, &length) || length > UART_TRACE_MAX_FRAME) return -1;
+    if (fread(record->data, 1, (size_t)length, trace->file) != (size_t)length) return -1;
+
+    trace->last_us += delta;
+    record->direction = (uint8_t)direction;
+    record->time_us = trace->last_us;
+    record->length = (uint16_t)length;
+    return 1;
+}
+
+int uart_trace_close(uart_trace_file_t *trace) {
+    if (trace->file == NULL) return 0;
+    int status = fclose(trace->file);
+    trace->file = NULL;
+    return status == 0 ? 0 : -1;
+}
+
+void uart_trace_framer_init(uart_trace_framer_t *framer, uint8_t direction) {
+    memset(framer, 0, sizeof(*framer));
+    framer->direction = direction;
+    framer->frame.direction = direction;
+}
+
+const uart_trace_record_t *uart_trace_framer_put(uart_trace_framer_t *framer, uint8_t byte, uint64_t time_us) {
+    uart_trace_record_t *frame = &framer->frame;
+    frame->data[frame->length++] = byte;
+    frame->time_us = time_us;
+
+    bool complete = frame->length == UART_TRACE_MAX_FRAME;
+    if (framer->direction == UART_TRACE_RX) {
+        complete |= byte == '#' || byte == '\n' || (byte == 'K' && frame->length == 1);
+    } else {
+        complete |= byte == '\n';
+    }
+    return complete ? uart_trace_framer_flush(framer) : NULL;
+}
+
+const uart_trace_record_t *uart_trace_framer_flush(uart_trace_framer_t *framer) {
+    if (framer->frame.length == 0) return NULL;
+    framer->completed = framer->frame;
+    framer->frame.length = 0;
+    return &framer->completed;
+}
+
+void uart_trace_print_frame(FILE *out, const uart_trace_record_t *record) {
+    for (uint16_t i = 0; i < record->length; i++) {
+        uint8_t c = record->data[i];
+        if (c == '\n') {
+            fputs("\\n", out);
+        } else if (c == '\r') {
+            fputs("\\r", out);
+        } else if (c < 0x20 || c >= 0x7f || c == '\\') {
+            fprintf(out, "\\x%02x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+}
+
+/*** end of file ***/
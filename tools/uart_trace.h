@@ -0,0 +1,122 @@
+/** @file uart_trace.h
+*
+* @brief Binary trace of the RPi <-> RP1 UART traffic, shared by uart_record and uart_replay.
+*
+*        File layout: "RP1U", version byte, three reserved bytes, then one record per frame:
+*            direction (0 = RX to the RP1, 1 = TX from the RP1)
+*            LEB128 microseconds since the previous record
+*            LEB128 frame length, frame bytes
+*        The timestamp of a frame is the arrival of its last byte.
+*
+*/
+
+#ifndef _UART_TRACE_H
+#define _UART_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define UART_TRACE_MAGIC "RP1U"
+#define UART_TRACE_VERSION 1
+#define UART_TRACE_HEADER_SIZE 8
+#define UART_TRACE_MAX_FRAME 256
+
+// Frames still open after this idle time are flushed, binary telemetry has no terminator
+#define UART_TRACE_IDLE_US 20000
+
+#define UART_TRACE_RX 0
+#define UART_TRACE_TX 1
+
+typedef struct {
+    uint8_t direction;
+    uint64_t time_us;
+    uint16_t length;
+    uint8_t data[UART_TRACE_MAX_FRAME];
+} uart_trace_record_t;
+
+typedef struct {
+    FILE *file;
+    uint64_t last_us;
+} uart_trace_file_t;
+
+// Splits one direction of the byte stream into frames
+typedef struct {
+    uint8_t direction;
+    uart_trace_record_t frame;      // frame being assembled
+    uart_trace_record_t completed;  // last frame returned
+} uart_trace_framer_t;
+
+/**
+ * @brief Creates a trace file and writes the header
+ * @param trace
+ * @param path
+ * @return 0 on success, -1 on error
+ */
+int uart_trace_create(uart_trace_file_t *trace, const char *path);
+
+/**
+ * @brief Opens a trace file and checks the header
+ * @param trace
+ * @param path
+ * @return 0 on success, -1 on error
+ */
+int uart_trace_open(uart_trace_file_t *trace, const char *path);
+
+/**
+ * @brief Appends a record, records must be written in time order
+ * @param trace
+ * @param record
+ * @return 0 on success, -1 on error
+ */
+int uart_trace_write(uart_trace_file_t *trace, const uart_trace_record_t *record);
+
+/**
+ * @brief Reads the next record
+ * @param trace
+ * @param record
+ * @return 1 for a record, 0 at the end of the trace, -1 on a corrupt trace
+ */
+int uart_trace_read(uart_trace_file_t *trace, uart_trace_record_t *record);
+
+/**
+ * @brief Closes a trace file
+ * @param trace
+ * @return 0 on success, -1 if buffered records could not be written
+ */
+int uart_trace_close(uart_trace_file_t *trace);
+
+/**
+ * @brief Resets a framer
+ * @param framer
+ * @param direction - UART_TRACE_RX or UART_TRACE_TX
+ */
+void uart_trace_framer_init(uart_trace_framer_t *framer, uint8_t direction);
+
+/**
+ * @brief Adds one byte. RX frames end with '#' or '\n' or are a lone kill switch 'K',
+ *        TX frames end with '\n', both also end when the frame buffer is full
+ * @param framer
+ * @param byte
+ * @param time_us
+ * @return the completed frame, valid until the next call, NULL while the frame is open
+ */
+const uart_trace_record_t *uart_trace_framer_put(uart_trace_framer_t *framer, uint8_t byte, uint64_t time_us);
+
+/**
+ * @brief Closes the open frame, used after UART_TRACE_IDLE_US without a byte
+ * @param framer
+ * @return the flushed frame, NULL if no frame is open
+ */
+const uart_trace_record_t *uart_trace_framer_flush(uart_trace_framer_t *framer);
+
+/**
+ * @brief Prints a frame with non printable bytes escaped
+ * @param out
+ * @param record
+ */
+void uart_trace_print_frame(FILE *out, const uart_trace_record_t *record);
+
+#endif /* _UART_TRACE_H */
+
+/*** end of file ***/